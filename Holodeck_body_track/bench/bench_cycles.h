@@ -0,0 +1,68 @@
+/*
+ * bench_cycles.h
+ *
+ * Cycle counter used by the benchmarks.
+ * On the Due (Cortex-M3) this is DWT->CYCCNT, on a x86 host the TSC, anywhere
+ * else the monotonic clock in ns.
+ */
+
+
+#ifndef BENCH_CYCLES_H_
+#define BENCH_CYCLES_H_
+
+#include <stdint.h>
+
+#if defined(__SAM3X8E__)
+
+#include <asf.h>
+
+#define BENCH_CYCLES_UNIT	"cycles"
+
+static inline void bench_cycles_init(void)
+{
+	CoreDebug->DEMCR |= CoreDebug_DEMCR_TRCENA_Msk;
+	DWT->CYCCNT = 0;
+	DWT->CTRL |= DWT_CTRL_CYCCNTENA_Msk;
+}
+
+static inline uint32_t bench_cycles(void)
+{
+	return DWT->CYCCNT;
+}
+
+#elif defined(__x86_64__) || defined(__i386__)
+
+#include <x86intrin.h>
+
+#define BENCH_CYCLES_UNIT	"tsc"
+
+static inline void bench_cycles_init(void)
+{
+}
+
+static inline uint32_t bench_cycles(void)
+{
+	return (uint32_t)__rdtsc();
+}
+
+#else
+
+#include <time.h>
+
+#define BENCH_CYCLES_UNIT	"ns"
+
+static inline void bench_cycles_init(void)
+{
+}
+
+static inline uint32_t bench_cycles(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint32_t)(ts.tv_sec * 1000000000ull + ts.tv_nsec);
+}
+
+#endif
+
+#endif /* BENCH_CYCLES_H_ */
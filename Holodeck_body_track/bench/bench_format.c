@@ -0,0 +1,99 @@
+/*
+ * bench_format.c
+ *
+ * Cost of one "<imu>:0:quat:w,x,y,z\n" text line: sprintf() with %f against
+ * InvFormat_fixedArray2dec() on the same Q30 quaternion.
+ * Quaternions come from a fixed seed so runs can be compared.
+ */
+#include <stdio.h>
+#include <string.h>
+#include <stdint.h>
+
+#include "Invn/EmbUtils/InvFormat.h"
+
+#include "bench_cycles.h"
+
+#define BENCH_FORMAT_LINES	1000
+#define BENCH_FORMAT_SEED	0x1234567u
+
+static int32_t quats[BENCH_FORMAT_LINES][4];
+
+static uint32_t xorshift32(uint32_t * state)
+{
+	uint32_t x = *state;
+
+	x ^= x << 13;
+	x ^= x >> 17;
+	x ^= x << 5;
+	return *state = x;
+}
+
+static int line_sprintf(char * out, size_t max, int imu, const int32_t q[4])
+{
+	return snprintf(out, max, "%d:0:quat:%f,%f,%f,%f\n", imu,
+			q[0] / 1073741824.0, q[1] / 1073741824.0, q[2] / 1073741824.0, q[3] / 1073741824.0);
+}
+
+static int line_fixed(char * out, size_t max, int imu, const int32_t q[4])
+{
+	int idx = InvFormat_fixed2dec(out, max, imu, 0, 0);
+
+	memcpy(&out[idx], ":0:quat:", 8);
+	idx += 8;
+	idx += InvFormat_fixedArray2dec(&out[idx], max - idx - 1, q, 4, 30, 6, ',');
+	out[idx++] = '\n';
+	return idx;
+}
+
+static uint32_t run(int (*fn)(char *, size_t, int, const int32_t *), uint32_t * best)
+{
+	static char out[128];
+	uint32_t total = 0;
+	int i;
+
+	*best = UINT32_MAX;
+	for(i = 0; i < BENCH_FORMAT_LINES; ++i) {
+		const uint32_t start = bench_cycles();
+		uint32_t dt;
+
+		fn(out, sizeof(out), i % 16, quats[i]);
+		dt = bench_cycles() - start;
+		total += dt;
+		if(dt < *best)
+			*best = dt;
+	}
+	return total / BENCH_FORMAT_LINES;
+}
+
+int main(void)
+{
+	uint32_t seed = BENCH_FORMAT_SEED;
+	uint32_t mean_sprintf, mean_fixed, best_sprintf, best_fixed;
+	unsigned mismatch = 0;
+	int i, k;
+
+	bench_cycles_init();
+
+	for(i = 0; i < BENCH_FORMAT_LINES; ++i)
+		for(k = 0; k < 4; ++k)
+			quats[i][k] = (int32_t)(xorshift32(&seed) % (2u << 30)) - (1 << 30);
+
+	/* both must print the same line, sprintf rounds exact ties to even so allow a few */
+	for(i = 0; i < BENCH_FORMAT_LINES; ++i) {
+		char a[128], b[128];
+		const int la = line_sprintf(a, sizeof(a), i % 16, quats[i]);
+		const int lb = line_fixed(b, sizeof(b), i % 16, quats[i]);
+
+		if(la != lb || memcmp(a, b, la) != 0)
+			++mismatch;
+	}
+
+	mean_sprintf = run(line_sprintf, &best_sprintf);
+	mean_fixed   = run(line_fixed, &best_fixed);
+
+	printf("format line (%s/line, %d lines): sprintf mean=%u min=%u, fixed mean=%u min=%u, mismatch=%u\n",
+			BENCH_CYCLES_UNIT, BENCH_FORMAT_LINES,
+			(unsigned)mean_sprintf, (unsigned)best_sprintf, (unsigned)mean_fixed, (unsigned)best_fixed, mismatch);
+
+	return (mismatch > BENCH_FORMAT_LINES / 100);
+}
@@ -0,0 +1,579 @@
+/*
+ * bench_hotpath.c
+ *
+ * Cost per sample of the acquisition hot path, from the DMP FIFO to the bytes
+ * handed to the USB CDC link, with rotation vector packets as configured by
+ * run_icm20948.c:
+ *   decode_packet       inv_icm20948_inv_decode_one_ivory_fifo_packet()
+ *   fifo_pop_drain      inv_icm20948_fifo_swmirror() then inv_icm20948_fifo_pop() on a full FIFO
+ *   process_fifo_drain  inv_icm20948_dmp_process_fifo() on a full FIFO
+ *   convert_rv          inv_icm20948_convert_rotation_vector(), float
+ *   convert_rv_q30      inv_icm20948_convert_rotation_vector_q30(), as run_icm20948.c
+ *   scalar_part         inv_icm20948_convert_compute_scalar_part_fxp()
+ *   dynpro_encode       DynProtocol_encodeAsync(NEW_SENSOR_DATA) of a Q30 event
+ *   dynpro_batch_add    DynProtocol_encodeBatchAdd(), one batch per 16 events
+ *   format_text         "<imu>:0:quat:w,x,y,z\n" line of OUTPUT_FORMAT_TEXT
+ *   format_sprintf      same line from snprintf() with %f, the C library baseline
+ *                       (newlib on the Due, see bench_format.c for the host)
+ *   format_binary       host_cmd SENSOR_DATA frame of OUTPUT_FORMAT_BINARY
+ *   cksum_packet        InvCksum_compute() over one FIFO packet
+ *   poll_text           end to end, inv_icm20948_poll_sensor() on a full FIFO
+ *                       in Q30 only with a text line formatted per sample
+ *
+ * The check also runs both rotation vector conversions on every sample
+ * under a few mountings: the Q14 of the binary frame must not differ by
+ * more than one LSB between the float and the Q30 paths.
+ *
+ * FIFO reads are served from memory by a replay serif, so only CPU time is
+ * measured. Packets come from a fixed seed so runs can be compared.
+ * The report is JSON, see bench_json.h.
+ *
+ * On the Due, define BENCH_HOTPATH in the project: main() then runs
+ * bench_hotpath_run() once USB is up, before the acquisition starts.
+ */
+#if !defined(__SAM3X8E__) || defined(BENCH_HOTPATH)
+
+#include <stdio.h>
+#include <string.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <math.h>
+
+#include "Invn/Devices/SensorTypes.h"
+#include "Invn/Devices/Drivers/Icm20948/Icm20948.h"
+#include "Invn/Devices/Drivers/Icm20948/Icm20948Defs.h"
+#include "Invn/Devices/Drivers/Icm20948/Icm20948DataBaseControl.h"
+#include "Invn/Devices/Drivers/Icm20948/Icm20948DataConverter.h"
+#include "Invn/Devices/Drivers/Icm20948/Icm20948MPUFifoControl.h"
+#include "Invn/Devices/Drivers/Icm20948/Icm20948Setup.h"
+#include "Invn/DynamicProtocol/DynProtocol.h"
+#include "Invn/EmbUtils/DataConverter.h"
+#include "Invn/EmbUtils/InvCksum.h"
+#include "Invn/EmbUtils/InvFormat.h"
+#include "Invn/EmbUtils/InvProtocol.h"
+
+#include "bench_cycles.h"
+#include "bench_json.h"
+#include "bench_hotpath.h"
+
+#define BENCH_HOTPATH_SEED		0x1234567u
+#define BENCH_HOTPATH_REPS		16
+
+/* Rotation vector packet: header, header2, accel, gyro + bias, compass, quat9 + accuracy, accuracies, footer */
+#define BENCH_PACKET_HEADER		(ACCEL_SET | GYRO_SET | CPASS_SET | QUAT9_SET | HEADER2_SET)
+#define BENCH_PACKET_HEADER2	(ACCEL_ACCURACY_SET | GYRO_ACCURACY_SET | CPASS_ACCURACY_SET)
+#define BENCH_PACKET_SIZE		(HEADER_SZ + HEADER2_SZ + ACCEL_DATA_SZ + GYRO_DATA_SZ + GYRO_BIAS_DATA_SZ \
+		+ CPASS_DATA_SZ + QUAT9_DATA_SZ + 3 * ACCEL_ACCURACY_SZ + FOOTER_SZ)
+
+/* Packets of one full FIFO read, and number of FIFO reads per repetition */
+#define BENCH_FIFO_PACKETS		(HARDWARE_FIFO_SIZE / BENCH_PACKET_SIZE)
+#define BENCH_FIFO_IMAGES		8
+#define BENCH_SAMPLES			(BENCH_FIFO_PACKETS * BENCH_FIFO_IMAGES)
+
+#define BENCH_IMUS				16
+
+static uint8_t packets[BENCH_SAMPLES][BENCH_PACKET_SIZE];
+static long quat9[BENCH_SAMPLES][3];
+static int32_t quat30[BENCH_SAMPLES][4];
+
+static struct inv_icm20948 icm;
+static struct inv_fifo_decoded_t decoded;
+static DynProtocol_t protocol;
+static DynProtocolEdata_t edata;
+static uint8_t out[512];
+static uint16_t out_len;
+static unsigned samples;
+static volatile uint32_t sink;
+
+/*
+ * Serif playing back a FIFO image: FIFO_COUNT and FIFO_R_W are served from
+ * memory, INT_STATUS reports a DMP interrupt, writes are dropped
+ */
+static struct {
+	const uint8_t * data;
+	uint32_t len;
+	uint32_t pos;
+	uint8_t bank;
+} replay;
+
+static int replay_read_reg(void * context, uint8_t reg, uint8_t * buf, uint32_t len)
+{
+	const uint32_t left = replay.len - replay.pos;
+
+	(void)context;
+	memset(buf, 0, len);
+	if(replay.bank != 0)
+		return 0;
+
+	switch(reg) {
+	case REG_INT_STATUS:
+		buf[0] = BIT_MSG_DMP_INT;
+		break;
+	case REG_FIFO_COUNT_H:
+		buf[0] = (uint8_t)(left >> 8);
+		if(len > 1)
+			buf[1] = (uint8_t)left;
+		break;
+	case REG_FIFO_R_W:
+		if(len > left)
+			len = left;
+		memcpy(buf, &replay.data[replay.pos], len);
+		replay.pos += len;
+		break;
+	default:
+		break;
+	}
+	return 0;
+}
+
+static int replay_write_reg(void * context, uint8_t reg, const uint8_t * buf, uint32_t len)
+{
+	(void)context;
+	if(reg == REG_BANK_SEL && len)
+		replay.bank = (buf[0] >> 4) & 0x3;
+	return 0;
+}
+
+static void replay_image(unsigned image)
+{
+	replay.data = packets[image * BENCH_FIFO_PACKETS];
+	replay.len = BENCH_FIFO_PACKETS * BENCH_PACKET_SIZE;
+	replay.pos = 0;
+}
+
+static uint32_t xorshift32(uint32_t * state)
+{
+	uint32_t x = *state;
+
+	x ^= x << 13;
+	x ^= x >> 17;
+	x ^= x << 5;
+	return *state = x;
+}
+
+static void put_be16(uint8_t * p, uint16_t v)
+{
+	p[0] = (uint8_t)(v >> 8);
+	p[1] = (uint8_t)v;
+}
+
+static void put_be32(uint8_t * p, uint32_t v)
+{
+	p[0] = (uint8_t)(v >> 24);
+	p[1] = (uint8_t)(v >> 16);
+	p[2] = (uint8_t)(v >> 8);
+	p[3] = (uint8_t)v;
+}
+
+static void build_packet(uint8_t * p, uint32_t * seed, const int32_t q[4])
+{
+	int k;
+
+	put_be16(p, BENCH_PACKET_HEADER);
+	p += HEADER_SZ;
+	put_be16(p, BENCH_PACKET_HEADER2);
+	p += HEADER2_SZ;
+	/* accel, gyro, gyro bias and compass */
+	for(k = 0; k < 12; ++k, p += 2)
+		put_be16(p, (uint16_t)xorshift32(seed));
+	/* quat9 x y z in Q30 and heading accuracy in Q29 */
+	for(k = 1; k < 4; ++k, p += 4)
+		put_be32(p, (uint32_t)q[k]);
+	put_be16(p, (uint16_t)(xorshift32(seed) & 0x1fff));
+	p += 2;
+	/* accel, gyro, compass accuracies */
+	for(k = 0; k < 3; ++k, p += 2)
+		put_be16(p, 3);
+	/* footer, ODR counter */
+	put_be16(p, 0);
+}
+
+static void build_data(void)
+{
+	uint32_t seed = BENCH_HOTPATH_SEED;
+	int i, k;
+
+	for(i = 0; i < BENCH_SAMPLES; ++i) {
+		double q[4], norm = 0;
+
+		for(k = 0; k < 4; ++k) {
+			q[k] = (double)(int32_t)xorshift32(&seed) / 2147483648.0;
+			norm += q[k] * q[k];
+		}
+		norm = sqrt(norm);
+		/* the DMP keeps w positive, w is computed back from x y z */
+		if(q[0] < 0)
+			norm = -norm;
+		for(k = 0; k < 4; ++k) {
+			quat30[i][k] = (int32_t)(q[k] / norm * 1073741823.0);
+		}
+		for(k = 0; k < 3; ++k)
+			quat9[i][k] = quat30[i][k + 1];
+		build_packet(packets[i], &seed, quat30[i]);
+	}
+}
+
+static void device_init(void)
+{
+	static const signed char identity[9] = { 1, 0, 0, 0, 1, 0, 0, 0, 1 };
+	const struct inv_icm20948_serif serif = {
+		0, replay_read_reg, replay_write_reg, HARDWARE_FIFO_SIZE, HARDWARE_FIFO_SIZE, 0
+	};
+
+	inv_icm20948_reset_states(&icm, &serif);
+	icm.base_state.serial_interface = SERIAL_INTERFACE_I2C;
+	icm.base_state.wake_state = CHIP_AWAKE;
+	inv_icm20948_set_chip_to_body_axis_quaternion(&icm, (signed char *)identity, 0.0);
+	icm.quat_q30_only = 1;
+	/* rotation vector on, as inv_icm20948_enable_sensor() leaves it */
+	icm.inv_androidSensorsOn_mask[ANDROID_SENSOR_ROTATION_VECTOR >> 5] |= (1L << (ANDROID_SENSOR_ROTATION_VECTOR & 0x1F));
+	replay.bank = 0;
+}
+
+static int16_t q30_to_q14(int32_t q30)
+{
+	return (int16_t)((q30 + (1 << 15)) >> 16);
+}
+
+static int line_text(char * str, size_t max, int imu, const int32_t q30[4])
+{
+	int idx;
+
+	idx = InvFormat_fixed2dec(str, max, imu, 0, 0);
+	memcpy(&str[idx], ":0:quat:", 8);
+	idx += 8;
+	idx += InvFormat_fixedArray2dec(&str[idx], max - idx - 1, q30, 4, 30, 6, ',');
+	str[idx++] = '\n';
+	return idx;
+}
+
+static int line_sprintf(char * str, size_t max, int imu, const int32_t q30[4])
+{
+	return snprintf(str, max, "%d:0:quat:%f,%f,%f,%f\n", imu,
+			q30[0] / 1073741824.0, q30[1] / 1073741824.0, q30[2] / 1073741824.0, q30[3] / 1073741824.0);
+}
+
+static void poll_handler(void * context, enum inv_icm20948_sensor sensor, uint64_t timestamp,
+		const void * data, const void * arg)
+{
+	(void)context, (void)timestamp, (void)arg;
+
+	if(sensor == INV_ICM20948_SENSOR_ROTATION_VECTOR)
+		sink += line_text((char *)out, sizeof(out), samples++ % BENCH_IMUS,
+				((const struct inv_icm20948_quat_sample *)data)->quat_q30);
+}
+
+/*
+ * Cases, each one handles BENCH_SAMPLES items
+ */
+static void case_decode_packet(void)
+{
+	int i;
+
+	for(i = 0; i < BENCH_SAMPLES; ++i) {
+		decoded.header = BENCH_PACKET_HEADER;
+		decoded.header2 = BENCH_PACKET_HEADER2;
+		sink += inv_icm20948_inv_decode_one_ivory_fifo_packet(&icm, &decoded, &packets[i][HEADER_SZ + HEADER2_SZ]);
+	}
+}
+
+static void case_fifo_pop_drain(void)
+{
+	unsigned image;
+
+	for(image = 0; image < BENCH_FIFO_IMAGES; ++image) {
+		unsigned short total = 0, header, header2;
+		unsigned short cnt[GENERAL_SENSORS_MAX] = { 0 };
+		int left = 0;
+
+		replay_image(image);
+		if(inv_icm20948_fifo_swmirror(&icm, &left, &total, cnt) != 0)
+			continue;
+		while(total--) {
+			if(inv_icm20948_fifo_pop(&icm, &header, &header2, &left) != 0)
+				break;
+			samples++;
+		}
+	}
+}
+
+static void case_process_fifo_drain(void)
+{
+	unsigned image;
+
+	for(image = 0; image < BENCH_FIFO_IMAGES; ++image) {
+		unsigned short header, header2;
+		long long ts;
+		int left = 0;
+
+		replay_image(image);
+		do {
+			if(inv_icm20948_dmp_process_fifo(&icm, &left, &header, &header2, &ts) != 0)
+				break;
+			samples++;
+		} while(left > 0);
+	}
+}
+
+static void case_convert_rv(void)
+{
+	float values[4];
+	int i;
+
+	for(i = 0; i < BENCH_SAMPLES; ++i) {
+		inv_icm20948_convert_rotation_vector(&icm, quat9[i], values);
+		sink += (uint32_t)(values[3] * 1000);
+	}
+}
+
+static void case_convert_rv_q30(void)
+{
+	int32_t q[4];
+	int i;
+
+	for(i = 0; i < BENCH_SAMPLES; ++i) {
+		inv_icm20948_convert_rotation_vector_q30(&icm, quat9[i], q);
+		sink += (uint32_t)q[0];
+	}
+}
+
+static void case_scalar_part(void)
+{
+	long q[4];
+	int i;
+
+	for(i = 0; i < BENCH_SAMPLES; ++i) {
+		inv_icm20948_convert_compute_scalar_part_fxp(quat9[i], q);
+		sink += (uint32_t)q[0];
+	}
+}
+
+static void sensor_edata(int i)
+{
+	edata.sensor_id = DYN_PRO_SENSOR_TYPE_ROTATION_VECTOR;
+	edata.device_id = i % BENCH_IMUS;
+	edata.d.async.sensorEvent.status = DYN_PRO_SENSOR_STATUS_DATA_UPDATED;
+	memcpy(&edata.d.async.sensorEvent.vdata.data.u32[0], quat30[i], sizeof(quat30[i]));
+}
+
+static void case_dynpro_encode(void)
+{
+	int i;
+
+	for(i = 0; i < BENCH_SAMPLES; ++i) {
+		sensor_edata(i);
+		if(DynProtocol_encodeAsync(&protocol, DYN_PROTOCOL_EID_NEW_SENSOR_DATA, &edata,
+				out, sizeof(out), &out_len) == 0)
+			samples++;
+	}
+}
+
+static void case_dynpro_batch_add(void)
+{
+	int i;
+
+	for(i = 0; i < BENCH_SAMPLES; ++i) {
+		if(i % BENCH_IMUS == 0)
+			DynProtocol_encodeBatchStart(&protocol, out, sizeof(out), &out_len);
+		sensor_edata(i);
+		if(DynProtocol_encodeBatchAdd(&protocol, &edata, out, sizeof(out), &out_len) == 0)
+			samples++;
+	}
+}
+
+static void case_format_text(void)
+{
+	int i;
+
+	for(i = 0; i < BENCH_SAMPLES; ++i)
+		sink += line_text((char *)out, sizeof(out), i % BENCH_IMUS, quat30[i]);
+}
+
+static void case_format_sprintf(void)
+{
+	int i;
+
+	for(i = 0; i < BENCH_SAMPLES; ++i)
+		sink += line_sprintf((char *)out, sizeof(out), i % BENCH_IMUS, quat30[i]);
+}
+
+static void case_format_binary(void)
+{
+	int i, k;
+
+	for(i = 0; i < BENCH_SAMPLES; ++i) {
+		/* <imu> <sensor> <timestamp (4)> <w x y z in Q14 (4*2)> */
+		uint8_t payload[2+4+4*2];
+
+		payload[0] = (uint8_t)(i % BENCH_IMUS);
+		payload[1] = (uint8_t)INV_SENSOR_TYPE_ROTATION_VECTOR;
+		inv_dc_int32_to_little8((int32_t)i, &payload[2]);
+		for(k = 0; k < 4; k++)
+			inv_dc_int16_to_little8(q30_to_q14(quat30[i][k]), &payload[6+2*k]);
+		sink += InvProtocolFormater_formatBuffer(0x03, 0x10, payload, sizeof(payload), out, sizeof(out));
+	}
+}
+
+static void case_cksum_packet(void)
+{
+	int i;
+
+	for(i = 0; i < BENCH_SAMPLES; ++i)
+		sink += InvCksum_compute(packets[i], BENCH_PACKET_SIZE);
+}
+
+static void case_poll_text(void)
+{
+	unsigned image;
+
+	for(image = 0; image < BENCH_FIFO_IMAGES; ++image) {
+		replay_image(image);
+		inv_icm20948_poll_sensor(&icm, 0, poll_handler);
+	}
+}
+
+static const struct {
+	const char * name;
+	const char * per;
+	void (*fn)(void);
+	int counted;	/* samples must reach BENCH_SAMPLES per repetition */
+} cases[] = {
+	{ "decode_packet",      "packet", case_decode_packet,      0 },
+	{ "fifo_pop_drain",     "sample", case_fifo_pop_drain,     1 },
+	{ "process_fifo_drain", "sample", case_process_fifo_drain, 1 },
+	{ "convert_rv",         "sample", case_convert_rv,         0 },
+	{ "convert_rv_q30",     "sample", case_convert_rv_q30,     0 },
+	{ "scalar_part",        "sample", case_scalar_part,        0 },
+	{ "dynpro_encode",      "event",  case_dynpro_encode,      1 },
+	{ "dynpro_batch_add",   "event",  case_dynpro_batch_add,   1 },
+	{ "format_text",        "line",   case_format_text,        0 },
+	{ "format_sprintf",     "line",   case_format_sprintf,     0 },
+	{ "format_binary",      "frame",  case_format_binary,      0 },
+	{ "cksum_packet",       "packet", case_cksum_packet,       0 },
+	{ "poll_text",          "sample", case_poll_text,          1 },
+};
+
+/* Q14 of the binary frame from the float and the Q30 conversions, one LSB apart at most */
+static unsigned check_q30(void)
+{
+	static const signed char mountings[][9] = {
+		{ 1, 0, 0, 0, 1, 0, 0, 0, 1 },
+		{ 0, 1, 0, -1, 0, 0, 0, 0, 1 },
+		{ 0, 0, -1, 0, -1, 0, -1, 0, 0 },
+	};
+	static const float angles[] = { 0.0f, 30.0f, -135.0f };
+	unsigned errors = 0, m;
+	int i, k;
+
+	icm.quat_q30_only = 0;
+	for(m = 0; m < sizeof(mountings) / sizeof(mountings[0]); ++m) {
+		inv_icm20948_set_chip_to_body_axis_quaternion(&icm, (signed char *)mountings[m], angles[m]);
+		for(i = 0; i < BENCH_SAMPLES; ++i) {
+			float values[4];
+			int32_t q30[4];
+
+			/* android order x y z w */
+			inv_icm20948_convert_rotation_vector(&icm, quat9[i], values);
+			inv_icm20948_convert_rotation_vector_q30(&icm, quat9[i], q30);
+			for(k = 0; k < 4; k++) {
+				const int16_t from_float = (int16_t)(values[(k + 3) % 4]*(1<<14));
+
+				if(abs(from_float - q30_to_q14(q30[k])) > 1)
+					errors++;
+			}
+		}
+	}
+	device_init();
+	return errors;
+}
+
+/* Check outputs once, outside of the timed runs */
+static unsigned check(void)
+{
+	unsigned errors = 0;
+	long q[4];
+	int i;
+
+	for(i = 0; i < BENCH_SAMPLES; ++i) {
+		decoded.header = BENCH_PACKET_HEADER;
+		decoded.header2 = BENCH_PACKET_HEADER2;
+		if(inv_icm20948_inv_decode_one_ivory_fifo_packet(&icm, &decoded, &packets[i][HEADER_SZ + HEADER2_SZ])
+				!= BENCH_PACKET_SIZE - HEADER_SZ - HEADER2_SZ
+				|| memcmp(decoded.dmp_3e_9quat, quat9[i], sizeof(quat9[i])) != 0) {
+			errors++;
+			break;
+		}
+		inv_icm20948_convert_compute_scalar_part_fxp(quat9[i], q);
+		/* w is computed back from x y z */
+		if(labs(q[0] - quat30[i][0]) > (1L << 16)) {
+			errors++;
+			break;
+		}
+	}
+	return errors;
+}
+
+int bench_hotpath_run(void)
+{
+	struct bench_json json;
+	unsigned errors;
+	unsigned c;
+
+	bench_cycles_init();
+	build_data();
+	device_init();
+	DynProtocol_init(&protocol, 0, 0);
+
+	errors = check() + check_q30();
+
+	bench_json_begin(&json, "hotpath", BENCH_HOTPATH_SEED);
+	for(c = 0; c < sizeof(cases) / sizeof(cases[0]); ++c) {
+		uint32_t total = 0, best = UINT32_MAX;
+		int rep;
+
+		/* warm up, and output check for the counted cases */
+		samples = 0;
+		cases[c].fn();
+		if(cases[c].counted && samples != BENCH_SAMPLES)
+			errors++;
+
+		for(rep = 0; rep < BENCH_HOTPATH_REPS; ++rep) {
+			uint32_t start, dt;
+
+			samples = 0;
+			start = bench_cycles();
+			cases[c].fn();
+			dt = (bench_cycles() - start) / BENCH_SAMPLES;
+			total += dt;
+			if(dt < best)
+				best = dt;
+		}
+		bench_json_result(&json, cases[c].name, cases[c].per, BENCH_SAMPLES, BENCH_HOTPATH_REPS,
+				total / BENCH_HOTPATH_REPS, best);
+	}
+	bench_json_end(&json, errors);
+
+	return (int)errors;
+}
+
+#if !defined(__SAM3X8E__)
+
+/* Driver hooks, time_wrapper.c on the target */
+void inv_icm20948_sleep_us(int us)
+{
+	(void)us;
+}
+
+uint64_t inv_icm20948_get_time_us(void)
+{
+	return 0;
+}
+
+int main(void)
+{
+	return bench_hotpath_run() != 0;
+}
+
+#endif
+
+#endif /* !__SAM3X8E__ || BENCH_HOTPATH */
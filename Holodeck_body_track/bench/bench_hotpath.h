@@ -0,0 +1,16 @@
+/*
+ * bench_hotpath.h
+ *
+ * Acquisition hot path benchmarks, see bench_hotpath.c.
+ */
+
+
+#ifndef BENCH_HOTPATH_H_
+#define BENCH_HOTPATH_H_
+
+/** @brief Run every case and send the JSON report
+ *  @return number of cases whose output was wrong, 0 on success
+ */
+int bench_hotpath_run(void);
+
+#endif /* BENCH_HOTPATH_H_ */
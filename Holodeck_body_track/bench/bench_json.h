@@ -0,0 +1,72 @@
+/*
+ * bench_json.h
+ *
+ * JSON report of a benchmark run, one object per run:
+ *   {"bench":"<name>","unit":"<BENCH_CYCLES_UNIT>","seed":<seed>,"results":[
+ *     {"name":"<case>","per":"<item>","items":<n>,"reps":<r>,"mean":<x>,"min":<y>}, ...]}
+ * mean and min are in BENCH_CYCLES_UNIT per item, min being the best of the
+ * repetitions, so the same case can be compared from one commit to the next.
+ * The report goes to stdout on the host and to the USB CDC link on the Due.
+ */
+
+
+#ifndef BENCH_JSON_H_
+#define BENCH_JSON_H_
+
+#include <stdio.h>
+#include <stdint.h>
+
+#include "bench_cycles.h"
+
+#if defined(__SAM3X8E__)
+
+#include "usb_cdc_coms.h"
+
+static inline void bench_json_write(const char * str, int len)
+{
+	serialWrite((char *)str, len);
+}
+
+#else
+
+static inline void bench_json_write(const char * str, int len)
+{
+	fwrite(str, 1, len, stdout);
+}
+
+#endif
+
+struct bench_json {
+	unsigned results;
+	char line[192];
+};
+
+static inline void bench_json_begin(struct bench_json * j, const char * bench, uint32_t seed)
+{
+	const int len = snprintf(j->line, sizeof(j->line), "{\"bench\":\"%s\",\"unit\":\"%s\",\"seed\":%lu,\"results\":[\n",
+			bench, BENCH_CYCLES_UNIT, (unsigned long)seed);
+
+	j->results = 0;
+	bench_json_write(j->line, len);
+}
+
+static inline void bench_json_result(struct bench_json * j, const char * name, const char * per,
+		uint32_t items, uint32_t reps, uint32_t mean, uint32_t min)
+{
+	const int len = snprintf(j->line, sizeof(j->line),
+			"%s {\"name\":\"%s\",\"per\":\"%s\",\"items\":%lu,\"reps\":%lu,\"mean\":%lu,\"min\":%lu}",
+			j->results ? ",\n" : "", name, per,
+			(unsigned long)items, (unsigned long)reps, (unsigned long)mean, (unsigned long)min);
+
+	j->results++;
+	bench_json_write(j->line, len);
+}
+
+static inline void bench_json_end(struct bench_json * j, unsigned errors)
+{
+	const int len = snprintf(j->line, sizeof(j->line), "\n],\"errors\":%u}\n", errors);
+
+	bench_json_write(j->line, len);
+}
+
+#endif /* BENCH_JSON_H_ */
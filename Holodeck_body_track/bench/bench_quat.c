@@ -0,0 +1,166 @@
+/*
+ * bench_quat.c
+ *
+ * Rotation vector conversion of a sweep of 16, 64 and 256 samples:
+ *   per_sample_<n>  inv_icm20948_convert_rotation_vector_q30() then Q14, one
+ *                   sample at a time as the driver does without quat_batch
+ *   batch_<n>       quat_batch_add() of every sample then quat_batch_run()
+ * both per sample. Samples come from a fixed seed, each IMU of the sweep
+ * has one of a few mountings.
+ *
+ * Both paths run on every sample outside of the timed runs, any Q30 or Q14
+ * value that differs is counted as an error.
+ * The report is JSON, see bench_json.h.
+ */
+#include <string.h>
+#include <stdint.h>
+#include <math.h>
+
+#include "Invn/Devices/Drivers/Icm20948/Icm20948.h"
+#include "Invn/Devices/Drivers/Icm20948/Icm20948DataConverter.h"
+
+#include "quat_batch.h"
+#include "bench_cycles.h"
+#include "bench_json.h"
+
+#define BENCH_QUAT_SEED			0x51ed270bu
+#define BENCH_QUAT_REPS			16
+#define BENCH_QUAT_SWEEPS		64
+#define BENCH_QUAT_MAX			256
+#define BENCH_QUAT_MOUNTINGS	4
+
+#if QUAT_BATCH_MAX < BENCH_QUAT_MAX
+#error "build quat_batch.c with QUAT_BATCH_MAX of BENCH_QUAT_MAX, see Makefile"
+#endif
+
+static struct inv_icm20948 icm[BENCH_QUAT_MOUNTINGS];
+static long quat9[BENCH_QUAT_MAX][3];
+static int32_t q30[BENCH_QUAT_MAX][4];
+static int16_t q14[BENCH_QUAT_MAX][4];
+static struct quat_batch batch;
+static volatile uint32_t sink;
+
+static uint32_t rand_state;
+
+static uint32_t bench_rand(void)
+{
+	rand_state = rand_state * 1664525u + 1013904223u;
+	return rand_state >> 8;
+}
+
+static int16_t q30_to_q14(int32_t q)
+{
+	return (int16_t)((q + (1 << 15)) >> 16);
+}
+
+static void setup(void)
+{
+	static const signed char mountings[BENCH_QUAT_MOUNTINGS][9] = {
+		{ 1, 0, 0, 0, 1, 0, 0, 0, 1 },
+		{ 0, 1, 0, -1, 0, 0, 0, 0, 1 },
+		{ 0, 0, -1, 0, -1, 0, -1, 0, 0 },
+		{ -1, 0, 0, 0, 1, 0, 0, 0, -1 },
+	};
+	static const float angles[BENCH_QUAT_MOUNTINGS] = { 0.0f, 30.0f, -135.0f, 90.0f };
+	int i, k;
+
+	for(i = 0; i < BENCH_QUAT_MOUNTINGS; ++i)
+		inv_icm20948_set_chip_to_body_axis_quaternion(&icm[i], (signed char *)mountings[i], angles[i]);
+
+	rand_state = BENCH_QUAT_SEED;
+	for(i = 0; i < BENCH_QUAT_MAX; ++i) {
+		double q[4], norm = 0;
+
+		for(k = 0; k < 4; ++k) {
+			q[k] = (double)((int32_t)bench_rand() - (1 << 23)) / (1 << 23);
+			norm += q[k] * q[k];
+		}
+		norm = sqrt(norm);
+		/* the DMP keeps w positive and sends x y z only */
+		if(q[0] < 0)
+			norm = -norm;
+		for(k = 0; k < 3; ++k)
+			quat9[i][k] = (long)(q[k + 1] / norm * 1073741823.0);
+	}
+}
+
+static void per_sample(unsigned n)
+{
+	unsigned i;
+	int k;
+
+	for(i = 0; i < n; ++i) {
+		inv_icm20948_convert_rotation_vector_q30(&icm[i % BENCH_QUAT_MOUNTINGS], quat9[i], q30[i]);
+		for(k = 0; k < 4; ++k)
+			q14[i][k] = q30_to_q14(q30[i][k]);
+	}
+	sink += (uint32_t)q14[n - 1][0];
+}
+
+static void batched(unsigned n)
+{
+	unsigned i;
+
+	quat_batch_clear(&batch);
+	for(i = 0; i < n; ++i)
+		quat_batch_add(&batch, quat9[i], icm[i % BENCH_QUAT_MOUNTINGS].s_quat_chip_to_body);
+	quat_batch_run(&batch);
+	sink += (uint32_t)batch.q14w[n - 1];
+}
+
+static void bench_case(struct bench_json * j, const char * prefix, void (*run)(unsigned), unsigned n)
+{
+	char name[32];
+	uint64_t total = 0;
+	uint32_t best = UINT32_MAX;
+	unsigned rep, s;
+
+	for(rep = 0; rep < BENCH_QUAT_REPS; ++rep) {
+		const uint32_t start = bench_cycles();
+		uint32_t per;
+
+		for(s = 0; s < BENCH_QUAT_SWEEPS; ++s)
+			run(n);
+		per = (bench_cycles() - start) / (BENCH_QUAT_SWEEPS * n);
+		total += per;
+		if(per < best)
+			best = per;
+	}
+	snprintf(name, sizeof(name), "%s_%u", prefix, n);
+	bench_json_result(j, name, "sample", n, BENCH_QUAT_REPS, (uint32_t)(total / BENCH_QUAT_REPS), best);
+}
+
+/* The batch must give the per sample results bit for bit */
+static unsigned check(void)
+{
+	unsigned errors = 0, i;
+
+	per_sample(BENCH_QUAT_MAX);
+	batched(BENCH_QUAT_MAX);
+	for(i = 0; i < BENCH_QUAT_MAX; ++i) {
+		const int32_t bq30[4] = { batch.qw[i], batch.qx[i], batch.qy[i], batch.qz[i] };
+		const int16_t bq14[4] = { batch.q14w[i], batch.q14x[i], batch.q14y[i], batch.q14z[i] };
+
+		if(memcmp(bq30, q30[i], sizeof(bq30)) != 0 || memcmp(bq14, q14[i], sizeof(bq14)) != 0)
+			errors++;
+	}
+	return errors;
+}
+
+int main(void)
+{
+	static const unsigned counts[] = { 16, 64, 256 };
+	struct bench_json j;
+	unsigned errors, k;
+
+	bench_cycles_init();
+	setup();
+	errors = check();
+	bench_json_begin(&j, "quat", BENCH_QUAT_SEED);
+	for(k = 0; k < sizeof(counts)/sizeof(counts[0]); ++k) {
+		bench_case(&j, "per_sample", per_sample, counts[k]);
+		bench_case(&j, "batch", batched, counts[k]);
+	}
+	bench_json_end(&j, errors);
+	return errors ? 1 : 0;
+}
@@ -0,0 +1,159 @@
+/*
+ * bench_sched.c
+ *
+ * Cost of the InvScheduler core with 16, 64 and 256 periodic tasks:
+ *   dispatch_<n>    InvScheduler_dispatchTasks() once per tick, per task run
+ *   next_time_<n>   InvScheduler_getNextTime(), per call
+ *   restart_<n>     InvScheduler_startTask() of a queued task, per call
+ *
+ * Periods come from a fixed seed. Every task must run once per period over
+ * the dispatch case, the tasks that do not are counted as errors.
+ * The report is JSON, see bench_json.h.
+ */
+#include <string.h>
+#include <stdint.h>
+
+#include "Invn/EmbUtils/InvScheduler.h"
+
+#include "bench_cycles.h"
+#include "bench_json.h"
+
+#define BENCH_SCHED_SEED		0x2468aceu
+#define BENCH_SCHED_REPS		16
+#define BENCH_SCHED_MAX_TASKS	256
+/* periods in ticks */
+#define BENCH_SCHED_PERIOD_MIN	8
+#define BENCH_SCHED_PERIOD_SPAN	120
+#define BENCH_SCHED_TICKS		1000
+#define BENCH_SCHED_CALLS		1000
+
+static InvScheduler scheduler;
+static InvSchedulerTask tasks[BENCH_SCHED_MAX_TASKS];
+static uint32_t runs[BENCH_SCHED_MAX_TASKS];
+
+static uint32_t rand_state;
+
+static uint32_t bench_rand(void)
+{
+	rand_state = rand_state * 1664525u + 1013904223u;
+	return rand_state >> 8;
+}
+
+static void task_main(void * arg)
+{
+	runs[(InvSchedulerTask *)arg - tasks]++;
+}
+
+static void setup(unsigned n)
+{
+	unsigned i;
+
+	rand_state = BENCH_SCHED_SEED;
+	InvScheduler_init(&scheduler);
+	memset(runs, 0, sizeof(runs));
+	for(i = 0; i < n; ++i) {
+		InvScheduler_initTask(&scheduler, &tasks[i], "bench", task_main, &tasks[i],
+				INVSCHEDULER_TASK_PRIO_NORMAL, BENCH_SCHED_PERIOD_MIN + bench_rand() % BENCH_SCHED_PERIOD_SPAN);
+		InvScheduler_startTask(&tasks[i], 0);
+	}
+}
+
+static void bench_dispatch(struct bench_json * j, unsigned n, unsigned * errors)
+{
+	char name[32];
+	uint64_t total = 0;
+	uint32_t best = UINT32_MAX, items = 0;
+	unsigned rep, i, t;
+
+	for(rep = 0; rep < BENCH_SCHED_REPS; ++rep) {
+		uint32_t cycles = 0, run = 0;
+
+		setup(n);
+		for(t = 0; t < BENCH_SCHED_TICKS; ++t) {
+			const uint32_t start = bench_cycles();
+			run += InvScheduler_dispatchTasks(&scheduler);
+			cycles += bench_cycles() - start;
+			InvScheduler_updateTime(&scheduler);
+		}
+		/* first run on tick 0, then every period */
+		for(i = 0; i < n; ++i) {
+			if(runs[i] != (BENCH_SCHED_TICKS + tasks[i].period - 1) / tasks[i].period)
+				(*errors)++;
+		}
+		total += cycles / run;
+		if(cycles / run < best)
+			best = cycles / run;
+		items = run;
+	}
+	snprintf(name, sizeof(name), "dispatch_%u", n);
+	bench_json_result(j, name, "task run", items, BENCH_SCHED_REPS, (uint32_t)(total / BENCH_SCHED_REPS), best);
+}
+
+static void bench_next_time(struct bench_json * j, unsigned n)
+{
+	char name[32];
+	uint64_t total = 0;
+	uint32_t best = UINT32_MAX;
+	volatile uint32_t sink = 0;
+	unsigned rep, c;
+
+	setup(n);
+	InvScheduler_dispatchTasks(&scheduler);
+	InvScheduler_updateTime(&scheduler);
+	for(rep = 0; rep < BENCH_SCHED_REPS; ++rep) {
+		const uint32_t start = bench_cycles();
+		uint32_t per;
+
+		for(c = 0; c < BENCH_SCHED_CALLS; ++c)
+			sink += InvScheduler_getNextTime(&scheduler);
+		per = (bench_cycles() - start) / BENCH_SCHED_CALLS;
+		total += per;
+		if(per < best)
+			best = per;
+	}
+	(void)sink;
+	snprintf(name, sizeof(name), "next_time_%u", n);
+	bench_json_result(j, name, "call", BENCH_SCHED_CALLS, BENCH_SCHED_REPS, (uint32_t)(total / BENCH_SCHED_REPS), best);
+}
+
+static void bench_restart(struct bench_json * j, unsigned n)
+{
+	char name[32];
+	uint64_t total = 0;
+	uint32_t best = UINT32_MAX;
+	unsigned rep, c;
+
+	setup(n);
+	InvScheduler_dispatchTasks(&scheduler);
+	InvScheduler_updateTime(&scheduler);
+	for(rep = 0; rep < BENCH_SCHED_REPS; ++rep) {
+		const uint32_t start = bench_cycles();
+		uint32_t per;
+
+		for(c = 0; c < BENCH_SCHED_CALLS; ++c)
+			InvScheduler_startTask(&tasks[bench_rand() % n], 1 + c % BENCH_SCHED_PERIOD_SPAN);
+		per = (bench_cycles() - start) / BENCH_SCHED_CALLS;
+		total += per;
+		if(per < best)
+			best = per;
+	}
+	snprintf(name, sizeof(name), "restart_%u", n);
+	bench_json_result(j, name, "call", BENCH_SCHED_CALLS, BENCH_SCHED_REPS, (uint32_t)(total / BENCH_SCHED_REPS), best);
+}
+
+int main(void)
+{
+	static const unsigned counts[] = { 16, 64, 256 };
+	struct bench_json j;
+	unsigned errors = 0, k;
+
+	bench_cycles_init();
+	bench_json_begin(&j, "sched", BENCH_SCHED_SEED);
+	for(k = 0; k < sizeof(counts)/sizeof(counts[0]); ++k) {
+		bench_dispatch(&j, counts[k], &errors);
+		bench_next_time(&j, counts[k]);
+		bench_restart(&j, counts[k]);
+	}
+	bench_json_end(&j, errors);
+	return errors ? 1 : 0;
+}
@@ -0,0 +1,53 @@
+/*
+ * asf.h
+ *
+ * Host replacement for the ASF header, only what the application sources
+ * built in the simulator use. TWI transfers go to the simulated bus
+ * (sim_bus.c), delays move the simulated time.
+ */
+
+
+#ifndef SIM_ASF_H_
+#define SIM_ASF_H_
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+
+#define TWI_SUCCESS              0
+#define TWI_INVALID_ARGUMENT     1
+#define TWI_NO_CHIP_FOUND        3
+#define TWI_RECEIVE_NACK         5
+
+typedef struct {
+	int id;
+} Twi;
+
+extern Twi sim_twi0;
+#define TWI0	(&sim_twi0)
+
+typedef struct {
+	uint32_t speed;
+	uint8_t chip;
+} twi_master_options_t;
+
+typedef struct twi_packet {
+	uint8_t addr[3];
+	uint32_t addr_length;
+	void *buffer;
+	uint32_t length;
+	uint8_t chip;
+} twi_packet_t;
+
+typedef twi_packet_t twi_package_t;
+
+uint32_t twi_master_setup(Twi *p_twi, twi_master_options_t *p_opt);
+uint32_t twi_master_read(Twi *p_twi, twi_packet_t *p_packet);
+uint32_t twi_master_write(Twi *p_twi, twi_packet_t *p_packet);
+
+void sim_delay_us(uint32_t us);
+
+#define delay_us(us)	sim_delay_us(us)
+#define delay_ms(ms)	sim_delay_us((ms) * 1000)
+
+#endif /* SIM_ASF_H_ */
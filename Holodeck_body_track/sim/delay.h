@@ -0,0 +1,13 @@
+/*
+ * delay.h
+ *
+ * Host replacement for the ASF delay service, see asf.h.
+ */
+
+
+#ifndef SIM_DELAY_H_
+#define SIM_DELAY_H_
+
+#include "asf.h"
+
+#endif /* SIM_DELAY_H_ */
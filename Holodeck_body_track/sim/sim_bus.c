@@ -0,0 +1,265 @@
+/*
+ * sim_bus.c
+ *
+ * Simulated TWI0 bus, see sim_bus.h.
+ *
+ * Wire cost of a transfer: START, 9 bits per byte (8 data + ACK) and STOP,
+ * plus a repeated START between the register address and the data of a read.
+ */
+#include <asf.h>
+#include <string.h>
+
+#include "prof_zone.h"
+#include "time_wrapper.h"
+#include "acq_cycle.h"
+
+#include "sim_icm20948.h"
+#include "sim_bus.h"
+
+#define BUS_DEFAULT_SPEED	100000
+/* Time a pass of the firmware idle loop costs while it waits for a cycle */
+#define CYCLE_IDLE_NS		2000
+
+Twi sim_twi0;
+
+static uint32_t speed_hz = BUS_DEFAULT_SPEED;
+static uint32_t speed_override;
+static uint64_t now_ns;
+static struct sim_bus_stats stats;
+
+static struct {
+	uint8_t addr;
+	int     parent;
+	int     channel;
+	uint8_t mask;
+} muxes[SIM_BUS_MAX_MUXES];
+static int mux_count;
+
+static void wire(unsigned bytes, unsigned extra_bits)
+{
+	const uint64_t ns = ((uint64_t)bytes * 9 + extra_bits) * 1000000000u / speed_hz;
+
+	now_ns += ns;
+	stats.busy_ns += ns;
+	stats.bytes += bytes;
+}
+
+/* Whether what is behind a mux channel is on the bus, mux -1 being TWI0 itself */
+static int port_open(int mux, int channel)
+{
+	while(mux >= 0) {
+		if(!(muxes[mux].mask & (1 << channel)))
+			return 0;
+		channel = muxes[mux].channel;
+		mux = muxes[mux].parent;
+	}
+	return 1;
+}
+
+/*
+ * Muxes and devices acking addr through the open channels
+ * Returns how many answer, mux first
+ */
+static int answering(uint8_t addr, int * mux, int * mux_n, int * dev, int * dev_n)
+{
+	const int count = sim_icm20948_count();
+	int i;
+
+	*mux_n = *dev_n = 0;
+	for(i = 0; i < mux_count; ++i) {
+		if(muxes[i].addr == addr && port_open(muxes[i].parent, muxes[i].channel))
+			mux[(*mux_n)++] = i;
+	}
+	for(i = 0; i < count; ++i) {
+		const struct sim_icm20948_stats * st = sim_icm20948_get_stats(i);
+
+		if(st->addr == addr && sim_icm20948_plugged(i) && port_open(st->mux, st->channel))
+			dev[(*dev_n)++] = i;
+	}
+	return *mux_n + *dev_n;
+}
+
+/*
+ * Mux or device acking addr through the open channels, negative if none
+ * The first one found gets the transfer when more answer
+ */
+static void lookup(uint8_t addr, int * mux, int * dev)
+{
+	int muxes_found[SIM_BUS_MAX_MUXES], devs_found[SIM_ICM20948_MAX];
+	int mux_n, dev_n;
+
+	if(answering(addr, muxes_found, &mux_n, devs_found, &dev_n) > 1)
+		stats.conflicts++;
+	*mux = mux_n ? muxes_found[0] : -1;
+	*dev = (!mux_n && dev_n) ? devs_found[0] : -1;
+}
+
+void sim_bus_init(uint32_t speed)
+{
+	int i;
+
+	speed_override = speed;
+	speed_hz = speed ? speed : BUS_DEFAULT_SPEED;
+	now_ns = 0;
+	for(i = 0; i < mux_count; ++i)
+		muxes[i].mask = 0;
+	memset(&stats, 0, sizeof(stats));
+}
+
+int sim_bus_add_mux(uint8_t addr, int parent, int channel)
+{
+	if(mux_count >= SIM_BUS_MAX_MUXES || parent >= mux_count || channel < 0 || channel >= SIM_BUS_MUX_CHANNELS)
+		return -1;
+	muxes[mux_count].addr = addr;
+	muxes[mux_count].parent = parent;
+	muxes[mux_count].channel = (parent < 0) ? 0 : channel;
+	muxes[mux_count].mask = 0;
+	return mux_count++;
+}
+
+int sim_bus_find_mux(uint8_t addr)
+{
+	int i;
+
+	for(i = 0; i < mux_count; ++i) {
+		if(muxes[i].addr == addr)
+			return i;
+	}
+	return -1;
+}
+
+uint8_t sim_bus_mux_addr(int mux)
+{
+	return (mux >= 0 && mux < mux_count) ? muxes[mux].addr : 0;
+}
+
+uint64_t sim_bus_time_ns(void)
+{
+	return now_ns;
+}
+
+void sim_bus_wait_ns(uint64_t ns)
+{
+	now_ns += ns;
+}
+
+const struct sim_bus_stats * sim_bus_get_stats(void)
+{
+	return &stats;
+}
+
+void sim_bus_clear_stats(void)
+{
+	memset(&stats, 0, sizeof(stats));
+}
+
+void sim_delay_us(uint32_t us)
+{
+	now_ns += (uint64_t)us * 1000;
+}
+
+uint64_t time_wrapper_host_us(void)
+{
+	return now_ns / 1000;
+}
+
+void acq_cycle_host_idle(void)
+{
+	now_ns += CYCLE_IDLE_NS;
+}
+
+#if PROF_ZONES
+uint32_t prof_zone_host_cycles(void)
+{
+	return (uint32_t)(now_ns * (SIM_CPU_HZ / 1000000) / 1000);
+}
+#endif
+
+uint32_t twi_master_setup(Twi *p_twi, twi_master_options_t *p_opt)
+{
+	(void)p_twi;
+	if(!speed_override && p_opt->speed)
+		speed_hz = p_opt->speed;
+	return TWI_SUCCESS;
+}
+
+uint32_t twi_master_write(Twi *p_twi, twi_packet_t *p_packet)
+{
+	const uint8_t * data = (const uint8_t *)p_packet->buffer;
+	unsigned len = p_packet->length;
+	int mux[SIM_BUS_MAX_MUXES], dev[SIM_ICM20948_MAX];
+	int reg = -1, mux_n, dev_n, k;
+
+	(void)p_twi;
+	stats.transactions++;
+
+	/* every target answering takes the write, each acks on the same wire */
+	if(answering(p_packet->chip, mux, &mux_n, dev, &dev_n) > 1) {
+		if(mux_n && dev_n)
+			stats.conflicts++;
+		else
+			stats.broadcasts++;
+	}
+	if(mux_n) {
+		/* TCA9548 keeps the last byte received as control register */
+		const unsigned n = p_packet->addr_length + len;
+		for(k = 0; k < mux_n; ++k) {
+			if(len)
+				muxes[mux[k]].mask = data[len - 1];
+			else if(p_packet->addr_length)
+				muxes[mux[k]].mask = p_packet->addr[p_packet->addr_length - 1];
+		}
+		stats.mux_transactions++;
+		stats.mux_bytes += 1 + n;
+		wire(1 + n, 2);
+		return TWI_SUCCESS;
+	}
+
+	if(!dev_n) {
+		stats.nacks++;
+		wire(1, 2);
+		return TWI_RECEIVE_NACK;
+	}
+
+	if(p_packet->addr_length)
+		reg = p_packet->addr[0];
+	else if(len)
+		reg = *data++, --len;
+
+	for(k = 0; k < dev_n; ++k)
+		sim_icm20948_write(dev[k], reg, data, len, now_ns);
+	stats.write_bytes += len;
+	wire(1 + p_packet->addr_length + p_packet->length, 2);
+	return TWI_SUCCESS;
+}
+
+uint32_t twi_master_read(Twi *p_twi, twi_packet_t *p_packet)
+{
+	uint8_t * data = (uint8_t *)p_packet->buffer;
+	const unsigned addr_bytes = p_packet->addr_length ? 1 + p_packet->addr_length : 0;
+	const unsigned restart = p_packet->addr_length ? 1 : 0;
+	int mux, idx;
+
+	(void)p_twi;
+	stats.transactions++;
+
+	lookup(p_packet->chip, &mux, &idx);
+	if(mux >= 0) {
+		memset(data, muxes[mux].mask, p_packet->length);
+		stats.mux_transactions++;
+		stats.mux_bytes += addr_bytes + 1 + p_packet->length;
+		wire(addr_bytes + 1 + p_packet->length, 2 + restart);
+		return TWI_SUCCESS;
+	}
+
+	if(idx < 0) {
+		stats.nacks++;
+		wire(1, 2);
+		return TWI_RECEIVE_NACK;
+	}
+
+	sim_icm20948_read(idx, p_packet->addr_length ? p_packet->addr[0] : -1, data, p_packet->length, now_ns);
+	stats.read_bytes += p_packet->length;
+	wire(addr_bytes + 1 + p_packet->length, 2 + restart);
+	return TWI_SUCCESS;
+}
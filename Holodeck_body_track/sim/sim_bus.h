@@ -0,0 +1,68 @@
+/*
+ * sim_bus.h
+ *
+ * Simulated TWI0 bus of the Due: a tree of TCA9548 muxes, on TWI0 or behind
+ * a channel of another mux, and ICM-20948 behind their channels (0x68 and
+ * 0x69), see sim_icm20948.h. A transfer goes to whatever answers at its
+ * address through the channels open. A write reaches every device, or
+ * every mux, answering, as on the wire; more than one answering a read,
+ * or a mux and a device a write, is counted as a conflict.
+ *
+ * Time only moves when the firmware uses the bus or waits (delay_us()), each
+ * transfer costing its bits on the wire at the speed given to
+ * twi_master_setup(). CPU time of the firmware is not accounted.
+ */
+
+
+#ifndef SIM_BUS_H_
+#define SIM_BUS_H_
+
+#include <stdint.h>
+
+#define SIM_BUS_MUX_ADDR		0x70
+#define SIM_BUS_MUX_CHANNELS	8
+#define SIM_BUS_MAX_MUXES		16
+
+/* Core clock of the Due, simulated time is reported in these cycles to prof_zone.h */
+#define SIM_CPU_HZ				84000000u
+
+/* Bus counters, "bytes" are bytes on the wire including address bytes */
+struct sim_bus_stats {
+	uint32_t transactions;	/* START to STOP, a register read counts as one */
+	uint32_t nacks;			/* transactions nobody answered */
+	uint32_t bytes;
+	uint32_t read_bytes;	/* data bytes read from devices */
+	uint32_t write_bytes;	/* data bytes written to devices, register address excluded */
+	uint32_t mux_transactions;
+	uint32_t mux_bytes;
+	uint32_t conflicts;		/* transactions more than one target answered */
+	uint32_t broadcasts;	/* writes that reached more than one target, no conflict */
+	uint64_t busy_ns;		/* time the bus was busy */
+};
+
+/** @brief Reset the simulated time, the mux states and the counters
+ *  @param[in] speed_hz  bus speed, 0 to use the one given to twi_master_setup()
+ */
+void sim_bus_init(uint32_t speed_hz);
+
+/** @brief Add a mux, all channels off
+ *  @param[in] parent   index of the mux it is behind, -1 for TWI0
+ *  @param[in] channel  channel of the parent
+ *  @return mux index, negative value if the table is full
+ */
+int sim_bus_add_mux(uint8_t addr, int parent, int channel);
+
+/* Index of the first mux added at addr, negative if none */
+int sim_bus_find_mux(uint8_t addr);
+uint8_t sim_bus_mux_addr(int mux);
+
+/* Current simulated time */
+uint64_t sim_bus_time_ns(void);
+
+/* Let the simulated time move forward */
+void sim_bus_wait_ns(uint64_t ns);
+
+const struct sim_bus_stats * sim_bus_get_stats(void);
+void sim_bus_clear_stats(void);
+
+#endif /* SIM_BUS_H_ */
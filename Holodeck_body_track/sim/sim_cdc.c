@@ -0,0 +1,104 @@
+/*
+ * sim_cdc.c
+ *
+ * Simulated USB CDC link, see sim_cdc.h.
+ */
+#include <asf.h>
+#include <string.h>
+
+#include "usb_cdc_coms.h"
+#include "sim_bus.h"
+#include "sim_cdc.h"
+
+#define SIM_CDC_RX_SIZE		1024
+
+static FILE * out_file;
+static uint64_t enable_ns;
+static uint8_t rx_buf[SIM_CDC_RX_SIZE];
+static unsigned rx_head, rx_count;
+static struct sim_cdc_stats stats;
+
+void sim_cdc_init(FILE * out, uint32_t enum_ms)
+{
+	out_file = out;
+	enable_ns = (uint64_t)enum_ms * 1000000;
+	rx_head = rx_count = 0;
+	memset(&stats, 0, sizeof(stats));
+}
+
+unsigned sim_cdc_feed(const uint8_t * data, unsigned len)
+{
+	unsigned i;
+
+	for(i = 0; i < len && rx_count < SIM_CDC_RX_SIZE; ++i, ++rx_count)
+		rx_buf[(rx_head + rx_count) % SIM_CDC_RX_SIZE] = data[i];
+	return i;
+}
+
+const struct sim_cdc_stats * sim_cdc_get_stats(void)
+{
+	return &stats;
+}
+
+void sim_cdc_clear_stats(void)
+{
+	memset(&stats, 0, sizeof(stats));
+}
+
+void serialInit()
+{
+}
+
+bool serialReady(void)
+{
+	return sim_bus_time_ns() >= enable_ns;
+}
+
+uint32_t serialEnableCycles(void)
+{
+	return (uint32_t)(enable_ns / 1000);
+}
+
+void serialWrite(char *buffer, int size)
+{
+	if(!serialReady())
+		return;
+	stats.writes++;
+	stats.tx_bytes += size;
+	if(out_file)
+		fwrite(buffer, 1, size, out_file);
+}
+
+void handleInput()
+{
+}
+
+uint16_t serialRead(uint8_t *buffer, uint16_t max)
+{
+	uint16_t n = 0;
+
+	while(n < max && rx_count) {
+		buffer[n++] = rx_buf[rx_head];
+		rx_head = (rx_head + 1) % SIM_CDC_RX_SIZE;
+		rx_count--;
+	}
+	stats.rx_bytes += n;
+	return n;
+}
+
+void twi_init(void)
+{
+}
+
+const struct serial_stats * serialStats(void)
+{
+	static struct serial_stats tx_stats;
+
+	/* the simulated link never drops */
+	tx_stats.written_bytes = stats.tx_bytes;
+	return &tx_stats;
+}
+
+void waitForTXReady()
+{
+}
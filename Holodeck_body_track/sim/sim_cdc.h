@@ -0,0 +1,37 @@
+/*
+ * sim_cdc.h
+ *
+ * Simulated USB CDC link, implements usb_cdc_coms.h.
+ * What the firmware sends is counted and can be copied to a file, what the
+ * host sends is queued with sim_cdc_feed(). The host enables CDC a given
+ * time after the start, what is sent before is lost as on the Due.
+ */
+
+
+#ifndef SIM_CDC_H_
+#define SIM_CDC_H_
+
+#include <stdint.h>
+#include <stdio.h>
+
+struct sim_cdc_stats {
+	uint32_t writes;		/* serialWrite() calls */
+	uint32_t tx_bytes;
+	uint32_t rx_bytes;		/* bytes read by the firmware */
+};
+
+/** @brief Reset the link
+ *  @param[in] out      file receiving the CDC output, may be NULL
+ *  @param[in] enum_ms  simulated time at which the host enables CDC
+ */
+void sim_cdc_init(FILE * out, uint32_t enum_ms);
+
+/** @brief Queue bytes sent by the host
+ *  @return number of bytes queued
+ */
+unsigned sim_cdc_feed(const uint8_t * data, unsigned len);
+
+const struct sim_cdc_stats * sim_cdc_get_stats(void);
+void sim_cdc_clear_stats(void);
+
+#endif /* SIM_CDC_H_ */
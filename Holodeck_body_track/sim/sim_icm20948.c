@@ -0,0 +1,772 @@
+/*
+ * sim_icm20948.c
+ *
+ * Register level ICM-20948 model, see sim_icm20948.h.
+ */
+#include <math.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "Invn/Devices/Drivers/Icm20948/Icm20948.h"
+#include "Invn/Devices/Drivers/Icm20948/Icm20948Defs.h"
+#include "Invn/Devices/Drivers/Icm20948/Icm20948DataBaseControl.h"
+
+#include "sim_icm20948.h"
+
+#define WHO_AM_I_VALUE		0xEA
+#define SIM_FIFO_SIZE			HARDWARE_FIFO_SIZE
+#define DMP_MEM_SIZE		(256 * 256)
+#define BASE_RATE_HZ		1125
+
+/* DMP memory addresses, same as Icm20948Dmp3Driver.c */
+#define DATA_OUT_CTL1		(4 * 16)
+#define DATA_OUT_CTL2		(4 * 16 + 2)
+#define ODR_ACCEL			(11 * 16 + 14)
+#define ODR_GYRO			(11 * 16 + 10)
+#define ODR_CPASS			(11 * 16 +  6)
+#define ODR_QUAT6			(10 * 16 + 12)
+#define ODR_QUAT9			(10 * 16 +  8)
+#define ODR_PQUAT6			(10 * 16 +  4)
+#define ODR_GEOMAG			(10 * 16 +  0)
+#define ODR_CPASS_CALIBR	(11 * 16 +  4)
+
+/* Auxiliary I2C master, bank 3 */
+#define SLV_ADDR(i)			(0x03 + 4*(i))
+#define SLV_REG(i)			(0x04 + 4*(i))
+#define SLV_CTRL(i)			(0x05 + 4*(i))
+#define SLV_DO(i)			(0x06 + 4*(i))
+#define EXT_SLV_SENS_DATA	(REG_EXT_SLV_SENS_DATA_00 & 0x7F)
+#define EXT_SLV_SENS_SIZE	24
+
+/* AK09916 */
+#define AK_ADDR				0x0C
+#define AK_WIA1				0x00
+#define AK_WIA2				0x01
+#define AK_ST1				0x10
+#define AK_HXL				0x11
+#define AK_ST2				0x18
+#define AK_CNTL2			0x31
+#define AK_CNTL3			0x32
+#define AK_REGS				0x40
+
+/* Output scales, FSR as configured by the driver at init */
+#define GYRO_LSB_PER_DPS	16.4		/* 2000 dps */
+#define ACCEL_LSB_PER_G		8192.0		/* 4 g */
+#define CPASS_UT_PER_LSB	0.15
+#define Q30					1073741824.0
+#define Q16					65536.0
+#define Q14					16384.0
+
+/* Quaternion accuracy sent with QUAT9/GEOMAG, rad in Q29, high 16 bits */
+#define QUAT_ACCURACY_RAD	0.05
+#define SENSOR_ACCURACY		3
+
+struct dmp_output {
+	uint16_t bit;
+	uint16_t odr_addr;
+};
+
+/* FIFO packet order, see inv_icm20948_inv_decode_one_ivory_fifo_packet() */
+static const struct dmp_output outputs[] = {
+	{ ACCEL_SET,        ODR_ACCEL },
+	{ GYRO_SET,         ODR_GYRO },
+	{ CPASS_SET,        ODR_CPASS },
+	{ QUAT6_SET,        ODR_QUAT6 },
+	{ QUAT9_SET,        ODR_QUAT9 },
+	{ PQUAT6_SET,       ODR_PQUAT6 },
+	{ GEOMAG_SET,       ODR_GEOMAG },
+	{ CPASS_CALIBR_SET, ODR_CPASS_CALIBR },
+};
+#define NB_OUTPUTS	(sizeof(outputs)/sizeof(outputs[0]))
+
+struct sim_icm20948 {
+	struct sim_icm20948_stats stats;
+
+	uint8_t  regs[4][128];
+	uint8_t  bank;
+	uint8_t  reg_ptr;
+	uint8_t  mem_bank;
+	uint8_t  mem_addr;
+	uint8_t  mem[DMP_MEM_SIZE];
+	uint16_t fifo_count_latch;
+
+	uint8_t  fifo[SIM_FIFO_SIZE];
+	uint16_t fifo_head;
+	uint16_t fifo_count;
+
+	uint8_t  ak[AK_REGS];
+	int      unplugged;
+
+	/* DMP */
+	int32_t  clock_ppm;			/* sample clock error */
+	float    motion_scale;		/* of the rates of the script */
+	int      running;
+	uint64_t next_tick_ns;
+	uint16_t odr_cnt[NB_OUTPUTS];
+	uint16_t tick_cnt;
+	uint64_t motion_ns;			/* time the motion is at */
+	uint32_t motion_us;			/* time in current segment */
+	int      motion_seg;
+	double   q[4];				/* body to world, w x y z */
+	double   rate_body[3];		/* rad/s */
+};
+
+static const struct sim_motion_seg default_motion[] = {
+	{  500, {   0.0f,  0.0f,   0.0f } },
+	{ 1000, {   0.0f,  0.0f,  90.0f } },
+	{  500, { 180.0f,  0.0f,   0.0f } },
+	{  500, {   0.0f, 45.0f, -45.0f } },
+	{  500, {   0.0f,  0.0f,   0.0f } },
+};
+
+static struct sim_icm20948 devices[SIM_ICM20948_MAX];
+static int device_count;
+
+static const struct sim_motion_seg * motion = default_motion;
+static int motion_count = sizeof(default_motion)/sizeof(default_motion[0]);
+/* every device on one body, the script running from time 0 */
+static int rigid;
+
+/* Loaded script */
+#define MOTION_MAX_SEGS		64
+static struct sim_motion_seg motion_file[MOTION_MAX_SEGS];
+
+/*
+ * Quaternion helpers, w x y z
+ */
+static void quat_mult(const double a[4], const double b[4], double r[4])
+{
+	double t[4];
+
+	t[0] = a[0]*b[0] - a[1]*b[1] - a[2]*b[2] - a[3]*b[3];
+	t[1] = a[0]*b[1] + a[1]*b[0] + a[2]*b[3] - a[3]*b[2];
+	t[2] = a[0]*b[2] - a[1]*b[3] + a[2]*b[0] + a[3]*b[1];
+	t[3] = a[0]*b[3] + a[1]*b[2] - a[2]*b[1] + a[3]*b[0];
+	memcpy(r, t, sizeof(t));
+}
+
+/* World vector to body frame */
+static void quat_to_body(const double q[4], const double v[3], double r[3])
+{
+	const double qc[4] = { q[0], -q[1], -q[2], -q[3] };
+	const double p[4] = { 0, v[0], v[1], v[2] };
+	double t[4];
+
+	quat_mult(qc, p, t);
+	quat_mult(t, q, t);
+	r[0] = t[1], r[1] = t[2], r[2] = t[3];
+}
+
+static int16_t sat16(double v)
+{
+	if(v > 32767.0)
+		return 32767;
+	if(v < -32768.0)
+		return -32768;
+	return (int16_t)lrint(v);
+}
+
+static int32_t sat32(double v)
+{
+	if(v > 2147483647.0)
+		return 2147483647;
+	if(v < -2147483648.0)
+		return (int32_t)-2147483647 - 1;
+	return (int32_t)llrint(v);
+}
+
+static uint8_t * put16(uint8_t * p, int16_t v)
+{
+	p[0] = (uint8_t)((uint16_t)v >> 8);
+	p[1] = (uint8_t)v;
+	return p + 2;
+}
+
+static uint8_t * put32(uint8_t * p, int32_t v)
+{
+	p[0] = (uint8_t)((uint32_t)v >> 24);
+	p[1] = (uint8_t)((uint32_t)v >> 16);
+	p[2] = (uint8_t)((uint32_t)v >> 8);
+	p[3] = (uint8_t)v;
+	return p + 4;
+}
+
+static uint16_t mem16(const struct sim_icm20948 * d, uint16_t addr)
+{
+	return (uint16_t)((d->mem[addr] << 8) | d->mem[addr + 1]);
+}
+
+/*
+ * Motion
+ */
+static void motion_reset(struct sim_icm20948 * d, int idx)
+{
+	uint32_t offset_ms = rigid ? 0 : 137 * idx;	/* so that all devices do not show the same data */
+
+	d->q[0] = 1.0, d->q[1] = d->q[2] = d->q[3] = 0.0;
+	d->motion_seg = 0;
+	d->motion_ns = 0;
+	d->motion_us = 0;
+	d->rate_body[0] = d->rate_body[1] = d->rate_body[2] = 0.0;
+	while(motion_count && offset_ms >= motion[d->motion_seg].duration_ms) {
+		offset_ms -= motion[d->motion_seg].duration_ms;
+		d->motion_seg = (d->motion_seg + 1) % motion_count;
+	}
+	d->motion_us = offset_ms * 1000;
+}
+
+static void motion_step(struct sim_icm20948 * d, uint32_t dt_us)
+{
+	const struct sim_motion_seg * seg;
+	double w[3], n, dq[4];
+
+	if(motion_count == 0)
+		return;
+
+	seg = &motion[d->motion_seg];
+	w[0] = seg->rate_dps[0] * d->motion_scale * M_PI / 180.0;
+	w[1] = seg->rate_dps[1] * d->motion_scale * M_PI / 180.0;
+	w[2] = seg->rate_dps[2] * d->motion_scale * M_PI / 180.0;
+	n = sqrt(w[0]*w[0] + w[1]*w[1] + w[2]*w[2]);
+	if(n > 0.0) {
+		const double a = n * dt_us * 1e-6 / 2;
+		dq[0] = cos(a);
+		dq[1] = sin(a) * w[0] / n;
+		dq[2] = sin(a) * w[1] / n;
+		dq[3] = sin(a) * w[2] / n;
+		quat_mult(dq, d->q, d->q);
+		n = sqrt(d->q[0]*d->q[0] + d->q[1]*d->q[1] + d->q[2]*d->q[2] + d->q[3]*d->q[3]);
+		d->q[0] /= n, d->q[1] /= n, d->q[2] /= n, d->q[3] /= n;
+	}
+	quat_to_body(d->q, w, d->rate_body);
+
+	d->motion_us += dt_us;
+	while(d->motion_us >= motion[d->motion_seg].duration_ms * 1000) {
+		d->motion_us -= motion[d->motion_seg].duration_ms * 1000;
+		d->motion_seg = (d->motion_seg + 1) % motion_count;
+		if(motion[d->motion_seg].duration_ms == 0)
+			break;
+	}
+}
+
+/*
+ * Run the motion up to t_ns, in steps of the longest DMP period at most that
+ * stop at the end of each segment, so the orientation does not depend on
+ * when the device is read
+ */
+static void motion_advance(struct sim_icm20948 * d, uint64_t t_ns)
+{
+	while(d->motion_ns < t_ns) {
+		uint64_t next = (t_ns - d->motion_ns > 10000000) ? d->motion_ns + 10000000 : t_ns;
+
+		if(motion_count) {
+			const uint64_t seg_end = d->motion_ns / 1000 * 1000
+					+ ((uint64_t)motion[d->motion_seg].duration_ms * 1000 - d->motion_us) * 1000;
+
+			if(seg_end > d->motion_ns && seg_end < next)
+				next = seg_end;
+		}
+		motion_step(d, (uint32_t)(next / 1000 - d->motion_ns / 1000));
+		d->motion_ns = next;
+	}
+}
+
+/*
+ * FIFO
+ */
+static void fifo_reset(struct sim_icm20948 * d)
+{
+	d->stats.fifo_bytes_lost += d->fifo_count;
+	d->fifo_head = 0;
+	d->fifo_count = 0;
+}
+
+static void fifo_push(struct sim_icm20948 * d, const uint8_t * data, unsigned len)
+{
+	unsigned i;
+
+	for(i = 0; i < len; ++i) {
+		if(d->fifo_count == SIM_FIFO_SIZE) {
+			/* stream mode, oldest byte is lost */
+			d->fifo_head = (d->fifo_head + 1) % SIM_FIFO_SIZE;
+			d->fifo_count--;
+			d->stats.fifo_bytes_lost++;
+			d->regs[0][REG_INT_STATUS_2 & 0x7F] |= 0x1F;
+		}
+		d->fifo[(d->fifo_head + d->fifo_count) % SIM_FIFO_SIZE] = data[i];
+		d->fifo_count++;
+	}
+	d->stats.fifo_bytes_in += len;
+	if(d->fifo_count > d->stats.fifo_peak)
+		d->stats.fifo_peak = d->fifo_count;
+}
+
+static uint8_t fifo_pop(struct sim_icm20948 * d)
+{
+	uint8_t v;
+
+	if(d->fifo_count == 0)
+		return 0xFF;
+	v = d->fifo[d->fifo_head];
+	d->fifo_head = (d->fifo_head + 1) % SIM_FIFO_SIZE;
+	d->fifo_count--;
+	d->stats.fifo_bytes_out++;
+	return v;
+}
+
+/*
+ * DMP
+ */
+static uint64_t dmp_period_ns(const struct sim_icm20948 * d)
+{
+	const unsigned div = d->regs[2][REG_GYRO_SMPLRT_DIV & 0x7F];
+
+	return (uint64_t)1000000000 * (1 + div) * (1000000 + d->clock_ppm) / 1000000 / BASE_RATE_HZ;
+}
+
+static int dmp_enabled(const struct sim_icm20948 * d)
+{
+	const uint8_t user_ctrl = d->regs[0][REG_USER_CTRL & 0x7F];
+
+	return (user_ctrl & (BIT_DMP_EN | BIT_FIFO_EN)) == (BIT_DMP_EN | BIT_FIFO_EN);
+}
+
+static void dmp_tick(struct sim_icm20948 * d, uint64_t now_ns)
+{
+	const uint16_t ctl1 = mem16(d, DATA_OUT_CTL1);
+	const uint16_t ctl2 = mem16(d, DATA_OUT_CTL2);
+	const double gravity[3] = { 0.0, 0.0, 1.0 };
+	const double field[3] = { 20.0, 0.0, -40.0 };	/* uT */
+	uint16_t header = 0, header2 = 0;
+	uint8_t pkt[64], * p = pkt;
+	double q[4], v[3];
+	unsigned k;
+
+	motion_advance(d, now_ns);
+	d->stats.dmp_ticks++;
+	d->tick_cnt++;
+
+	for(k = 0; k < NB_OUTPUTS; ++k) {
+		if(!(ctl1 & outputs[k].bit))
+			continue;
+		if(d->odr_cnt[k] >= mem16(d, outputs[k].odr_addr)) {
+			d->odr_cnt[k] = 0;
+			header |= outputs[k].bit;
+		} else {
+			d->odr_cnt[k]++;
+		}
+	}
+	if(header == 0)
+		return;
+
+	if(ctl1 & HEADER2_SET) {
+		if((header & ACCEL_SET) && (ctl2 & ACCEL_ACCURACY_SET))
+			header2 |= ACCEL_ACCURACY_SET;
+		if((header & GYRO_SET) && (ctl2 & GYRO_ACCURACY_SET))
+			header2 |= GYRO_ACCURACY_SET;
+		if((header & (CPASS_SET | QUAT9_SET | GEOMAG_SET | CPASS_CALIBR_SET)) && (ctl2 & CPASS_ACCURACY_SET))
+			header2 |= CPASS_ACCURACY_SET;
+		if(header2)
+			header |= HEADER2_SET;
+	}
+
+	/* DMP sends the vector part with a positive w */
+	memcpy(q, d->q, sizeof(q));
+	if(q[0] < 0)
+		q[0] = -q[0], q[1] = -q[1], q[2] = -q[2], q[3] = -q[3];
+
+	p = put16(p, (int16_t)header);
+	if(header & HEADER2_SET)
+		p = put16(p, (int16_t)header2);
+	if(header & ACCEL_SET) {
+		quat_to_body(d->q, gravity, v);
+		for(k = 0; k < 3; ++k)
+			p = put16(p, sat16(v[k] * ACCEL_LSB_PER_G));
+	}
+	if(header & GYRO_SET) {
+		for(k = 0; k < 3; ++k)
+			p = put16(p, sat16(d->rate_body[k] * 180.0 / M_PI * GYRO_LSB_PER_DPS));
+		for(k = 0; k < 3; ++k)
+			p = put16(p, 0);	/* bias */
+	}
+	if(header & CPASS_SET) {
+		quat_to_body(d->q, field, v);
+		for(k = 0; k < 3; ++k)
+			p = put16(p, sat16(v[k] / CPASS_UT_PER_LSB));
+	}
+	if(header & QUAT6_SET) {
+		for(k = 1; k < 4; ++k)
+			p = put32(p, sat32(q[k] * Q30));
+	}
+	if(header & QUAT9_SET) {
+		for(k = 1; k < 4; ++k)
+			p = put32(p, sat32(q[k] * Q30));
+		p = put16(p, (int16_t)((int32_t)(QUAT_ACCURACY_RAD * (1L << 29)) >> 16));
+	}
+	if(header & PQUAT6_SET) {
+		for(k = 1; k < 4; ++k)
+			p = put16(p, sat16(q[k] * Q14));
+	}
+	if(header & GEOMAG_SET) {
+		for(k = 1; k < 4; ++k)
+			p = put32(p, sat32(q[k] * Q30));
+		p = put16(p, (int16_t)((int32_t)(QUAT_ACCURACY_RAD * (1L << 29)) >> 16));
+	}
+	if(header & CPASS_CALIBR_SET) {
+		quat_to_body(d->q, field, v);
+		for(k = 0; k < 3; ++k)
+			p = put32(p, sat32(v[k] * Q16));
+	}
+	if(header2 & ACCEL_ACCURACY_SET)
+		p = put16(p, SENSOR_ACCURACY);
+	if(header2 & GYRO_ACCURACY_SET)
+		p = put16(p, SENSOR_ACCURACY);
+	if(header2 & CPASS_ACCURACY_SET)
+		p = put16(p, SENSOR_ACCURACY);
+	p = put16(p, (int16_t)(d->tick_cnt & 0xFFF));	/* footer, gyro ODR counter */
+
+	fifo_push(d, pkt, (unsigned)(p - pkt));
+	if(!d->stats.packets++)
+		d->stats.first_packet_ns = now_ns;
+	d->stats.last_packet_ns = now_ns;
+	d->regs[0][REG_INT_STATUS & 0x7F] |= BIT_MSG_DMP_INT;
+	d->regs[0][REG_DMP_INT_STATUS & 0x7F] |= (BIT_MSG_DMP_INT_0 >> 8);
+}
+
+/* Run the DMP up to now */
+static void dmp_update(struct sim_icm20948 * d, uint64_t now_ns)
+{
+	if(!dmp_enabled(d)) {
+		d->running = 0;
+		return;
+	}
+	if(!d->running) {
+		d->running = 1;
+		d->next_tick_ns = now_ns + dmp_period_ns(d);
+		/* the body moved meanwhile, or the script starts now */
+		if(rigid)
+			motion_advance(d, now_ns);
+		else
+			d->motion_ns = now_ns;
+		return;
+	}
+	while(d->next_tick_ns <= now_ns) {
+		dmp_tick(d, d->next_tick_ns);
+		d->next_tick_ns += dmp_period_ns(d);
+	}
+}
+
+/*
+ * AK09916 behind the auxiliary I2C master, transactions of the enabled
+ * slaves are run once when I2C_MST_EN is set
+ */
+static void aux_run(struct sim_icm20948 * d)
+{
+	unsigned ext = 0;
+	int i;
+
+	for(i = 0; i < 4; ++i) {
+		const uint8_t ctrl = d->regs[3][SLV_CTRL(i)];
+		const uint8_t addr = d->regs[3][SLV_ADDR(i)];
+		const uint8_t reg  = d->regs[3][SLV_REG(i)];
+		unsigned len = ctrl & 0x0F, k;
+
+		if(!(ctrl & INV_MPU_BIT_SLV_EN) || (addr & 0x7F) != AK_ADDR)
+			continue;
+		if(addr & INV_MPU_BIT_I2C_READ) {
+			for(k = 0; k < len && ext < EXT_SLV_SENS_SIZE; ++k, ++ext)
+				d->regs[0][EXT_SLV_SENS_DATA + ext] = d->ak[(reg + k) % AK_REGS];
+		} else if(reg < AK_REGS) {
+			d->ak[reg] = d->regs[3][SLV_DO(i)];
+			if(reg == AK_CNTL3 && (d->ak[reg] & 1))
+				d->ak[AK_CNTL2] = 0, d->ak[AK_CNTL3] = 0;
+		}
+	}
+}
+
+static void ak_reset(struct sim_icm20948 * d)
+{
+	memset(d->ak, 0, sizeof(d->ak));
+	d->ak[AK_WIA1] = 0x48;
+	d->ak[AK_WIA2] = 0x09;
+	d->ak[AK_ST1]  = 0x01;	/* data always ready */
+}
+
+static void device_reset(struct sim_icm20948 * d)
+{
+	memset(d->regs, 0, sizeof(d->regs));
+	d->regs[0][REG_WHO_AM_I & 0x7F] = WHO_AM_I_VALUE;
+	d->regs[0][REG_PWR_MGMT_1 & 0x7F] = BIT_SLEEP | 0x01;
+	d->bank = 0;
+	d->reg_ptr = 0;
+	d->mem_bank = 0;
+	d->mem_addr = 0;
+	d->running = 0;
+	memset(d->odr_cnt, 0, sizeof(d->odr_cnt));
+	fifo_reset(d);
+}
+
+/*
+ * Register accesses
+ */
+static void reg_write(struct sim_icm20948 * d, uint8_t reg, uint8_t v, uint64_t now_ns)
+{
+	uint8_t * const r = &d->regs[d->bank][reg];
+	const uint8_t old = *r;
+
+	if(reg == (REG_BANK_SEL & 0x7F)) {
+		d->bank = (v >> 4) & 3;
+		return;
+	}
+	if(d->bank != 0) {
+		*r = v;
+		return;
+	}
+
+	switch(reg) {
+	case REG_WHO_AM_I & 0x7F:
+	case REG_INT_STATUS & 0x7F:
+	case REG_DMP_INT_STATUS & 0x7F:
+	case REG_INT_STATUS_2 & 0x7F:
+	case REG_FIFO_COUNT_H & 0x7F:
+	case (REG_FIFO_COUNT_H & 0x7F) + 1:
+	case REG_FIFO_R_W & 0x7F:
+		break;
+	case REG_PWR_MGMT_1 & 0x7F:
+		if(v & BIT_H_RESET)
+			device_reset(d);
+		else
+			*r = v;
+		break;
+	case REG_USER_CTRL & 0x7F:
+		*r = v;
+		if((v & BIT_I2C_MST_EN) && !(old & BIT_I2C_MST_EN))
+			aux_run(d);
+		dmp_update(d, now_ns);
+		break;
+	case REG_FIFO_RST & 0x7F:
+		*r = v;
+		if(v & 0x1F) {
+			fifo_reset(d);
+			memset(d->odr_cnt, 0, sizeof(d->odr_cnt));
+		}
+		break;
+	case REG_MEM_START_ADDR & 0x7F:
+		d->mem_addr = v;
+		break;
+	case REG_MEM_BANK_SEL & 0x7F:
+		d->mem_bank = v;
+		break;
+	case REG_MEM_R_W & 0x7F:
+		d->mem[(d->mem_bank << 8) | d->mem_addr] = v;
+		d->mem_addr++;
+		break;
+	default:
+		*r = v;
+		break;
+	}
+}
+
+static uint8_t reg_read(struct sim_icm20948 * d, uint8_t reg)
+{
+	uint8_t * const r = &d->regs[d->bank][reg];
+	uint8_t v;
+
+	if(reg == (REG_BANK_SEL & 0x7F))
+		return (uint8_t)(d->bank << 4);
+	if(d->bank != 0)
+		return *r;
+
+	switch(reg) {
+	case REG_INT_STATUS & 0x7F:
+	case REG_DMP_INT_STATUS & 0x7F:
+	case REG_INT_STATUS_2 & 0x7F:
+		/* cleared on read */
+		v = *r;
+		*r = 0;
+		return v;
+	case REG_FIFO_COUNT_H & 0x7F:
+		d->fifo_count_latch = d->fifo_count;
+		return (uint8_t)(d->fifo_count_latch >> 8);
+	case (REG_FIFO_COUNT_H & 0x7F) + 1:
+		return (uint8_t)d->fifo_count_latch;
+	case REG_FIFO_R_W & 0x7F:
+		return fifo_pop(d);
+	case REG_MEM_START_ADDR & 0x7F:
+		return d->mem_addr;
+	case REG_MEM_BANK_SEL & 0x7F:
+		return d->mem_bank;
+	case REG_MEM_R_W & 0x7F:
+		return d->mem[(d->mem_bank << 8) | d->mem_addr++];
+	default:
+		return *r;
+	}
+}
+
+/* FIFO_R_W and MEM_R_W stay in place during bursts */
+static uint8_t next_reg(const struct sim_icm20948 * d, uint8_t reg)
+{
+	if(d->bank == 0 && (reg == (REG_FIFO_R_W & 0x7F) || reg == (REG_MEM_R_W & 0x7F)))
+		return reg;
+	return (reg + 1) & 0x7F;
+}
+
+void sim_icm20948_init(void)
+{
+	device_count = 0;
+	rigid = 0;
+	motion = default_motion;
+	motion_count = sizeof(default_motion)/sizeof(default_motion[0]);
+}
+
+int sim_icm20948_add(int mux, int channel, uint8_t addr)
+{
+	struct sim_icm20948 * d;
+
+	if(device_count >= SIM_ICM20948_MAX)
+		return -1;
+
+	d = &devices[device_count];
+	memset(d, 0, sizeof(*d));
+	d->stats.mux = mux;
+	d->stats.channel = channel;
+	d->stats.addr = addr;
+	device_reset(d);
+	ak_reset(d);
+	motion_reset(d, device_count);
+	d->motion_scale = 1.0f;
+	d->stats.fifo_bytes_lost = 0;
+
+	return device_count++;
+}
+
+void sim_icm20948_set_motion(const struct sim_motion_seg * script, int count)
+{
+	int i;
+
+	motion = script;
+	motion_count = count;
+	for(i = 0; i < device_count; ++i)
+		motion_reset(&devices[i], i);
+}
+
+int sim_icm20948_load_motion(const char * path)
+{
+	FILE * f = fopen(path, "r");
+	char line[128];
+	int count = 0;
+
+	if(!f)
+		return -1;
+	while(count < MOTION_MAX_SEGS && fgets(line, sizeof(line), f)) {
+		struct sim_motion_seg * seg = &motion_file[count];
+		if(line[0] == '#')
+			continue;
+		if(sscanf(line, "%u %f %f %f", &seg->duration_ms, &seg->rate_dps[0], &seg->rate_dps[1], &seg->rate_dps[2]) == 4
+				&& seg->duration_ms > 0)
+			count++;
+	}
+	fclose(f);
+	if(count == 0)
+		return -1;
+	sim_icm20948_set_motion(motion_file, count);
+	return count;
+}
+
+void sim_icm20948_set_plugged(int idx, int plugged)
+{
+	struct sim_icm20948 * d;
+
+	if(idx < 0 || idx >= device_count)
+		return;
+	d = &devices[idx];
+	if(plugged && d->unplugged) {
+		/* powered again: the DMP image is gone */
+		device_reset(d);
+		ak_reset(d);
+		memset(d->mem, 0, sizeof(d->mem));
+	}
+	d->unplugged = !plugged;
+}
+
+int sim_icm20948_plugged(int idx)
+{
+	return idx >= 0 && idx < device_count && !devices[idx].unplugged;
+}
+
+void sim_icm20948_set_clock(int idx, int32_t ppm)
+{
+	if(idx >= 0 && idx < device_count)
+		devices[idx].clock_ppm = ppm;
+}
+
+void sim_icm20948_set_motion_scale(int idx, float scale)
+{
+	if(idx >= 0 && idx < device_count)
+		devices[idx].motion_scale = scale;
+}
+
+void sim_icm20948_set_rigid(int enable)
+{
+	int i;
+
+	rigid = enable;
+	for(i = 0; i < device_count; ++i)
+		motion_reset(&devices[i], i);
+}
+
+int sim_icm20948_count(void)
+{
+	return device_count;
+}
+
+const struct sim_icm20948_stats * sim_icm20948_get_stats(int idx)
+{
+	return (idx >= 0 && idx < device_count) ? &devices[idx].stats : 0;
+}
+
+void sim_icm20948_clear_stats(void)
+{
+	int i;
+
+	for(i = 0; i < device_count; ++i) {
+		struct sim_icm20948_stats * st = &devices[i].stats;
+		const int mux = st->mux;
+		const int channel = st->channel;
+		const uint8_t addr = st->addr;
+
+		memset(st, 0, sizeof(*st));
+		st->mux = mux;
+		st->channel = channel;
+		st->addr = addr;
+		st->fifo_peak = devices[i].fifo_count;
+	}
+}
+
+void sim_icm20948_write(int idx, int reg, const uint8_t * data, unsigned len, uint64_t now_ns)
+{
+	struct sim_icm20948 * d = &devices[idx];
+	unsigned i;
+
+	dmp_update(d, now_ns);
+	if(reg >= 0)
+		d->reg_ptr = (uint8_t)(reg & 0x7F);
+	for(i = 0; i < len; ++i) {
+		reg_write(d, d->reg_ptr, data[i], now_ns);
+		d->reg_ptr = next_reg(d, d->reg_ptr);
+	}
+}
+
+void sim_icm20948_read(int idx, int reg, uint8_t * data, unsigned len, uint64_t now_ns)
+{
+	struct sim_icm20948 * d = &devices[idx];
+	unsigned i;
+
+	dmp_update(d, now_ns);
+	if(reg >= 0)
+		d->reg_ptr = (uint8_t)(reg & 0x7F);
+	for(i = 0; i < len; ++i) {
+		data[i] = reg_read(d, d->reg_ptr);
+		d->reg_ptr = next_reg(d, d->reg_ptr);
+	}
+}
@@ -0,0 +1,95 @@
+/*
+ * sim_icm20948.h
+ *
+ * Register level model of the ICM-20948 as used by the Invn driver:
+ *  - 4 register banks selected by REG_BANK_SEL, burst accesses auto-increment
+ *    the register address except on FIFO_R_W and MEM_R_W,
+ *  - DMP memory accessed through MEM_BANK_SEL, MEM_START_ADDR and MEM_R_W,
+ *  - 1 kB FIFO in stream mode (oldest bytes lost on overflow),
+ *  - the DMP, which pushes one FIFO packet per engine tick (gyro rate) with
+ *    the outputs enabled in DATA_OUT_CTL1/2 at their ODR divider,
+ *  - an AK09916 behind the auxiliary I2C master, enough for compass setup.
+ *
+ * DMP outputs follow a scripted motion: a loop of segments of constant
+ * angular rate, integrated from the time the DMP is enabled. Each device
+ * ticks on its own clock, which can be given an error.
+ */
+
+
+#ifndef SIM_ICM20948_H_
+#define SIM_ICM20948_H_
+
+#include <stdint.h>
+
+#define SIM_ICM20948_MAX		64
+
+struct sim_motion_seg {
+	uint32_t duration_ms;
+	float    rate_dps[3];	/* angular rate in world frame */
+};
+
+struct sim_icm20948_stats {
+	int      mux;				/* mux index of sim_bus.h, -1 on TWI0 */
+	int      channel;			/* mux channel */
+	uint8_t  addr;				/* I2C address */
+	uint32_t dmp_ticks;			/* engine ticks while the DMP was running */
+	uint32_t packets;			/* packets pushed in the FIFO */
+	uint64_t first_packet_ns;	/* times of the first and last packets */
+	uint64_t last_packet_ns;
+	uint32_t fifo_bytes_in;
+	uint32_t fifo_bytes_out;	/* bytes read out of the FIFO */
+	uint32_t fifo_bytes_lost;	/* bytes overwritten on overflow or discarded by a FIFO reset */
+	uint16_t fifo_peak;			/* highest FIFO level seen */
+};
+
+/** @brief Remove every device and restore the default motion script
+ */
+void sim_icm20948_init(void);
+
+/** @brief Add a device in power-on state
+ *  @return device index, negative value if the table is full
+ */
+int sim_icm20948_add(int mux, int channel, uint8_t addr);
+
+/** @brief Replace the motion script, script is not copied
+ */
+void sim_icm20948_set_motion(const struct sim_motion_seg * script, int count);
+
+/** @brief Load a motion script, one "<duration ms> <x dps> <y dps> <z dps>" segment per line
+ *  @return number of segments, negative value on error
+ */
+int sim_icm20948_load_motion(const char * path);
+
+/** @brief Error of the sample clock of a device, the DMP ticks that much slower
+ */
+void sim_icm20948_set_clock(int idx, int32_t ppm);
+
+/** @brief Scale of the angular rates of the script for a device, 0 keeps it still
+ */
+void sim_icm20948_set_motion_scale(int idx, float scale);
+
+/** @brief Every device on one rigid body: the same motion, the script
+ *  running from time 0 whenever the DMP starts. The outputs of all devices
+ *  then match at any given time, which shows how well they are synchronized.
+ */
+void sim_icm20948_set_rigid(int enable);
+
+/** @brief Take a device off the bus or put it back in power-on state
+ */
+void sim_icm20948_set_plugged(int idx, int plugged);
+int sim_icm20948_plugged(int idx);
+
+int sim_icm20948_count(void);
+const struct sim_icm20948_stats * sim_icm20948_get_stats(int idx);
+void sim_icm20948_clear_stats(void);
+
+/*
+ * Bus side, see sim_bus.c
+ * Devices are looked up from their stats: mux, channel and address. reg is
+ * the register address sent first in the transfer, negative to go on from
+ * the current one.
+ */
+void sim_icm20948_write(int idx, int reg, const uint8_t * data, unsigned len, uint64_t now_ns);
+void sim_icm20948_read(int idx, int reg, uint8_t * data, unsigned len, uint64_t now_ns);
+
+#endif /* SIM_ICM20948_H_ */
@@ -0,0 +1,460 @@
+/*
+ * sim_main.c
+ *
+ * Runs the firmware acquisition (run_icm20948.c) against the simulated bus
+ * and reports bus, FIFO and USB counters.
+ *
+ *   sim_icm20948 [-n imus] [-x mux[:parent mux:channel]]... [-i [mux:]channel:addr]...
+ *                [-t ms] [-b bus hz] [-p rv period us] [-f output format] [-s stats period ms]
+ *                [-c cycle period us, 0 for the ODR] [-m motion file] [-o cdc output file]
+ *                [-e ms the host takes to enable CDC] [-u imu:unplug ms[:plug ms]]...
+ *                [-d clock spread ppm] [-r] [-a odr plan frame us]
+ *                [-w imu:motion scale]... [-g fastest us:slowest us]
+ *
+ * Muxes are given by address, -x adds one on TWI0 or behind a channel of
+ * another, a mux named by -i or -n that was not added goes on TWI0.
+ * By default -i puts the IMU behind 0x70. -n puts one IMU at 0x69 on each
+ * channel of 0x70, then one at 0x68, then goes on with 0x71 and so on: by
+ * default 8 IMUs, one on each channel of 0x70.
+ *
+ * -u takes an IMU off the bus at a time of the run, and puts it back in
+ * power-on state later when a second time is given.
+ *
+ * -d gives the sample clock of each IMU an error from -ppm to +ppm, -r puts
+ * every IMU on one rigid body so their outputs only differ by when they were
+ * sampled. With -f 4 the clocks tracked by frame_sync.h are printed.
+ *
+ * -w scales the motion of an IMU, 0 keeps it still. -g adapts the period of
+ * the rotation vectors to the motion (see odr_adapt.h) between the bounds,
+ * 0:0 for those of the DMP.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "Invn/Devices/SensorTypes.h"
+
+#include "host_cmd.h"
+#include "prof_zone.h"
+#include "lat_trace.h"
+#include "acq_cycle.h"
+#include "fifo_watch.h"
+#include "bringup.h"
+#include "startup.h"
+#include "hotplug.h"
+#include "frame_sync.h"
+#include "odr_adapt.h"
+#include "run_icm20948.h"
+
+#include "sim_bus.h"
+#include "sim_cdc.h"
+#include "sim_icm20948.h"
+
+#define SIM_DEFAULT_IMUS		8
+#define SIM_DEFAULT_ADDR		0x69
+#define SIM_DEFAULT_ADDR2		0x68
+#define SIM_DEFAULT_TIME_MS		1000
+/* Time a sweep costs when no IMU is there to keep the bus busy */
+#define SIM_IDLE_SWEEP_NS		10000
+/* Plug and unplug events of -u */
+#define SIM_PLUG_EVENTS			16
+
+static struct {
+	int imu;
+	int plugged;
+	uint64_t ns;	/* from the start of the run */
+} plug_events[SIM_PLUG_EVENTS];
+static int plug_event_count;
+/* Motion scale of each IMU given by -w, negative when not given */
+static float motion_scales[SIM_ICM20948_MAX];
+
+static void usage(const char * name)
+{
+	fprintf(stderr, "usage: %s [-n imus] [-x mux[:parent mux:channel]]... [-i [mux:]channel:addr]...\n"
+			"       [-t ms] [-b bus hz] [-p rv period us] [-f output format] [-s stats period ms]\n"
+			"       [-c cycle period us, 0 for the ODR] [-m motion file] [-o cdc output file]\n"
+			"       [-e ms the host takes to enable CDC] [-u imu:unplug ms[:plug ms]]...\n"
+			"       [-d clock spread ppm] [-r] [-a odr plan frame us]\n"
+			"       [-w imu:motion scale]... [-g fastest us:slowest us]\n", name);
+	exit(2);
+}
+
+/* Index of the mux at addr, added on TWI0 if there is none yet */
+static int mux_at(unsigned addr)
+{
+	const int mux = sim_bus_find_mux((uint8_t)addr);
+
+	return (mux >= 0) ? mux : sim_bus_add_mux((uint8_t)addr, -1, 0);
+}
+
+static void print_bus(const char * phase, uint64_t ns, uint32_t sweeps)
+{
+	const struct sim_bus_stats * bus = sim_bus_get_stats();
+
+	printf("%s: %.1f ms", phase, ns / 1e6);
+	if(sweeps)
+		printf(", %lu sweeps", (unsigned long)sweeps);
+	printf(", bus busy %.1f %%, %lu transactions (%lu mux), %lu bytes (%lu read, %lu written), %lu nacks, %lu conflicts, %lu broadcasts\n",
+			ns ? 100.0 * bus->busy_ns / ns : 0.0,
+			(unsigned long)bus->transactions, (unsigned long)bus->mux_transactions,
+			(unsigned long)bus->bytes, (unsigned long)bus->read_bytes, (unsigned long)bus->write_bytes,
+			(unsigned long)bus->nacks, (unsigned long)bus->conflicts, (unsigned long)bus->broadcasts);
+}
+
+static void print_boot(void)
+{
+	static const char * const names[BRINGUP_STAGE_COUNT] = { "probe", "setup", "load", "start" };
+	const struct bringup_stats * st = bringup_get();
+	int s;
+
+	printf("boot: %.1f ms, %u ready, %u failed, waits %.1f ms of which %.1f ms on other IMUs\n",
+			st->total_us / 1e3, st->ready, st->failed, st->wait_us / 1e3, st->lent_us / 1e3);
+	for(s = 0; s < BRINGUP_STAGE_COUNT; ++s) {
+		printf("  %-6s %10.1f ms, longest IMU %8.1f ms", names[s], st->stage_us[s] / 1e3, st->stage_max_us[s] / 1e3);
+		if(st->grouped[s])
+			printf(", %u IMUs in groups %8.1f ms", st->grouped[s], st->group_us[s] / 1e3);
+		printf("\n");
+	}
+}
+
+static void print_startup(void)
+{
+	printf("startup: usb %.1f ms, discovery %.1f ms, bring-up %.1f ms, first frame %.1f ms\n",
+			startup_time_us(STARTUP_PHASE_USB) / 1e3, startup_time_us(STARTUP_PHASE_DISCOVERY) / 1e3,
+			startup_time_us(STARTUP_PHASE_BRINGUP) / 1e3, startup_time_us(STARTUP_PHASE_FRAME) / 1e3);
+}
+
+/* Unplug (plugged 0) or plug an IMU back ms into the run, see -u */
+static void plug_event_add(int imu, int plugged, uint32_t ms)
+{
+	if(plug_event_count >= SIM_PLUG_EVENTS)
+		return;
+	plug_events[plug_event_count].imu = imu;
+	plug_events[plug_event_count].plugged = plugged;
+	plug_events[plug_event_count].ns = (uint64_t)ms * 1000000;
+	plug_event_count++;
+}
+
+/* Events due at ns from the start of the run, each applied once */
+static void plug_events_run(uint64_t ns)
+{
+	int i;
+
+	for(i = 0; i < plug_event_count; ++i) {
+		if(plug_events[i].imu < 0 || plug_events[i].ns > ns)
+			continue;
+		sim_icm20948_set_plugged(plug_events[i].imu, plug_events[i].plugged);
+		printf("%.3f s: IMU %d %s\n", ns / 1e9, plug_events[i].imu, plug_events[i].plugged ? "plugged" : "unplugged");
+		plug_events[i].imu = -1;
+	}
+}
+
+/* Zones in simulated time, so they show where the bus time goes */
+static void print_zones(uint64_t ns)
+{
+	const double us_per_cycle = 1e6 / SIM_CPU_HZ;
+	int z;
+
+	printf("zone          count    min us    max us   mean us  share\n");
+	for(z = 0; z < PROF_ZONE_COUNT; ++z) {
+		const struct prof_zone_stats * st = prof_zone_get(z);
+
+		if(!st->count)
+			continue;
+		printf("%-12s %6lu %9.1f %9.1f %9.1f %5.1f %%\n", prof_zone_name(z), (unsigned long)st->count,
+				st->min * us_per_cycle, st->max * us_per_cycle, (double)st->total / st->count * us_per_cycle,
+				ns ? 100.0 * st->total * us_per_cycle * 1000 / ns : 0.0);
+	}
+}
+
+/* Latency in simulated time, only the bus costs time there */
+static void print_latency(void)
+{
+	int imu, s;
+
+	printf("imu  samples   p50 us   p99 us   max us   fifo mean/max   format mean/max    usb mean/max\n");
+	for(imu = 0; imu < LAT_TRACE_IMUS; ++imu) {
+		const struct lat_trace_stats * st = lat_trace_get(imu);
+
+		if(!st->count)
+			continue;
+		printf("%3d  %7lu  %7lu  %7lu  %7lu", imu, (unsigned long)st->count,
+				(unsigned long)lat_trace_percentile(imu, 50), (unsigned long)lat_trace_percentile(imu, 99),
+				(unsigned long)st->max);
+		for(s = 0; s < LAT_TRACE_STAGE_COUNT; ++s)
+			printf("  %6lu/%-7lu", (unsigned long)(st->stage[s].total / st->count), (unsigned long)st->stage[s].max);
+		printf("\n");
+	}
+}
+
+/* Fill rates as the firmware sees them */
+static void print_fifo_watch(void)
+{
+	int imu;
+
+	printf("imu  configured B/s  observed B/s  near  overflows\n");
+	for(imu = 0; imu < FIFO_WATCH_IMUS; ++imu) {
+		const struct fifo_watch_imu * w = fifo_watch_get(imu);
+
+		if(!w->configured_bps && !w->observed_bps)
+			continue;
+		printf("%3d  %14lu  %12lu  %4lu  %9lu\n", imu, (unsigned long)w->configured_bps,
+				(unsigned long)w->observed_bps, (unsigned long)w->near_cnt, (unsigned long)w->overflow_cnt);
+	}
+}
+
+/* Period each IMU ends at after its motion */
+static void print_adapt(void)
+{
+	int imu;
+
+	printf("imu  period us  changes  turn mdeg/sample\n");
+	for(imu = 0; imu < sim_icm20948_count() && imu < ODR_ADAPT_IMUS; ++imu) {
+		const struct odr_adapt_imu * a = odr_adapt_get(imu);
+
+		printf("%3d  %9lu  %7lu  %16u\n", imu, (unsigned long)a->period_us, (unsigned long)a->changes, a->motion_mdeg);
+	}
+}
+
+/* Sample clocks as frame_sync.h tracks them, against the packets of the run */
+static void print_clocks(void)
+{
+	int imu;
+
+	printf("imu  clock period us  true us  error ppm\n");
+	for(imu = 0; imu < sim_icm20948_count() && imu < FRAME_SYNC_IMUS; ++imu) {
+		const struct frame_sync_clock * c = frame_sync_clock(imu);
+		const struct sim_icm20948_stats * st = sim_icm20948_get_stats(imu);
+		double period, truth;
+
+		if(!c->period_q16 || st->packets < 2)
+			continue;
+		period = c->period_q16 / 65536.0;
+		truth = (st->last_packet_ns - st->first_packet_ns) / 1e3 / (st->packets - 1);
+		printf("%3d  %15.3f  %7.3f  %9.0f\n", imu, period, truth, (period - truth) / truth * 1e6);
+	}
+}
+
+static void print_cycle(void)
+{
+	const struct acq_cycle_stats * st = acq_cycle_get();
+	const uint32_t n = st->cycles ? st->cycles : 1;
+
+	printf("cycle: %lu us, %lu cycles, %lu overruns, %lu missed, jitter mean %lu max %lu us, busy mean %lu max %lu us\n",
+			(unsigned long)acq_cycle_period_us(), (unsigned long)st->cycles, (unsigned long)st->overruns,
+			(unsigned long)st->missed, (unsigned long)(st->jitter_total / n), (unsigned long)st->jitter_max,
+			(unsigned long)(st->busy_total / n), (unsigned long)st->busy_max);
+}
+
+int main(int argc, char * argv[])
+{
+	int imus = -1, format = -1, cycle = 0, rigid = 0, opt, i;
+	int32_t spread_ppm = 0;
+	uint32_t time_ms = SIM_DEFAULT_TIME_MS, speed = 0, period_us = 0, stats_ms = 0, cycle_us = 0, sweeps = 0, enum_ms = 0;
+	uint32_t plan_us = 0, adapt_fastest_us = 0, adapt_slowest_us = 0;
+	int adapt = 0;
+	const char * motion_path = 0;
+	FILE * out = 0;
+	uint64_t start, end, reconf_ns;
+	uint32_t reconf_bytes;
+
+	sim_icm20948_init();
+	for(i = 0; i < SIM_ICM20948_MAX; ++i)
+		motion_scales[i] = -1.0f;
+
+	while((opt = getopt(argc, argv, "n:x:i:t:b:p:f:s:c:m:o:e:u:d:ra:w:g:")) != -1) {
+		switch(opt) {
+		case 'n':
+			imus = atoi(optarg);
+			break;
+		case 'x': {
+			unsigned addr, parent, ch;
+			const int n = sscanf(optarg, "%i:%i:%u", &addr, &parent, &ch);
+			if(n == 1) {
+				if(sim_bus_find_mux((uint8_t)addr) >= 0 || mux_at(addr) < 0)
+					usage(argv[0]);
+			} else if(n != 3 || sim_bus_find_mux((uint8_t)parent) < 0
+					|| sim_bus_add_mux((uint8_t)addr, sim_bus_find_mux((uint8_t)parent), (int)ch) < 0) {
+				usage(argv[0]);
+			}
+			break;
+		}
+		case 'i': {
+			unsigned mux = SIM_BUS_MUX_ADDR, ch, addr;
+			if(sscanf(optarg, "%i:%u:%i", &mux, &ch, &addr) != 3) {
+				mux = SIM_BUS_MUX_ADDR;
+				if(sscanf(optarg, "%u:%i", &ch, &addr) != 2)
+					usage(argv[0]);
+			}
+			if(ch >= SIM_BUS_MUX_CHANNELS || mux_at(mux) < 0 || sim_icm20948_add(mux_at(mux), ch, (uint8_t)addr) < 0)
+				usage(argv[0]);
+			break;
+		}
+		case 't':
+			time_ms = strtoul(optarg, 0, 0);
+			break;
+		case 'b':
+			speed = strtoul(optarg, 0, 0);
+			break;
+		case 'p':
+			period_us = strtoul(optarg, 0, 0);
+			break;
+		case 'f':
+			format = atoi(optarg);
+			break;
+		case 's':
+			stats_ms = strtoul(optarg, 0, 0);
+			break;
+		case 'c':
+			cycle = 1;
+			cycle_us = strtoul(optarg, 0, 0);
+			break;
+		case 'm':
+			motion_path = optarg;
+			break;
+		case 'e':
+			enum_ms = strtoul(optarg, 0, 0);
+			break;
+		case 'u': {
+			unsigned off_ms, on_ms;
+			const int n = sscanf(optarg, "%i:%u:%u", &i, &off_ms, &on_ms);
+			if(n < 2 || i < 0 || plug_event_count + n - 1 > SIM_PLUG_EVENTS)
+				usage(argv[0]);
+			plug_event_add(i, 0, off_ms);
+			if(n == 3)
+				plug_event_add(i, 1, on_ms);
+			break;
+		}
+		case 'd':
+			spread_ppm = atoi(optarg);
+			break;
+		case 'r':
+			rigid = 1;
+			break;
+		case 'a':
+			plan_us = strtoul(optarg, 0, 0);
+			break;
+		case 'w': {
+			float scale;
+			if(sscanf(optarg, "%i:%f", &i, &scale) != 2 || i < 0 || i >= SIM_ICM20948_MAX || scale < 0.0f)
+				usage(argv[0]);
+			motion_scales[i] = scale;
+			break;
+		}
+		case 'g':
+			adapt = 1;
+			if(sscanf(optarg, "%u:%u", &adapt_fastest_us, &adapt_slowest_us) != 2)
+				usage(argv[0]);
+			break;
+		case 'o':
+			out = fopen(optarg, "wb");
+			if(!out) {
+				perror(optarg);
+				return 1;
+			}
+			break;
+		default:
+			usage(argv[0]);
+		}
+	}
+
+	if(imus < 0 && sim_icm20948_count() == 0)
+		imus = SIM_DEFAULT_IMUS;
+	for(i = 0; i < imus; ++i) {
+		const int per_mux = 2 * SIM_BUS_MUX_CHANNELS;
+		const int mux = mux_at(SIM_BUS_MUX_ADDR + i / per_mux);
+		const uint8_t addr = (i % per_mux < SIM_BUS_MUX_CHANNELS) ? SIM_DEFAULT_ADDR : SIM_DEFAULT_ADDR2;
+
+		if(mux < 0 || sim_icm20948_add(mux, i % SIM_BUS_MUX_CHANNELS, addr) < 0)
+			usage(argv[0]);
+	}
+	if(motion_path && sim_icm20948_load_motion(motion_path) < 0) {
+		fprintf(stderr, "bad motion file %s\n", motion_path);
+		return 1;
+	}
+	/* spread over the range, not in the order of the sweep */
+	for(i = 0; i < sim_icm20948_count(); ++i)
+		sim_icm20948_set_clock(i, spread_ppm * ((i * 7) % 9 - 4) / 4);
+	sim_icm20948_set_rigid(rigid);
+	for(i = 0; i < sim_icm20948_count(); ++i) {
+		if(motion_scales[i] >= 0.0f)
+			sim_icm20948_set_motion_scale(i, motion_scales[i]);
+	}
+
+	sim_bus_init(speed);
+	sim_cdc_init(out, enum_ms);
+	startup_init();
+
+	run_icm20948_setup();
+	if(format >= 0 && run_icm20948_set_output_format(format) != 0) {
+		fprintf(stderr, "bad output format %d\n", format);
+		return 1;
+	}
+	/* the host commands that set every IMU again */
+	start = sim_bus_time_ns();
+	reconf_bytes = sim_bus_get_stats()->bytes;
+	if(period_us && run_icm20948_set_sensor_period(HOST_CMD_ALL_IMUS, INV_SENSOR_TYPE_ROTATION_VECTOR, period_us) != 0)
+		fprintf(stderr, "cannot set period to %lu us\n", (unsigned long)period_us);
+	if(plan_us && run_icm20948_plan_odr(plan_us, speed, 0) != 0)
+		fprintf(stderr, "ODR plan of %lu us rejected\n", (unsigned long)plan_us);
+	if(adapt && run_icm20948_set_adapt(1, adapt_fastest_us, adapt_slowest_us) != 0)
+		fprintf(stderr, "cannot adapt between %lu and %lu us\n", (unsigned long)adapt_fastest_us, (unsigned long)adapt_slowest_us);
+	reconf_ns = sim_bus_time_ns() - start;
+	reconf_bytes = sim_bus_get_stats()->bytes - reconf_bytes;
+	if(stats_ms)
+		run_icm20948_set_stats_period((uint16_t)stats_ms);
+	if(cycle && run_icm20948_set_cycle(1, cycle_us) != 0) {
+		fprintf(stderr, "bad cycle period %lu us\n", (unsigned long)cycle_us);
+		return 1;
+	}
+	print_bus("setup", sim_bus_time_ns(), 0);
+	print_boot();
+	if(period_us || plan_us || adapt)
+		printf("reconfigure: %.1f ms, %lu bytes\n", reconf_ns / 1e6, (unsigned long)reconf_bytes);
+
+	sim_bus_clear_stats();
+	sim_cdc_clear_stats();
+	sim_icm20948_clear_stats();
+	prof_zone_init();
+	lat_trace_init();
+	start = sim_bus_time_ns();
+	end = start + (uint64_t)time_ms * 1000000;
+	while(sim_bus_time_ns() < end) {
+		const uint64_t t = sim_bus_time_ns();
+		plug_events_run(t - start);
+		run_icm20948_sweep();
+		if(sim_bus_time_ns() == t)
+			sim_bus_wait_ns(SIM_IDLE_SWEEP_NS);
+		sweeps++;
+	}
+	print_bus("run", sim_bus_time_ns() - start, sweeps);
+	print_startup();
+	if(plug_event_count)
+		printf("hotplug: %lu topology changes\n", (unsigned long)hotplug_generation());
+
+	printf("usb: %lu bytes in %lu writes\n",
+			(unsigned long)sim_cdc_get_stats()->tx_bytes, (unsigned long)sim_cdc_get_stats()->writes);
+	printf("dev   mux  ch  addr  dmp ticks  packets  period us  fifo in  fifo out  lost  peak\n");
+	for(i = 0; i < sim_icm20948_count(); ++i) {
+		const struct sim_icm20948_stats * st = sim_icm20948_get_stats(i);
+		printf("%3d  0x%02x  %2d  0x%02x  %9lu  %7lu  %9.1f  %7lu  %8lu  %4lu  %4u\n", i, sim_bus_mux_addr(st->mux), st->channel, st->addr,
+				(unsigned long)st->dmp_ticks, (unsigned long)st->packets,
+				(st->packets > 1) ? (st->last_packet_ns - st->first_packet_ns) / 1e3 / (st->packets - 1) : 0.0,
+				(unsigned long)st->fifo_bytes_in, (unsigned long)st->fifo_bytes_out,
+				(unsigned long)st->fifo_bytes_lost, st->fifo_peak);
+	}
+	print_zones(sim_bus_time_ns() - start);
+	print_latency();
+	print_fifo_watch();
+	if(acq_cycle_period_us())
+		print_cycle();
+	if(format == OUTPUT_FORMAT_SKELETON)
+		print_clocks();
+	if(adapt)
+		print_adapt();
+
+	if(out)
+		fclose(out);
+	return 0;
+}
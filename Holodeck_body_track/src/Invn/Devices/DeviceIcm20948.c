@@ -424,6 +424,16 @@ void inv_device_icm20948_init_aux_compass(inv_device_icm20948_t * self,
 			(enum inv_icm20948_compass_id)aux_compass_id, aux_compass_addr);
 }
 
+void inv_device_icm20948_set_quat_q30_only(inv_device_icm20948_t * self, inv_bool_t enable)
+{
+	self->icm20948_states.quat_q30_only = enable ? 1 : 0;
+}
+
+void inv_device_icm20948_set_quat_raw(inv_device_icm20948_t * self, inv_bool_t enable)
+{
+	self->icm20948_states.quat_raw = enable ? 1 : 0;
+}
+
 int inv_device_icm20948_set_sensor_config(void * context, int sensor, int setting,
 		const void * value, unsigned size)
 {
@@ -524,11 +534,16 @@ static inv_bool_t build_sensor_event_data(inv_device_icm20948_t * self,
 	case INV_SENSOR_TYPE_GEOMAG_ROTATION_VECTOR:
 	case INV_SENSOR_TYPE_ROTATION_VECTOR:
 		memcpy(&(event->data.quaternion.accuracy), arg, sizeof(event->data.quaternion.accuracy));
-		memcpy(event->data.quaternion.quat, data, sizeof(event->data.quaternion.quat));
-		break;
+		/* no break */
 	case INV_SENSOR_TYPE_GAME_ROTATION_VECTOR:
-		memcpy(event->data.quaternion.quat, data, sizeof(event->data.quaternion.quat));
+	{
+		const struct inv_icm20948_quat_sample * sample = (const struct inv_icm20948_quat_sample *)data;
+
+		memcpy(event->data.quaternion.quat, sample->quat, sizeof(event->data.quaternion.quat));
+		memcpy(event->data.quaternion.quat_q30, sample->quat_q30, sizeof(event->data.quaternion.quat_q30));
+		event->data.quaternion.accuracy_q29 = sample->accuracy_q29;
 		break;
+	}
 	case INV_SENSOR_TYPE_BAC:
 		memcpy(&(event->data.bac.event), data, sizeof(event->data.bac.event));
 		break;
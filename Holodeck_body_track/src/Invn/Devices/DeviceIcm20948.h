@@ -158,6 +158,16 @@ int INV_EXPORT inv_device_icm20948_read_mems_register(void * context, int sensor
 void INV_EXPORT inv_device_icm20948_init_aux_compass(inv_device_icm20948_t * self,
 	int aux_compass_id, uint8_t aux_compass_addr);
 
+/** @brief Deliver the rotation vectors in Q30 only (quat_q30 and accuracy_q29 of the event),
+ *         leaving the float fields to 0, so no float conversion runs on the acquisition path
+ */
+void INV_EXPORT inv_device_icm20948_set_quat_q30_only(inv_device_icm20948_t * self, inv_bool_t enable);
+
+/** @brief Deliver the rotation vectors as read from the DMP: quat_q30 holds 0, x, y, z in chip
+ *         frame, the scalar part and the mounting matrix are left to the caller (quat_batch.h)
+ */
+void INV_EXPORT inv_device_icm20948_set_quat_raw(inv_device_icm20948_t * self, inv_bool_t enable);
+
 int INV_EXPORT inv_device_icm20948_set_sensor_config(void * context, int sensor, int setting,
 	const void * value, unsigned size);
 
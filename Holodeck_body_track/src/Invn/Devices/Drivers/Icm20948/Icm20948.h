@@ -91,8 +91,10 @@ typedef struct inv_icm20948 {
 		uint8_t accel_fullscale;
 		uint8_t lp_en_support:1;
 		uint8_t firmware_loaded:1;
+		uint8_t secondary_set:1; /* I2C master set up, see inv_icm20948_set_secondary() */
 		uint8_t serial_interface;
 		uint8_t timebase_correction_pll;
+		long gyro_sf; /* last written to the DMP, per device as each has its own */
 	}base_state;
 	/* secondary device support */
 	struct inv_icm20948_secondary_states {
@@ -125,12 +127,20 @@ typedef struct inv_icm20948 {
 	{
 		int fifoError;
 		unsigned char fifo_overflow;
+		/* health counters, only cleared with the states */
+		uint32_t reset_cnt;			/* dmp_reset_fifo() calls */
+		uint32_t lost_bytes;		/* bytes flushed by the resets or dropped from the SW FIFO */
+		uint32_t decode_error_cnt;	/* bad headers found by check_fifo_decoded_headers() */
+		uint32_t drain_cnt;			/* FIFO reads that returned data */
+		uint32_t drained_bytes;
 	} fifo_info;
 	/* interface mapping */
 	unsigned long sStepCounterToBeSubtracted;
 	unsigned long sOldSteps;
 	/* data converter */
 	long s_quat_chip_to_body[4];
+	uint8_t quat_q30_only;	/* rotation vectors in Q30 only, no float conversion */
+	uint8_t quat_raw;		/* rotation vectors as read from the DMP, converted by the caller */
 	/* base driver */
 	uint8_t sAllowLpEn;
 	uint8_t s_compass_available;
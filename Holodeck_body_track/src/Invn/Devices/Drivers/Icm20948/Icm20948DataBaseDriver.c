@@ -172,13 +172,12 @@ int inv_icm20948_set_dmp_address(struct inv_icm20948 * s)
 int inv_icm20948_set_secondary(struct inv_icm20948 * s)
 {
 	int r = 0;
-	static uint8_t lIsInited = 0;
 
-	if(lIsInited == 0) {
+	if(s->base_state.secondary_set == 0) {
 		r  = inv_icm20948_write_single_mems_reg(s, REG_I2C_MST_CTRL, BIT_I2C_MST_P_NSR);
 		r |= inv_icm20948_write_single_mems_reg(s, REG_I2C_MST_ODR_CONFIG, MIN_MST_ODR_CONFIG);
 
-		lIsInited = 1;
+		s->base_state.secondary_set = 1;
 	}
 	return r;
 }
@@ -454,7 +453,6 @@ uint32_t inv_icm20948_get_odr_in_units(struct inv_icm20948 * s, unsigned short o
 int inv_icm20948_set_gyro_sf(struct inv_icm20948 * s, unsigned char div, int gyro_level)
 {
 	long gyro_sf;
-	static long lLastGyroSf = 0;
 	int result = 0;
 
 	if(s->base_state.timebase_correction_pll == 0)
@@ -482,9 +480,9 @@ int inv_icm20948_set_gyro_sf(struct inv_icm20948 * s, unsigned char div, int gyr
 			gyro_sf = (long)ResultLL;
 	}
 
-	if (gyro_sf != lLastGyroSf) {
+	if (gyro_sf != s->base_state.gyro_sf) {
 		result |= dmp_icm20948_set_gyro_sf(s, gyro_sf);
-		lLastGyroSf = gyro_sf;
+		s->base_state.gyro_sf = gyro_sf;
 	}
 
 	return result;
@@ -114,6 +114,20 @@ void inv_icm20948_convert_rotation_vector_2(struct inv_icm20948 * s, const long
     memcpy(quat4_world, quat_body_to_world, 4*sizeof(long));
 }
 
+/** Convert 3 element fixed point DMP rotation vector to 4 element rotation vector in world frame, without float
+* @param[in] quat 3 element rotation vector from DMP, missing the scalar part. Converts from Chip frame to World frame
+* @param[out] quat4_q30 4 element quaternion w,x,y,z in Q30, w positive
+*/
+void inv_icm20948_convert_rotation_vector_q30(struct inv_icm20948 * s, const long *quat, int32_t *quat4_q30)
+{
+    long quat_body_to_world[4];
+    int i;
+
+    inv_icm20948_convert_rotation_vector_2(s, quat, quat_body_to_world);
+    for (i = 0; i < 4; i++)
+        quat4_q30[i] = (int32_t)((quat_body_to_world[0] >= 0) ? quat_body_to_world[i] : -quat_body_to_world[i]);
+}
+
 /** Convert 4 element rotation vector in world frame to floating point android notation
 * @param[in] quat 4 element rotation vector in World frame
 * @param[out] values in Android format
@@ -17,6 +17,8 @@
 #define INV_ICM20948_DATA_CONVERTER_H__
 
 
+#include <stdint.h>
+
 #ifdef __cplusplus
 extern "C"
 {
@@ -25,6 +27,14 @@ extern "C"
 /* forward declaration */
 struct inv_icm20948;
 
+/** @brief Rotation vector sample handed to the poll handler, w,x,y,z
+*/
+struct inv_icm20948_quat_sample {
+	float quat[4];			/**< unit quaternion, 0 when the driver converts in Q30 only */
+	int32_t quat_q30[4];	/**< same in Q30, w positive */
+	int32_t accuracy_q29;	/**< heading accuracy in Q29, 0 for GRV */
+};
+
 #ifndef M_PI
   #define M_PI 3.14159265358979323846f
 #endif 
@@ -67,6 +77,12 @@ void INV_EXPORT inv_icm20948_convert_rotation_vector(struct inv_icm20948 * s, co
 */
 void INV_EXPORT inv_icm20948_convert_rotation_vector_2(struct inv_icm20948 * s, const long *quat, long *quat4_world);
 
+/** @brief Converts fixed point DMP rotation vector to a world frame quaternion without float
+* @param[in] quat 3 element rotation vector from DMP, missing the scalar part. Converts from Chip frame to World frame
+* @param[out] quat4_q30 4 element quaternion w,x,y,z in Q30, w positive as in the float conversion
+*/
+void INV_EXPORT inv_icm20948_convert_rotation_vector_q30(struct inv_icm20948 * s, const long *quat, int32_t *quat4_q30);
+
 /** @brief Converts 4 element rotation vector in world frame to floating point android notation
 * @param[in] quat4_world 4 element rotation vector in World frame
 * @param[out] values in Android format
@@ -114,6 +114,11 @@ static int dmp_reset_fifo(struct inv_icm20948 * s)
 	unsigned char tries = 0;
 	int result = 0;
     
+	s->fifo_info.reset_cnt++;
+	if (dmp_get_fifo_length(s, &len) == 0)
+		s->fifo_info.lost_bytes += len;
+	len = HARDWARE_FIFO_SIZE;
+
 	while (len != 0 && tries < 6) 
 	{ 
 		s->base_state.user_ctrl &= (~BIT_FIFO_EN);
@@ -212,6 +217,8 @@ static uint_fast16_t dmp_get_fifo_all(struct inv_icm20948 * s, uint_fast16_t len
 		s->fifo_info.fifoError = result;
 		return 0;
 	}
+	s->fifo_info.drain_cnt++;
+	s->fifo_info.drained_bytes += in_fifo;
 	return in_fifo;
 }
 
@@ -383,6 +390,7 @@ static int extract_sample_cnt(struct inv_icm20948 * s, int fifo_size, unsigned s
 		// Decode any error
 		if (check_fifo_decoded_headers(header, header2)) {
 			// in that case, stop processing, we might have overflowed so following bytes are non sense
+			s->fifo_info.decode_error_cnt++;
 			dmp_reset_fifo(s);
 			return -1;
 		}
@@ -426,6 +434,7 @@ int inv_icm20948_fifo_swmirror(struct inv_icm20948 * s, int *fifo_sw_size, unsig
 	return MPU_SUCCESS;
 	
 error:
+	s->fifo_info.lost_bytes += *fifo_sw_size;
 	*fifo_sw_size = 0;
 	return -1;
 	
@@ -507,6 +516,8 @@ int inv_icm20948_dmp_process_fifo(struct inv_icm20948 * s, int *left_in_fifo, un
         
         if (check_fifo_decoded_headers(fd.header, fd.header2)) { 
             // Decode error
+            s->fifo_info.decode_error_cnt++;
+            s->fifo_info.lost_bytes += *left_in_fifo;
             dmp_reset_fifo(s);
             *left_in_fifo = 0;
             return -1;
@@ -539,9 +550,10 @@ int inv_icm20948_dmp_process_fifo(struct inv_icm20948 * s, int *left_in_fifo, un
 
 static void inv_decode_3_32bit_elements(long *out_data, const unsigned char *in_data)
 {
-    out_data[0] = ((long)(0xff & in_data[0]) << 24) | ((long)(0xff & in_data[1]) << 16) | ((long)(0xff & in_data[2]) << 8) | (0xff & in_data[3]);
-    out_data[1] = ((long)(0xff & in_data[4]) << 24) | ((long)(0xff & in_data[5]) << 16) | ((long)(0xff & in_data[6]) << 8) | (0xff & in_data[7]);
-    out_data[2] = ((long)(0xff & in_data[8]) << 24) | ((long)(0xff & in_data[9]) << 16) | ((long)(0xff & in_data[10]) << 8) | (0xff & in_data[11]);
+    /* through int32_t so that the sign is kept where long is 64-bit (host build) */
+    out_data[0] = (int32_t)(((uint32_t)in_data[0] << 24) | ((uint32_t)in_data[1] << 16) | ((uint32_t)in_data[2] << 8) | in_data[3]);
+    out_data[1] = (int32_t)(((uint32_t)in_data[4] << 24) | ((uint32_t)in_data[5] << 16) | ((uint32_t)in_data[6] << 8) | in_data[7]);
+    out_data[2] = (int32_t)(((uint32_t)in_data[8] << 24) | ((uint32_t)in_data[9] << 16) | ((uint32_t)in_data[10] << 8) | in_data[11]);
 }
 static void inv_decode_3_16bit_elements(short *out_data, const unsigned char *in_data)
 {
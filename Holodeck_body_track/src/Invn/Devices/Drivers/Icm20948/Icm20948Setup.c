@@ -33,6 +33,7 @@
 
 #include "Invn/EmbUtils/DataConverter.h"
 #include "Invn/EmbUtils/Message.h"
+#include "prof_zone.h"
 
 #include <assert.h>
 
@@ -113,6 +114,26 @@ static int skip_sensor(struct inv_icm20948 * s, unsigned char androidSensor)
 	return skip_sample;
 }
 
+/* Rotation vector sample from a DMP quaternion, float only when asked for */
+static void quat_sample_convert(struct inv_icm20948 * s, const long * quat, long accuracy_q29, struct inv_icm20948_quat_sample * sample)
+{
+	int i;
+
+	sample->accuracy_q29 = (int32_t)accuracy_q29;
+	if (s->quat_raw) {
+		/* DMP x y z in chip frame, scalar part and mounting left to the caller */
+		sample->quat_q30[0] = 0;
+		for (i = 0; i < 3; i++)
+			sample->quat_q30[i + 1] = (int32_t)quat[i];
+		for (i = 0; i < 4; i++)
+			sample->quat[i] = 0;
+		return;
+	}
+	inv_icm20948_convert_rotation_vector_q30(s, quat, sample->quat_q30);
+	for (i = 0; i < 4; i++)
+		sample->quat[i] = s->quat_q30_only ? 0 : sample->quat_q30[i] * INV_TWO_POWER_NEG_30;
+}
+
 /* Identification related functions */
 int inv_icm20948_get_whoami(struct inv_icm20948 * s, uint8_t * whoami)
 {
@@ -566,12 +587,10 @@ int inv_icm20948_poll_sensor(struct inv_icm20948 * s, void * context,
 	float rv_accuracy = 0;
 	float gmrv_accuracy = 0;
 	float accel_float[3];
-	float grv_float[4];
+	struct inv_icm20948_quat_sample quat_sample;
 	float gyro_float[3];
 	float compass_float[3] = {0};
 	float compass_raw_float[3];
-	float rv_float[4];
-	float gmrv_float[4];
 	uint16_t pickup_state = 0;
 	uint64_t lastIrqTimeUs;
 	
@@ -582,8 +601,13 @@ int inv_icm20948_poll_sensor(struct inv_icm20948 * s, void * context,
 		do {
 			unsigned short total_sample_cnt = 0;
 
+			int rc;
+
 			/* Mirror FIFO contents and stop processing FIFO if an error was detected*/
-			if(inv_icm20948_updateTs(s, &data_left_in_fifo, &total_sample_cnt, &lastIrqTimeUs))
+			PROF_ZONE_BEGIN(PROF_ZONE_FIFO_DRAIN);
+			rc = inv_icm20948_updateTs(s, &data_left_in_fifo, &total_sample_cnt, &lastIrqTimeUs);
+			PROF_ZONE_END(PROF_ZONE_FIFO_DRAIN);
+			if(rc)
 				break;
 			while(total_sample_cnt--) {
 				/* Read FIFO contents and parse it, and stop processing FIFO if an error was detected*/
@@ -727,18 +751,13 @@ int inv_icm20948_poll_sensor(struct inv_icm20948 * s, void * context,
 				/* 6axis AG orientation quaternion sample available from DMP FIFO */
 				if (header & QUAT6_SET) {
 					long gravityQ16[3];
-					float ref_quat[4];
 					/* Read 6 axis quaternion out of DMP FIFO in Q30 */
 					inv_icm20948_dmp_get_6quaternion(long_quat);
 					if(inv_icm20948_ctrl_androidSensor_enabled(s, ANDROID_SENSOR_GAME_ROTATION_VECTOR) && !skip_sensor(s, ANDROID_SENSOR_GAME_ROTATION_VECTOR)) {
-						/* and convert it from Q30 DMP format to Android format only if GRV sensor is enabled */
-						inv_icm20948_convert_rotation_vector(s, long_quat, grv_float);
-						ref_quat[0] = grv_float[3];
-						ref_quat[1] = grv_float[0];
-						ref_quat[2] = grv_float[1];
-						ref_quat[3] = grv_float[2];
+						/* and convert it from Q30 DMP format to world frame only if GRV sensor is enabled */
+						quat_sample_convert(s, long_quat, 0, &quat_sample);
 						s->timestamp[INV_ICM20948_SENSOR_GAME_ROTATION_VECTOR] += s->sensorlist[INV_ICM20948_SENSOR_GAME_ROTATION_VECTOR].odr_applied_us;
-						handler(context, INV_ICM20948_SENSOR_GAME_ROTATION_VECTOR, s->timestamp[INV_ICM20948_SENSOR_GAME_ROTATION_VECTOR], ref_quat, 0);
+						handler(context, INV_ICM20948_SENSOR_GAME_ROTATION_VECTOR, s->timestamp[INV_ICM20948_SENSOR_GAME_ROTATION_VECTOR], &quat_sample, 0);
 					}
 					
 					/* Compute gravity sensor data in Q16 in g based on 6 axis quaternion in Q30 DMP format */
@@ -773,20 +792,15 @@ int inv_icm20948_poll_sensor(struct inv_icm20948 * s, void * context,
 				}
 				/* 9axis orientation quaternion sample available from DMP FIFO */
 				if (header & QUAT9_SET) {
-					float ref_quat[4];
 					/* Read 9 axis quaternion out of DMP FIFO in Q30 */
 					inv_icm20948_dmp_get_9quaternion(long_quat);
 					if(inv_icm20948_ctrl_androidSensor_enabled(s, ANDROID_SENSOR_ROTATION_VECTOR) && !skip_sensor(s, ANDROID_SENSOR_ROTATION_VECTOR)) {
-						/* and convert it from Q30 DMP format to Android format only if RV sensor is enabled */
-						inv_icm20948_convert_rotation_vector(s, long_quat, rv_float);
-						/* Read rotation vector heading accuracy out of DMP FIFO in Q29*/
-						rv_accuracy = (float)inv_icm20948_get_rv_accuracy()/(float)(1ULL << (29));
-						ref_quat[0] = rv_float[3];
-						ref_quat[1] = rv_float[0];
-						ref_quat[2] = rv_float[1];
-						ref_quat[3] = rv_float[2];
+						/* and convert it from Q30 DMP format to world frame only if RV sensor is enabled,
+						 * with the heading accuracy out of DMP FIFO in Q29 */
+						quat_sample_convert(s, long_quat, inv_icm20948_get_rv_accuracy(), &quat_sample);
+						rv_accuracy = s->quat_q30_only ? 0 : (float)quat_sample.accuracy_q29/(float)(1ULL << (29));
 						s->timestamp[INV_ICM20948_SENSOR_ROTATION_VECTOR] += s->sensorlist[INV_ICM20948_SENSOR_ROTATION_VECTOR].odr_applied_us;
-						handler(context, INV_ICM20948_SENSOR_ROTATION_VECTOR, s->timestamp[INV_ICM20948_SENSOR_ROTATION_VECTOR], ref_quat, &rv_accuracy);
+						handler(context, INV_ICM20948_SENSOR_ROTATION_VECTOR, s->timestamp[INV_ICM20948_SENSOR_ROTATION_VECTOR], &quat_sample, &rv_accuracy);
 					}
 					
 					if(inv_icm20948_ctrl_androidSensor_enabled(s, ANDROID_SENSOR_ORIENTATION) && !skip_sensor(s, ANDROID_SENSOR_ORIENTATION)) {
@@ -803,20 +817,15 @@ int inv_icm20948_poll_sensor(struct inv_icm20948 * s, void * context,
 				}
 				/* 6axis AM orientation quaternion sample available from DMP FIFO */
 				if (header & GEOMAG_SET) {
-					float ref_quat[4];
-					/* Read 6 axis quaternion out of DMP FIFO in Q30 and convert it to Android format */
+					/* Read 6 axis quaternion out of DMP FIFO in Q30 and convert it to world frame */
 					inv_icm20948_dmp_get_gmrvquaternion(long_quat);
 					if(inv_icm20948_ctrl_androidSensor_enabled(s, ANDROID_SENSOR_GEOMAGNETIC_ROTATION_VECTOR) && !skip_sensor(s, ANDROID_SENSOR_GEOMAGNETIC_ROTATION_VECTOR)) {
-						inv_icm20948_convert_rotation_vector(s, long_quat, gmrv_float);
-						/* Read geomagnetic rotation vector heading accuracy out of DMP FIFO in Q29*/
-						gmrv_accuracy = (float)inv_icm20948_get_gmrv_accuracy()/(float)(1ULL << (29));
-						ref_quat[0] = gmrv_float[3];
-						ref_quat[1] = gmrv_float[0];
-						ref_quat[2] = gmrv_float[1];
-						ref_quat[3] = gmrv_float[2];
+						/* with the geomagnetic rotation vector heading accuracy out of DMP FIFO in Q29 */
+						quat_sample_convert(s, long_quat, inv_icm20948_get_gmrv_accuracy(), &quat_sample);
+						gmrv_accuracy = s->quat_q30_only ? 0 : (float)quat_sample.accuracy_q29/(float)(1ULL << (29));
 						s->timestamp[INV_ICM20948_SENSOR_GEOMAGNETIC_ROTATION_VECTOR] += s->sensorlist[INV_ICM20948_SENSOR_GEOMAGNETIC_ROTATION_VECTOR].odr_applied_us;
 						handler(context, INV_ICM20948_SENSOR_GEOMAGNETIC_ROTATION_VECTOR, s->timestamp[INV_ICM20948_SENSOR_GEOMAGNETIC_ROTATION_VECTOR], 
-								ref_quat, &gmrv_accuracy);
+								&quat_sample, &gmrv_accuracy);
 					}
 				}
 				/* Activity recognition sample available from DMP FIFO */
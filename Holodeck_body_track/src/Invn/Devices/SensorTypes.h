@@ -209,6 +209,8 @@ typedef struct inv_sensor_event
 			float        quat[4];          /**< w,x,y,z quaternion data */
 			float        accuracy;         /**< heading accuracy in deg */
 			uint8_t      accuracy_flag;    /**< accuracy flag specific for GRV*/
+			int32_t      quat_q30[4];      /**< w,x,y,z quaternion data in Q30, when the device provides it */
+			int32_t      accuracy_q29;     /**< heading accuracy in Q29 */
 		} quaternion;                      /**< quaternion data */
 		struct {
 			float        x,y,z;            /**< x,y,z angles in deg as defined by Google Orientation sensor */
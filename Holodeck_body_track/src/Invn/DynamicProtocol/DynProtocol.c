@@ -124,6 +124,106 @@ static int DynProtocol_getPrecision(DynProtocol_t * self, int sensor_id)
 	return QxIn;
 }
 
+/* Size of a NEW_SENSOR_DATA payload (status, sensor id, timestamp and data) from its sensor id */
+static int16_t DynProtocol_getSensorEventSize(uint8_t sensor_id)
+{
+	switch(sensor_id) {
+	case DYN_PRO_SENSOR_TYPE_RESERVED:
+		return 1+1+4;
+	case DYN_PRO_SENSOR_TYPE_CUSTOM_PRESSURE:
+		return 1+1+4+16;
+	case DYN_PRO_SENSOR_TYPE_HIGH_RATE_GYRO:
+		return 1+1+6;
+	case DYN_PRO_SENSOR_TYPE_RAW_ACCELEROMETER:
+	case DYN_PRO_SENSOR_TYPE_RAW_MAGNETOMETER:
+	case DYN_PRO_SENSOR_TYPE_RAW_GYROSCOPE:
+	case DYN_PRO_SENSOR_TYPE_OIS:
+		return 1+1+4+6;
+	case DYN_PRO_SENSOR_TYPE_EIS:
+		return 1+1+4+6+6+2;
+	case DYN_PRO_SENSOR_TYPE_AMBIENT_TEMPERATURE:
+		return 1+1+4+2;
+	case DYN_PRO_SENSOR_TYPE_RAW_TEMPERATURE:
+		return 1+1+4+4;
+	case DYN_PRO_SENSOR_TYPE_LINEAR_ACCELERATION:
+	case DYN_PRO_SENSOR_TYPE_GRAVITY:
+	case DYN_PRO_SENSOR_TYPE_ORIENTATION:
+		return 1+1+4+6+1;
+	case DYN_PRO_SENSOR_TYPE_ACCELEROMETER:
+	case DYN_PRO_SENSOR_TYPE_GYROSCOPE:
+	case DYN_PRO_SENSOR_TYPE_MAGNETOMETER:
+		return 1+1+4+6+1;
+	case DYN_PRO_SENSOR_TYPE_UNCAL_MAGNETOMETER:
+	case DYN_PRO_SENSOR_TYPE_UNCAL_GYROSCOPE:
+		return 1+1+4+12+1;
+	case DYN_PRO_SENSOR_TYPE_PREDICTIVE_QUATERNION:
+	case DYN_PRO_SENSOR_TYPE_3AXIS:
+	case DYN_PRO_SENSOR_TYPE_GAME_ROTATION_VECTOR:
+		return 1+1+4+8+1;
+	case DYN_PRO_SENSOR_TYPE_ROTATION_VECTOR:
+	case DYN_PRO_SENSOR_TYPE_GEOMAG_ROTATION_VECTOR:
+		return 1+1+4+10+1;
+	case DYN_PRO_SENSOR_TYPE_B2S:
+	case DYN_PRO_SENSOR_TYPE_SHAKE:
+	case DYN_PRO_SENSOR_TYPE_DOUBLE_TAP:
+	case DYN_PRO_SENSOR_TYPE_SEDENTARY_REMIND:
+	case DYN_PRO_SENSOR_TYPE_SMD:
+	case DYN_PRO_SENSOR_TYPE_STEP_DETECTOR:
+	case DYN_PRO_SENSOR_TYPE_TILT_DETECTOR:
+	case DYN_PRO_SENSOR_TYPE_WAKE_GESTURE:
+	case DYN_PRO_SENSOR_TYPE_GLANCE_GESTURE:
+	case DYN_PRO_SENSOR_TYPE_PICK_UP_GESTURE:
+	case DYN_PRO_SENSOR_TYPE_PRESSURE:
+	case DYN_PRO_SENSOR_TYPE_LIGHT:
+		return 1+1+4+4;
+	case DYN_PRO_SENSOR_TYPE_WOM:
+	case DYN_PRO_SENSOR_TYPE_BAC:
+		return 1+1+4+1+4;
+	case DYN_PRO_SENSOR_TYPE_STEP_COUNTER:
+		return 1+1+4+4+4;
+	case DYN_PRO_SENSOR_TYPE_PROXIMITY:
+		return 1+1+4+2;
+	case DYN_PRO_SENSOR_TYPE_CUSTOM0:
+	case DYN_PRO_SENSOR_TYPE_CUSTOM1:
+	case DYN_PRO_SENSOR_TYPE_CUSTOM2:
+	case DYN_PRO_SENSOR_TYPE_CUSTOM3:
+	case DYN_PRO_SENSOR_TYPE_CUSTOM4:
+	case DYN_PRO_SENSOR_TYPE_CUSTOM5:
+	case DYN_PRO_SENSOR_TYPE_CUSTOM6:
+	case DYN_PRO_SENSOR_TYPE_CUSTOM7:
+		return 1+1+4+65;
+	default:
+		/* undefined for now */
+		return -1;
+	}
+}
+
+/* Batch payload size, as far as it can be determined from the bytes received so far */
+static int16_t DynProtocol_getBatchPayload(DynProtocol_t * self)
+{
+	const uint8_t * buf = self->decode_state_machine.tmp_buffer;
+	uint16_t idx = 1; /* event count */
+	uint8_t i;
+
+	if(self->decode_state_machine.received_size == 0)
+		return 1;
+
+	for(i = 0; i < buf[0]; ++i) {
+		int16_t size;
+
+		/* need device id, sensor status and sensor id to go further */
+		if(idx + 3 > self->decode_state_machine.received_size)
+			return (idx + 3 <= MAX_EXPECTED_PAYLOAD) ? (int16_t)(idx + 3) : -1;
+
+		size = DynProtocol_getSensorEventSize(buf[idx + 2]);
+		if(size < 0)
+			return -1;
+		idx += 1 + size;
+	}
+
+	return (idx <= MAX_EXPECTED_PAYLOAD) ? (int16_t)idx : -1;
+}
+
 static int16_t DynProtocol_getPayload(DynProtocol_t * self)
 {
 	const uint8_t eventType = self->decode_state_machine.event_type;
@@ -190,6 +290,9 @@ static int16_t DynProtocol_getPayload(DynProtocol_t * self)
 			case DYN_PROTOCOL_EID_NEW_SENSOR_DATA:
 				/* need at least two more byte to determine payload (sensor status + sensor id) */
 				return 2;
+			case DYN_PROTOCOL_EID_NEW_SENSOR_DATA_BATCH:
+				/* need event count first */
+				return DynProtocol_getBatchPayload(self);
 			default:
 				break;
 			}
@@ -210,75 +313,11 @@ static int16_t DynProtocol_getPayload(DynProtocol_t * self)
 
 		switch(eventType) {
 		case EVENT_TYPE_ASYNC:
-			switch(sensor_id) {
-			case DYN_PRO_SENSOR_TYPE_RESERVED:
+			if(cmdId == DYN_PROTOCOL_EID_NEW_SENSOR_DATA_BATCH)
+				return DynProtocol_getBatchPayload(self);
+			if(sensor_id == DYN_PRO_SENSOR_TYPE_RESERVED)
 				return self->decode_state_machine.received_size;
-			case DYN_PRO_SENSOR_TYPE_CUSTOM_PRESSURE:
-				return 1+1+4+16;
-			case DYN_PRO_SENSOR_TYPE_HIGH_RATE_GYRO:
-				return 1+1+6;
-			case DYN_PRO_SENSOR_TYPE_RAW_ACCELEROMETER:
-			case DYN_PRO_SENSOR_TYPE_RAW_MAGNETOMETER:
-			case DYN_PRO_SENSOR_TYPE_RAW_GYROSCOPE:
-			case DYN_PRO_SENSOR_TYPE_OIS:
-				return 1+1+4+6;
-			case DYN_PRO_SENSOR_TYPE_EIS:
-				return 1+1+4+6+6+2;
-			case DYN_PRO_SENSOR_TYPE_AMBIENT_TEMPERATURE:
-				return 1+1+4+2;
-			case DYN_PRO_SENSOR_TYPE_RAW_TEMPERATURE:
-				return 1+1+4+4;
-			case DYN_PRO_SENSOR_TYPE_LINEAR_ACCELERATION:
-			case DYN_PRO_SENSOR_TYPE_GRAVITY:
-			case DYN_PRO_SENSOR_TYPE_ORIENTATION:
-				return 1+1+4+6+1;
-			case DYN_PRO_SENSOR_TYPE_ACCELEROMETER:
-			case DYN_PRO_SENSOR_TYPE_GYROSCOPE:
-			case DYN_PRO_SENSOR_TYPE_MAGNETOMETER:
-				return 1+1+4+6+1;
-			case DYN_PRO_SENSOR_TYPE_UNCAL_MAGNETOMETER:
-			case DYN_PRO_SENSOR_TYPE_UNCAL_GYROSCOPE:
-				return 1+1+4+12+1;
-			case DYN_PRO_SENSOR_TYPE_PREDICTIVE_QUATERNION:
-			case DYN_PRO_SENSOR_TYPE_3AXIS:
-			case DYN_PRO_SENSOR_TYPE_GAME_ROTATION_VECTOR:
-				return 1+1+4+8+1;
-			case DYN_PRO_SENSOR_TYPE_ROTATION_VECTOR:
-			case DYN_PRO_SENSOR_TYPE_GEOMAG_ROTATION_VECTOR:
-				return 1+1+4+10+1;
-			case DYN_PRO_SENSOR_TYPE_B2S:
-			case DYN_PRO_SENSOR_TYPE_SHAKE:
-			case DYN_PRO_SENSOR_TYPE_DOUBLE_TAP:
-			case DYN_PRO_SENSOR_TYPE_SEDENTARY_REMIND:
-			case DYN_PRO_SENSOR_TYPE_SMD:
-			case DYN_PRO_SENSOR_TYPE_STEP_DETECTOR:
-			case DYN_PRO_SENSOR_TYPE_TILT_DETECTOR:
-			case DYN_PRO_SENSOR_TYPE_WAKE_GESTURE:
-			case DYN_PRO_SENSOR_TYPE_GLANCE_GESTURE:
-			case DYN_PRO_SENSOR_TYPE_PICK_UP_GESTURE:
-			case DYN_PRO_SENSOR_TYPE_PRESSURE:
-			case DYN_PRO_SENSOR_TYPE_LIGHT:
-				return 1+1+4+4;
-			case DYN_PRO_SENSOR_TYPE_WOM:
-			case DYN_PRO_SENSOR_TYPE_BAC:
-				return 1+1+4+1+4;
-			case DYN_PRO_SENSOR_TYPE_STEP_COUNTER:
-				return 1+1+4+4+4;
-			case DYN_PRO_SENSOR_TYPE_PROXIMITY:
-				return 1+1+4+2;
-			case DYN_PRO_SENSOR_TYPE_CUSTOM0:
-			case DYN_PRO_SENSOR_TYPE_CUSTOM1:
-			case DYN_PRO_SENSOR_TYPE_CUSTOM2:
-			case DYN_PRO_SENSOR_TYPE_CUSTOM3:
-			case DYN_PRO_SENSOR_TYPE_CUSTOM4:
-			case DYN_PRO_SENSOR_TYPE_CUSTOM5:
-			case DYN_PRO_SENSOR_TYPE_CUSTOM6:
-			case DYN_PRO_SENSOR_TYPE_CUSTOM7:
-				return 1+1+4+65;
-			default:
-				/* undefined for now */
-				return -1;
-			}
+			return DynProtocol_getSensorEventSize(sensor_id);
 
 		default:
 			/* do not need to update expected payload */
@@ -632,6 +671,29 @@ static inline void DynProtocol_callEventCB(DynProtocol_t * self,
 	}
 }
 
+/* Report each event of a batch as a NEW_SENSOR_DATA event */
+static int DynProtocol_doProcessBatch(DynProtocol_t * self)
+{
+	const uint8_t * buf = self->decode_state_machine.tmp_buffer;
+	struct DynProtocolEdata edata;
+	uint16_t idx = 1;
+	uint8_t i;
+
+	for(i = 0; i < buf[0]; ++i) {
+		const int16_t size = DynProtocol_getSensorEventSize(buf[idx + 1 + 1]);
+
+		edata.device_id = buf[idx];
+		if(size < 0 || DynProtocol_decodeSensorEvent(self, &buf[idx + 1], size, &edata, DYN_PROTOCOL_ETYPE_ASYNC) != 0) {
+			INV_MSG(INV_MSG_LEVEL_ERROR, "DynProtocol: Unexpected event in batch.");
+			return -1;
+		}
+		DynProtocol_callEventCB(self, DYN_PROTOCOL_ETYPE_ASYNC, DYN_PROTOCOL_EID_NEW_SENSOR_DATA, &edata);
+		idx += 1 + size;
+	}
+
+	return 1;
+}
+
 static int DynProtocol_doProcess(DynProtocol_t * self)
 {
 	struct DynProtocolEdata edata;
@@ -639,6 +701,7 @@ static int DynProtocol_doProcess(DynProtocol_t * self)
 	int rc;
 
 	self->decode_state_machine.state = PROTOCOL_STATE_IDLE;
+	edata.device_id = 0;
 
 	switch(self->decode_state_machine.event_type) {
 	case EVENT_TYPE_CMD:
@@ -652,6 +715,8 @@ static int DynProtocol_doProcess(DynProtocol_t * self)
 		break;
 
 	case EVENT_TYPE_ASYNC:
+		if(self->decode_state_machine.cmd_id == DYN_PROTOCOL_EID_NEW_SENSOR_DATA_BATCH)
+			return DynProtocol_doProcessBatch(self);
 		rc = DynProtocol_decodePktAsync(self, &edata);
 		etype = DYN_PROTOCOL_ETYPE_ASYNC;
 		break;
@@ -1387,6 +1452,60 @@ error_size:
 	return -1;
 }
 
+int DynProtocol_encodeBatchStart(DynProtocol_t * self,
+		uint8_t * outBuffer, uint16_t maxBufferSize, uint16_t *outBufferSize)
+{
+	uint16_t idx = 0;
+
+	(void)self;
+
+	*outBufferSize = 0;
+
+	if(maxBufferSize < 3) {
+		INV_MSG(INV_MSG_LEVEL_ERROR, "DynProtocol: output buffer size too small");
+		return -1;
+	}
+
+	outBuffer[idx]  = EVENT_TYPE_ASYNC; // Set event type
+	outBuffer[idx++] |= DYN_PROTOCOL_GROUP_ID & ~EVENT_TYPE_MASK; // Set group ID
+	outBuffer[idx++] = (uint8_t)DYN_PROTOCOL_EID_NEW_SENSOR_DATA_BATCH;
+	outBuffer[idx++] = 0; // event count
+
+	*outBufferSize = idx;
+
+	return 0;
+}
+
+int DynProtocol_encodeBatchAdd(DynProtocol_t * self, const DynProtocolEdata_t * edata,
+		uint8_t * outBuffer, uint16_t maxBufferSize, uint16_t *outBufferSize)
+{
+	const uint16_t idx = *outBufferSize;
+	const int16_t size = DynProtocol_getSensorEventSize((uint8_t)edata->sensor_id);
+	int len;
+
+	/* sanity check */
+	if(idx < 3 || outBuffer[1] != DYN_PROTOCOL_EID_NEW_SENSOR_DATA_BATCH || size < 0) {
+		INV_MSG(INV_MSG_LEVEL_ERROR, "DynProtocol: Unexpected argument for encode_batch()");
+		return -1;
+	}
+
+	/* check before encoding, so a full batch is left untouched */
+	if(outBuffer[2] == UINT8_MAX || idx + 1 + size > maxBufferSize)
+		return INV_ERROR_SIZE;
+
+	len = DynProtocol_encodeSensorEvent(self, edata, &outBuffer[idx + 1], maxBufferSize - idx - 1, DYN_PROTOCOL_ETYPE_ASYNC);
+	if(len != size) {
+		INV_MSG(INV_MSG_LEVEL_ERROR, "DynProtocol: Unexpected argument for encode_batch()");
+		return -1;
+	}
+
+	outBuffer[idx] = (uint8_t)edata->device_id;
+	outBuffer[2]++;
+	*outBufferSize = idx + 1 + len;
+
+	return 0;
+}
+
 const char * DynProtocol_sensorTypeToStr(int type)
 {
 	switch(type) {
@@ -154,6 +154,7 @@ enum DynProtocolEid {
 
 	/* Events */
 	DYN_PROTOCOL_EID_NEW_SENSOR_DATA    = 0x30,
+	DYN_PROTOCOL_EID_NEW_SENSOR_DATA_BATCH = 0x31, /**< several NEW_SENSOR_DATA payloads from different devices */
 };
 
 /** @brief Event type definition
@@ -176,6 +177,7 @@ enum dynamic_protocol_ereg {
  */
 typedef struct DynProtocolEdata {
 	int sensor_id; /** 0 if not applicable */
+	int device_id; /** index of the device the event comes from, 0 if not applicable (batched events only) */
 	union {
 		union {
 			uint32_t period;  /** for EID_SET_SENSOR_PERIOD */
@@ -264,6 +266,34 @@ int DynProtocol_encodeCommand(DynProtocol_t * self,
 		enum DynProtocolEid eid, const DynProtocolEdata_t * edata,
 		uint8_t * outBuffer, uint16_t maxBufferSize, uint16_t *outBufferSize);
 
+/** @brief Start encoding a batch of sensor events
+ *
+ *  A batch packs several DYN_PROTOCOL_EID_NEW_SENSOR_DATA payloads, possibly from different
+ *  devices, in a single DYN_PROTOCOL_EID_NEW_SENSOR_DATA_BATCH async packet:
+ *    <EVENT_TYPE|GID> <EID> <COUNT (1)> COUNT * { <DEVICE ID (1)> <NEW_SENSOR_DATA payload> }
+ *  so framing overhead is paid once for all events.
+ *  On reception, each event of the batch is reported as a DYN_PROTOCOL_EID_NEW_SENSOR_DATA
+ *  event with edata->device_id set.
+ *
+ *  @param[out] outBuffer      packet buffer
+ *  @param[in]  maxBufferSize  size of packet buffer
+ *  @param[out] outBufferSize  current packet size
+ *  @return 0 on success, -1 on error
+ */
+int DynProtocol_encodeBatchStart(DynProtocol_t * self,
+		uint8_t * outBuffer, uint16_t maxBufferSize, uint16_t *outBufferSize);
+
+/** @brief Append a sensor event to a batch started with DynProtocol_encodeBatchStart()
+ *  @param[in]    edata          event to add, as for DynProtocol_encodeAsync(), edata->device_id is sent along
+ *  @param[inout] outBuffer      packet buffer
+ *  @param[in]    maxBufferSize  size of packet buffer
+ *  @param[inout] outBufferSize  current packet size, updated on success
+ *  @return 0 on success, INV_ERROR_SIZE if the event does not fit (batch is left untouched and
+ *          must be sent before adding the event to a new one), -1 on other errors
+ */
+int DynProtocol_encodeBatchAdd(DynProtocol_t * self, const DynProtocolEdata_t * edata,
+		uint8_t * outBuffer, uint16_t maxBufferSize, uint16_t *outBufferSize);
+
 /** @brief Utility function that returns a string from a sensor type
  *  Empty string is returned if sensor is invalid
  */
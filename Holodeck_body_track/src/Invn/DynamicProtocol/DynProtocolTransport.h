@@ -39,6 +39,7 @@ enum DynProTransportEvent {
 	DYN_PRO_TRANSPORT_EVENT_TX_BYTE,
 	DYN_PRO_TRANSPORT_EVENT_TX_END,
 	DYN_PRO_TRANSPORT_EVENT_TX_START_DMA,
+	DYN_PRO_TRANSPORT_EVENT_TX_BLOCK,
 };
 
 union DynProTransportEventData {
@@ -48,6 +49,10 @@ union DynProTransportEventData {
 	uint32_t tx_start;
 	uint8_t  tx_byte;
 	void *frame;
+	struct {
+		const uint8_t * buffer;
+		uint16_t        len;
+	} tx_block;
 };
 
 typedef void (*DynProTransportEvent_cb)(enum DynProTransportEvent e,
@@ -50,6 +50,7 @@ void DynProTransportUart_init(DynProTransportUart_t * self,
 	self->event_cb_cookie = cookie;
 	self->rx_sm_state     = RECEIVER_STATE_IDLE;
 	self->use_tx_dma        = 0;
+	self->use_tx_block      = 0;
 }
 
 
@@ -70,6 +71,25 @@ void DynProTransportUart_enableTxDma(DynProTransportUart_t * self)
 	self->use_tx_dma = 1;
 }
 
+/** @brief This function forces protocol to hand complete frames to the transport callback
+ *
+ * Block transmit is unused by default at startup, frames are then sent byte per byte
+ * with DYN_PRO_TRANSPORT_EVENT_TX_BYTE events. Once enabled, each frame is sent with a
+ * single DYN_PRO_TRANSPORT_EVENT_TX_BLOCK event pointing to the encoded frame (header
+ * and payload), so the callback can pass it as is to a block oriented driver (eg: USB).
+ * The buffer is only valid during the callback.
+ *
+ *  @note : rx data is not impacted. Only tx data.
+ *  @note : DMA, if enabled, takes precedence over block transmit.
+ *
+ * @param[in] self pointer on current DynProTransportUart_t transport object
+ *
+ */
+void DynProTransportUart_enableTxBlock(DynProTransportUart_t * self)
+{
+	self->use_tx_block = 1;
+}
+
 void DynProTransportUart_rxProcessReset(DynProTransportUart_t * self)
 {
 	self->rx_sm_state = RECEIVER_STATE_IDLE;
@@ -160,7 +180,9 @@ int DynProTransportUart_rxProcessByte(DynProTransportUart_t * self, uint8_t rcv_
  * 
  * If DMA is enabled, function sends DYN_PRO_TRANSPORT_EVENT_TX_START_DMA event and frame pointer
  * to transport callback 
- * If DMA is disabled, function sends :
+ * If block transmit is enabled, function sends DYN_PRO_TRANSPORT_EVENT_TX_BLOCK event with
+ * frame buffer and size to transport callback
+ * Otherwise, function sends :
  *    - DYN_PRO_TRANSPORT_EVENT_TX_START event and frame size in bytes to the transport callback
  *    - DYN_PRO_TRANSPORT_EVENT_TX_BYTE event for each byte of the frame
  *    - DYN_PRO_TRANSPORT_EVENT_TX_END event and frame pointer to transport callback  
@@ -181,6 +203,11 @@ int DynProTransportUart_txSendFrame(DynProTransportUart_t * self, DynProTranspor
 		udata.frame = (void*)frame;
 		DynProTransportUart_callEventCB(self, DYN_PRO_TRANSPORT_EVENT_TX_START_DMA, udata);
 	}
+	else if(self->use_tx_block) {
+		udata.tx_block.buffer = frame->header;
+		udata.tx_block.len    = frame->len;
+		DynProTransportUart_callEventCB(self, DYN_PRO_TRANSPORT_EVENT_TX_BLOCK, udata);
+	}
 	else {
 		udata.tx_start = frame->len;
 		DynProTransportUart_callEventCB(self, DYN_PRO_TRANSPORT_EVENT_TX_START, udata);
@@ -211,6 +238,9 @@ int DynProTransportUart_txSendFrame(DynProTransportUart_t * self, DynProTranspor
  *    - buffer given in paramters
  *  
  * Finnally it sends DYN_PRO_TRANSPORT_EVENT_TX_END to the transport callback
+ *
+ * If block transmit is enabled, header and buffer are sent with two
+ * DYN_PRO_TRANSPORT_EVENT_TX_BLOCK events instead (buffer is not copied).
  * 
  * @param[in] self : pointer on current DynProTransportUart_t transport object
  * @param[in] buffer : pointer to the first byte to be sent
@@ -225,6 +255,21 @@ int DynProTransportUart_tx(DynProTransportUart_t * self,
 	const uint32_t total_bytes = DYN_PRO_TRANSPORT_UART_OVERHEAD + size;
 	uint16_t i;
 
+	if(self->use_tx_block) {
+		const uint8_t header[DYN_PRO_TRANSPORT_UART_OVERHEAD] = {
+			SYNC_BYTE_0, SYNC_BYTE_1, (size & 0x00FF), (size & 0xFF00) >> 8
+		};
+
+		udata.tx_block.buffer = header;
+		udata.tx_block.len    = sizeof(header);
+		DynProTransportUart_callEventCB(self, DYN_PRO_TRANSPORT_EVENT_TX_BLOCK, udata);
+		udata.tx_block.buffer = buffer;
+		udata.tx_block.len    = size;
+		DynProTransportUart_callEventCB(self, DYN_PRO_TRANSPORT_EVENT_TX_BLOCK, udata);
+
+		return 0;
+	}
+
 	udata.tx_start = total_bytes;
 	DynProTransportUart_callEventCB(self, DYN_PRO_TRANSPORT_EVENT_TX_START, udata);
 	udata.tx_byte = SYNC_BYTE_0;
@@ -46,6 +46,7 @@ typedef struct DynProTransportUart {
 	uint16_t rx_expected_bytes;
 	uint16_t rx_received_bytes;
 	uint8_t use_tx_dma; 
+	uint8_t use_tx_block;
 } DynProTransportUart_t;
 
 typedef struct {
@@ -61,6 +62,8 @@ void DynProTransportUart_init(DynProTransportUart_t * self,
 
 void DynProTransportUart_enableTxDma(DynProTransportUart_t * self);
 
+void DynProTransportUart_enableTxBlock(DynProTransportUart_t * self);
+
 void DynProTransportUart_rxProcessReset(DynProTransportUart_t * self);
 int DynProTransportUart_rxProcessByte(DynProTransportUart_t * self, uint8_t rcvByte);
 
@@ -43,3 +43,77 @@ char *InvFormat_uint322hex(char out[9], uint32_t a)
 {
 	return InvFormat_uint2hex(out, a, 2 * sizeof(a));
 }
+
+int InvFormat_fixed2dec(char *out, size_t max, int32_t value, unsigned q, unsigned decimals)
+{
+	static const uint32_t pow10[INV_FORMAT_FIXED_MAX_DECIMALS + 1] = {
+		1, 10, 100, 1000, 10000, 100000, 1000000, 10000000, 100000000, 1000000000
+	};
+
+	/* sign + 10 integer digits + '.' + decimals */
+	char tmp[1 + 10 + 1 + INV_FORMAT_FIXED_MAX_DECIMALS];
+	size_t i = sizeof(tmp);
+	const uint32_t mag = (value < 0) ? (0u - (uint32_t)value) : (uint32_t)value;
+	uint32_t ipart, fpart;
+
+	if(q > 31 || decimals > INV_FORMAT_FIXED_MAX_DECIMALS)
+		return -1;
+
+	ipart = mag >> q;
+	fpart = mag & ((1u << q) - 1);
+
+	/* scale fractional part to decimals, rounded (fpart < 2^31 and pow10 < 2^30: fits in 64 bits) */
+	fpart = (uint32_t)(((uint64_t)fpart * pow10[decimals] + ((q) ? (1ull << (q - 1)) : 0)) >> q);
+	if(fpart >= pow10[decimals]) {
+		fpart -= pow10[decimals];
+		ipart += 1;
+	}
+
+	if(decimals) {
+		unsigned n;
+
+		for(n = decimals; n != 0; --n) {
+			tmp[--i] = (char)('0' + fpart % 10);
+			fpart /= 10;
+		}
+		tmp[--i] = '.';
+	}
+
+	do {
+		tmp[--i] = (char)('0' + ipart % 10);
+		ipart /= 10;
+	} while(ipart != 0);
+
+	if(value < 0)
+		tmp[--i] = '-';
+
+	if(sizeof(tmp) - i > max)
+		return -1;
+
+	InvString_memcpy(out, &tmp[i], sizeof(tmp) - i);
+
+	return (int)(sizeof(tmp) - i);
+}
+
+int InvFormat_fixedArray2dec(char *out, size_t max, const int32_t *values, unsigned count,
+		unsigned q, unsigned decimals, char sep)
+{
+	size_t idx = 0;
+	unsigned i;
+
+	for(i = 0; i < count; ++i) {
+		int len;
+
+		if(i != 0) {
+			if(idx >= max)
+				return -1;
+			out[idx++] = sep;
+		}
+		len = InvFormat_fixed2dec(&out[idx], max - idx, values[i], q, decimals);
+		if(len < 0)
+			return -1;
+		idx += len;
+	}
+
+	return (int)idx;
+}
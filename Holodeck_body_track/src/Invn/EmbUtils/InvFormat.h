@@ -34,6 +34,37 @@ char *InvFormat_uint162hex(char out[5], uint16_t a);
 */
 char *InvFormat_uint322hex(char out[9], uint32_t a);
 
+/** @brief  Maximum number of decimals supported by InvFormat_fixed2dec()
+*/
+#define INV_FORMAT_FIXED_MAX_DECIMALS 9
+
+/** @brief  Convert a signed fixed-point number to a decimal string
+	Only integer arithmetic is used. Last decimal is rounded to nearest.
+	No terminating '\0' is written, so the result can be built in place
+	inside an output frame.
+	@param[out] out       output buffer
+	@param[in]  max       size of output buffer
+	@param[in]  value     fixed-point number
+	@param[in]  q         number of fractional bits of value (0 to 31), 14 for Q14, 30 for Q30
+	@param[in]  decimals  number of decimals to print (0 to INV_FORMAT_FIXED_MAX_DECIMALS)
+	@return     number of characters written, -1 if out is too small or arguments are invalid
+*/
+int InvFormat_fixed2dec(char *out, size_t max, int32_t value, unsigned q, unsigned decimals);
+
+/** @brief  Convert an array of signed fixed-point numbers to a decimal string
+	Numbers are formatted as with InvFormat_fixed2dec() and separated by sep.
+	@param[out] out       output buffer
+	@param[in]  max       size of output buffer
+	@param[in]  values    fixed-point numbers
+	@param[in]  count     number of fixed-point numbers
+	@param[in]  q         number of fractional bits of values
+	@param[in]  decimals  number of decimals to print
+	@param[in]  sep       separator character
+	@return     number of characters written, -1 if out is too small or arguments are invalid
+*/
+int InvFormat_fixedArray2dec(char *out, size_t max, const int32_t *values, unsigned count,
+		unsigned q, unsigned decimals, char sep);
+
 #ifdef __cplusplus
 }
 #endif
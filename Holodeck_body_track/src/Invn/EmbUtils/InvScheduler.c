@@ -16,134 +16,178 @@
 
 #include "InvScheduler.h"
 
+/*
+ * Tasks awaiting to be scheduled are kept in a pairing heap ordered by
+ * deadline, the highest priority first on equal deadlines.
+ * child points to the first child of a task, next to its next sibling and
+ * prev to its previous sibling, or to its parent for the first child.
+ * scheduler->queue is the root.
+ */
+
+static inline uint32_t InvScheduler_deadline(const InvSchedulerTask *task)
+{
+	return task->lasttime + ((task->delay != 0) ? task->delay : task->period);
+}
+
+static inline int InvScheduler_isBefore(const InvSchedulerTask *a,
+		const InvSchedulerTask *b)
+{
+	const int32_t diff = (int32_t)(InvScheduler_deadline(a) - InvScheduler_deadline(b));
+
+	return (diff < 0) || (diff == 0 && a->priority > b->priority);
+}
+
+/* Link two roots, the later one becomes the first child of the other one */
+static InvSchedulerTask * InvScheduler_meld(InvSchedulerTask *a,
+		InvSchedulerTask *b)
+{
+	if(a == 0)
+		return b;
+	if(b == 0)
+		return a;
+	if(InvScheduler_isBefore(b, a)) {
+		InvSchedulerTask *tmp = a;
+		a = b;
+		b = tmp;
+	}
+	b->next = a->child;
+	if(a->child)
+		a->child->prev = b;
+	b->prev  = a;
+	a->child = b;
+	a->next  = 0;
+	a->prev  = 0;
+
+	return a;
+}
+
+/* Meld a list of siblings into one root, pairs left to right then right to left */
+static InvSchedulerTask * InvScheduler_mergePairs(InvSchedulerTask *first)
+{
+	InvSchedulerTask *pairs = 0; /* melded pairs, last one first, linked by prev */
+	InvSchedulerTask *root  = 0;
+
+	while(first) {
+		InvSchedulerTask *a = first;
+		InvSchedulerTask *b = first->next;
+		InvSchedulerTask *pair;
+
+		first = b ? b->next : 0;
+		pair = InvScheduler_meld(a, b);
+		pair->prev = pairs;
+		pairs = pair;
+	}
+
+	while(pairs) {
+		InvSchedulerTask *prev = pairs->prev;
+
+		pairs->next = 0;
+		pairs->prev = 0;
+		root  = InvScheduler_meld(root, pairs);
+		pairs = prev;
+	}
+
+	return root;
+}
+
 static void InvScheduler_insertTask(InvScheduler * scheduler,
 		InvSchedulerTask *task)
 {
-	if(scheduler->queue == 0) {
-		task->prev = task;
-		task->next = 0;
-		scheduler->queue = task;
-	} else {
-		task->prev = scheduler->queue->prev;
-		task->next = 0;
-		scheduler->queue->prev->next = task;
-		scheduler->queue->prev       = task;
-	}
+	task->child = 0;
+	task->next  = 0;
+	task->prev  = 0;
+	scheduler->queue = InvScheduler_meld(scheduler->queue, task);
+	++scheduler->count;
 }
 
-static inline void InvScheduler_removeTask(InvScheduler * scheduler,
+static void InvScheduler_removeTask(InvScheduler * scheduler,
 		InvSchedulerTask *task)
 {
+	InvSchedulerTask * const children = InvScheduler_mergePairs(task->child);
+
 	if(scheduler->queue == task) {
-		scheduler->queue = task->next;
+		scheduler->queue = children;
 	} else {
-		if(scheduler->queue->prev == task)
-			scheduler->queue->prev = task->prev;
-		task->prev->next = task->next;
+		if(task->prev->child == task)
+			task->prev->child = task->next;
+		else
+			task->prev->next = task->next;
+		if(task->next)
+			task->next->prev = task->prev;
+		scheduler->queue = InvScheduler_meld(scheduler->queue, children);
 	}
-	if(task->next)
-		task->next->prev = task->prev;
+	--scheduler->count;
+}
+
+/* Next task of a depth first walk of the heap, 0 when done */
+static const InvSchedulerTask * InvScheduler_walkNext(const InvSchedulerTask *task)
+{
+	if(task->child)
+		return task->child;
+
+	while(task) {
+		if(task->next)
+			return task->next;
+		/* back to the first sibling, its prev is the parent */
+		while(task->prev && task->prev->child != task)
+			task = task->prev;
+		task = task->prev;
+	}
+
+	return 0;
 }
 
 static InvSchedulerTask * InvScheduler_getTaskToSchedule(InvScheduler * scheduler,
 		uint32_t now)
 {
-	InvSchedulerTask * cur  = scheduler->queue;
-	InvSchedulerTask * task = 0;
-	uint32_t           max_diff = 0;
-
-	while(cur) {
-		const uint32_t timeout = (cur->delay != 0) ? cur->delay : cur->period;
-		uint32_t elpased;
-
-		/* initalize task states after it was started */
-		if(cur->state == INVSCHEDULER_TASK_STATE_STARTED) {
-			cur->state    = INVSCHEDULER_TASK_STATE_READY;
-			cur->lasttime = now;
-
-			if(cur->delay == 0) {
-				cur->lasttime -= cur->period; /* ensure task is run ASAP */
-			}
-		}
+	InvSchedulerTask * task = scheduler->queue;
 
-		elpased = (now - cur->lasttime);
+	if(task) {
+		const uint32_t timeout = (task->delay != 0) ? task->delay : task->period;
 
 		/* check timeout against elpased time */
-		if(elpased >= timeout) {
-			const uint32_t diff = (elpased - timeout);
-
-			if(task == 0 || diff > max_diff ||
-					(diff == max_diff && cur->priority > task->priority)) {
-				task = cur;
-				max_diff = diff;
-			}
-		}
-
-		cur = cur->next;
+		if((now - task->lasttime) >= timeout)
+			return task;
 	}
 
-	return task;
+	return 0;
 }
 
 int InvScheduler_getActiveTaskCountU(const InvScheduler *scheduler)
 {
-	int count = 0;
-	const InvSchedulerTask *cur;
-
 	/* /!\ RUNNING task is not in the queue hence ignored */
-	for(cur = scheduler->queue; cur != 0; cur = cur->next)
-		++count;
-
-	return count;
+	return scheduler->count;
 }
 
 uint32_t InvScheduler_getNextTimeU(const InvScheduler *scheduler)
 {
-	const uint32_t           now = scheduler->currentTime;
-	const InvSchedulerTask * cur = scheduler->queue;
-	uint32_t                 max_diff = UINT32_MAX;
-
-	for(; cur != 0; cur = cur->next ) {
-		if(cur->state == INVSCHEDULER_TASK_STATE_STARTED) {
-			return 0;
-		} else {
-			const uint32_t timeout = (cur->delay != 0) ? cur->delay : cur->period;
-			const uint32_t elpased = (now - cur->lasttime);
-
-			if(elpased >= timeout) {
-				return 0;
-			} else {
-				const uint32_t diff = timeout - elpased;
-
-				if(diff < max_diff) {
-					max_diff = diff;
-				}
-			}
-		}
+	const InvSchedulerTask * task = scheduler->queue;
+
+	if(task) {
+		const uint32_t timeout = (task->delay != 0) ? task->delay : task->period;
+		const uint32_t elpased = (scheduler->currentTime - task->lasttime);
+
+		return (elpased >= timeout) ? 0 : (timeout - elpased);
 	}
 
-	return max_diff;
+	return UINT32_MAX;
 }
 
 uint32_t InvScheduler_getMinPeriodU(const InvScheduler *scheduler)
 {
-	if(scheduler->queue) {
-		InvSchedulerTask *cur = scheduler->queue->next;
-		uint32_t min = scheduler->queue->period;
+	const InvSchedulerTask *cur = scheduler->queue;
+	uint32_t min = UINT32_MAX;
 
-		/* /!\ RUNNING task is not in the queue hence ignored */
-		/* /!\ delay is not taken into account */
+	/* /!\ RUNNING task is not in the queue hence ignored */
+	/* /!\ delay is not taken into account */
 
-		for(; cur != 0; cur = cur->next ) {
-			if(cur->period < min) {
-				min = cur->period;
-			}
+	for(; cur != 0; cur = InvScheduler_walkNext(cur)) {
+		if(cur->period < min) {
+			min = cur->period;
 		}
-
-		return min;
 	}
 
-	return UINT32_MAX;
+	return min;
 }
 
 int InvScheduler_dispatchOneTask(InvScheduler *scheduler)
@@ -157,13 +201,13 @@ int InvScheduler_dispatchOneTask(InvScheduler *scheduler)
 	task = InvScheduler_getTaskToSchedule(scheduler, now);
 
 	if(task) {
+		InvScheduler_removeTask(scheduler, task);
+
 		/* update lastime and task state */
 		task->delay    = 0; /* clear delay */
 		task->lasttime = now;
 		task->state    = INVSCHEDULER_TASK_STATE_RUNNING;
 
-		InvScheduler_removeTask(scheduler, task);
-
 		InvScheduler_unlock(scheduler->contextLock);
 		InvScheduler_onTaskEnterHook(task, scheduler->currentTime);
 		task->func(task->arg); /* execute the task */
@@ -214,9 +258,13 @@ void InvScheduler_startTaskU(InvSchedulerTask *task, uint32_t delay)
 			task->state == INVSCHEDULER_TASK_STATE_READY) {
 		InvScheduler_removeTask(task->scheduler, task);
 	}
-	InvScheduler_insertTask(task->scheduler, task);
-	task->delay = delay;
+	task->delay    = delay;
+	task->lasttime = task->scheduler->currentTime;
+	if(delay == 0) {
+		task->lasttime -= task->period; /* ensure task is run ASAP */
+	}
 	task->state = INVSCHEDULER_TASK_STATE_STARTED;
+	InvScheduler_insertTask(task->scheduler, task);
 }
 
 void InvScheduler_startTask(InvSchedulerTask *task, uint32_t delay)
@@ -242,6 +290,28 @@ void InvScheduler_stopTask(InvSchedulerTask *task)
 	InvScheduler_unlock(task->scheduler->contextLock);
 }
 
+/* The deadline of a queued task changes, so does its place in the heap */
+static void InvScheduler_requeueTaskU(InvSchedulerTask *task)
+{
+	if(task->state == INVSCHEDULER_TASK_STATE_STARTED ||
+			task->state == INVSCHEDULER_TASK_STATE_READY) {
+		InvScheduler_removeTask(task->scheduler, task);
+		InvScheduler_insertTask(task->scheduler, task);
+	}
+}
+
+void InvScheduler_setTaskPeriodU(InvSchedulerTask *task, uint32_t period)
+{
+	task->period = period;
+	InvScheduler_requeueTaskU(task);
+}
+
+void InvScheduler_setTaskPrioU(InvSchedulerTask *task, uint8_t prio)
+{
+	task->priority = prio;
+	InvScheduler_requeueTaskU(task);
+}
+
 /* Debugging functions ********************************************************/
 
 #ifndef NDEBUG
@@ -264,7 +334,7 @@ void InvScheduler_printTask(const InvSchedulerTask *task,
 			"    prio   = %-12u state  = %s \n"
 			"    period = %-12u delay = %-12u\n"
 			"    time   = %-12lu\n"
-			"    next   = %p prev   = %p\n",
+			"    next   = %p prev   = %p child = %p\n",
 			(void *)task,
 #ifdef INVSCHEDULER_TASK_NAME
 			task->name,
@@ -274,7 +344,7 @@ void InvScheduler_printTask(const InvSchedulerTask *task,
 			(unsigned int)task->priority,
 			InvScheduler_taskState2Str(task->state), (unsigned int)task->period,
 			(unsigned int)task->delay, (unsigned long)task->lasttime,
-			(void *)task->next, (void *)task->prev
+			(void *)task->next, (void *)task->prev, (void *)task->child
 	);
 }
 
@@ -283,7 +353,7 @@ void InvScheduler_dumpTasks(const InvSchedulerTask * queue,
 {
 	const InvSchedulerTask *cur = queue;
 
-	for(; cur != 0; cur = cur->next) {
+	for(; cur != 0; cur = InvScheduler_walkNext(cur)) {
 		InvScheduler_printTask(cur, printf_cb);
 	}
 }
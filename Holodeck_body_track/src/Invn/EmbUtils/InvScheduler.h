@@ -18,6 +18,13 @@
 /** @defgroup InvScheduler InvScheduler
  *  @brief Simple cooperative scheduler
  *
+ *  Tasks awaiting their time are kept in a heap ordered by deadline, so
+ *  dispatching a task costs O(log n) and InvScheduler_getNextTime() O(1)
+ *  whatever the number of tasks. For a tickless main loop, advance the time
+ *  with InvScheduler_updateTimeDelta(), dispatch, then sleep or do background
+ *  work for InvScheduler_getNextTime() ticks.
+ *  The delay given to InvScheduler_startTask() counts from the current tick.
+ *
  *  @ingroup EmbUtils
  *  @{
  */
@@ -74,15 +81,19 @@ typedef struct InvSchedulerTask {
 	uint32_t delay;                     /**< task delay value            */
 	struct InvScheduler * scheduler;    /**< reference to scheduler the
 	                                         task is attach to           */
-	struct InvSchedulerTask *next;      /**< next task in list           */
-	struct InvSchedulerTask *prev;      /**< previous task in list       */
+	struct InvSchedulerTask *child;     /**< first child in heap         */
+	struct InvSchedulerTask *next;      /**< next sibling in heap        */
+	struct InvSchedulerTask *prev;      /**< previous sibling in heap, or
+	                                         parent for the first child  */
 } InvSchedulerTask;
 
 /** @brief 	InvScheduler object states definition
  */
 typedef struct InvScheduler {
 	volatile uint32_t 	currentTime;	/** current time value                    */
-	struct InvSchedulerTask *queue;	    /** list of task awaiting to be scheduled */
+	struct InvSchedulerTask *queue;	    /** heap of task awaiting to be scheduled,
+	                                        next one to run first     */
+	int                     count;      /** number of task in queue               */
 	void * contextLock;                 /** reference to some context passed to
 	                                        lock/unlock macro to protect critical section */
 } InvScheduler;
@@ -134,6 +145,7 @@ static inline void InvScheduler_init(InvScheduler *scheduler)
 {
 	scheduler->currentTime  = 0;
 	scheduler->queue        = 0;
+	scheduler->count        = 0;
 	scheduler->contextLock  = 0;
 }
 
@@ -317,20 +329,12 @@ void InvScheduler_stopTask(InvSchedulerTask *task);
 /** @brief Change period of a task
  *  @param[in] task    handle to task
  */
-static inline void InvScheduler_setTaskPeriodU(InvSchedulerTask *task,
-		uint32_t period)
-{
-	task->period = period;
-}
+void InvScheduler_setTaskPeriodU(InvSchedulerTask *task, uint32_t period);
 
 /** @brief Change priority of a task
  *  @param[in] task    handle to task
  */
-static inline void InvScheduler_setTaskPrioU(InvSchedulerTask *task,
-		uint8_t prio)
-{
-	task->priority = prio;
-}
+void InvScheduler_setTaskPrioU(InvSchedulerTask *task, uint8_t prio);
 
 /* Optionnal hooks called before/after exectuting a task **********************/
 
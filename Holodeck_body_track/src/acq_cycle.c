@@ -0,0 +1,156 @@
+/*
+ * acq_cycle.c
+ *
+ * Fixed period acquisition cycle, see acq_cycle.h.
+ */
+#include <asf.h>
+#include <string.h>
+
+#include "Invn/InvError.h"
+#include "Invn/EmbUtils/DataConverter.h"
+
+#include "time_wrapper.h"
+#include "host_cmd.h"
+#include "acq_cycle.h"
+
+static uint32_t period_us;
+static uint32_t ticks_done;		/* ticks consumed by acq_cycle_begin() */
+static struct acq_cycle_stats stats;
+
+#if defined(__SAM3X8E__)
+
+static volatile uint32_t ticks;
+
+void SysTick_Handler(void)
+{
+	ticks++;
+}
+
+/*
+ * Ticks so far and time since the last one, from the SysTick down counter,
+ * read again if a tick came in between. A reload the handler did not count
+ * yet, interrupts masked, is pending and counts.
+ */
+static uint32_t ticks_now(uint32_t * since_us)
+{
+	uint32_t t, val, pending;
+
+	do {
+		t = ticks;
+		pending = SCB->ICSR & SCB_ICSR_PENDSTSET_Msk;
+		val = SysTick->VAL;
+	} while(ticks != t || (SCB->ICSR & SCB_ICSR_PENDSTSET_Msk) != pending);
+	*since_us = (SysTick->LOAD - val) / (sysclk_get_cpu_hz() / 1000000);
+	return pending ? t + 1 : t;
+}
+
+#else
+
+static uint64_t base_us;
+
+static uint32_t ticks_now(uint32_t * since_us)
+{
+	const uint64_t us = inv_icm20948_get_time_us() - base_us;
+
+	*since_us = (uint32_t)(us % period_us);
+	return (uint32_t)(us / period_us);
+}
+
+#endif
+
+int acq_cycle_start(uint32_t period)
+{
+	if(period < ACQ_CYCLE_MIN_PERIOD_US || period > ACQ_CYCLE_MAX_PERIOD_US)
+		return INV_ERROR_BAD_ARG;
+
+	period_us = period;
+	ticks_done = 0;
+	memset(&stats, 0, sizeof(stats));
+#if defined(__SAM3X8E__)
+	ticks = 0;
+	if(SysTick_Config((sysclk_get_cpu_hz() / 1000000) * period)) {
+		period_us = 0;
+		return INV_ERROR_BAD_ARG;
+	}
+#else
+	base_us = inv_icm20948_get_time_us();
+#endif
+	return 0;
+}
+
+void acq_cycle_stop(void)
+{
+#if defined(__SAM3X8E__)
+	SysTick->CTRL = 0;
+#endif
+	period_us = 0;
+}
+
+uint32_t acq_cycle_period_us(void)
+{
+	return period_us;
+}
+
+int acq_cycle_begin(void)
+{
+	uint32_t jitter;
+	const uint32_t t = ticks_now(&jitter);
+
+	if(t == ticks_done)
+		return 0;
+	stats.missed += t - ticks_done - 1;
+	ticks_done = t;
+	stats.cycles++;
+	stats.jitter_total += jitter;
+	if(jitter > stats.jitter_max)
+		stats.jitter_max = jitter;
+	return 1;
+}
+
+void acq_cycle_end(void)
+{
+	uint32_t since;
+	/* ticks that came during the sweep count for full periods */
+	const uint32_t late = ticks_now(&since) - ticks_done;
+	const uint32_t busy = late * period_us + since;
+
+	if(late)
+		stats.overruns++;
+	stats.busy_total += busy;
+	if(busy > stats.busy_max)
+		stats.busy_max = busy;
+}
+
+void acq_cycle_idle(void)
+{
+#if defined(__SAM3X8E__)
+	/* no __WFI(), DWT->CYCCNT, the time base, stops while sleeping */
+#else
+	acq_cycle_host_idle();
+#endif
+}
+
+const struct acq_cycle_stats * acq_cycle_get(void)
+{
+	return &stats;
+}
+
+int acq_cycle_send(void)
+{
+	/* <period (4)> <cycles (4)> <overruns (4)> <missed (4)> <jitter mean, max (2*4)> <busy mean, max (2*4)> */
+	uint8_t payload[8*4];
+	const uint32_t n = stats.cycles ? stats.cycles : 1;
+
+	if(!period_us)
+		return -1;
+	inv_dc_int32_to_little8((int32_t)period_us, &payload[0]);
+	inv_dc_int32_to_little8((int32_t)stats.cycles, &payload[4]);
+	inv_dc_int32_to_little8((int32_t)stats.overruns, &payload[8]);
+	inv_dc_int32_to_little8((int32_t)stats.missed, &payload[12]);
+	inv_dc_int32_to_little8((int32_t)(stats.jitter_total / n), &payload[16]);
+	inv_dc_int32_to_little8((int32_t)stats.jitter_max, &payload[20]);
+	inv_dc_int32_to_little8((int32_t)(stats.busy_total / n), &payload[24]);
+	inv_dc_int32_to_little8((int32_t)stats.busy_max, &payload[28]);
+	memset(&stats, 0, sizeof(stats));
+	return host_cmd_send(HOST_CMD_TYPE_ASYNC, HOST_CMD_CODE_CYCLE, payload, sizeof(payload));
+}
@@ -0,0 +1,92 @@
+/*
+ * acq_cycle.h
+ *
+ * Fixed period acquisition cycle.
+ *
+ * Instead of free running, the sweep of run_icm20948.c starts on a timer
+ * tick, SysTick on the Due, so every IMU is read at the same point of each
+ * period and the frames leave evenly spaced. What is left of the period
+ * services the host. The period is derived from the sensor ODR unless the
+ * host sets one (see HOST_CMD_CODE_SET_CYCLE in host_cmd.h).
+ *
+ * Per cycle:
+ *   jitter   time from the tick to the start of the sweep
+ *   busy     time from the tick to the end of the sweep
+ *   overrun  busy longer than the period
+ *   missed   ticks that went by without a sweep
+ *
+ * The statistics are sent and cleared every stats period while the cycle
+ * runs:
+ *   HOST_CMD_CODE_CYCLE <period us (4)> <cycles (4)> <overruns (4)> <missed (4)>
+ *                       <jitter mean (4)> <jitter max (4)>
+ *                       <busy mean (4)> <busy max (4)>
+ * times in us.
+ */
+
+
+#ifndef ACQ_CYCLE_H_
+#define ACQ_CYCLE_H_
+
+#include <stdint.h>
+
+/* SysTick reload is 24 bits, 199 ms at 84 MHz */
+#define ACQ_CYCLE_MAX_PERIOD_US		199000u
+#define ACQ_CYCLE_MIN_PERIOD_US		1000u
+
+struct acq_cycle_stats {
+	uint32_t cycles;
+	uint32_t overruns;
+	uint32_t missed;
+	uint32_t jitter_max;
+	uint64_t jitter_total;
+	uint32_t busy_max;
+	uint64_t busy_total;
+};
+
+/** @brief Start the timer
+ *  @param[in] period_us  cycle period, ACQ_CYCLE_MIN_PERIOD_US to ACQ_CYCLE_MAX_PERIOD_US
+ *  @return 0 on success, INV_ERROR_BAD_ARG if the period is out of range
+ */
+int acq_cycle_start(uint32_t period_us);
+
+/** @brief Stop the timer, back to free running
+ */
+void acq_cycle_stop(void);
+
+/** @brief Period of the running cycle, 0 when stopped
+ */
+uint32_t acq_cycle_period_us(void);
+
+/** @brief Start a cycle if its tick came, never waits
+ *  @return 1 if the cycle started, 0 if the tick is still to come
+ */
+int acq_cycle_begin(void);
+
+/** @brief End the cycle started by acq_cycle_begin()
+ */
+void acq_cycle_end(void);
+
+/** @brief Nothing to do until the next tick
+ *
+ *  Spins on the Due, sleeping would stop DWT->CYCCNT that
+ *  inv_icm20948_get_time_us() counts with. The host build calls
+ *  acq_cycle_host_idle().
+ */
+void acq_cycle_idle(void);
+
+/** @brief Statistics since the last acq_cycle_send()
+ */
+const struct acq_cycle_stats * acq_cycle_get(void);
+
+/** @brief Send the HOST_CMD_CODE_CYCLE frame and clear the statistics
+ *  @return 0 on success, negative value if not sent or stopped
+ */
+int acq_cycle_send(void);
+
+#if !defined(__SAM3X8E__)
+/** @brief Let the time go by, provided by the harness
+ */
+void acq_cycle_host_idle(void);
+#endif
+
+#endif /* ACQ_CYCLE_H_ */
@@ -0,0 +1,221 @@
+/*
+ * bringup.c
+ *
+ * Bring-up of the IMUs, see bringup.h.
+ */
+#include <asf.h>
+#include <string.h>
+#include "delay.h"
+
+#include "Invn/EmbUtils/Message.h"
+#include "Invn/InvError.h"
+
+#include "time_wrapper.h"
+#include "idd_io_hal.h"
+#include "mux_topo.h"
+#include "bringup.h"
+
+static const char * const stage_names[BRINGUP_STAGE_COUNT] = { "probe", "setup", "load", "start" };
+
+static uint8_t stages[BRINGUP_IMUS];
+static uint8_t active[BRINGUP_IMUS];	/* step in progress */
+static unsigned imu_count;
+static bringup_step_t step_cb;
+static int running;
+
+/* Steps in progress, the last one is the one waiting */
+static int nest[BRINGUP_NEST_MAX];
+static unsigned nest_imus[BRINGUP_NEST_MAX];	/* IMUs each step is made for */
+static int depth;
+/* Time of the steps run inside the step in progress */
+static uint64_t inner_us;
+
+static struct bringup_stats stats;
+
+/* bringup_imu(): the IMU brought up, what runs meanwhile */
+static int alone_imu = -1;
+static bringup_yield_t yield_cb;
+static int in_yield;
+
+/* IMU at the earliest stage with no step in progress, -1 if none */
+static int next_imu(void)
+{
+	int best = -1;
+	unsigned i;
+
+	for(i = 0; i < imu_count; ++i) {
+		if(active[i] || stages[i] >= BRINGUP_READY)
+			continue;
+		if(best < 0 || stages[i] < stages[best])
+			best = (int)i;
+	}
+	return best;
+}
+
+static void run_step(int imu)
+{
+	const int stage = stages[imu];
+	const uint64_t start = inv_icm20948_get_time_us();
+	const uint64_t outer_us = inner_us;
+	uint64_t elapsed;
+	uint32_t own;
+	unsigned imus;
+	int rc;
+
+	active[imu] = 1;
+	nest_imus[depth] = 1;
+	nest[depth++] = imu;
+	inner_us = 0;
+	rc = step_cb(imu, stage);
+	imus = nest_imus[--depth];
+	active[imu] = 0;
+
+	/* the steps run during its waits belong to their own IMU */
+	elapsed = inv_icm20948_get_time_us() - start;
+	own = (uint32_t)(elapsed - inner_us);
+	inner_us = outer_us + elapsed;
+	if(running) {
+		stats.stage_us[stage] += own;
+		if(imus > 1) {
+			stats.group_us[stage] += own;
+			stats.grouped[stage] += imus;
+		} else if(own > stats.stage_max_us[stage]) {
+			stats.stage_max_us[stage] = own;
+		}
+	}
+
+	if(rc != 0) {
+		INV_MSG(INV_MSG_LEVEL_ERROR, "IMU %d failed to %s: %d", imu, stage_names[stage], rc);
+		stages[imu] = BRINGUP_FAILED;
+		stats.failed += running;
+	} else if(++stages[imu] == BRINGUP_READY) {
+		stats.ready += running;
+	}
+}
+
+/* Between two transfers of the IMU brought up alone, the others get the bus */
+static int lend(void)
+{
+	int used;
+
+	if(in_yield)
+		return 0;
+	in_yield = 1;
+	used = yield_cb();
+	if(used)
+		mux_topo_select(alone_imu);
+	in_yield = 0;
+	return used;
+}
+
+static void lend_transfer(void)
+{
+	lend();
+}
+
+unsigned bringup_run(unsigned count, bringup_step_t step)
+{
+	const uint64_t start = inv_icm20948_get_time_us();
+	int imu, s;
+
+	if(count > BRINGUP_IMUS)
+		count = BRINGUP_IMUS;
+	memset(stages, BRINGUP_FAILED, sizeof(stages));
+	memset(stages, BRINGUP_STAGE_PROBE, count);
+	memset(active, 0, sizeof(active));
+	memset(&stats, 0, sizeof(stats));
+	imu_count = count;
+	step_cb = step;
+	depth = 0;
+	inner_us = 0;
+
+	running = 1;
+	while((imu = next_imu()) >= 0)
+		run_step(imu);
+	running = 0;
+
+	stats.total_us = (uint32_t)(inv_icm20948_get_time_us() - start);
+	INV_MSG(INV_MSG_LEVEL_INFO, "Boot of %d IMUs in %lu ms, %d failed", stats.ready, (unsigned long)(stats.total_us / 1000), stats.failed);
+	for(s = 0; s < BRINGUP_STAGE_COUNT; ++s) {
+		INV_MSG(INV_MSG_LEVEL_INFO, "  %s: %lu ms, longest IMU %lu ms", stage_names[s],
+				(unsigned long)(stats.stage_us[s] / 1000), (unsigned long)(stats.stage_max_us[s] / 1000));
+		if(stats.grouped[s])
+			INV_MSG(INV_MSG_LEVEL_INFO, "    of which %lu ms for %d IMUs in groups",
+					(unsigned long)(stats.group_us[s] / 1000), stats.grouped[s]);
+	}
+	INV_MSG(INV_MSG_LEVEL_INFO, "  waits: %lu ms, %lu ms of it on other IMUs",
+			(unsigned long)(stats.wait_us / 1000), (unsigned long)(stats.lent_us / 1000));
+	return stats.ready;
+}
+
+int bringup_imu(int imu, bringup_step_t step, bringup_yield_t yield)
+{
+	if(running || alone_imu >= 0 || imu < 0 || imu >= BRINGUP_IMUS)
+		return INV_ERROR_BAD_ARG;
+	stages[imu] = BRINGUP_STAGE_PROBE;
+	step_cb = step;
+	yield_cb = yield;
+	alone_imu = imu;
+	depth = 0;
+	inner_us = 0;
+	idd_io_hal_set_yield(lend_transfer);
+	while(stages[imu] < BRINGUP_READY)
+		run_step(imu);
+	idd_io_hal_set_yield(0);
+	alone_imu = -1;
+	return (stages[imu] == BRINGUP_READY) ? 0 : INV_ERROR;
+}
+
+void bringup_step_group(unsigned imus)
+{
+	if(depth > 0)
+		nest_imus[depth - 1] = imus;
+}
+
+int bringup_stage(int imu)
+{
+	if(imu < 0 || imu >= BRINGUP_IMUS)
+		return BRINGUP_FAILED;
+	return stages[imu];
+}
+
+const struct bringup_stats * bringup_get(void)
+{
+	return &stats;
+}
+
+uint32_t bringup_wait_us(uint32_t us)
+{
+	const uint64_t start = inv_icm20948_get_time_us();
+	const uint64_t end = start + us;
+	/* a broadcast session keeps the bus on its group */
+	const int session = (idd_io_hal_broadcast_mode() != IDD_IO_HAL_UNICAST);
+	uint64_t now;
+	int waiting, imu;
+
+	if(alone_imu >= 0 && !in_yield && !session) {
+		/* the others run until the wait is over, 2 ms at most in between */
+		while((now = inv_icm20948_get_time_us()) < end) {
+			if(!lend())
+				delay_us((end - now < BRINGUP_YIELD_MIN_US) ? (uint32_t)(end - now) : BRINGUP_YIELD_MIN_US);
+		}
+		return 0;
+	}
+	if(!running || depth == 0)
+		return us;
+	stats.wait_us += us;
+	if(session || depth >= BRINGUP_NEST_MAX || us < BRINGUP_YIELD_MIN_US)
+		return us;
+
+	waiting = nest[depth - 1];
+	while(inv_icm20948_get_time_us() < end && (imu = next_imu()) >= 0)
+		run_step(imu);
+
+	now = inv_icm20948_get_time_us();
+	if(now == start)
+		return us;
+	stats.lent_us += (now < end) ? (uint32_t)(now - start) : us;
+	mux_topo_select(waiting);
+	now = inv_icm20948_get_time_us();
+	return (now < end) ? (uint32_t)(end - now) : 0;
+}
@@ -0,0 +1,116 @@
+/*
+ * bringup.h
+ *
+ * Bring-up of the IMUs as a state machine per IMU.
+ *
+ * Each IMU goes through the stages below, the step callback of
+ * run_icm20948.c doing the work of one stage at a time:
+ *   probe   WHO_AM_I, device object
+ *   setup   inv_device_setup(): DMP image written and verified, compass
+ *   load    inv_device_load()
+ *   start   sensors pinged, ODR set and started
+ * bringup_run() advances the IMU at the earliest stage first, so every IMU
+ * is set up before any starts and the FIFOs do not fill while the others
+ * are still booting.
+ *
+ * The driver waits a fixed time in some steps, 60 ms for each transfer to
+ * the compass behind the auxiliary I2C master. The IMU does not need the
+ * bus meanwhile: inv_icm20948_sleep_us() hands the wait to
+ * bringup_wait_us(), which runs the steps of other IMUs until it is over,
+ * then selects the waiting IMU again. Those steps may wait in turn, up to
+ * BRINGUP_NEST_MAX steps in progress, each on the stack of the one before.
+ *
+ * Times are kept per stage, the steps run during a wait counted for their
+ * own IMU and not for the waiting one, and logged at the end. A step made
+ * for a group of IMUs at once (bringup_step_group()) counts for the group,
+ * not as the time of one IMU.
+ *
+ * An IMU that appears later is brought up alone by bringup_imu() while the
+ * others stream: the yield callback, the acquisition sweep, runs between
+ * two bus transfers of the driver (idd_io_hal_set_yield()) and during its
+ * waits, then the IMU is selected again.
+ */
+
+
+#ifndef BRINGUP_H_
+#define BRINGUP_H_
+
+#include <stdint.h>
+
+#include "mux_topo.h"
+
+/* Number of IMUs, indexed as the sensor table of run_icm20948.c */
+#define BRINGUP_IMUS				MUX_TOPO_MAX_DEVICES
+/* Steps in progress at once, each nesting costs the stack of a driver call */
+#define BRINGUP_NEST_MAX			3
+/* Shorter waits are not worth a mux switch to another IMU and back,
+ * bringup_imu() also sleeps this long at most between two yields */
+#define BRINGUP_YIELD_MIN_US		2000u
+
+enum bringup_stage {
+	BRINGUP_STAGE_PROBE = 0,
+	BRINGUP_STAGE_SETUP,
+	BRINGUP_STAGE_LOAD,
+	BRINGUP_STAGE_START,
+	BRINGUP_STAGE_COUNT,
+};
+
+/* Stage of an IMU that is up, and of one that failed */
+#define BRINGUP_READY				BRINGUP_STAGE_COUNT
+#define BRINGUP_FAILED				0xff
+
+struct bringup_stats {
+	uint32_t total_us;							/* first step to last */
+	uint32_t stage_us[BRINGUP_STAGE_COUNT];		/* every IMU */
+	uint32_t stage_max_us[BRINGUP_STAGE_COUNT];	/* longest IMU, alone */
+	uint32_t group_us[BRINGUP_STAGE_COUNT];		/* steps made for a group, part of stage_us */
+	uint16_t grouped[BRINGUP_STAGE_COUNT];		/* IMUs in those groups */
+	uint32_t wait_us;							/* fixed waits of the driver */
+	uint32_t lent_us;							/* part of them spent on other IMUs */
+	uint16_t ready;
+	uint16_t failed;
+};
+
+/** @brief Work of one stage of an IMU, selecting it first
+ *  @return 0 on success, the IMU is left out otherwise
+ */
+typedef int (*bringup_step_t)(int imu, int stage);
+
+/** @brief Work of the other IMUs while one is brought up alone
+ *  @return 1 if it used the bus, 0 if it had nothing to do yet
+ */
+typedef int (*bringup_yield_t)(void);
+
+/** @brief Bring every IMU up
+ *  @param[in] count  IMUs 0 to count - 1, BRINGUP_IMUS at most
+ *  @return number of IMUs ready
+ */
+unsigned bringup_run(unsigned count, bringup_step_t step);
+
+/** @brief Bring one IMU up, yield running between its transfers and waits
+ *  @return 0 if it is ready, negative value otherwise
+ */
+int bringup_imu(int imu, bringup_step_t step, bringup_yield_t yield);
+
+/** @brief The step in progress is made for imus IMUs at once, its own included
+ */
+void bringup_step_group(unsigned imus);
+
+/** @brief Stage an IMU is at, BRINGUP_READY or BRINGUP_FAILED when done
+ */
+int bringup_stage(int imu);
+
+/** @brief Statistics of the last bringup_run()
+ */
+const struct bringup_stats * bringup_get(void);
+
+/** @brief A wait of the driver, inv_icm20948_sleep_us()
+ *
+ *  Outside of bringup_run() and bringup_imu(), too deep in steps or in a
+ *  broadcast session (idd_io_hal_broadcast()), nothing is done, the wait
+ *  still counts in the statistics of bringup_run().
+ *  @return time of the wait still to go, us
+ */
+uint32_t bringup_wait_us(uint32_t us);
+
+#endif /* BRINGUP_H_ */
@@ -0,0 +1,622 @@
+/*
+ * device_array.c
+ *
+ * The IMUs as one device, see device_array.h.
+ */
+#include <asf.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "Invn/InvError.h"
+#include "Invn/Devices/Drivers/Icm20948/Icm20948Defs.h"
+#include "Invn/Devices/Drivers/Icm20948/Icm20948Transport.h"
+
+#include "prof_zone.h"
+#include "idd_io_hal.h"
+#include "device_array.h"
+
+/* Tag of a leader without a call to follow */
+#define NO_TAG		(-1)
+
+/* Device of a follower before its call, in case it has to make it again alone */
+static inv_device_icm20948_t snapshot;
+
+/* Arguments of the calls made by fan_out() */
+struct array_args {
+	int sensor;
+	int setting;			/* or type of the image */
+	uint32_t value;			/* period, timeout, register address or verify */
+	inv_bool_t flag;		/* enable or force */
+	const void * data;		/* matrix, setting, register value or image */
+	unsigned size;
+};
+
+static int targeted(const struct device_array * self, unsigned i)
+{
+	const struct device_array_member * m = self->members[i];
+
+	return m && m->present && (self->target == DEVICE_ARRAY_ALL || self->target == (int)i);
+}
+
+/*
+ * Member the call goes to at index i, put on the bus
+ * Returns 0 if it is not targeted or its select failed, rc then holds why
+ */
+static struct device_array_member * target(struct device_array * self, unsigned i)
+{
+	struct device_array_member * m = self->members[i];
+
+	if(!targeted(self, i))
+		return 0;
+	m->rc = self->select ? self->select((int)i) : 0;
+	if(m->rc < 0)
+		return 0;
+	m->rc = 0;
+	return m;
+}
+
+/* Every member targeted, each put on the bus, m and i its member and index */
+#define FOR_EACH_TARGET(self, m, i) \
+	for((i) = 0; (i) < (self)->count; ++(i)) \
+		if(((m) = target((self), (i))) != 0)
+
+/* Return code of a call: the first error of the members targeted */
+static int fan_in(const struct device_array * self)
+{
+	int found = 0;
+	unsigned i;
+
+	for(i = 0; i < self->count; ++i) {
+		if(!targeted(self, i))
+			continue;
+		if(self->members[i]->rc < 0)
+			return self->members[i]->rc;
+		found = 1;
+	}
+	return found ? 0 : INV_ERROR_BAD_ARG;
+}
+
+/* A call on member i alone */
+static void alone(struct device_array * self, int i, device_array_call_t call, void * arg)
+{
+	struct device_array_member * m = self->members[i];
+
+	m->rc = self->select ? self->select(i) : 0;
+	if(m->rc >= 0)
+		m->rc = call(&m->icm20948.base, i, arg);
+}
+
+/*
+ * A call on the first member of a set, its writes broadcast to all of them
+ * and its reads checked on each, then on the others from the leader's reads,
+ * see idd_io_hal_broadcast()
+ * The followers it did not make are left with tag NO_TAG, made alone with again
+ */
+static void group_call(struct device_array * self, const int * set, unsigned n, int tag,
+		device_array_call_t call, void * arg, int again)
+{
+	struct device_array_member * leader = self->members[set[0]];
+	uint32_t digest;
+	uint64_t diverged;
+	int lost;
+	unsigned k;
+
+	leader->rc = mux_topo_select_group(set, n);
+	if(leader->rc < 0)
+		return;
+	inv_icm20948_transport_init(&leader->icm20948.icm20948_states);
+	idd_io_hal_broadcast(IDD_IO_HAL_LEAD, mux_topo_route, n);
+	leader->rc = call(&leader->icm20948.base, set[0], arg);
+	idd_io_hal_broadcast(IDD_IO_HAL_UNICAST, 0, 0);
+	digest = idd_io_hal_get_session()->digest;
+	diverged = idd_io_hal_get_session()->diverged;
+	lost = idd_io_hal_get_session()->lost;
+	leader->tag = (leader->rc >= 0) ? tag : NO_TAG;
+	self->stats.led++;
+
+	for(k = 1; k < n; ++k) {
+		struct device_array_member * m = self->members[set[k]];
+
+		m->tag = NO_TAG;
+		if(leader->rc >= 0 && !lost && !(diverged & (1ull << k))) {
+			memcpy(&snapshot, &m->icm20948, sizeof(snapshot));
+			inv_icm20948_transport_init(&m->icm20948.icm20948_states);
+			idd_io_hal_broadcast(IDD_IO_HAL_FOLLOW, 0, 0);
+			m->rc = call(&m->icm20948.base, set[k], arg);
+			idd_io_hal_broadcast(IDD_IO_HAL_UNICAST, 0, 0);
+			if(m->rc >= 0 && !idd_io_hal_get_session()->lost && idd_io_hal_get_session()->digest == digest) {
+				m->tag = tag;
+				self->stats.followed++;
+				continue;
+			}
+			/* the device object points to itself, it is restored in place */
+			memcpy(&m->icm20948, &snapshot, sizeof(snapshot));
+		}
+		/* the leader's writes may have left it on another bank */
+		inv_icm20948_transport_init(&m->icm20948.icm20948_states);
+		if(again) {
+			alone(self, set[k], call, arg);
+			self->stats.alone++;
+		}
+	}
+}
+
+/*
+ * A call on every member targeted, through their groups when the array
+ * broadcasts (device_array_set_broadcast())
+ */
+static int fan_out(struct device_array * self, device_array_call_t call, void * arg)
+{
+	int devs[DEVICE_ARRAY_MAX], set[DEVICE_ARRAY_MAX];
+	uint8_t group[DEVICE_ARRAY_MAX];
+	struct device_array_member * m;
+	unsigned n = 0, groups, g, size, i, k;
+
+	if(self->broadcast) {
+		for(i = 0; i < self->count; ++i) {
+			if(targeted(self, i))
+				devs[n++] = (int)i;
+		}
+	}
+	if(n < 2) {
+		FOR_EACH_TARGET(self, m, i)
+			m->rc = call(&m->icm20948.base, (int)i, arg);
+		return fan_in(self);
+	}
+	groups = mux_topo_groups(devs, n, group);
+	for(g = 0; g < groups; ++g) {
+		size = 0;
+		for(k = 0; k < n; ++k) {
+			if(group[k] == g)
+				set[size++] = devs[k];
+		}
+		if(size > 1)
+			group_call(self, set, size, NO_TAG, call, arg, 1);
+		else
+			alone(self, set[0], call, arg);
+	}
+	return fan_in(self);
+}
+
+static void member_event_cb(const inv_sensor_event_t * event, void * context)
+{
+	const struct device_array_member * m = (const struct device_array_member *)context;
+
+	if(m->array->event_cb)
+		m->array->event_cb(event, m->index, m->array->context);
+}
+
+/*
+ * Device interface
+ */
+static int array_whoami(void * context, uint8_t * whoami)
+{
+	struct device_array * self = (struct device_array *)context;
+	struct device_array_member * m;
+	unsigned i;
+
+	FOR_EACH_TARGET(self, m, i)
+		return m->rc = inv_device_whoami(&m->icm20948.base, whoami);
+	return fan_in(self);
+}
+
+static int run_reset(inv_device_t * device, int member, void * arg)
+{
+	(void)member;
+	(void)arg;
+	return inv_device_reset(device);
+}
+
+static int array_reset(void * context)
+{
+	return fan_out((struct device_array *)context, run_reset, 0);
+}
+
+static int run_setup(inv_device_t * device, int member, void * arg)
+{
+	(void)member;
+	(void)arg;
+	return inv_device_setup(device);
+}
+
+static int array_setup(void * context)
+{
+	return fan_out((struct device_array *)context, run_setup, 0);
+}
+
+static int run_cleanup(inv_device_t * device, int member, void * arg)
+{
+	(void)member;
+	(void)arg;
+	return inv_device_cleanup(device);
+}
+
+static int array_cleanup(void * context)
+{
+	return fan_out((struct device_array *)context, run_cleanup, 0);
+}
+
+static int run_load(inv_device_t * device, int member, void * arg)
+{
+	const struct array_args * a = (const struct array_args *)arg;
+
+	(void)member;
+	return inv_device_load(device, a->setting, (const uint8_t *)a->data, a->size, a->value, a->flag);
+}
+
+/* the image of the array when none is given */
+static int array_load(void * context, int type, const uint8_t * image, uint32_t size, inv_bool_t verify, inv_bool_t force)
+{
+	struct device_array * self = (struct device_array *)context;
+	struct array_args a = { 0 };
+
+	a.setting = type;
+	a.data = image ? image : self->image;
+	a.size = image ? size : self->image_size;
+	a.value = verify;
+	a.flag = force;
+	return fan_out(self, run_load, &a);
+}
+
+static int array_poll(void * context)
+{
+	struct device_array * self = (struct device_array *)context;
+	const struct device_array_policy * p = self->policy;
+	int order[DEVICE_ARRAY_MAX];
+	unsigned n = 0, i, k;
+	int rc = 0;
+
+	for(i = 0; i < self->count; ++i) {
+		if(self->members[i] && self->members[i]->present)
+			order[n++] = (int)i;
+	}
+	if(p && p->schedule)
+		n = p->schedule(order, n, p->context);
+	for(k = 0; k < n; ++k) {
+		struct device_array_member * m = self->members[order[k]];
+		int err;
+
+		if(p && p->begin)
+			p->begin(order[k], p->context);
+		err = self->select ? self->select(order[k]) : 0;
+		PROF_ZONE_BEGIN(PROF_ZONE_DEVICE_POLL);
+		if(err >= 0)
+			err = inv_device_poll(&m->icm20948.base);
+		PROF_ZONE_END(PROF_ZONE_DEVICE_POLL);
+		m->rc = (p && p->end) ? p->end(order[k], err, p->context) : err;
+		if(m->rc < 0)
+			rc = m->rc;
+	}
+	return rc;
+}
+
+static int array_self_test(void * context, int sensor)
+{
+	struct device_array * self = (struct device_array *)context;
+	struct device_array_member * m;
+	unsigned i;
+
+	FOR_EACH_TARGET(self, m, i)
+		m->rc = inv_device_self_test(&m->icm20948.base, sensor);
+	return fan_in(self);
+}
+
+static int array_ping_sensor(void * context, int sensor)
+{
+	struct device_array * self = (struct device_array *)context;
+	struct device_array_member * m;
+	unsigned i;
+
+	FOR_EACH_TARGET(self, m, i)
+		m->rc = inv_device_ping_sensor(&m->icm20948.base, sensor);
+	return fan_in(self);
+}
+
+static int run_enable_sensor(inv_device_t * device, int member, void * arg)
+{
+	const struct array_args * a = (const struct array_args *)arg;
+
+	(void)member;
+	return inv_device_enable_sensor(device, a->sensor, a->flag);
+}
+
+static int array_enable_sensor(void * context, int sensor, inv_bool_t en)
+{
+	struct array_args a = { 0 };
+
+	a.sensor = sensor;
+	a.flag = en;
+	return fan_out((struct device_array *)context, run_enable_sensor, &a);
+}
+
+static int run_set_sensor_period_us(inv_device_t * device, int member, void * arg)
+{
+	const struct array_args * a = (const struct array_args *)arg;
+
+	(void)member;
+	return inv_device_set_sensor_period_us(device, a->sensor, a->value);
+}
+
+static int array_set_sensor_period_us(void * context, int sensor, uint32_t period)
+{
+	struct array_args a = { 0 };
+
+	a.sensor = sensor;
+	a.value = period;
+	return fan_out((struct device_array *)context, run_set_sensor_period_us, &a);
+}
+
+static int run_set_sensor_timeout(inv_device_t * device, int member, void * arg)
+{
+	const struct array_args * a = (const struct array_args *)arg;
+
+	(void)member;
+	return inv_device_set_sensor_timeout(device, a->sensor, a->value);
+}
+
+static int array_set_sensor_timeout(void * context, int sensor, uint32_t timeout)
+{
+	struct array_args a = { 0 };
+
+	a.sensor = sensor;
+	a.value = timeout;
+	return fan_out((struct device_array *)context, run_set_sensor_timeout, &a);
+}
+
+static int run_set_sensor_mounting_matrix(inv_device_t * device, int member, void * arg)
+{
+	const struct array_args * a = (const struct array_args *)arg;
+
+	(void)member;
+	return inv_device_set_sensor_mounting_matrix(device, a->sensor, (const float *)a->data);
+}
+
+static int array_set_sensor_mounting_matrix(void * context, int sensor, const float matrix[9])
+{
+	struct array_args a = { 0 };
+
+	a.sensor = sensor;
+	a.data = matrix;
+	return fan_out((struct device_array *)context, run_set_sensor_mounting_matrix, &a);
+}
+
+static int run_set_sensor_config(inv_device_t * device, int member, void * arg)
+{
+	const struct array_args * a = (const struct array_args *)arg;
+
+	(void)member;
+	return inv_device_set_sensor_config(device, a->sensor, a->setting, a->data, a->size);
+}
+
+static int array_set_sensor_config(void * context, int sensor, int setting, const void * arg, unsigned size)
+{
+	struct array_args a = { 0 };
+
+	a.sensor = sensor;
+	a.setting = setting;
+	a.data = arg;
+	a.size = size;
+	return fan_out((struct device_array *)context, run_set_sensor_config, &a);
+}
+
+static int array_get_sensor_config(void * context, int sensor, int setting, void * arg, unsigned size)
+{
+	struct device_array * self = (struct device_array *)context;
+	struct device_array_member * m;
+	unsigned i;
+
+	FOR_EACH_TARGET(self, m, i)
+		return m->rc = inv_device_get_sensor_config(&m->icm20948.base, sensor, setting, arg, size);
+	return fan_in(self);
+}
+
+static int run_write_mems_register(inv_device_t * device, int member, void * arg)
+{
+	const struct array_args * a = (const struct array_args *)arg;
+
+	(void)member;
+	return inv_device_write_mems_register(device, a->sensor, (uint16_t)a->value, a->data, a->size);
+}
+
+static int array_write_mems_register(void * context, int sensor, uint16_t reg_addr, const void * value, unsigned size)
+{
+	struct array_args a = { 0 };
+
+	a.sensor = sensor;
+	a.value = reg_addr;
+	a.data = value;
+	a.size = size;
+	return fan_out((struct device_array *)context, run_write_mems_register, &a);
+}
+
+static int array_read_mems_register(void * context, int sensor, uint16_t reg_addr, void * value, unsigned size)
+{
+	struct device_array * self = (struct device_array *)context;
+	struct device_array_member * m;
+	unsigned i;
+
+	FOR_EACH_TARGET(self, m, i)
+		return m->rc = inv_device_read_mems_register(&m->icm20948.base, sensor, reg_addr, value, size);
+	return fan_in(self);
+}
+
+static const inv_device_vt_t device_array_vt = {
+	array_whoami,
+	array_reset,
+	array_setup,
+	array_cleanup,
+	array_load,
+	array_poll,
+	array_self_test,
+	0, /* get_fw_info */
+	array_ping_sensor,
+	0, /* set_running_state */
+	array_enable_sensor,
+	array_set_sensor_period_us,
+	array_set_sensor_timeout,
+	0, /* flush_sensor */
+	0, /* set_sensor_bias */
+	0, /* get_sensor_bias */
+	array_set_sensor_mounting_matrix,
+	0, /* get_sensor_data */
+	array_set_sensor_config,
+	array_get_sensor_config,
+	array_write_mems_register,
+	array_read_mems_register,
+};
+
+void device_array_init(struct device_array * self, const inv_host_serif_t * serif, int (*select)(int member),
+		device_array_event_cb_t event_cb, void * context, const uint8_t * image, uint32_t image_size)
+{
+	memset(self, 0, sizeof(*self));
+	self->base.instance = self;
+	self->base.vt = &device_array_vt;
+	/* the events go to event_cb, tagged */
+	self->base.listener = 0;
+	self->target = DEVICE_ARRAY_ALL;
+	self->serif = serif;
+	self->select = select;
+	self->event_cb = event_cb;
+	self->context = context;
+	self->image = image;
+	self->image_size = image_size;
+	/* the leaders' checks of the DMP image are not kept as data */
+	idd_io_hal_set_image(image, image_size, DMP_LOAD_START);
+}
+
+void device_array_set_policy(struct device_array * self, const struct device_array_policy * policy)
+{
+	self->policy = policy;
+}
+
+void device_array_target(struct device_array * self, int member)
+{
+	self->target = member;
+}
+
+void device_array_set_broadcast(struct device_array * self, int enable)
+{
+	self->broadcast = enable;
+}
+
+void device_array_group(struct device_array * self, int enable)
+{
+	int devs[DEVICE_ARRAY_MAX];
+	uint8_t group[DEVICE_ARRAY_MAX];
+	int first[DEVICE_ARRAY_MAX];
+	unsigned n = 0, groups = 0, i, k;
+
+	for(i = 0; i < self->count; ++i) {
+		if(!self->members[i])
+			continue;
+		self->members[i]->lead = (int)i;
+		self->members[i]->tag = NO_TAG;
+		if(enable && self->members[i]->present)
+			devs[n++] = (int)i;
+	}
+	if(n == 0)
+		return;
+	mux_topo_groups(devs, n, group);
+	/* numbered in the order of their first member, which leads */
+	for(k = 0; k < n; ++k) {
+		if(group[k] == groups)
+			first[groups++] = devs[k];
+		self->members[devs[k]]->lead = first[group[k]];
+	}
+}
+
+/* Members present a leader leads, itself first */
+static unsigned led_set(const struct device_array * self, int member, int * set)
+{
+	unsigned n = 0, i;
+
+	for(i = 0; i < self->count; ++i) {
+		if(self->members[i] && self->members[i]->present && self->members[i]->lead == member)
+			set[n++] = (int)i;
+	}
+	return n;
+}
+
+unsigned device_array_led(const struct device_array * self, int member)
+{
+	const struct device_array_member * m = device_array_member(self, member);
+	int set[DEVICE_ARRAY_MAX];
+
+	if(!m || m->lead != member)
+		return 0;
+	return led_set(self, member, set);
+}
+
+int device_array_call(struct device_array * self, int member, int tag, device_array_call_t call, void * arg)
+{
+	struct device_array_member * m = device_array_member(self, member);
+	int set[DEVICE_ARRAY_MAX];
+	unsigned n;
+
+	if(!m)
+		return INV_ERROR_BAD_ARG;
+	if(m->lead != member) {
+		/* made by its leader already, or alone */
+		if(m->tag != tag) {
+			alone(self, member, call, arg);
+			self->stats.alone++;
+		}
+		m->tag = NO_TAG;
+		return m->rc;
+	}
+	n = led_set(self, member, set);
+	if(n > 1)
+		group_call(self, set, n, tag, call, arg, 0);
+	else
+		alone(self, member, call, arg);
+	return m->rc;
+}
+
+int device_array_add(struct device_array * self)
+{
+	struct device_array_member * m;
+
+	if(self->count >= DEVICE_ARRAY_MAX)
+		return INV_ERROR_MEM;
+	m = calloc(1, sizeof(*m));
+	if(!m)
+		return INV_ERROR_MEM;
+	m->present = 1;
+	m->lead = (int)self->count;
+	m->array = self;
+	m->index = (int)self->count;
+	m->tag = NO_TAG;
+	inv_sensor_listener_init(&m->listener, member_event_cb, m);
+	self->members[self->count] = m;
+	return (int)self->count++;
+}
+
+void device_array_clear(struct device_array * self)
+{
+	unsigned i;
+
+	for(i = 0; i < self->count; ++i) {
+		free(self->members[i]);
+		self->members[i] = 0;
+	}
+	self->count = 0;
+}
+
+void device_array_member_init(struct device_array * self, int member)
+{
+	struct device_array_member * m = device_array_member(self, member);
+
+	if(!m)
+		return;
+	inv_device_icm20948_init(&m->icm20948, self->serif, &m->listener, self->image, self->image_size);
+}
+
+inv_device_t * device_array_select(struct device_array * self, int member)
+{
+	struct device_array_member * m = device_array_member(self, member);
+
+	if(!m)
+		return 0;
+	m->rc = self->select ? self->select(member) : 0;
+	return (m->rc < 0) ? 0 : &m->icm20948.base;
+}
@@ -0,0 +1,189 @@
+/*
+ * device_array.h
+ *
+ * The IMUs as one device of the Invn Device interface (Invn/Devices/Device.h).
+ *
+ * A device_array owns one inv_device_icm20948_t per IMU, all of them behind
+ * the same serial interface and started from one DMP image. Its base object
+ * takes the inv_device_*() calls:
+ *  - the commands go out to the targeted members, every member present or
+ *    one of them (device_array_target()), each selected on the bus first.
+ *    The call returns 0 when every member took it, the first error
+ *    otherwise, INV_ERROR_BAD_ARG when no member is targeted. Each member
+ *    keeps its own return code in rc. whoami and the reads go to the first
+ *    member targeted only.
+ *  - inv_device_poll() polls every member present once, in the order and
+ *    with the work around each poll of a policy (struct device_array_policy),
+ *    in index order without one.
+ * The events of all members go to one listener, with the index of the
+ * member that gave them.
+ *
+ * The members at one address behind different mux channels take the same
+ * writes at once (mux_topo_groups()). With broadcast on, a command that
+ * writes is made on the first member of each group, its leader, the writes
+ * reaching the whole group and the reads made on every member, then on the
+ * others, its followers, from the leader's reads without the bus, see
+ * idd_io_hal_broadcast(). A follower that read or wrote otherwise makes the
+ * command again alone. device_array_call() does the same for a call made
+ * member by member, as the bring-up steps: the leader's call makes it for
+ * its followers.
+ *
+ * Members are allocated one by one and never moved, the device object of
+ * each points to itself. They are indexed as mux_topo.h, a member left out
+ * stays in the array with present cleared.
+ */
+
+
+#ifndef DEVICE_ARRAY_H_
+#define DEVICE_ARRAY_H_
+
+#include <stdint.h>
+
+#include "Invn/Devices/Device.h"
+#include "Invn/Devices/DeviceIcm20948.h"
+
+#include "mux_topo.h"
+
+/* Number of members */
+#define DEVICE_ARRAY_MAX			MUX_TOPO_MAX_DEVICES
+/* Target of the commands to every member present */
+#define DEVICE_ARRAY_ALL			(-1)
+
+/** @brief Event of a member
+ *  @param[in] member   index of the member that gave it
+ *  @param[in] context  context given to device_array_init()
+ */
+typedef void (*device_array_event_cb_t)(const inv_sensor_event_t * event, int member, void * context);
+
+struct device_array;
+
+struct device_array_member {
+	int present;				/* streams, polled and taking the commands */
+	int ready;					/* its sensors are started */
+	int rc;						/* return code of the last call it took */
+	int lead;					/* member leading its group, see device_array_group() */
+	inv_device_icm20948_t icm20948;
+	/* internal */
+	inv_sensor_listener_t listener;
+	struct device_array * array;
+	int index;
+	int tag;					/* of the call its leader made for it */
+};
+
+/** @brief A call on the device of a member, see device_array_call()
+ */
+typedef int (*device_array_call_t)(inv_device_t * device, int member, void * arg);
+
+/* Calls through the groups */
+struct device_array_stats {
+	uint32_t led;				/* by a leader for its group */
+	uint32_t followed;			/* followers the leader's call did */
+	uint32_t alone;				/* followers that made it on their own */
+};
+
+/* How inv_device_poll() goes through the members */
+struct device_array_policy {
+	/* the members to poll and their order, out of the n present given in index
+	 * order, returns how many to poll */
+	unsigned (*schedule)(int * members, unsigned n, void * context);
+	/* before a member is selected and polled */
+	void (*begin)(int member, void * context);
+	/* after, with the return code of the poll, returns it as the policy sees it */
+	int (*end)(int member, int rc, void * context);
+	void * context;
+};
+
+struct device_array {
+	inv_device_t base;
+	unsigned count;				/* members allocated */
+	struct device_array_member * members[DEVICE_ARRAY_MAX];
+	/* internal */
+	int target;
+	const inv_host_serif_t * serif;
+	int (*select)(int member);
+	device_array_event_cb_t event_cb;
+	void * context;
+	const uint8_t * image;
+	uint32_t image_size;
+	const struct device_array_policy * policy;
+	int broadcast;
+	struct device_array_stats stats;
+};
+
+/** @brief Constructor of an empty array
+ *  @param[in] serif     serial interface of every member
+ *  @param[in] select    puts a member on the bus (mux_topo_select()), 0 if they all are
+ *  @param[in] event_cb  listener of the events of every member
+ *  @param[in] image     DMP image every member loads
+ */
+void device_array_init(struct device_array * self, const inv_host_serif_t * serif, int (*select)(int member),
+		device_array_event_cb_t event_cb, void * context, const uint8_t * image, uint32_t image_size);
+
+/** @brief Base object, for the inv_device_*() calls
+ */
+static inline inv_device_t * device_array_get_base(struct device_array * self)
+{
+	return &self->base;
+}
+
+/** @brief Policy of inv_device_poll(), 0 for every member in index order
+ *  @param[in] policy  not copied
+ */
+void device_array_set_policy(struct device_array * self, const struct device_array_policy * policy);
+
+/** @brief Member the commands go to, DEVICE_ARRAY_ALL for every member present
+ */
+void device_array_target(struct device_array * self, int member);
+
+/** @brief Broadcast the writes of the commands to the groups of the members targeted
+ *
+ *  The members are to be those of mux_topo.h, selected with mux_topo_select().
+ */
+void device_array_set_broadcast(struct device_array * self, int enable);
+
+/** @brief Group the members present for device_array_call(), or leave every member alone
+ */
+void device_array_group(struct device_array * self, int enable);
+
+/** @brief Make a call on a member as part of its group (device_array_group())
+ *
+ *  The call on the leader is made for every member present in the group.
+ *  On a follower, it returns what the leader's call of the same tag left,
+ *  makes the call alone if that did not make it.
+ *  @param[in] tag  what the call is, 0 or more, the same for every member
+ *  @param[in] arg  given to call as is, with the member it is made on
+ *  @return return code of the call on the member
+ */
+int device_array_call(struct device_array * self, int member, int tag, device_array_call_t call, void * arg);
+
+/** @brief Members a device_array_call() on member is made for, its own included
+ *  @return 1 for a member alone, 0 for a follower
+ */
+unsigned device_array_led(const struct device_array * self, int member);
+
+/** @brief Allocate a member at the end, present
+ *  @return its index, INV_ERROR_MEM if there is no memory or room left
+ */
+int device_array_add(struct device_array * self);
+
+/** @brief Free every member
+ */
+void device_array_clear(struct device_array * self);
+
+/** @brief Construct the device of a member, before it is set up (inv_device_icm20948_init())
+ */
+void device_array_member_init(struct device_array * self, int member);
+
+/** @brief Put a member on the bus
+ *  @return its device, 0 if there is no such member or the select fails
+ */
+inv_device_t * device_array_select(struct device_array * self, int member);
+
+/** @brief A member, 0 if there is none at that index
+ */
+static inline struct device_array_member * device_array_member(const struct device_array * self, int member)
+{
+	return (member >= 0 && (unsigned)member < self->count) ? self->members[member] : 0;
+}
+
+#endif /* DEVICE_ARRAY_H_ */
@@ -0,0 +1,301 @@
+/*
+ * dynpro_cdc.c
+ *
+ * DynProtocol over USB CDC, see dynpro_cdc.h.
+ * Frames are written in one block with serialWrite(), received bytes come
+ * from the RX FIFO through host_cmd_process().
+ */
+#include <asf.h>
+#include <string.h>
+
+#include "Invn/InvError.h"
+#include "Invn/EmbUtils/Message.h"
+#include "Invn/EmbUtils/DataConverter.h"
+#include "Invn/DynamicProtocol/DynProtocol.h"
+#include "Invn/DynamicProtocol/DynProtocolTransportUart.h"
+
+#include "usb_cdc_coms.h"
+#include "host_cmd.h"
+#include "run_icm20948.h"
+#include "dynpro_cdc.h"
+
+#define DYNPRO_CDC_SYNC_BYTE_0		0x55
+#define DYNPRO_CDC_TRANSPORT_OVERHEAD	4
+
+static DynProtocol_t protocol;
+static DynProTransportUart_t transport;
+
+/* Set by the protocol callback when a command was executed */
+static int cmd_executed;
+
+/* static to take on .bss */
+static DynProtocolEdata_t resp_edata;
+static DynProtocolEdata_t async_edata;
+static uint8_t tx_buffer[DYNPRO_CDC_TRANSPORT_OVERHEAD + DYNPRO_CDC_MAX_PACKET_SIZE];
+
+/* Batch being built, packet is in batch_buffer after the transport header */
+static uint8_t batch_buffer[DYNPRO_CDC_TRANSPORT_OVERHEAD + DYNPRO_CDC_MAX_PACKET_SIZE];
+static uint16_t batch_len;
+
+static void send_frame(uint8_t * mem_buf, uint16_t payload_len)
+{
+	DynProTransportUartFrame_t frame;
+
+	DynProTransportUart_txAssignBuffer(&transport, &frame, mem_buf, DYNPRO_CDC_TRANSPORT_OVERHEAD + DYNPRO_CDC_MAX_PACKET_SIZE);
+	frame.payload_len = payload_len;
+	if(DynProTransportUart_txEncodeFrame(&transport, &frame) == 0)
+		DynProTransportUart_txSendFrame(&transport, &frame);
+}
+
+/*
+ * Convert sensor_event to VSensorData because dynamic protocol transports VSensorData
+ */
+static void convert_sensor_event_to_dyn_prot_data(const inv_sensor_event_t * event, VSensorDataAny * vsensor_data)
+{
+	memset(vsensor_data, 0, sizeof(*vsensor_data));
+	vsensor_data->base.timestamp = event->timestamp;
+
+	switch(INV_SENSOR_ID_TO_TYPE(event->sensor)) {
+	case DYN_PRO_SENSOR_TYPE_ACCELEROMETER:
+	case DYN_PRO_SENSOR_TYPE_GRAVITY:
+	case DYN_PRO_SENSOR_TYPE_LINEAR_ACCELERATION:
+		inv_dc_float_to_sfix32(&event->data.acc.vect[0], 3, 16, (int32_t *)&vsensor_data->data.u32[0]);
+		vsensor_data->base.meta_data = event->data.acc.accuracy_flag;
+		break;
+	case DYN_PRO_SENSOR_TYPE_GYROSCOPE:
+		inv_dc_float_to_sfix32(&event->data.gyr.vect[0], 3, 16, (int32_t *)&vsensor_data->data.u32[0]);
+		vsensor_data->base.meta_data = event->data.gyr.accuracy_flag;
+		break;
+	case DYN_PRO_SENSOR_TYPE_MAGNETOMETER:
+		inv_dc_float_to_sfix32(&event->data.mag.vect[0], 3, 16, (int32_t *)&vsensor_data->data.u32[0]);
+		vsensor_data->base.meta_data = event->data.mag.accuracy_flag;
+		break;
+	case DYN_PRO_SENSOR_TYPE_UNCAL_GYROSCOPE:
+		inv_dc_float_to_sfix32(&event->data.gyr.vect[0], 3, 16, (int32_t *)&vsensor_data->data.u32[0]);
+		inv_dc_float_to_sfix32(&event->data.gyr.bias[0], 3, 16, (int32_t *)&vsensor_data->data.u32[3]);
+		vsensor_data->base.meta_data = event->data.gyr.accuracy_flag;
+		break;
+	case DYN_PRO_SENSOR_TYPE_UNCAL_MAGNETOMETER:
+		inv_dc_float_to_sfix32(&event->data.mag.vect[0], 3, 16, (int32_t *)&vsensor_data->data.u32[0]);
+		inv_dc_float_to_sfix32(&event->data.mag.bias[0], 3, 16, (int32_t *)&vsensor_data->data.u32[3]);
+		vsensor_data->base.meta_data = event->data.mag.accuracy_flag;
+		break;
+	case DYN_PRO_SENSOR_TYPE_GAME_ROTATION_VECTOR:
+		memcpy(&vsensor_data->data.u32[0], event->data.quaternion.quat_q30, sizeof(event->data.quaternion.quat_q30));
+		vsensor_data->base.meta_data = event->data.quaternion.accuracy_flag;
+		break;
+	case DYN_PRO_SENSOR_TYPE_ROTATION_VECTOR:
+	case DYN_PRO_SENSOR_TYPE_GEOMAG_ROTATION_VECTOR:
+		/* already in the Q30 of the wire, the accuracy goes from Q29 to Q16 */
+		memcpy(&vsensor_data->data.u32[0], event->data.quaternion.quat_q30, sizeof(event->data.quaternion.quat_q30));
+		vsensor_data->data.u32[4] = (uint32_t)(event->data.quaternion.accuracy_q29 >> 13);
+		vsensor_data->base.meta_data = event->data.quaternion.accuracy_flag;
+		break;
+	case DYN_PRO_SENSOR_TYPE_ORIENTATION:
+		inv_dc_float_to_sfix32(&event->data.orientation.x, 1, 16, (int32_t *)&vsensor_data->data.u32[0]);
+		inv_dc_float_to_sfix32(&event->data.orientation.y, 1, 16, (int32_t *)&vsensor_data->data.u32[1]);
+		inv_dc_float_to_sfix32(&event->data.orientation.z, 1, 16, (int32_t *)&vsensor_data->data.u32[2]);
+		vsensor_data->base.meta_data = event->data.orientation.accuracy_flag;
+		break;
+	case DYN_PRO_SENSOR_TYPE_RAW_ACCELEROMETER:
+	case DYN_PRO_SENSOR_TYPE_RAW_GYROSCOPE:
+		vsensor_data->data.u32[0] = event->data.raw3d.vect[0];
+		vsensor_data->data.u32[1] = event->data.raw3d.vect[1];
+		vsensor_data->data.u32[2] = event->data.raw3d.vect[2];
+		break;
+	case DYN_PRO_SENSOR_TYPE_STEP_COUNTER:
+		vsensor_data->data.u32[0] = (uint32_t)event->data.step.count;
+		break;
+	case DYN_PRO_SENSOR_TYPE_BAC:
+		vsensor_data->data.u8[0] = (uint8_t)(int8_t)event->data.bac.event;
+		break;
+	case DYN_PRO_SENSOR_TYPE_B2S:
+	case DYN_PRO_SENSOR_TYPE_SMD:
+	case DYN_PRO_SENSOR_TYPE_STEP_DETECTOR:
+	case DYN_PRO_SENSOR_TYPE_TILT_DETECTOR:
+	case DYN_PRO_SENSOR_TYPE_PICK_UP_GESTURE:
+		vsensor_data->data.u8[0] = event->data.event;
+		break;
+	default:
+		break;
+	}
+}
+
+/*
+ * Dispatch received command, commands address every present IMU
+ */
+static int handle_command(enum DynProtocolEid eid, const DynProtocolEdata_t * edata)
+{
+	const int sensor = edata->sensor_id;
+	uint8_t whoami;
+	int rc;
+
+	switch(eid) {
+	case DYN_PROTOCOL_EID_PROTOCOLVERSION:
+		memset(resp_edata.d.response.version, 0, sizeof(resp_edata.d.response.version));
+		strncpy(resp_edata.d.response.version, DYN_PROTOCOL_VERSION, sizeof(resp_edata.d.response.version) - 1);
+		return 0;
+
+	case DYN_PROTOCOL_EID_GET_SW_REG:
+		/* no handshake support on the CDC link */
+		return 0;
+
+	case DYN_PROTOCOL_EID_WHO_AM_I:
+		rc = run_icm20948_whoami(HOST_CMD_ALL_IMUS, &whoami);
+		return (rc == 0) ? whoami : rc;
+
+	case DYN_PROTOCOL_EID_SETUP:
+	case DYN_PROTOCOL_EID_CLEANUP:
+		/* devices are set up at boot */
+		return 0;
+
+	case DYN_PROTOCOL_EID_PING_SENSOR:
+		INV_MSG(INV_MSG_LEVEL_DEBUG, "dynpro_cdc: received command ping(%s)", inv_sensor_2str(sensor));
+		return run_icm20948_ping_sensor(HOST_CMD_ALL_IMUS, sensor);
+
+	case DYN_PROTOCOL_EID_START_SENSOR:
+	case DYN_PROTOCOL_EID_STOP_SENSOR:
+		INV_MSG(INV_MSG_LEVEL_DEBUG, "dynpro_cdc: received command %s(%s)",
+				(eid == DYN_PROTOCOL_EID_START_SENSOR) ? "start" : "stop", inv_sensor_2str(sensor));
+		return run_icm20948_enable_sensor(HOST_CMD_ALL_IMUS, sensor, (eid == DYN_PROTOCOL_EID_START_SENSOR));
+
+	case DYN_PROTOCOL_EID_SET_SENSOR_PERIOD:
+		INV_MSG(INV_MSG_LEVEL_DEBUG, "dynpro_cdc: received command set_period(%s, %d us)",
+				inv_sensor_2str(sensor), edata->d.command.period);
+		return run_icm20948_set_sensor_period(HOST_CMD_ALL_IMUS, sensor, edata->d.command.period);
+
+	default:
+		return INV_ERROR_NIMPL;
+	}
+}
+
+static void protocol_event_cb(enum DynProtocolEtype etype, enum DynProtocolEid eid,
+		const DynProtocolEdata_t * edata, void * cookie)
+{
+	uint8_t * payload = &tx_buffer[DYNPRO_CDC_TRANSPORT_OVERHEAD];
+	uint16_t payload_len;
+	int rc;
+
+	(void)cookie;
+
+	if(etype != DYN_PROTOCOL_ETYPE_CMD) {
+		INV_MSG(INV_MSG_LEVEL_WARNING, "dynpro_cdc: unexpected packet received. Ignored.");
+		return;
+	}
+
+	cmd_executed = 1;
+	if(run_icm20948_get_output_format() < OUTPUT_FORMAT_DYNPROTOCOL)
+		run_icm20948_set_output_format(OUTPUT_FORMAT_DYNPROTOCOL);
+
+	rc = handle_command(eid, edata);
+	resp_edata.d.response.rc = rc;
+
+	if(DynProtocol_encodeResponse(&protocol, eid, &resp_edata,
+			payload, DYNPRO_CDC_MAX_PACKET_SIZE, &payload_len) != 0) {
+		INV_MSG(INV_MSG_LEVEL_WARNING, "dynpro_cdc: encode error, response dropped");
+		return;
+	}
+	send_frame(tx_buffer, payload_len);
+}
+
+static void transport_event_cb(enum DynProTransportEvent e,
+	union DynProTransportEventData data, void * cookie)
+{
+	(void)cookie;
+
+	switch(e) {
+	case DYN_PRO_TRANSPORT_EVENT_ERROR:
+		DynProtocol_processReset(&protocol);
+		break;
+
+	case DYN_PRO_TRANSPORT_EVENT_PKT_SIZE:
+		/* also rejects host_cmd frames, their header reads as a huge size */
+		if(data.pkt_size > DYNPRO_CDC_MAX_PACKET_SIZE) {
+			DynProTransportUart_rxProcessReset(&transport);
+			DynProtocol_processReset(&protocol);
+			break;
+		}
+		DynProtocol_processReset(&protocol);
+		DynProtocol_setCurrentFrameSize(&protocol, data.pkt_size);
+		break;
+
+	case DYN_PRO_TRANSPORT_EVENT_PKT_BYTE:
+		DynProtocol_processPktByte(&protocol, data.pkt_byte);
+		break;
+
+	case DYN_PRO_TRANSPORT_EVENT_TX_BLOCK:
+		serialWrite((char *)data.tx_block.buffer, data.tx_block.len);
+		break;
+
+	default:
+		break;
+	}
+}
+
+void dynpro_cdc_init(void)
+{
+	DynProTransportUart_init(&transport, transport_event_cb, 0);
+	DynProTransportUart_enableTxBlock(&transport);
+	DynProtocol_init(&protocol, protocol_event_cb, 0);
+	/* Icm20948 is set by default to 4g(Q13) and 2000dps(Q4) */
+	DynProtocol_setPrecision(&protocol, DYN_PRO_SENSOR_TYPE_ACCELEROMETER, 13);
+	DynProtocol_setPrecision(&protocol, DYN_PRO_SENSOR_TYPE_GYROSCOPE, 4);
+	cmd_executed = 0;
+	batch_len = 0;
+}
+
+int dynpro_cdc_process_byte(uint8_t byte)
+{
+	/* skip bytes of other frames without reporting a transport error for each */
+	if(transport.rx_sm_state == RECEIVER_STATE_IDLE && byte != DYNPRO_CDC_SYNC_BYTE_0)
+		return 0;
+
+	cmd_executed = 0;
+	DynProTransportUart_rxProcessByte(&transport, byte);
+
+	return cmd_executed;
+}
+
+void dynpro_cdc_sensor_event(int imu, const inv_sensor_event_t * event, int batch)
+{
+	uint8_t * payload;
+	uint16_t payload_len;
+
+	async_edata.sensor_id = INV_SENSOR_ID_TO_TYPE(event->sensor);
+	async_edata.device_id = imu;
+	async_edata.d.async.sensorEvent.status = DYN_PRO_SENSOR_STATUS_DATA_UPDATED;
+	convert_sensor_event_to_dyn_prot_data(event, &async_edata.d.async.sensorEvent.vdata);
+
+	if(!batch) {
+		payload = &tx_buffer[DYNPRO_CDC_TRANSPORT_OVERHEAD];
+		if(DynProtocol_encodeAsync(&protocol, DYN_PROTOCOL_EID_NEW_SENSOR_DATA, &async_edata,
+				payload, DYNPRO_CDC_MAX_PACKET_SIZE, &payload_len) != 0) {
+			INV_MSG(INV_MSG_LEVEL_WARNING, "dynpro_cdc: encode error, frame dropped");
+			return;
+		}
+		send_frame(tx_buffer, payload_len);
+		return;
+	}
+
+	payload = &batch_buffer[DYNPRO_CDC_TRANSPORT_OVERHEAD];
+	if(batch_len == 0)
+		DynProtocol_encodeBatchStart(&protocol, payload, DYNPRO_CDC_MAX_PACKET_SIZE, &batch_len);
+
+	if(DynProtocol_encodeBatchAdd(&protocol, &async_edata, payload, DYNPRO_CDC_MAX_PACKET_SIZE, &batch_len) == INV_ERROR_SIZE) {
+		/* batch is full, send it and start a new one with this event */
+		dynpro_cdc_flush();
+		DynProtocol_encodeBatchStart(&protocol, payload, DYNPRO_CDC_MAX_PACKET_SIZE, &batch_len);
+		if(DynProtocol_encodeBatchAdd(&protocol, &async_edata, payload, DYNPRO_CDC_MAX_PACKET_SIZE, &batch_len) != 0) {
+			INV_MSG(INV_MSG_LEVEL_WARNING, "dynpro_cdc: encode error, frame dropped");
+			batch_len = 0;
+		}
+	}
+}
+
+void dynpro_cdc_flush(void)
+{
+	/* a batch with no event is not worth sending */
+	if(batch_len > 3)
+		send_frame(batch_buffer, batch_len);
+	batch_len = 0;
+}
@@ -0,0 +1,54 @@
+/*
+ * dynpro_cdc.h
+ *
+ * DynProtocol (sensor-cli protocol) over the USB CDC link.
+ *
+ * Packets are framed by DynProTransportUart:
+ *   0x55 0xAA <SIZE (2, LE)> <DynProtocol packet (SIZE)>
+ * Commands received from the host apply to every present IMU. Receiving a
+ * command switches the sensor output to OUTPUT_FORMAT_DYNPROTOCOL unless one
+ * of the DynProtocol formats is already selected.
+ *
+ * In OUTPUT_FORMAT_DYNPROTOCOL each sample is sent in its own
+ * DYN_PROTOCOL_EID_NEW_SENSOR_DATA packet, as expected by existing clients.
+ * In OUTPUT_FORMAT_DYNPROTOCOL_BATCH the samples of one sweep are packed in
+ * DYN_PROTOCOL_EID_NEW_SENSOR_DATA_BATCH packets, the device id of each
+ * event being the IMU index.
+ */
+
+
+#ifndef DYNPRO_CDC_H_
+#define DYNPRO_CDC_H_
+
+#include <stdint.h>
+
+#include "Invn/Devices/SensorTypes.h"
+
+/* Largest DynProtocol packet sent, sized for the receiver buffer of DynProtocol_t */
+#define DYNPRO_CDC_MAX_PACKET_SIZE	(2 + 256)
+
+/** @brief Reset protocol and transport states
+ */
+void dynpro_cdc_init(void);
+
+/** @brief Feed one byte received from the host
+ *
+ *  Bytes that cannot start a transport frame are skipped while waiting for
+ *  one, so the same stream can be fed to the host_cmd parser too.
+ *
+ *  @return 1 if a command was executed, 0 otherwise
+ */
+int dynpro_cdc_process_byte(uint8_t byte);
+
+/** @brief Send a sensor event
+ *  @param[in] imu    index of the IMU the event comes from
+ *  @param[in] event  sensor event
+ *  @param[in] batch  1 to add the event to the current batch, 0 to send it now
+ */
+void dynpro_cdc_sensor_event(int imu, const inv_sensor_event_t * event, int batch);
+
+/** @brief Send the current batch, if any, to be called at the end of a sweep
+ */
+void dynpro_cdc_flush(void);
+
+#endif /* DYNPRO_CDC_H_ */
@@ -0,0 +1,114 @@
+/*
+ * fault.c
+ *
+ * Fault policy of the IMUs, see fault.h.
+ */
+#include <asf.h>
+#include <string.h>
+
+#include "Invn/EmbUtils/Message.h"
+#include "Invn/InvError.h"
+
+#include "time_wrapper.h"
+#include "fault.h"
+
+static struct fault_imu imus[FAULT_IMUS];
+
+/* base doubled n - 1 times, up to max */
+static uint32_t backoff_us(uint32_t base, uint32_t max, unsigned n)
+{
+	while(--n && base < max)
+		base <<= 1;
+	return (base < max) ? base : max;
+}
+
+void fault_init(void)
+{
+	memset(imus, 0, sizeof(imus));
+}
+
+int fault_poll_due(int imu)
+{
+	struct fault_imu * f;
+
+	if(imu < 0 || imu >= FAULT_IMUS)
+		return 1;
+	f = &imus[imu];
+	if(f->state == FAULT_STATE_OK)
+		return 1;
+	if(f->state == FAULT_STATE_QUARANTINED)
+		return 0;
+	return inv_icm20948_get_time_us() >= f->next_us;
+}
+
+int fault_polled(int imu, int rc, uint32_t samples, int streaming)
+{
+	const uint64_t now = inv_icm20948_get_time_us();
+	struct fault_imu * f;
+
+	if(imu < 0 || imu >= FAULT_IMUS)
+		return 0;
+	f = &imus[imu];
+	if(samples != f->samples || !streaming) {
+		f->samples = samples;
+		f->progress_us = now;
+	} else if(rc >= 0 && now - f->progress_us > FAULT_STALL_US) {
+		rc = INV_ERROR;
+	}
+	if(rc >= 0) {
+		f->state = FAULT_STATE_OK;
+		f->fails = 0;
+		return 0;
+	}
+	f->failed_polls++;
+	if(++f->fails < FAULT_QUARANTINE_FAILS) {
+		f->state = FAULT_STATE_BACKOFF;
+		f->next_us = now + backoff_us(FAULT_BACKOFF_MIN_US, FAULT_BACKOFF_MAX_US, f->fails);
+		return 0;
+	}
+	INV_MSG(INV_MSG_LEVEL_WARNING, "IMU %d quarantined after %d failed polls", imu, f->fails);
+	f->state = FAULT_STATE_QUARANTINED;
+	f->quarantines++;
+	f->fails = 0;
+	f->next_us = now + FAULT_RECOVERY_MIN_US;
+	return 1;
+}
+
+int fault_recovery_due(int imu)
+{
+	if(imu < 0 || imu >= FAULT_IMUS)
+		return 0;
+	return inv_icm20948_get_time_us() >= imus[imu].next_us;
+}
+
+void fault_brought_up(int imu, int ok)
+{
+	struct fault_imu * f;
+
+	if(imu < 0 || imu >= FAULT_IMUS)
+		return;
+	f = &imus[imu];
+	if(ok) {
+		if(f->state == FAULT_STATE_QUARANTINED)
+			f->recoveries++;
+		f->state = FAULT_STATE_OK;
+		f->fails = 0;
+		/* time for its first samples */
+		f->progress_us = inv_icm20948_get_time_us();
+		return;
+	}
+	/* the first failure of an IMU that was never up quarantines it */
+	if(f->state != FAULT_STATE_QUARANTINED) {
+		f->state = FAULT_STATE_QUARANTINED;
+		f->quarantines++;
+		f->fails = 0;
+	}
+	if(f->fails < 0xff)
+		f->fails++;
+	f->next_us = inv_icm20948_get_time_us() + backoff_us(FAULT_RECOVERY_MIN_US, FAULT_RECOVERY_MAX_US, f->fails);
+}
+
+const struct fault_imu * fault_get(int imu)
+{
+	return &imus[imu];
+}
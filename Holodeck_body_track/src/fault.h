@@ -0,0 +1,94 @@
+/*
+ * fault.h
+ *
+ * Fault policy of the IMUs: one that fails is left aside, the others
+ * stream on.
+ *
+ * A poll fails when the driver returns an error or one of its transfers
+ * still fails after the retries of idd_io_hal.c. It also fails when the
+ * IMU has sensors started but sent no sample for FAULT_STALL_US, as one
+ * reset by a power glitch answers but lost its DMP image.
+ *
+ * After a failed poll the IMU is skipped by the sweeps for a backoff time,
+ * FAULT_BACKOFF_MIN_US doubled on each failure in a row up to
+ * FAULT_BACKOFF_MAX_US, so a flaky IMU does not take the bus time of the
+ * healthy ones with its NACKs. After FAULT_QUARANTINE_FAILS failures in a
+ * row it is quarantined: no longer polled, its slot is probed again by the
+ * recovery of hotplug.h and the IMU is brought up anew when it answers. A
+ * bring-up that fails doubles the time to the next one, from
+ * FAULT_RECOVERY_MIN_US to FAULT_RECOVERY_MAX_US, as it holds the bus for a
+ * while. A successful poll clears the failures.
+ *
+ * The state and the counters of each IMU go in its HOST_CMD_CODE_HEALTH_IMU
+ * frame, see health.h.
+ */
+
+
+#ifndef FAULT_H_
+#define FAULT_H_
+
+#include <stdint.h>
+
+#include "mux_topo.h"
+
+/* Number of IMUs, indexed as the sensor table of run_icm20948.c */
+#define FAULT_IMUS					MUX_TOPO_MAX_DEVICES
+/* Failed polls in a row that quarantine an IMU */
+#define FAULT_QUARANTINE_FAILS		8
+/* Polls skipped after a failure, doubled on each failure in a row */
+#define FAULT_BACKOFF_MIN_US		2000u
+#define FAULT_BACKOFF_MAX_US		64000u
+/* Time without a sample that stalls an IMU with sensors started, longer
+ * than the slowest sensor period */
+#define FAULT_STALL_US				1000000u
+/* Time from the quarantine to a bring-up, doubled on each one that fails */
+#define FAULT_RECOVERY_MIN_US		500000u
+#define FAULT_RECOVERY_MAX_US		16000000u
+
+enum fault_state {
+	FAULT_STATE_OK = 0,
+	FAULT_STATE_BACKOFF,		/* failed, polled again after the backoff */
+	FAULT_STATE_QUARANTINED,	/* not polled, until brought up again */
+};
+
+struct fault_imu {
+	uint32_t failed_polls;		/* since boot */
+	uint32_t quarantines;
+	uint32_t recoveries;		/* bring-ups after a quarantine that succeeded */
+	uint8_t  state;
+	/* internal */
+	uint8_t  fails;				/* failures in a row, polls or bring-ups */
+	uint64_t next_us;			/* end of the backoff, next bring-up */
+	uint32_t samples;			/* at the last progress */
+	uint64_t progress_us;
+};
+
+/** @brief Every IMU OK, counters cleared
+ */
+void fault_init(void);
+
+/** @brief Whether the sweep polls an IMU now, 0 while it backs off
+ */
+int fault_poll_due(int imu);
+
+/** @brief Outcome of the poll of an IMU
+ *  @param[in] rc         return code of the poll
+ *  @param[in] samples    samples it sent since boot, health.h
+ *  @param[in] streaming  whether it has sensors started
+ *  @return 1 if the IMU is quarantined by this failure
+ */
+int fault_polled(int imu, int rc, uint32_t samples, int streaming);
+
+/** @brief Whether an IMU out of the sweeps may be brought up now
+ */
+int fault_recovery_due(int imu);
+
+/** @brief Outcome of the bring-up of an IMU, at boot or on recovery
+ */
+void fault_brought_up(int imu, int ok);
+
+/** @brief State and counters of an IMU
+ */
+const struct fault_imu * fault_get(int imu);
+
+#endif /* FAULT_H_ */
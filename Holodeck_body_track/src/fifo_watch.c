@@ -0,0 +1,215 @@
+/*
+ * fifo_watch.c
+ *
+ * FIFO fill prediction and service order, see fifo_watch.h.
+ */
+#include <asf.h>
+#include <string.h>
+
+#include "Invn/EmbUtils/Message.h"
+#include "Invn/Devices/SensorTypes.h"
+#include "Invn/Devices/Drivers/Icm20948/Icm20948DataBaseControl.h"
+
+#include "time_wrapper.h"
+#include "idd_io_hal.h"
+#include "fifo_watch.h"
+
+static struct fifo_watch_imu imus[FIFO_WATCH_IMUS];
+
+uint32_t fifo_watch_packet_bytes(int type)
+{
+	uint32_t data;
+
+	switch(type) {
+	case INV_SENSOR_TYPE_RAW_ACCELEROMETER:
+		data = ACCEL_DATA_SZ;
+		break;
+	case INV_SENSOR_TYPE_RAW_GYROSCOPE:
+		data = GYRO_DATA_SZ;
+		break;
+	case INV_SENSOR_TYPE_UNCAL_MAGNETOMETER:
+		data = CPASS_DATA_SZ;
+		break;
+	case INV_SENSOR_TYPE_ACCELEROMETER:
+		data = ACCEL_DATA_SZ + HEADER2_SZ + ACCEL_ACCURACY_SZ;
+		break;
+	case INV_SENSOR_TYPE_GYROSCOPE:
+	case INV_SENSOR_TYPE_UNCAL_GYROSCOPE:
+		data = GYRO_DATA_SZ + GYRO_BIAS_DATA_SZ + HEADER2_SZ + GYRO_ACCURACY_SZ;
+		break;
+	case INV_SENSOR_TYPE_MAGNETOMETER:
+		data = CPASS_DATA_SZ + HEADER2_SZ + CPASS_ACCURACY_SZ;
+		break;
+	case INV_SENSOR_TYPE_GAME_ROTATION_VECTOR:
+	case INV_SENSOR_TYPE_GRAVITY:
+	case INV_SENSOR_TYPE_LINEAR_ACCELERATION:
+		data = QUAT6_DATA_SZ;
+		break;
+	case INV_SENSOR_TYPE_ROTATION_VECTOR:
+	case INV_SENSOR_TYPE_ORIENTATION:
+		data = QUAT9_DATA_SZ;
+		break;
+	case INV_SENSOR_TYPE_GEOMAG_ROTATION_VECTOR:
+		data = GEOMAG_DATA_SZ;
+		break;
+	default:
+		return 0;
+	}
+	return HEADER_SZ + data + FOOTER_SZ;
+}
+
+static uint32_t rate_bps(const struct fifo_watch_imu * w)
+{
+	return (w->observed_bps > w->configured_bps) ? w->observed_bps : w->configured_bps;
+}
+
+uint32_t fifo_watch_bus_ns_per_byte(void)
+{
+	const struct idd_io_hal_stats * st = idd_io_hal_get_stats();
+
+	if(st->bytes == 0)
+		return (uint32_t)(9 * 1000000000ull / IDD_IO_HAL_SPEED);
+	return (uint32_t)(st->busy_us * 1000 / st->bytes);
+}
+
+void fifo_watch_init(void)
+{
+	memset(imus, 0, sizeof(imus));
+}
+
+void fifo_watch_sensor(int imu, int type, uint32_t period_us)
+{
+	struct fifo_watch_imu * w;
+	const uint32_t bps = period_us ? (uint32_t)((uint64_t)fifo_watch_packet_bytes(type) * 1000000 / period_us) : 0;
+	int s, slot = -1;
+
+	if(imu < 0 || imu >= FIFO_WATCH_IMUS)
+		return;
+	w = &imus[imu];
+	for(s = 0; s < FIFO_WATCH_SENSORS; ++s) {
+		if(w->sensors[s].bps && w->sensors[s].type == type) {
+			slot = s;
+			break;
+		}
+		if(!w->sensors[s].bps && slot < 0)
+			slot = s;
+	}
+	if(slot < 0)
+		return;
+	w->sensors[slot].type = (uint8_t)type;
+	w->sensors[slot].bps = bps;
+
+	w->configured_bps = 0;
+	for(s = 0; s < FIFO_WATCH_SENSORS; ++s)
+		w->configured_bps += w->sensors[s].bps;
+	/* the observed rate belongs to the old configuration */
+	w->observed_bps = 0;
+	w->drain_us = 0;
+}
+
+uint32_t fifo_watch_headroom_us(int imu)
+{
+	const uint32_t bps = (imu >= 0 && imu < FIFO_WATCH_IMUS) ? rate_bps(&imus[imu]) : 0;
+	uint64_t fill;
+
+	if(!bps)
+		return UINT32_MAX;
+	fill = (inv_icm20948_get_time_us() - imus[imu].poll_us) * bps / 1000000;
+	if(fill >= FIFO_WATCH_FIFO_BYTES)
+		return 0;
+	return (uint32_t)((FIFO_WATCH_FIFO_BYTES - fill) * 1000000 / bps);
+}
+
+void fifo_watch_order(int * order, unsigned n)
+{
+	uint32_t headroom[FIFO_WATCH_IMUS];
+	unsigned i, j;
+
+	/* insertion sort, n is small and mostly sorted from one sweep to the next */
+	for(i = 0; i < n; ++i) {
+		const int imu = order[i];
+		const uint32_t h = fifo_watch_headroom_us(imu);
+
+		for(j = i; j > 0 && headroom[j - 1] > h; --j) {
+			order[j] = order[j - 1];
+			headroom[j] = headroom[j - 1];
+		}
+		order[j] = imu;
+		headroom[j] = h;
+	}
+}
+
+void fifo_watch_polled(int imu, const struct fifo_info_t * fifo)
+{
+	struct fifo_watch_imu * w;
+	const uint64_t now = inv_icm20948_get_time_us();
+	uint32_t drained;
+
+	if(imu < 0 || imu >= FIFO_WATCH_IMUS)
+		return;
+	w = &imus[imu];
+	drained = fifo->drained_bytes - w->drained_bytes;
+	w->drained_bytes = fifo->drained_bytes;
+	w->poll_us = now;
+
+	if(fifo->reset_cnt != w->reset_cnt) {
+		w->overflow_cnt += fifo->reset_cnt - w->reset_cnt;
+		w->reset_cnt = fifo->reset_cnt;
+		INV_MSG(INV_MSG_LEVEL_WARNING, "IMU %d FIFO overflowed, %u B/s", imu, rate_bps(w));
+	}
+	if(!drained)
+		return;
+
+	/* rate between two drains, smoothed over 4 */
+	if(w->drain_us && now > w->drain_us) {
+		const uint32_t bps = (uint32_t)((uint64_t)drained * 1000000 / (now - w->drain_us));
+
+		w->observed_bps = w->observed_bps ? (uint32_t)(((uint64_t)w->observed_bps * 3 + bps) / 4) : bps;
+	}
+	w->drain_us = now;
+
+	/* what was drained is what the FIFO held */
+	if(drained * 1000 >= FIFO_WATCH_FIFO_BYTES * FIFO_WATCH_NEAR_PERMILLE) {
+		w->near_cnt++;
+		if(!w->near)
+			INV_MSG(INV_MSG_LEVEL_WARNING, "IMU %d FIFO near overflow, %u B", imu, drained);
+		w->near = 1;
+	} else {
+		w->near = 0;
+	}
+}
+
+uint32_t fifo_watch_check(unsigned n)
+{
+	const uint32_t ns_per_byte = fifo_watch_bus_ns_per_byte();
+	uint64_t load = 0;
+	uint32_t fastest = 0;
+	int imu;
+
+	for(imu = 0; imu < FIFO_WATCH_IMUS; ++imu) {
+		const uint32_t bps = rate_bps(&imus[imu]);
+
+		load += (uint64_t)bps * ns_per_byte / 1000000;
+		if(bps > fastest)
+			fastest = bps;
+	}
+
+	if(load >= FIFO_WATCH_LOAD_PERMILLE) {
+		INV_MSG(INV_MSG_LEVEL_WARNING, "FIFO load %u permille of the bus (%u ns/B), samples will be lost",
+				(uint32_t)load, ns_per_byte);
+	} else if(fastest) {
+		/* a sweep is the empty polls stretched by the share of the bus the data takes */
+		const uint64_t sweep_us = (uint64_t)n * FIFO_WATCH_POLL_BYTES * ns_per_byte / 1000 * 1000 / (1000 - load);
+		const uint64_t fill = sweep_us * fastest / 1000000;
+
+		if(fill * 1000 >= FIFO_WATCH_FIFO_BYTES * FIFO_WATCH_NEAR_PERMILLE)
+			INV_MSG(INV_MSG_LEVEL_WARNING, "FIFO fills %u B in a %u us sweep of %u IMUs, samples will be lost",
+					(uint32_t)fill, (uint32_t)sweep_us, n);
+	}
+	return (uint32_t)load;
+}
+
+const struct fifo_watch_imu * fifo_watch_get(int imu)
+{
+	return &imus[imu];
+}
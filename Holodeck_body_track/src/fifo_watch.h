@@ -0,0 +1,111 @@
+/*
+ * fifo_watch.h
+ *
+ * FIFO fill prediction and service order of the IMUs.
+ *
+ * The driver resets the whole FIFO, and loses every sample in it, when more
+ * bytes are waiting than it can take (dmp_get_fifo_all()). The fill rate of
+ * each IMU is estimated from its configured sensors, ODR times the DMP
+ * packet size, and from the bytes it actually drains. Each poll empties the
+ * FIFO, so the fill at a given time follows from the rate and the time of
+ * the last poll.
+ *
+ * The sweep polls the IMUs in order of headroom, the one closest to
+ * overflow first. fifo_watch_check() compares the configured load with the
+ * bus throughput measured by idd_io_hal.c and warns when it cannot be kept
+ * up with, before samples are lost.
+ */
+
+
+#ifndef FIFO_WATCH_H_
+#define FIFO_WATCH_H_
+
+#include <stdint.h>
+
+#include "Invn/Devices/Drivers/Icm20948/Icm20948.h"
+
+#include "mux_topo.h"
+
+/* Number of IMUs watched, indexed as the sensor table of run_icm20948.c */
+#define FIFO_WATCH_IMUS				MUX_TOPO_MAX_DEVICES
+/* Sensors with an ODR tracked per IMU */
+#define FIFO_WATCH_SENSORS			4
+/* Bytes the driver takes in one drain, HARDWARE_FIFO_SIZE */
+#define FIFO_WATCH_FIFO_BYTES		1024
+/* Fill at a poll that counts as near overflow, per mille */
+#define FIFO_WATCH_NEAR_PERMILLE	750
+/* Bus load beyond which fifo_watch_check() warns, per mille */
+#define FIFO_WATCH_LOAD_PERMILLE	800
+/* Bus bytes of an empty poll: mux switch, bank select, FIFO count */
+#define FIFO_WATCH_POLL_BYTES		12
+
+struct fifo_watch_imu {
+	uint32_t configured_bps;	/* ODR x packet size, bytes/s */
+	uint32_t observed_bps;		/* from the drains, 0 until known */
+	uint32_t near_cnt;			/* polls near overflow */
+	uint32_t overflow_cnt;		/* FIFO resets seen after a poll */
+	/* internal */
+	uint64_t poll_us;
+	uint64_t drain_us;
+	uint32_t drained_bytes;
+	uint32_t reset_cnt;
+	uint8_t near;
+	struct {
+		uint8_t type;
+		uint32_t bps;
+	} sensors[FIFO_WATCH_SENSORS];
+};
+
+/** @brief Forget every IMU
+ */
+void fifo_watch_init(void);
+
+/** @brief A sensor of an IMU started, changed period or stopped
+ *  @param[in] imu        index of the IMU
+ *  @param[in] type       INV_SENSOR_TYPE_*
+ *  @param[in] period_us  sensor period, 0 when stopped or asynchronous
+ */
+void fifo_watch_sensor(int imu, int type, uint32_t period_us);
+
+/** @brief DMP FIFO packet of one sample of a sensor, 0 if it writes none
+ *  @param[in] type  INV_SENSOR_TYPE_*
+ */
+uint32_t fifo_watch_packet_bytes(int type);
+
+/** @brief Bus time of a byte, measured over every transfer made so far,
+ *         9 bit times at IDD_IO_HAL_SPEED before the first one
+ */
+uint32_t fifo_watch_bus_ns_per_byte(void);
+
+/** @brief Sort IMUs by headroom, shortest first
+ *  @param[in,out] imus  indexes of the IMUs to poll
+ *  @param[in] n         number of IMUs
+ */
+void fifo_watch_order(int * imus, unsigned n);
+
+/** @brief An IMU was polled, update its rate and warn near overflow
+ *  @param[in] imu   index of the IMU
+ *  @param[in] fifo  FIFO counters of its driver
+ */
+void fifo_watch_polled(int imu, const struct fifo_info_t * fifo);
+
+/** @brief Time until an IMU overflows, as predicted now
+ */
+uint32_t fifo_watch_headroom_us(int imu);
+
+/** @brief Check the configured load against the bus throughput
+ *
+ *  Warns through INV_MSG when the bus load goes beyond
+ *  FIFO_WATCH_LOAD_PERMILLE or when a sweep would take longer than the
+ *  IMU that fills fastest takes to overflow.
+ *
+ *  @param[in] imus  IMUs polled per sweep
+ *  @return bus load of the configuration per mille, may exceed 1000
+ */
+uint32_t fifo_watch_check(unsigned imus);
+
+/** @brief Estimates of an IMU
+ */
+const struct fifo_watch_imu * fifo_watch_get(int imu);
+
+#endif /* FIFO_WATCH_H_ */
@@ -0,0 +1,324 @@
+/*
+ * frame_sync.c
+ *
+ * Skeleton frames, see frame_sync.h.
+ */
+#include <asf.h>
+#include <string.h>
+
+#include "Invn/Devices/Drivers/Icm20948/Icm20948.h"
+#include "Invn/Devices/Drivers/Icm20948/Icm20948DataConverter.h"
+
+#include "time_wrapper.h"
+#include "quat_batch.h"
+#include "frame_sync.h"
+
+/* Last samples of an IMU, oldest first from head - count */
+struct imu_samples {
+	uint64_t drain_us;
+	uint32_t next_n;			/* index of the next sample given */
+	uint8_t  head;
+	uint8_t  count;
+	uint32_t n[FRAME_SYNC_HISTORY];
+	int16_t  q14[FRAME_SYNC_HISTORY][4];
+};
+
+static struct frame_sync_clock clocks[FRAME_SYNC_IMUS];
+static struct imu_samples imus[FRAME_SYNC_IMUS];
+static unsigned imu_count;		/* highest IMU drained + 1 */
+static struct frame_sync_frame frame;
+static uint32_t period_us;
+static uint64_t frame_us;		/* time of the next frame, 0 until placed */
+
+/* Time of sample n, us in Q16 */
+static int64_t sample_q16(const struct frame_sync_clock * c, uint32_t n)
+{
+	return (int64_t)c->base_q16 + (int64_t)(int32_t)(n - c->base_n) * c->period_q16;
+}
+
+static void window_start(struct frame_sync_clock * c, uint64_t t, uint32_t n)
+{
+	c->window_us = t;
+	c->window_n = n;
+	c->window_min_q16 = INT64_MAX;
+}
+
+/* k-th sample from the oldest */
+static unsigned slot(const struct imu_samples * s, unsigned k)
+{
+	return (s->head + FRAME_SYNC_HISTORY - s->count + k) % FRAME_SYNC_HISTORY;
+}
+
+/* a to b at f in Q16, the shortest way, normalized */
+static void nlerp(const int16_t a[4], const int16_t b[4], uint32_t f_q16, int16_t out[4])
+{
+	int32_t q[4], dot = 0, sign;
+	int64_t norm2 = 0;
+	long norm;
+	int k;
+
+	for(k = 0; k < 4; ++k)
+		dot += (int32_t)a[k] * b[k];
+	sign = (dot < 0) ? -1 : 1;
+	/* Q14 by Q16: Q30, a convex combination so it fits */
+	for(k = 0; k < 4; ++k) {
+		q[k] = (int32_t)a[k] * (int32_t)(65536 - f_q16) + sign * (int32_t)b[k] * (int32_t)f_q16;
+		norm2 += (int64_t)q[k] * q[k];
+	}
+	norm = inv_icm20948_convert_fast_sqrt_fxp((long)(norm2 >> 30));
+	if(norm <= 0) {
+		memcpy(out, a, 4 * sizeof(out[0]));
+		return;
+	}
+	for(k = 0; k < 4; ++k) {
+		const int64_t v = ((int64_t)q[k] << 14) + ((q[k] < 0) ? -(norm / 2) : norm / 2);
+		int32_t r = (int32_t)(v / norm);
+
+		if(r > 16384)
+			r = 16384;
+		else if(r < -16384)
+			r = -16384;
+		out[k] = (int16_t)r;
+	}
+}
+
+/*
+ * Rotation vector of an IMU at t_q16
+ * Returns 1 if it is held at a sample, t being out of the samples kept
+ */
+static int resample(const struct frame_sync_clock * c, const struct imu_samples * s, int64_t t_q16, int16_t out[4])
+{
+	const unsigned oldest = slot(s, 0), newest = slot(s, s->count - 1);
+	unsigned k;
+
+	if(t_q16 >= sample_q16(c, s->n[newest])) {
+		memcpy(out, s->q14[newest], 4 * sizeof(out[0]));
+		return t_q16 > sample_q16(c, s->n[newest]);
+	}
+	if(t_q16 < sample_q16(c, s->n[oldest])) {
+		memcpy(out, s->q14[oldest], 4 * sizeof(out[0]));
+		return 1;
+	}
+	for(k = 1; k < s->count; ++k) {
+		const unsigned a = slot(s, k - 1), b = slot(s, k);
+		const int64_t ta = sample_q16(c, s->n[a]), tb = sample_q16(c, s->n[b]);
+
+		if(t_q16 < tb) {
+			const uint32_t f = (tb > ta) ? (uint32_t)(((t_q16 - ta) << 16) / (tb - ta)) : 0;
+
+			nlerp(s->q14[a], s->q14[b], f, out);
+			return 0;
+		}
+	}
+	memcpy(out, s->q14[newest], 4 * sizeof(out[0]));
+	return 0;
+}
+
+void frame_sync_init(void)
+{
+	memset(clocks, 0, sizeof(clocks));
+	memset(imus, 0, sizeof(imus));
+	imu_count = 0;
+	period_us = 0;
+	frame_us = 0;
+}
+
+void frame_sync_start(uint32_t period)
+{
+	unsigned i;
+
+	period_us = period;
+	frame_us = 0;
+	for(i = 0; i < imu_count; ++i)
+		imus[i].count = 0;
+}
+
+void frame_sync_drain(int imu, uint64_t drain_us)
+{
+	if(imu < 0 || imu >= FRAME_SYNC_IMUS)
+		return;
+	if((unsigned)imu >= imu_count)
+		imu_count = imu + 1;
+	imus[imu].drain_us = drain_us;
+	imus[imu].next_n = clocks[imu].samples + 1;
+}
+
+void frame_sync_drained(int imu, unsigned samples)
+{
+	struct frame_sync_clock * c;
+	uint64_t t;
+	uint32_t n;
+	int64_t r;
+
+	if(imu < 0 || imu >= FRAME_SYNC_IMUS || !samples)
+		return;
+	c = &clocks[imu];
+	t = imus[imu].drain_us;
+	c->samples += samples;
+	n = c->samples;
+
+	/* first drain, then the period over a window */
+	if(!c->window_us) {
+		c->base_q16 = t << 16;
+		c->base_n = n;
+		window_start(c, t, n);
+		return;
+	}
+	if(!c->period_q16) {
+		if(t - c->window_us < FRAME_SYNC_WINDOW_US)
+			return;
+		c->period_q16 = (uint32_t)(((t - c->window_us) << 16) / (n - c->window_n));
+		c->base_q16 = t << 16;
+		c->base_n = n;
+		window_start(c, t, n);
+		return;
+	}
+
+	/* sample n was taken before t */
+	r = (int64_t)(t << 16) - sample_q16(c, n);
+	if(r < 0) {
+		c->base_q16 += r;
+		r = 0;
+	}
+	if(r < c->window_min_q16)
+		c->window_min_q16 = r;
+	if(t - c->window_us < FRAME_SYNC_WINDOW_US)
+		return;
+
+	/* onto the tightest drain */
+	c->base_q16 = sample_q16(c, n) + c->window_min_q16;
+	c->base_n = n;
+	window_start(c, t, n);
+	if(!c->anchor_us) {
+		c->anchor_q16 = c->base_q16;
+		c->anchor_n = n;
+		c->anchor_us = t;
+		return;
+	}
+	c->period_q16 = (uint32_t)((c->base_q16 - c->anchor_q16) / (n - c->anchor_n));
+	/* the baseline goes from half to all of FRAME_SYNC_BASELINE_US */
+	if(!c->mid_us && t - c->anchor_us >= FRAME_SYNC_BASELINE_US / 2) {
+		c->mid_q16 = c->base_q16;
+		c->mid_n = n;
+		c->mid_us = t;
+	} else if(c->mid_us && t - c->anchor_us >= FRAME_SYNC_BASELINE_US) {
+		c->anchor_q16 = c->mid_q16;
+		c->anchor_n = c->mid_n;
+		c->anchor_us = c->mid_us;
+		c->mid_us = 0;
+	}
+}
+
+void frame_sync_sample(int imu, const int32_t q30[4])
+{
+	struct imu_samples * s;
+	int k;
+
+	if(imu < 0 || imu >= FRAME_SYNC_IMUS)
+		return;
+	s = &imus[imu];
+	s->n[s->head] = s->next_n++;
+	for(k = 0; k < 4; ++k)
+		s->q14[s->head][k] = quat_batch_q14(q30[k]);
+	s->head = (s->head + 1) % FRAME_SYNC_HISTORY;
+	if(s->count < FRAME_SYNC_HISTORY)
+		s->count++;
+}
+
+int frame_sync_sample_us(int imu, uint32_t n, uint64_t * sample_us)
+{
+	if(imu < 0 || imu >= FRAME_SYNC_IMUS || !clocks[imu].period_q16)
+		return -1;
+	*sample_us = (uint64_t)(sample_q16(&clocks[imu], n) >> 16);
+	return 0;
+}
+
+void frame_sync_leave(int imu)
+{
+	if(imu < 0 || imu >= FRAME_SYNC_IMUS)
+		return;
+	memset(&clocks[imu], 0, sizeof(clocks[imu]));
+	memset(&imus[imu], 0, sizeof(imus[imu]));
+}
+
+void frame_sync_rescale(int imu, unsigned from, unsigned to)
+{
+	struct frame_sync_clock * c;
+	struct imu_samples * s;
+
+	if(imu < 0 || imu >= FRAME_SYNC_IMUS || !from || !to)
+		return;
+	c = &clocks[imu];
+	s = &imus[imu];
+	if(!c->window_us)
+		return;
+	if(c->period_q16) {
+		c->base_q16 = sample_q16(c, c->samples);
+		c->base_n = c->samples;
+		c->period_q16 = (uint32_t)((uint64_t)c->period_q16 * to / from);
+	}
+	window_start(c, s->drain_us, c->samples);
+	c->anchor_us = 0;
+	c->mid_us = 0;
+	if(s->count > 1)
+		s->count = 1;
+}
+
+const struct frame_sync_frame * frame_sync_next(void)
+{
+	const uint64_t now = inv_icm20948_get_time_us();
+	int64_t oldest = INT64_MIN, newest = INT64_MAX, t;
+	unsigned i, n = 0;
+
+	if(!period_us)
+		return 0;
+	/* the latest first sample and the earliest last one */
+	for(i = 0; i < imu_count; ++i) {
+		const struct frame_sync_clock * c = &clocks[i];
+		const struct imu_samples * s = &imus[i];
+		int64_t ts;
+
+		if(!c->period_q16 || !s->count)
+			continue;
+		ts = sample_q16(c, s->n[slot(s, 0)]);
+		if(ts > oldest)
+			oldest = ts;
+		ts = sample_q16(c, s->n[slot(s, s->count - 1)]);
+		if(ts < newest)
+			newest = ts;
+		n++;
+	}
+	if(!n)
+		return 0;
+	if(!frame_us) {
+		/* first grid time every IMU has a sample before */
+		frame_us = (uint64_t)(oldest >> 16) / period_us * period_us + period_us;
+	} else if(now > frame_us + FRAME_SYNC_LATE_US + FRAME_SYNC_HISTORY * period_us) {
+		/* too far behind to resample anything, on to the frames still waited for */
+		frame_us = (now - FRAME_SYNC_LATE_US) / period_us * period_us;
+	}
+	t = (int64_t)(frame_us << 16);
+	if(newest < t && now < frame_us + FRAME_SYNC_LATE_US)
+		return 0;
+
+	frame.timestamp_us = frame_us;
+	frame.count = 0;
+	for(i = 0; i < imu_count; ++i) {
+		const struct frame_sync_clock * c = &clocks[i];
+		const struct imu_samples * s = &imus[i];
+
+		if(!c->period_q16 || !s->count)
+			continue;
+		frame.imu[frame.count] = (uint8_t)i;
+		if(resample(c, s, t, frame.q14[frame.count]))
+			frame.imu[frame.count] |= FRAME_SYNC_HELD;
+		frame.count++;
+	}
+	frame_us += period_us;
+	return &frame;
+}
+
+const struct frame_sync_clock * frame_sync_clock(int imu)
+{
+	return &clocks[imu];
+}
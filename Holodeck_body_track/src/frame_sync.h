@@ -0,0 +1,137 @@
+/*
+ * frame_sync.h
+ *
+ * Skeleton frames: the rotation vector of every IMU at one common time.
+ *
+ * Each DMP samples on its own clock, started when its IMU was brought up,
+ * and the sweep drains the IMUs one after the other. The latest samples of
+ * two IMUs are up to a sample period apart, which shows as limb shear in
+ * fast motion. The driver timestamps do not help: they spread the samples
+ * of a drain evenly up to the drain time.
+ *
+ * The sample clock of each IMU is tracked against the MCU timebase instead.
+ * A drain at time t that brings the count of samples to N tells that
+ * sample N was taken at t at the latest. Sample n is put on a line
+ *   t(n) = t(base) + (n - base) * period
+ * with the period first measured over FRAME_SYNC_WINDOW_US. The line is
+ * moved earlier whenever a drain comes before it, and every window it is
+ * moved later onto the tightest drain. It then follows the latest possible
+ * sample times, late by about the same for every IMU. The period is taken
+ * from where the line stands now and where it stood up to
+ * FRAME_SYNC_BASELINE_US ago, so the few hundred us the tightest drain
+ * varies by hardly show in it, while it still follows the drift of the
+ * clock with temperature.
+ *
+ * Every frame period, on a grid of the MCU time, each IMU is resampled to
+ * the frame time from the two samples around it: slerp, computed as a
+ * normalized lerp, which matches it to better than the Q14 resolution for
+ * up to 20 degrees between two samples. A frame waits for the last IMU to
+ * have a sample past its time, FRAME_SYNC_LATE_US at most: an IMU still
+ * late is held at its last sample and flagged. IMUs whose clock is not
+ * measured yet are left out.
+ *
+ * One rotation vector (RV or GRV) per IMU is followed. The frames are sent
+ * in the OUTPUT_FORMAT_SKELETON format of run_icm20948.h, see
+ * HOST_CMD_CODE_SKELETON in host_cmd.h.
+ */
+
+
+#ifndef FRAME_SYNC_H_
+#define FRAME_SYNC_H_
+
+#include <stdint.h>
+
+#include "mux_topo.h"
+
+/* Number of IMUs, indexed as the sensor table of run_icm20948.c */
+#define FRAME_SYNC_IMUS				MUX_TOPO_MAX_DEVICES
+/* Samples kept per IMU, enough for a frame FRAME_SYNC_LATE_US late */
+#define FRAME_SYNC_HISTORY			4
+/* Time over which a clock is measured, then corrected */
+#define FRAME_SYNC_WINDOW_US		500000u
+/* Longest time the period is measured over */
+#define FRAME_SYNC_BASELINE_US		30000000u
+/* Time a frame waits for a late IMU */
+#define FRAME_SYNC_LATE_US			20000u
+
+/* Flag of an IMU held at its last sample, with its index in a frame */
+#define FRAME_SYNC_HELD				0x80
+
+struct frame_sync_clock {
+	uint32_t period_q16;		/* sample period, us in Q16, 0 until measured */
+	uint32_t samples;			/* drained since the clock started */
+	/* internal: sample base_n at base_q16 us in Q16 */
+	uint64_t base_q16;
+	uint32_t base_n;
+	uint64_t window_us;
+	uint32_t window_n;
+	int64_t  window_min_q16;	/* tightest drain after the line */
+	/* line at the start of the baseline, and halfway through it */
+	uint64_t anchor_q16;
+	uint32_t anchor_n;
+	uint64_t anchor_us;
+	uint64_t mid_q16;
+	uint32_t mid_n;
+	uint64_t mid_us;
+};
+
+struct frame_sync_frame {
+	uint64_t timestamp_us;
+	unsigned count;
+	uint8_t  imu[FRAME_SYNC_IMUS];		/* FRAME_SYNC_HELD when held */
+	int16_t  q14[FRAME_SYNC_IMUS][4];	/* w x y z */
+};
+
+/** @brief Forget every clock and sample, no frame until frame_sync_start()
+ */
+void frame_sync_init(void);
+
+/** @brief Start the frames over, clocks kept
+ *  @param[in] period_us  frame period, 0 to stop
+ */
+void frame_sync_start(uint32_t period_us);
+
+/** @brief An IMU is about to be drained, its samples follow
+ *  @param[in] drain_us  time the poll starts
+ */
+void frame_sync_drain(int imu, uint64_t drain_us);
+
+/** @brief An IMU was drained
+ *  @param[in] samples  rotation vectors it gave
+ */
+void frame_sync_drained(int imu, unsigned samples);
+
+/** @brief A rotation vector of the IMU drained last, in order
+ *  @param[in] q30  w x y z in world frame, Q30
+ */
+void frame_sync_sample(int imu, const int32_t q30[4]);
+
+/** @brief An IMU stops, its clock starts over when it comes back
+ */
+void frame_sync_leave(int imu);
+
+/** @brief The sample period of an IMU went from `from` to `to` base samples
+ *
+ *  The clock goes on from the last sample at the period scaled, and is
+ *  measured over a new baseline. The samples kept but the last one are
+ *  dropped, their times no longer follow from the line.
+ */
+void frame_sync_rescale(int imu, unsigned from, unsigned to);
+
+/** @brief Next frame, when every IMU has a sample past it or it is late
+ *  @return the frame, 0 if none is due
+ */
+const struct frame_sync_frame * frame_sync_next(void);
+
+/** @brief Sample clock of an IMU
+ */
+const struct frame_sync_clock * frame_sync_clock(int imu);
+
+/** @brief Time sample n of an IMU was taken at the latest, on its clock line
+ *  @param[in]  n          sample, counted as frame_sync_clock()->samples
+ *  @param[out] sample_us  time of the sample
+ *  @return 0, -1 while the period of the IMU is not measured
+ */
+int frame_sync_sample_us(int imu, uint32_t n, uint64_t * sample_us);
+
+#endif /* FRAME_SYNC_H_ */
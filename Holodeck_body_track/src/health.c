@@ -0,0 +1,132 @@
+/*
+ * health.c
+ *
+ * Runtime health and throughput counters, see health.h.
+ */
+#include <asf.h>
+#include <string.h>
+
+#include "Invn/EmbUtils/DataConverter.h"
+
+#include "time_wrapper.h"
+#include "idd_io_hal.h"
+#include "usb_cdc_coms.h"
+#include "host_cmd.h"
+#include "health.h"
+
+static struct health_imu imus[HEALTH_IMUS];
+
+static struct {
+	uint32_t mux_switches;
+	uint32_t mux_errors;
+	uint64_t mux_busy_us;
+	/* at the previous report */
+	uint64_t report_us;
+	uint64_t report_busy_us;
+} global;
+
+static uint64_t bus_busy_us(void)
+{
+	return idd_io_hal_get_stats()->busy_us + global.mux_busy_us;
+}
+
+void health_init(void)
+{
+	memset(imus, 0, sizeof(imus));
+	memset(&global, 0, sizeof(global));
+	global.report_us = inv_icm20948_get_time_us();
+	global.report_busy_us = bus_busy_us();
+}
+
+void health_sample(int imu)
+{
+	if(imu < 0 || imu >= HEALTH_IMUS)
+		return;
+	imus[imu].samples++;
+	imus[imu].last_sample_us = inv_icm20948_get_time_us();
+}
+
+void health_bus(int imu, uint32_t errors, uint32_t retries)
+{
+	if(imu < 0 || imu >= HEALTH_IMUS)
+		return;
+	imus[imu].bus_errors += errors;
+	imus[imu].bus_retries += retries;
+}
+
+void health_mux(int rc, uint32_t busy_us)
+{
+	global.mux_switches++;
+	if(rc != TWI_SUCCESS)
+		global.mux_errors++;
+	global.mux_busy_us += busy_us;
+}
+
+const struct health_imu * health_get(int imu)
+{
+	return &imus[imu];
+}
+
+int health_send_imu(int imu, const struct fifo_info_t * fifo, const struct fault_imu * fault)
+{
+	/* <imu (1)> <samples (4)> <odr mHz (4)> <resets (4)> <lost (4)> <decode errors (4)>
+	 * <bus errors (4)> <retries (4)> <bytes per drain (2)> <since last sample ms (4)>
+	 * <fault state (1)> <failed polls (4)> <quarantines (4)> <recoveries (4)> */
+	uint8_t payload[1 + 7*4 + 2 + 4 + 1 + 3*4];
+	struct health_imu * h;
+	uint64_t now, elapsed_us;
+	uint32_t samples, drains, since_ms;
+
+	if(imu < 0 || imu >= HEALTH_IMUS)
+		return -1;
+	h = &imus[imu];
+	now = inv_icm20948_get_time_us();
+	elapsed_us = now - global.report_us;
+	samples = h->samples - h->report_samples;
+	drains = fifo->drain_cnt - h->report_drains;
+	since_ms = h->last_sample_us ? (uint32_t)((now - h->last_sample_us) / 1000) : HEALTH_NEVER;
+
+	payload[0] = (uint8_t)imu;
+	inv_dc_int32_to_little8((int32_t)h->samples, &payload[1]);
+	inv_dc_int32_to_little8(elapsed_us ? (int32_t)((uint64_t)samples * 1000000000u / elapsed_us) : 0, &payload[5]);
+	inv_dc_int32_to_little8((int32_t)fifo->reset_cnt, &payload[9]);
+	inv_dc_int32_to_little8((int32_t)fifo->lost_bytes, &payload[13]);
+	inv_dc_int32_to_little8((int32_t)fifo->decode_error_cnt, &payload[17]);
+	inv_dc_int32_to_little8((int32_t)h->bus_errors, &payload[21]);
+	inv_dc_int32_to_little8((int32_t)h->bus_retries, &payload[25]);
+	inv_dc_int16_to_little8(drains ? (int16_t)((fifo->drained_bytes - h->report_drained_bytes) / drains) : 0, &payload[29]);
+	inv_dc_int32_to_little8((int32_t)since_ms, &payload[31]);
+	payload[35] = fault->state;
+	inv_dc_int32_to_little8((int32_t)fault->failed_polls, &payload[36]);
+	inv_dc_int32_to_little8((int32_t)fault->quarantines, &payload[40]);
+	inv_dc_int32_to_little8((int32_t)fault->recoveries, &payload[44]);
+
+	h->report_samples = h->samples;
+	h->report_drains = fifo->drain_cnt;
+	h->report_drained_bytes = fifo->drained_bytes;
+	return host_cmd_send(HOST_CMD_TYPE_ASYNC, HOST_CMD_CODE_HEALTH_IMU, payload, sizeof(payload));
+}
+
+int health_send(void)
+{
+	/* <period ms (4)> <mux switches (4)> <mux errors (4)> <bus busy per mille (2)>
+	 * <usb bytes (4)> <usb dropped bytes (4)> <usb dropped writes (4)> */
+	uint8_t payload[3*4 + 2 + 3*4];
+	const struct serial_stats * usb = serialStats();
+	const uint64_t now = inv_icm20948_get_time_us();
+	const uint64_t busy_us = bus_busy_us();
+	const uint64_t elapsed_us = now - global.report_us;
+	const uint64_t permille = elapsed_us ? (busy_us - global.report_busy_us) * 1000 / elapsed_us : 0;
+
+	inv_dc_int32_to_little8((int32_t)(elapsed_us / 1000), &payload[0]);
+	inv_dc_int32_to_little8((int32_t)global.mux_switches, &payload[4]);
+	inv_dc_int32_to_little8((int32_t)global.mux_errors, &payload[8]);
+	inv_dc_int16_to_little8((int16_t)(permille > 1000 ? 1000 : permille), &payload[12]);
+	inv_dc_int32_to_little8((int32_t)usb->written_bytes, &payload[14]);
+	inv_dc_int32_to_little8((int32_t)usb->dropped_bytes, &payload[18]);
+	inv_dc_int32_to_little8((int32_t)usb->dropped_writes, &payload[22]);
+
+	global.report_us = now;
+	global.report_busy_us = busy_us;
+	return host_cmd_send(HOST_CMD_TYPE_ASYNC, HOST_CMD_CODE_HEALTH, payload, sizeof(payload));
+}
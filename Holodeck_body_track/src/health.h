@@ -0,0 +1,88 @@
+/*
+ * health.h
+ *
+ * Runtime health and throughput counters of the IMUs, the mux, the bus and
+ * the USB link, to tell a FIFO overflow from a decode error, a NACK, a mux
+ * failure or a USB drop when a joint goes quiet.
+ *
+ * Counters are plain increments on the acquisition path and count since
+ * boot, the host takes the differences. Rates are computed over the last
+ * stats period when the frames are sent (see HOST_CMD_CODE_SET_STATS_PERIOD
+ * in host_cmd.h), one async frame per IMU found then a global one:
+ *   HOST_CMD_CODE_HEALTH_IMU <imu (1)> <samples (4)> <odr mHz (4)>
+ *                            <fifo resets (4)> <lost bytes (4)> <decode errors (4)>
+ *                            <bus errors (4)> <retries (4)>
+ *                            <bytes per drain (2)> <since last sample ms (4)>
+ *                            <fault state (1)> <failed polls (4)> <quarantines (4)>
+ *                            <recoveries (4)>
+ *   HOST_CMD_CODE_HEALTH     <period ms (4)> <mux switches (4)> <mux errors (4)>
+ *                            <bus busy per mille (2)>
+ *                            <usb bytes (4)> <usb dropped bytes (4)> <usb dropped writes (4)>
+ * odr, bytes per drain and bus busy are over the period. FIFO counters come
+ * from the driver (struct fifo_info_t), fault ones from fault.h, since last
+ * sample is HEALTH_NEVER until the IMU sends a sample.
+ */
+
+
+#ifndef HEALTH_H_
+#define HEALTH_H_
+
+#include <stdint.h>
+
+#include "Invn/Devices/Drivers/Icm20948/Icm20948.h"
+
+#include "mux_topo.h"
+#include "fault.h"
+
+/* Number of IMUs counted, indexed as the sensor table of run_icm20948.c */
+#define HEALTH_IMUS			MUX_TOPO_MAX_DEVICES
+
+#define HEALTH_NEVER		0xFFFFFFFFu
+
+struct health_imu {
+	uint32_t samples;
+	uint32_t bus_errors;
+	uint32_t bus_retries;
+	uint64_t last_sample_us;
+	/* counters at the previous report, for the rates */
+	uint32_t report_samples;
+	uint32_t report_drains;
+	uint32_t report_drained_bytes;
+};
+
+/** @brief Clear the counters and start a report period
+ */
+void health_init(void);
+
+/** @brief An IMU sent a sample
+ */
+void health_sample(int imu);
+
+/** @brief Bus errors and retries seen while polling an IMU
+ */
+void health_bus(int imu, uint32_t errors, uint32_t retries);
+
+/** @brief A mux switch
+ *  @param[in] rc       twi_master_write() return code
+ *  @param[in] busy_us  time it took
+ */
+void health_mux(int rc, uint32_t busy_us);
+
+/** @brief Counters of an IMU
+ */
+const struct health_imu * health_get(int imu);
+
+/** @brief Send the HOST_CMD_CODE_HEALTH_IMU frame of an IMU
+ *  @param[in] imu    index of the IMU
+ *  @param[in] fifo   FIFO counters of its driver
+ *  @param[in] fault  its fault state
+ *  @return 0 on success, negative value if the frame was not sent
+ */
+int health_send_imu(int imu, const struct fifo_info_t * fifo, const struct fault_imu * fault);
+
+/** @brief Send the HOST_CMD_CODE_HEALTH frame and start the next period
+ *  @return 0 on success, negative value if the frame was not sent
+ */
+int health_send(void);
+
+#endif /* HEALTH_H_ */
@@ -0,0 +1,140 @@
+/*
+ * host_cmd.c
+ *
+ * Incremental parser and dispatcher for commands received over USB CDC.
+ * Bytes are pulled from the RX FIFO filled by handleInput(), so nothing in
+ * here ever waits on the USB stack.
+ * Every byte is also fed to the DynProtocol receiver (dynpro_cdc.h), each
+ * parser ignores the frames of the other one.
+ */
+#include <asf.h>
+#include <string.h>
+
+#include "Invn/EmbUtils/InvProtocol.h"
+#include "Invn/EmbUtils/DataConverter.h"
+
+#include "usb_cdc_coms.h"
+#include "run_icm20948.h"
+#include "dynpro_cdc.h"
+#include "prof_zone.h"
+#include "host_cmd.h"
+
+/* Largest frame sent by host_cmd_send(): header, type, code, size, args, checksum */
+#define HOST_CMD_TX_FRAME_SIZE	(4 + 1 + 1 + 2 + 128 + 2)
+
+/*
+ * Decoder outputs must stay at the same address while
+ * InvProtocolDecoder_processByte() returns INVPROTOCOL_INCOMPLETE
+ */
+static struct {
+	InvProtocolDecoder decoder;
+	uint8_t  type;
+	uint8_t  code;
+	size_t   size;
+	uint8_t  args[HOST_CMD_MAX_ARG_SIZE];
+} rx;
+
+static uint8_t tx_frame[HOST_CMD_TX_FRAME_SIZE];
+
+static void host_cmd_respond(uint8_t code, int rc)
+{
+	int8_t status = (int8_t)rc;
+
+	host_cmd_send(HOST_CMD_TYPE_RESP, code, &status, sizeof(status));
+}
+
+static int host_cmd_execute(uint8_t code, const uint8_t * args, size_t size)
+{
+	switch(code) {
+	case HOST_CMD_CODE_PING:
+		return 0;
+
+	case HOST_CMD_CODE_SET_PERIOD:
+		if(size < 6)
+			return -1;
+		return run_icm20948_set_sensor_period(args[0], args[1], (uint32_t)inv_dc_little8_to_int32(&args[2]));
+
+	case HOST_CMD_CODE_START_SENSOR:
+	case HOST_CMD_CODE_STOP_SENSOR:
+		if(size < 2)
+			return -1;
+		return run_icm20948_enable_sensor(args[0], args[1], (code == HOST_CMD_CODE_START_SENSOR));
+
+	case HOST_CMD_CODE_SET_OUTPUT:
+		if(size < 1)
+			return -1;
+		return run_icm20948_set_output_format(args[0]);
+
+	case HOST_CMD_CODE_GET_PROF:
+		return prof_zone_dump(size >= 1 && args[0]);
+
+	case HOST_CMD_CODE_SET_STATS_PERIOD:
+		if(size < 2)
+			return -1;
+		return run_icm20948_set_stats_period((uint16_t)inv_dc_le_to_int16(args));
+
+	case HOST_CMD_CODE_SET_CYCLE:
+		if(size < 1)
+			return -1;
+		return run_icm20948_set_cycle(args[0], (size >= 5) ? (uint32_t)inv_dc_little8_to_int32(&args[1]) : 0);
+
+	case HOST_CMD_CODE_PLAN_ODR:
+		if(size < 4)
+			return -1;
+		return run_icm20948_plan_odr((uint32_t)inv_dc_little8_to_int32(args),
+				(size >= 8) ? (uint32_t)inv_dc_little8_to_int32(&args[4]) : 0,
+				(size >= 12) ? (uint32_t)inv_dc_little8_to_int32(&args[8]) : 0);
+
+	case HOST_CMD_CODE_SET_ADAPT:
+		if(size < 1)
+			return -1;
+		return run_icm20948_set_adapt(args[0], (size >= 9) ? (uint32_t)inv_dc_little8_to_int32(&args[1]) : 0,
+				(size >= 9) ? (uint32_t)inv_dc_little8_to_int32(&args[5]) : 0);
+
+	default:
+		return -1;
+	}
+}
+
+void host_cmd_init(void)
+{
+	memset(&rx, 0, sizeof(rx));
+	InvProtocolDecoder_init(&rx.decoder);
+}
+
+int host_cmd_process(void)
+{
+	unsigned budget = HOST_CMD_MAX_BYTES_PER_CALL;
+	uint8_t byte;
+
+	while(budget-- && serialRead(&byte, 1)) {
+		const int rc = InvProtocolDecoder_processByte(&rx.decoder, byte,
+				&rx.type, &rx.code, &rx.size, rx.args, sizeof(rx.args));
+
+		if(dynpro_cdc_process_byte(byte))
+			return 1;
+
+		if(rc == INVPROTOCOL_INCOMPLETE)
+			continue;
+
+		if(rc == INVPROTOCOL_OK && rx.type == HOST_CMD_TYPE_CMD) {
+			host_cmd_respond(rx.code, host_cmd_execute(rx.code, rx.args, rx.size));
+			return 1;
+		}
+		/* bad header/checksum/size: decoder already went back to hunting for a header */
+	}
+
+	return 0;
+}
+
+int host_cmd_send(uint8_t type, uint8_t code, const void * arg, uint16_t size)
+{
+	const int len = InvProtocolFormater_formatBuffer(type, code, arg, size,
+			tx_frame, sizeof(tx_frame));
+
+	if(len < 0)
+		return len;
+
+	serialWrite((char *)tx_frame, len);
+	return 0;
+}
@@ -0,0 +1,88 @@
+/*
+ * host_cmd.h
+ *
+ * Framed command channel from the host over USB CDC.
+ *
+ * Frames follow the InvProtocol format (see Invn/EmbUtils/InvProtocol.h):
+ *   0x55 0xAA 0x55 0xAA <TYPE> <CODE> <SIZE (2, LE)> <ARGS (SIZE)> <CKSUM (2, LE)>
+ * Multi-byte arguments are little endian.
+ */
+
+
+#ifndef HOST_CMD_H_
+#define HOST_CMD_H_
+
+#include <stdint.h>
+
+/* Maximum number of received bytes parsed by one call to host_cmd_process() */
+#define HOST_CMD_MAX_BYTES_PER_CALL	32
+
+/* Maximum size of the arguments of a received command */
+#define HOST_CMD_MAX_ARG_SIZE		16
+
+/* Value for the <imu> argument addressing every present IMU */
+#define HOST_CMD_ALL_IMUS			0xFF
+
+enum host_cmd_type {
+	HOST_CMD_TYPE_CMD   = 0x01,	/* host to device command */
+	HOST_CMD_TYPE_RESP  = 0x02,	/* device to host response, args: <rc (1, signed)> */
+	HOST_CMD_TYPE_ASYNC = 0x03,	/* device to host unsolicited frame */
+};
+
+enum host_cmd_code {
+	HOST_CMD_CODE_PING          = 0x00,	/* no args */
+	HOST_CMD_CODE_SET_PERIOD    = 0x01,	/* <imu (1)> <sensor type (1)> <period us (4)> */
+	HOST_CMD_CODE_START_SENSOR  = 0x02,	/* <imu (1)> <sensor type (1)> */
+	HOST_CMD_CODE_STOP_SENSOR   = 0x03,	/* <imu (1)> <sensor type (1)> */
+	HOST_CMD_CODE_SET_OUTPUT    = 0x04,	/* <format (1)> see enum output_format in run_icm20948.h */
+	HOST_CMD_CODE_GET_PROF      = 0x05,	/* [<clear (1)>] HOST_CMD_CODE_PROF frames then response, see prof_zone.h */
+	HOST_CMD_CODE_SET_STATS_PERIOD = 0x06,	/* <period ms (2)> periodic stats frames, 0 to stop */
+	HOST_CMD_CODE_SET_CYCLE     = 0x07,	/* <enable (1)> [<period us (4)>] fixed sweep cycle, of the ODR without period */
+	HOST_CMD_CODE_PLAN_ODR      = 0x08,	/* <frame us (4)> [<bus hz (4)> [<usb B/s (4)>]] HOST_CMD_CODE_ODR_PLAN frame then response, see odr_plan.h */
+	HOST_CMD_CODE_SET_ADAPT     = 0x09,	/* <enable (1)> [<fastest us (4)> <slowest us (4)>] rotation vector period after the motion, see odr_adapt.h */
+
+	HOST_CMD_CODE_SENSOR_DATA   = 0x10,	/* async: <imu (1)> <sensor type (1)> <timestamp us (4)> <data> */
+	HOST_CMD_CODE_LOG           = 0x11,	/* async: deferred INV_MSG record, see msg_log.h */
+	HOST_CMD_CODE_PROF          = 0x12,	/* async: one profiling zone, see prof_zone.h */
+	HOST_CMD_CODE_LATENCY       = 0x13,	/* async stats: latency of one IMU, see lat_trace.h */
+	HOST_CMD_CODE_HEALTH_IMU    = 0x14,	/* async stats: counters of one IMU, see health.h */
+	HOST_CMD_CODE_HEALTH        = 0x15,	/* async stats: mux, bus and USB counters, see health.h */
+	HOST_CMD_CODE_CYCLE         = 0x16,	/* async stats: acquisition cycle jitter, see acq_cycle.h */
+	HOST_CMD_CODE_READY         = 0x17,	/* async: startup phase times, once after the first frame, see startup.h */
+	HOST_CMD_CODE_TOPOLOGY      = 0x18,	/* async: an IMU started or stopped streaming, see hotplug.h */
+	HOST_CMD_CODE_SKELETON      = 0x19,	/* async: <timestamp us (4)> <count (1)> {<imu (1)> <w x y z Q14 (8)>}, see frame_sync.h */
+	HOST_CMD_CODE_ODR_PLAN      = 0x1A,	/* async: <rc (1, signed)> <base div (1)> <frame us (4)> <bus permille (2)> <usb permille (2)>
+	                                     *   <count (1)> {<sensor type (1)> <frames (1)> <period us (4)>}, see odr_plan.h */
+	HOST_CMD_CODE_ODR_RATE      = 0x1B,	/* async: <imu (1)> <sensor type (1)> <period us (4)> <turn mdeg/sample (2)>, see odr_adapt.h */
+};
+
+/* IMUs per HOST_CMD_CODE_SKELETON frame in the 128 bytes of args of a frame,
+ * a skeleton of more is sent in several frames of the same timestamp */
+#define HOST_CMD_SKELETON_IMUS		((128 - 5) / 9)
+
+/** @brief Reset the command parser states
+ */
+void host_cmd_init(void);
+
+/** @brief Parse pending received bytes and execute at most one command
+ *
+ *  Bytes are parsed as host_cmd frames and as DynProtocol frames (see
+ *  dynpro_cdc.h), so either protocol can be used by the host.
+ *  Never waits for data. At most HOST_CMD_MAX_BYTES_PER_CALL bytes are parsed
+ *  and at most one command is executed per call, so the cost added to the
+ *  acquisition loop stays bounded.
+ *
+ *  @return 1 if a command was executed, 0 otherwise
+ */
+int host_cmd_process(void);
+
+/** @brief Format and send one frame to the host
+ *  @param[in] type  frame type (see enum host_cmd_type)
+ *  @param[in] code  frame code (see enum host_cmd_code)
+ *  @param[in] arg   frame arguments
+ *  @param[in] size  size of arguments
+ *  @return 0 on success, negative value if the frame does not fit
+ */
+int host_cmd_send(uint8_t type, uint8_t code, const void * arg, uint16_t size);
+
+#endif /* HOST_CMD_H_ */
@@ -0,0 +1,66 @@
+/*
+ * hotplug.c
+ *
+ * Presence of the IMUs while acquiring, see hotplug.h.
+ */
+#include <asf.h>
+
+#include "Invn/EmbUtils/Message.h"
+#include "Invn/EmbUtils/DataConverter.h"
+
+#include "time_wrapper.h"
+#include "host_cmd.h"
+#include "mux_topo.h"
+#include "hotplug.h"
+
+static uint32_t generation;
+static unsigned cursor;
+static uint64_t probe_us;
+
+void hotplug_init(void)
+{
+	generation = 0;
+	cursor = 0;
+	probe_us = 0;
+}
+
+int hotplug_due(void)
+{
+	const uint64_t now = inv_icm20948_get_time_us();
+
+	if(probe_us && now - probe_us < HOTPLUG_PROBE_PERIOD_US)
+		return 0;
+	probe_us = now;
+	return 1;
+}
+
+unsigned hotplug_next_slot(unsigned slots)
+{
+	if(cursor >= slots)
+		cursor = 0;
+	return cursor++;
+}
+
+int hotplug_changed(int imu, int present, unsigned imus)
+{
+	const struct mux_topo_dev * dev = mux_topo_dev(imu);
+	uint8_t payload[10];
+
+	generation++;
+	INV_MSG(INV_MSG_LEVEL_INFO, "Topology %lu: IMU %d %s, %d streaming", (unsigned long)generation, imu,
+			present ? "up" : "down", imus);
+
+	inv_dc_int32_to_little8((int32_t)generation, &payload[0]);
+	payload[4] = (uint8_t)imu;
+	payload[5] = (uint8_t)(present != 0);
+	payload[6] = (dev->mux < 0) ? 0 : mux_topo_mux(dev->mux)->addr;
+	payload[7] = dev->channel;
+	payload[8] = dev->addr;
+	payload[9] = (uint8_t)imus;
+	return host_cmd_send(HOST_CMD_TYPE_ASYNC, HOST_CMD_CODE_TOPOLOGY, payload, sizeof(payload));
+}
+
+uint32_t hotplug_generation(void)
+{
+	return generation;
+}
@@ -0,0 +1,53 @@
+/*
+ * hotplug.h
+ *
+ * Presence of the IMUs while acquiring.
+ *
+ * A limb connector reseated takes its IMUs away then back. An IMU that
+ * stops answering is quarantined by the fault policy (fault.h) and the
+ * others go on. In the spare time of the sweeps one slot of mux_topo.h is
+ * probed every HOTPLUG_PROBE_PERIOD_US, skipping the ones of IMUs streaming
+ * or waiting for their next recovery, and an IMU that answers in a slot is
+ * brought up alone (bringup_imu()) while the others keep streaming.
+ *
+ * Each change of the IMUs streaming counts a generation and is sent:
+ *   HOST_CMD_CODE_TOPOLOGY <generation (4)> <imu (1)> <present (1)>
+ *                          <mux address (1), 0 on TWI0> <channel (1)>
+ *                          <address (1)> <IMUs present (1)>
+ */
+
+
+#ifndef HOTPLUG_H_
+#define HOTPLUG_H_
+
+#include <stdint.h>
+
+#include "mux_topo.h"
+
+/* Time between two slot probes, a probe is a mux switch and a register read */
+#define HOTPLUG_PROBE_PERIOD_US		50000u
+
+/** @brief Back to the first slot, generation back to 0
+ */
+void hotplug_init(void);
+
+/** @brief Whether a probe is due, the next one is then one period away
+ */
+int hotplug_due(void);
+
+/** @brief Next slot to probe, round robin
+ *  @param[in] slots  mux_topo_slot_count()
+ */
+unsigned hotplug_next_slot(unsigned slots);
+
+/** @brief An IMU started or stopped streaming: count a generation and send it
+ *  @param[in] imus  IMUs streaming now
+ *  @return 0 on success, negative value if not sent
+ */
+int hotplug_changed(int imu, int present, unsigned imus);
+
+/** @brief Changes since boot
+ */
+uint32_t hotplug_generation(void);
+
+#endif /* HOTPLUG_H_ */
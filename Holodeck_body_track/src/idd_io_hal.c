@@ -23,6 +23,8 @@
  
 #include <asf.h>
 #include "idd_io_hal.h"
+#include "prof_zone.h"
+#include "time_wrapper.h"
 
 // board drivers
 //#include "i2c_master.h"
@@ -37,39 +39,263 @@
 
 /* Host Serif object definition for SPI ***************************************/
 
+static struct idd_io_hal_stats stats;
+
+/* IMU the driver talks to, set with the mux path (mux_topo_select()) */
+static uint8_t chip_addr = 0x69;
+
+static void (*yield_cb)(void);
+
+/* Broadcast session in progress, see idd_io_hal_broadcast() */
+static int session_mode = IDD_IO_HAL_UNICAST;
+static int (*route_cb)(int member);
+static unsigned session_members;
+static int session_route;		/* member the bus is on, or IDD_IO_HAL_GROUP */
+static struct idd_io_hal_session session;
+
+#define ROUTE_NONE	(-2)
+
+#define FNV_OFFSET	2166136261u
+#define FNV_PRIME	16777619u
+
+/* Longest read compared between the members of a group */
+#define MIRROR_MAX	64
+
+/* DMP memory of the ICM-20948: address registers and data port */
+#define REG_MEM_START_ADDR	0x7C
+#define REG_MEM_R_W			0x7D
+#define REG_MEM_BANK_SEL	0x7E
+
+static const uint8_t * dmp_image;
+static uint32_t dmp_image_size;
+static uint16_t dmp_image_addr;
+static uint16_t mem_addr;		/* of the next access to the DMP memory */
+
+/*
+ * Reads of the leader for its followers: register, length, then the data,
+ * or the length or'ed with LOG_IMAGE then how many reads in a row found the
+ * DMP image, as when a load is verified
+ */
+#define LOG_SIZE	512
+#define LOG_IMAGE	0x80
+static uint8_t session_log[LOG_SIZE];
+static unsigned log_len, log_pos;
+static unsigned log_run;		/* reads of the image replayed from the entry at log_pos */
+static int log_last;			/* entry of the image reads to count the next in, or -1 */
+
+/* Count a write in the session, and where it leaves the DMP memory address */
+static void session_write(uint8_t reg, const uint8_t * data, uint32_t len)
+{
+	uint32_t h = session.digest ^ reg;
+	uint32_t k;
+
+	h *= FNV_PRIME;
+	for(k = 0; k < len; ++k)
+		h = (h ^ data[k]) * FNV_PRIME;
+	/* the length too, a split write is not the same */
+	session.digest = (h ^ len) * FNV_PRIME;
+	session.writes++;
+	session.bytes += len;
+
+	if(reg == REG_MEM_BANK_SEL && len == 1)
+		mem_addr = (uint16_t)((data[0] << 8) | (mem_addr & 0xff));
+	else if(reg == REG_MEM_START_ADDR && len == 1)
+		mem_addr = (uint16_t)((mem_addr & 0xff00) | data[0]);
+	else if(reg == REG_MEM_R_W)
+		mem_addr += len;
+}
+
+/* Part of the DMP image a read of the DMP memory returns, 0 if it is outside */
+static const uint8_t * image_at(uint8_t reg, uint32_t len)
+{
+	if(reg != REG_MEM_R_W || !dmp_image || mem_addr < dmp_image_addr || mem_addr - dmp_image_addr + len > dmp_image_size)
+		return 0;
+	return dmp_image + (mem_addr - dmp_image_addr);
+}
+
+/* Keep a read of the leader */
+static void log_read(uint8_t reg, const uint8_t * data, uint32_t len)
+{
+	const uint8_t * image = image_at(reg, len);
+	const int as_image = image && memcmp(image, data, len) == 0;
+
+	if(as_image && log_last >= 0 && session_log[log_last] == reg && session_log[log_last + 1] == (len | LOG_IMAGE)
+			&& session_log[log_last + 2] < 0xff) {
+		session_log[log_last + 2]++;
+	} else if(len >= LOG_IMAGE || log_len + 2 + (as_image ? 1 : len) > LOG_SIZE) {
+		session.lost = 1;
+	} else {
+		log_last = as_image ? (int)log_len : -1;
+		session_log[log_len++] = reg;
+		session_log[log_len++] = (uint8_t)(len | (as_image ? LOG_IMAGE : 0));
+		if(as_image) {
+			session_log[log_len++] = 1;
+		} else {
+			memcpy(&session_log[log_len], data, len);
+			log_len += len;
+		}
+		session.log_used = (uint16_t)log_len;
+	}
+	if(reg == REG_MEM_R_W)
+		mem_addr += len;
+}
+
+/* Answer a read of a follower with the leader's */
+static int replay_read(uint8_t reg, uint8_t * data, uint32_t len)
+{
+	const uint8_t * image = image_at(reg, len);
+
+	if(session.lost || log_pos + 2 > log_len || session_log[log_pos] != reg
+			|| (session_log[log_pos + 1] & ~LOG_IMAGE) != len || ((session_log[log_pos + 1] & LOG_IMAGE) && !image)) {
+		session.lost = 1;
+		return TWI_NO_CHIP_FOUND;
+	}
+	if(session_log[log_pos + 1] & LOG_IMAGE) {
+		memcpy(data, image, len);
+		if(++log_run == session_log[log_pos + 2]) {
+			log_pos += 3;
+			log_run = 0;
+		}
+	} else {
+		memcpy(data, &session_log[log_pos + 2], len);
+		log_pos += 2 + len;
+	}
+	if(reg == REG_MEM_R_W)
+		mem_addr += len;
+	return TWI_SUCCESS;
+}
+
+/* Run a transfer, again on NACK, and account it */
+static int idd_io_hal_transfer(uint32_t (*transfer)(Twi *, twi_package_t *), twi_package_t * packet)
+{
+	const uint64_t start = inv_icm20948_get_time_us();
+	int rc, tries = 0;
+
+	while((rc = transfer(TWI0, packet)) == TWI_RECEIVE_NACK && tries < IDD_IO_HAL_RETRIES)
+		tries++;
+	stats.transfers++;
+	stats.retries += tries;
+	stats.bytes += (tries + 1) * (1 + packet->addr_length + packet->length);
+	if(rc != TWI_SUCCESS)
+		stats.errors++;
+	stats.busy_us += inv_icm20948_get_time_us() - start;
+	return rc;
+}
+
 static int idd_io_hal_init_twi(void)
 {
 
 	twi_master_options_t opt = {
-		.speed = 40000,
+		.speed = IDD_IO_HAL_SPEED,
 		.chip  = 0x50
 	};
 	twi_master_setup(TWI0, &opt);
 }
 
-static int idd_io_hal_read_reg_twi(uint8_t reg, uint8_t * rbuffer, uint32_t rlen)
+static int read_twi(uint8_t reg, uint8_t * rbuffer, uint32_t rlen)
 {
 	twi_package_t packet_read = {
 		.addr         = reg,      // TWI slave memory address data
 		.addr_length  = sizeof (uint8_t),    // TWI slave memory address data size
-		.chip         = 0x69,      // TWI slave bus address
+		.chip         = chip_addr, // TWI slave bus address
 		.buffer       = rbuffer,        // transfer data destination buffer
 		.length       = rlen                    // transfer data size (bytes)
 	};
+	int rc;
+
 	// Perform a multi-byte read access then check the result.
-	return twi_master_read(TWI0, &packet_read);
+	PROF_ZONE_BEGIN(PROF_ZONE_TWI_READ);
+	rc = idd_io_hal_transfer(twi_master_read, &packet_read);
+	PROF_ZONE_END(PROF_ZONE_TWI_READ);
+	return rc;
 }
 
-static int idd_io_hal_write_reg_twi(uint8_t reg, const uint8_t * wbuffer, uint32_t wlen)
+/* Put the bus of a session on a member or on the group */
+static int route_to(int member)
+{
+	if(session_route == member)
+		return TWI_SUCCESS;
+	if(route_cb(member) < 0) {
+		session_route = ROUTE_NONE;
+		stats.errors++;
+		return TWI_NO_CHIP_FOUND;
+	}
+	session_route = member;
+	return TWI_SUCCESS;
+}
+
+/* A read of the leader, made again on each follower that is to read the same */
+static int lead_read(uint8_t reg, uint8_t * rbuffer, uint32_t rlen)
+{
+	uint8_t mirror[MIRROR_MAX];
+	unsigned k;
+	int rc;
+
+	rc = route_to(0);
+	if(rc == TWI_SUCCESS)
+		rc = read_twi(reg, rbuffer, rlen);
+	if(rc != TWI_SUCCESS)
+		return rc;
+	for(k = 1; k < session_members; ++k) {
+		if(session.diverged & (1ull << k))
+			continue;
+		if(rlen > MIRROR_MAX || route_to((int)k) != TWI_SUCCESS || read_twi(reg, mirror, rlen) != TWI_SUCCESS
+				|| memcmp(mirror, rbuffer, rlen) != 0)
+			session.diverged |= 1ull << k;
+	}
+	log_read(reg, rbuffer, rlen);
+	return rc;
+}
+
+static int idd_io_hal_read_reg_twi(uint8_t reg, uint8_t * rbuffer, uint32_t rlen)
+{
+	int rc;
+
+	if(session_mode == IDD_IO_HAL_FOLLOW)
+		return replay_read(reg, rbuffer, rlen);
+	rc = (session_mode == IDD_IO_HAL_LEAD) ? lead_read(reg, rbuffer, rlen) : read_twi(reg, rbuffer, rlen);
+	if(yield_cb)
+		yield_cb();
+	return rc;
+}
+
+static int write_twi(uint8_t reg, const uint8_t * wbuffer, uint32_t wlen)
 {
 	twi_package_t packet_write = {
 		.addr         = reg,      // TWI slave memory address data
 		.addr_length  = sizeof (uint8_t),    // TWI slave memory address data size
-		.chip         = 0x69,      // TWI slave bus address
+		.chip         = chip_addr, // TWI slave bus address
 		.buffer       = wbuffer, // transfer data source buffer
 		.length       = wlen  // transfer data size (bytes)
 	};
-	return twi_master_write(TWI0, &packet_write) ;
+	int rc;
+
+	PROF_ZONE_BEGIN(PROF_ZONE_TWI_WRITE);
+	rc = idd_io_hal_transfer(twi_master_write, &packet_write);
+	PROF_ZONE_END(PROF_ZONE_TWI_WRITE);
+	return rc;
+}
+
+static int idd_io_hal_write_reg_twi(uint8_t reg, const uint8_t * wbuffer, uint32_t wlen)
+{
+	int rc;
+
+	if(session_mode != IDD_IO_HAL_UNICAST)
+		session_write(reg, wbuffer, wlen);
+	if(session_mode == IDD_IO_HAL_FOLLOW) {
+		/* the leader wrote it to this IMU already */
+		stats.followed_bytes += wlen;
+		return TWI_SUCCESS;
+	}
+	if(session_mode == IDD_IO_HAL_LEAD) {
+		if((rc = route_to(IDD_IO_HAL_GROUP)) != TWI_SUCCESS)
+			return rc;
+		stats.broadcast_bytes += wlen;
+	}
+	rc = write_twi(reg, wbuffer, wlen);
+	if(yield_cb)
+		yield_cb();
+	return rc;
 }
 
 static const inv_host_serif_t serif_instance_twi = {
@@ -87,3 +313,60 @@ const inv_host_serif_t * idd_io_hal_get_serif_instance_twi(void)
 {
 	return &serif_instance_twi;
 }
+
+void idd_io_hal_set_addr(uint8_t addr)
+{
+	chip_addr = addr;
+}
+
+void idd_io_hal_set_yield(void (*yield)(void))
+{
+	yield_cb = yield;
+}
+
+const struct idd_io_hal_stats * idd_io_hal_get_stats(void)
+{
+	return &stats;
+}
+
+void idd_io_hal_set_image(const uint8_t * image, uint32_t size, uint16_t addr)
+{
+	dmp_image = image;
+	dmp_image_size = size;
+	dmp_image_addr = addr;
+}
+
+void idd_io_hal_broadcast(int mode, int (*route)(int member), unsigned members)
+{
+	/* a follower that read less than its leader did not make the same call */
+	if(session_mode == IDD_IO_HAL_FOLLOW && log_pos != log_len)
+		session.lost = 1;
+	if(mode == IDD_IO_HAL_LEAD) {
+		memset(&session, 0, sizeof(session));
+		log_len = 0;
+		log_last = -1;
+	}
+	if(mode != IDD_IO_HAL_UNICAST) {
+		session.writes = 0;
+		session.bytes = 0;
+		session.digest = FNV_OFFSET;
+		session.lost = 0;
+		log_pos = 0;
+		log_run = 0;
+		mem_addr = 0;
+	}
+	session_mode = mode;
+	route_cb = (mode == IDD_IO_HAL_LEAD) ? route : 0;
+	session_members = (mode == IDD_IO_HAL_LEAD && members <= IDD_IO_HAL_GROUP_MAX) ? members : 1;
+	session_route = ROUTE_NONE;
+}
+
+int idd_io_hal_broadcast_mode(void)
+{
+	return session_mode;
+}
+
+const struct idd_io_hal_session * idd_io_hal_get_session(void)
+{
+	return &session;
+}
@@ -29,6 +29,8 @@
 #ifndef _IDD_IO_HAL_H_
 #define _IDD_IO_HAL_H_
 
+#include <stdint.h>
+
 #include "Invn/Devices/HostSerif.h"
 
 #ifdef __cplusplus
@@ -40,6 +42,97 @@ extern "C" {
  */
 const inv_host_serif_t * idd_io_hal_get_serif_instance_twi(void);
 
+/** @brief I2C address of the IMU the serif talks to, 0x69 until set
+ */
+void idd_io_hal_set_addr(uint8_t addr);
+
+/** @brief Called after each transfer of the serif, NULL for none
+ *
+ *  Lets other work use the bus between two transfers of a long driver call,
+ *  see bringup_imu(). It must leave the serif on the same IMU.
+ */
+void idd_io_hal_set_yield(void (*yield)(void));
+
+/* TWI clock */
+#define IDD_IO_HAL_SPEED	40000
+
+/* Times a NACKed transfer is tried again, an IMU busy with its DMP may miss one */
+#define IDD_IO_HAL_RETRIES	2
+
+/* Counters since boot, the caller knows which IMU is selected */
+struct idd_io_hal_stats {
+	uint32_t transfers;
+	uint32_t errors;	/* transfers still failing after the retries */
+	uint32_t retries;
+	uint32_t bytes;		/* on the bus, slave address and register included */
+	uint64_t busy_us;	/* time spent in transfers */
+	uint32_t broadcast_bytes;	/* data bytes written to a group at once, see idd_io_hal_broadcast() */
+	uint32_t followed_bytes;	/* data bytes of followers not sent, their leader wrote them */
+};
+
+/** @brief Counters of the transfers made by the serif
+ */
+const struct idd_io_hal_stats * idd_io_hal_get_stats(void);
+
+/* Broadcast sessions, see idd_io_hal_broadcast() */
+#define IDD_IO_HAL_UNICAST	0
+#define IDD_IO_HAL_LEAD		1
+#define IDD_IO_HAL_FOLLOW	2
+/* Route of a write of the leader, to the whole group */
+#define IDD_IO_HAL_GROUP	(-1)
+/* Members of a group, the leader included */
+#define IDD_IO_HAL_GROUP_MAX	64
+
+/* The session in progress, or the last one */
+struct idd_io_hal_session {
+	uint32_t writes;
+	uint32_t bytes;		/* data bytes, register address excluded */
+	uint32_t digest;	/* FNV-1a of the register and data of every write */
+	uint64_t diverged;	/* followers, by place in the group, that read otherwise than the leader */
+	uint16_t log_used;	/* bytes of the leader's reads kept for the followers */
+	uint8_t lost;		/* the reads kept do not cover the session */
+};
+
+/** @brief DMP image the reads of a leader are kept as, not as data
+ *  @param[in] addr  of the DMP memory the image starts at
+ */
+void idd_io_hal_set_image(const uint8_t * image, uint32_t size, uint16_t addr);
+
+/** @brief Start a broadcast session, or end it with IDD_IO_HAL_UNICAST
+ *
+ *  The IMUs at one address behind several mux channels take a write at
+ *  once when the channels are open together, not a read. A driver call is
+ *  made on one of them, the leader, member 0 of the group:
+ *  IDD_IO_HAL_LEAD    each write goes out once to the whole group,
+ *                     route(IDD_IO_HAL_GROUP). Each read goes to the leader
+ *                     then to every follower in turn, route(member), which
+ *                     is to read the same: a read-modify-write or the check
+ *                     of the DMP image sees what each IMU holds at that
+ *                     point of the call. The leader's reads are kept, those
+ *                     of the DMP image (idd_io_hal_set_image()) as such.
+ *  Then the same call is made on each follower, for its driver state:
+ *  IDD_IO_HAL_FOLLOW  nothing goes on the bus, the writes are dropped and
+ *                     the reads answered with the leader's, in order.
+ *  The register banks cached by the driver are to be forgotten before
+ *  either call (inv_icm20948_transport_init()), the leader and the
+ *  followers then write the same bank selections.
+ *  A follower that read what the leader read, then wrote what it wrote
+ *  (digest), is where the leader's call left it; any other has to make the
+ *  call again on its own.
+ *  @param[in] route    puts the bus on a member, or on the whole group,
+ *                      NULL outside of IDD_IO_HAL_LEAD
+ *  @param[in] members  of the group, IDD_IO_HAL_GROUP_MAX at most
+ */
+void idd_io_hal_broadcast(int mode, int (*route)(int member), unsigned members);
+
+/** @brief Mode of the session in progress, IDD_IO_HAL_UNICAST if none is
+ */
+int idd_io_hal_broadcast_mode(void);
+
+/** @brief Writes of the session in progress, or of the last one
+ */
+const struct idd_io_hal_session * idd_io_hal_get_session(void);
+
 #ifdef __cplusplus
 }
 #endif
@@ -0,0 +1,163 @@
+/*
+ * lat_trace.c
+ *
+ * Motion to host latency of the sensor samples, see lat_trace.h.
+ */
+#include <asf.h>
+#include <string.h>
+
+#include "Invn/EmbUtils/DataConverter.h"
+
+#include "time_wrapper.h"
+#include "host_cmd.h"
+#include "lat_trace.h"
+
+static struct lat_trace_stats stats[LAT_TRACE_IMUS];
+
+/*
+ * Samples drained and not sent yet, times are the low 32 bits of the us
+ * clock, differences stay right across its wrap
+ */
+static struct {
+	uint32_t sample;
+	uint32_t drain;
+	uint32_t format;
+	uint8_t imu;
+} pending[LAT_TRACE_PENDING];
+static unsigned pending_count;
+static unsigned formatted_count;
+
+static uint32_t now_us(void)
+{
+	return (uint32_t)inv_icm20948_get_time_us();
+}
+
+static int bucket(uint32_t us)
+{
+	int octave, b;
+
+	if(us < 4)
+		return (int)us;
+	octave = 31 - __builtin_clz(us);
+	b = 4*(octave - 1) + (int)((us >> (octave - 2)) & 3);
+	return (b < LAT_TRACE_BUCKETS) ? b : LAT_TRACE_BUCKETS - 1;
+}
+
+/* first latency above the bucket */
+static uint32_t bucket_edge(int b)
+{
+	if(b < 4)
+		return (uint32_t)b + 1;
+	return (uint32_t)(4 + (b & 3) + 1) << (b/4 - 1);
+}
+
+static void stage(struct lat_trace_stats * st, enum lat_trace_stage s, uint32_t us)
+{
+	st->stage[s].total += us;
+	if(us > st->stage[s].max)
+		st->stage[s].max = us;
+}
+
+void lat_trace_init(void)
+{
+	memset(stats, 0, sizeof(stats));
+	pending_count = formatted_count = 0;
+}
+
+void lat_trace_drained(int imu, uint64_t sample_us)
+{
+	if(imu < 0 || imu >= LAT_TRACE_IMUS || pending_count >= LAT_TRACE_PENDING)
+		return;
+	pending[pending_count].sample = (uint32_t)sample_us;
+	pending[pending_count].drain = now_us();
+	pending[pending_count].imu = (uint8_t)imu;
+	pending_count++;
+}
+
+void lat_trace_formatted(void)
+{
+	const uint32_t now = now_us();
+
+	for(; formatted_count < pending_count; ++formatted_count)
+		pending[formatted_count].format = now;
+}
+
+void lat_trace_sent(void)
+{
+	uint32_t now;
+	unsigned i;
+
+	if(!pending_count)
+		return;
+	lat_trace_formatted();
+	now = now_us();
+	for(i = 0; i < pending_count; ++i) {
+		struct lat_trace_stats * st = &stats[pending[i].imu];
+		/* the sample time may come a bit after its drain until the clock line is moved */
+		const uint32_t fifo = ((int32_t)(pending[i].drain - pending[i].sample) > 0) ?
+				pending[i].drain - pending[i].sample : 0;
+		const uint32_t total = fifo + (now - pending[i].drain);
+		const int b = bucket(total);
+
+		st->count++;
+		if(total > st->max)
+			st->max = total;
+		if(st->hist[b] != UINT16_MAX)
+			st->hist[b]++;
+		stage(st, LAT_TRACE_STAGE_FIFO, fifo);
+		stage(st, LAT_TRACE_STAGE_FORMAT, pending[i].format - pending[i].drain);
+		stage(st, LAT_TRACE_STAGE_USB, now - pending[i].format);
+	}
+	pending_count = formatted_count = 0;
+}
+
+const struct lat_trace_stats * lat_trace_get(int imu)
+{
+	return &stats[imu];
+}
+
+uint32_t lat_trace_percentile(int imu, unsigned pct)
+{
+	const struct lat_trace_stats * st = &stats[imu];
+	/* saturated buckets make the sum lower than count */
+	uint32_t total = 0, seen = 0;
+	int b;
+
+	for(b = 0; b < LAT_TRACE_BUCKETS; ++b)
+		total += st->hist[b];
+	for(b = 0; b < LAT_TRACE_BUCKETS; ++b) {
+		seen += st->hist[b];
+		if(seen && (uint64_t)seen*100 >= (uint64_t)total*pct)
+			break;
+	}
+	if(b == LAT_TRACE_BUCKETS || bucket_edge(b) - 1 > st->max)
+		return st->max;
+	return bucket_edge(b) - 1;
+}
+
+int lat_trace_send(void)
+{
+	/* <imu (1)> <samples (4)> <p50 (4)> <p99 (4)> <max (4)> <mean (4)> <max (4)> per stage */
+	uint8_t payload[1 + 4*4 + 2*4*LAT_TRACE_STAGE_COUNT];
+	int imu, s, sent = 0;
+
+	for(imu = 0; imu < LAT_TRACE_IMUS; ++imu) {
+		const struct lat_trace_stats * st = &stats[imu];
+
+		if(!st->count)
+			continue;
+		payload[0] = (uint8_t)imu;
+		inv_dc_int32_to_little8((int32_t)st->count, &payload[1]);
+		inv_dc_int32_to_little8((int32_t)lat_trace_percentile(imu, 50), &payload[5]);
+		inv_dc_int32_to_little8((int32_t)lat_trace_percentile(imu, 99), &payload[9]);
+		inv_dc_int32_to_little8((int32_t)st->max, &payload[13]);
+		for(s = 0; s < LAT_TRACE_STAGE_COUNT; ++s) {
+			inv_dc_int32_to_little8((int32_t)(st->stage[s].total / st->count), &payload[17 + 8*s]);
+			inv_dc_int32_to_little8((int32_t)st->stage[s].max, &payload[21 + 8*s]);
+		}
+		if(host_cmd_send(HOST_CMD_TYPE_ASYNC, HOST_CMD_CODE_LATENCY, payload, sizeof(payload)) == 0)
+			sent++;
+	}
+	memset(stats, 0, sizeof(stats));
+	return sent;
+}
@@ -0,0 +1,106 @@
+/*
+ * lat_trace.h
+ *
+ * Motion to host latency of the sensor samples.
+ *
+ * Each sample is timestamped at four stages, in microseconds of
+ * inv_icm20948_get_time_us():
+ *   sample  time the DMP took the sample, on the sample clock of its IMU
+ *           (frame_sync_sample_us()) for the rotation vectors; the driver
+ *           timestamp (event->timestamp) until that clock is measured and
+ *           for the other sensors, though it only spreads the samples of a
+ *           drain up to the drain time
+ *   drain   sample popped from the FIFO by inv_icm20948_poll_sensor(), on
+ *           entry of sensor_event_cb()
+ *   format  sample formatted for the current output format
+ *   sent    frame handed to udi_cdc_write_buf(), on return of the callback
+ *           or, for OUTPUT_FORMAT_DYNPROTOCOL_BATCH, once the batch is flushed
+ * In the text and binary formats the frame is written as soon as it is
+ * formatted, so the format to sent stage is short there. The rotation
+ * vectors converted per sweep (quat_batch.h) are formatted once the whole
+ * sweep is converted and sent after it.
+ *
+ * Per IMU the total (sample to sent) latency goes to a histogram of
+ * LAT_TRACE_BUCKETS buckets, 4 per octave, the last one taking everything
+ * above, from which p50 and p99 are read with a 25 % resolution. Each stage
+ * keeps its mean and max.
+ *
+ * The statistics are sent and cleared every stats period (see
+ * HOST_CMD_CODE_SET_STATS_PERIOD in host_cmd.h), one async frame per IMU
+ * that sent samples since the previous period:
+ *   HOST_CMD_CODE_LATENCY <imu (1)> <samples (4)> <p50 (4)> <p99 (4)> <max (4)>
+ *                         <fifo mean (4)> <fifo max (4)>
+ *                         <format mean (4)> <format max (4)>
+ *                         <usb mean (4)> <usb max (4)>
+ * all latencies in us, fifo being sample to drain, the time the sample sat in
+ * the IMU FIFO, format drain to format and usb format to sent. The clock line
+ * gives the latest time a sample can have been taken, so fifo is short by up
+ * to the few hundred us the drains vary by.
+ */
+
+
+#ifndef LAT_TRACE_H_
+#define LAT_TRACE_H_
+
+#include <stdint.h>
+
+/* Number of IMUs traced, indexed as the sensor table of run_icm20948.c, the
+ * ones above are not: a histogram per IMU is too much RAM for a whole suit */
+#define LAT_TRACE_IMUS			16
+
+/* 4 buckets per octave, up to 131 ms */
+#define LAT_TRACE_BUCKETS		64
+
+/* Samples formatted and not sent yet, the ones above are not traced */
+#define LAT_TRACE_PENDING		64
+
+enum lat_trace_stage {
+	LAT_TRACE_STAGE_FIFO,		/* sample to drain */
+	LAT_TRACE_STAGE_FORMAT,		/* drain to format */
+	LAT_TRACE_STAGE_USB,		/* format to sent */
+	LAT_TRACE_STAGE_COUNT
+};
+
+struct lat_trace_stats {
+	uint32_t count;
+	uint32_t max;
+	uint16_t hist[LAT_TRACE_BUCKETS];	/* saturating */
+	struct {
+		uint32_t max;
+		uint64_t total;
+	} stage[LAT_TRACE_STAGE_COUNT];
+};
+
+/** @brief Clear the statistics and drop the pending samples
+ */
+void lat_trace_init(void);
+
+/** @brief A sample of an IMU was drained from its FIFO
+ *  @param[in] imu        index of the IMU
+ *  @param[in] sample_us  time the sample was taken
+ */
+void lat_trace_drained(int imu, uint64_t sample_us);
+
+/** @brief Every drained sample not formatted yet is formatted now
+ */
+void lat_trace_formatted(void);
+
+/** @brief Every pending sample is sent, account them
+ */
+void lat_trace_sent(void);
+
+/** @brief Statistics of an IMU since the last lat_trace_send()
+ */
+const struct lat_trace_stats * lat_trace_get(int imu);
+
+/** @brief Latency under which pct % of the samples of an IMU were sent
+ *  @return upper edge of the histogram bucket, capped to the max latency
+ */
+uint32_t lat_trace_percentile(int imu, unsigned pct);
+
+/** @brief Send one HOST_CMD_CODE_LATENCY frame per IMU that sent samples and clear the statistics
+ *  @return number of frames sent
+ */
+int lat_trace_send(void);
+
+#endif /* LAT_TRACE_H_ */
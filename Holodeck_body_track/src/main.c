@@ -30,7 +30,11 @@
 #include "delay.h"
 #include "idd_io_hal.h"
 #include "usb_cdc_coms.h"
+#include "startup.h"
 #include "run_icm20948.h"
+#ifdef BENCH_HOTPATH
+#include "../bench/bench_hotpath.h"
+#endif
 
 inv_host_serif_t * twi_handler;
 
@@ -45,9 +49,15 @@ int main (void)
 	irq_initialize_vectors();
 	cpu_irq_enable();
 	board_init();
+	startup_init();
 	
+	serialInit();
+	/* the host enumerates while the IMUs are brought up, see startup.h */
 	udc_start();
-	delay_ms(2000);
+#ifdef BENCH_HOTPATH
+	while(!serialReady());
+	bench_hotpath_run();
+#endif
 	setup_and_run_icm20948();
 
 	
@@ -67,8 +77,7 @@ int main (void)
 
 	// Insert application code here, after the board has been initialized.
 	while(1){
-		//handleInput();
-		handleInput_blocking();
+		handleInput();
 			sprintf(outBuf,"About to delay 500ms\n");
 			serialWrite(outBuf,strlen(outBuf));
 			delay_ms(500);
@@ -0,0 +1,356 @@
+/*
+ * msg_log.c
+ *
+ * Deferred logger for the INV_MSG facility, see msg_log.h.
+ *
+ * msg_log_record() is the only producer and msg_log_flush() the only
+ * consumer of the ring, each one only moves its own index so no lock is
+ * needed between them.
+ */
+#include <asf.h>
+#include <ctype.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "Invn/EmbUtils/Message.h"
+#include "Invn/EmbUtils/RingBuffer.h"
+#include "Invn/EmbUtils/DataConverter.h"
+
+#include "usb_cdc_coms.h"
+#include "host_cmd.h"
+#include "msg_log.h"
+
+enum msg_log_arg {
+	MSG_LOG_ARG_NONE,		/* %% */
+	MSG_LOG_ARG_INT,		/* %d %i %u %x %X %o %c and h, hh modifiers */
+	MSG_LOG_ARG_LONG,		/* l, z, t modifiers */
+	MSG_LOG_ARG_LLONG,		/* ll, j modifiers */
+	MSG_LOG_ARG_DOUBLE,		/* %f %F %e %E %g %G %a %A */
+	MSG_LOG_ARG_PTR,		/* %s %p */
+	MSG_LOG_ARG_SKIP,		/* %n, never written back */
+};
+
+struct msg_log_rec {
+	uint8_t      level;
+	uint8_t      nwords;
+	uint8_t      truncated;
+	const char * str;
+	uint32_t     words[MSG_LOG_MAX_WORDS];
+};
+
+static RINGBUFFER(ring, MSG_LOG_RECORDS, struct msg_log_rec);
+
+static volatile uint32_t dropped;
+static uint32_t dropped_reported;
+
+/* Only used by msg_log_flush(), static to limit stack usage */
+static char out_str[256];
+
+static const char * const level_str[INV_MSG_LEVEL_MAX] = {
+	"",     // INV_MSG_LEVEL_OFF
+	"[E] ", // INV_MSG_LEVEL_ERROR
+	"[W] ", // INV_MSG_LEVEL_WARNING
+	"[I] ", // INV_MSG_LEVEL_INFO
+	"[V] ", // INV_MSG_LEVEL_VERBOSE
+	"[D] ", // INV_MSG_LEVEL_DEBUG
+};
+
+/*
+ * Skip one conversion specification, p points just after the '%'
+ * Return a pointer past the conversion character
+ */
+static const char * parse_spec(const char * p, int * stars, enum msg_log_arg * arg)
+{
+	int len = 0;
+
+	*stars = 0;
+	while(*p && strchr("-+ #0", *p))
+		++p;
+	if(*p == '*')
+		++*stars, ++p;
+	while(isdigit((unsigned char)*p))
+		++p;
+	if(*p == '.') {
+		++p;
+		if(*p == '*')
+			++*stars, ++p;
+		while(isdigit((unsigned char)*p))
+			++p;
+	}
+	for(;; ++p) {
+		if(*p == 'l')
+			++len;
+		else if(*p == 'j')
+			len = 2;
+		else if(*p == 'z' || *p == 't')
+			len = 1;
+		else if(*p != 'h' && *p != 'L')
+			break;
+	}
+
+	switch(*p) {
+	case '%':
+		*arg = MSG_LOG_ARG_NONE;
+		break;
+	case 'f': case 'F': case 'e': case 'E': case 'g': case 'G': case 'a': case 'A':
+		*arg = MSG_LOG_ARG_DOUBLE;
+		break;
+	case 's': case 'p':
+		*arg = MSG_LOG_ARG_PTR;
+		break;
+	case 'n':
+		*arg = MSG_LOG_ARG_SKIP;
+		break;
+	case '\0':
+		*arg = MSG_LOG_ARG_NONE;
+		return p;
+	default:
+		*arg = (len >= 2) ? MSG_LOG_ARG_LLONG : (len == 1) ? MSG_LOG_ARG_LONG : MSG_LOG_ARG_INT;
+		break;
+	}
+
+	return p + 1;
+}
+
+static int push_word(struct msg_log_rec * rec, const void * value, unsigned size)
+{
+	const unsigned n = (size + sizeof(uint32_t) - 1) / sizeof(uint32_t);
+
+	if(rec->nwords + n > MSG_LOG_MAX_WORDS)
+		return -1;
+	memcpy(&rec->words[rec->nwords], value, size);
+	rec->nwords += n;
+	return 0;
+}
+
+static int pop_word(const struct msg_log_rec * rec, unsigned * idx, void * value, unsigned size)
+{
+	const unsigned n = (size + sizeof(uint32_t) - 1) / sizeof(uint32_t);
+
+	if(*idx + n > rec->nwords)
+		return -1;
+	memcpy(value, &rec->words[*idx], size);
+	*idx += n;
+	return 0;
+}
+
+void msg_log_init(void)
+{
+	RINGBUFFER_CLEAR(&ring);
+	dropped = 0;
+	dropped_reported = 0;
+}
+
+void msg_log_record(int level, const char * str, va_list ap)
+{
+	struct msg_log_rec * rec;
+	const char * p = str;
+
+	if(RINGBUFFER_FULL(&ring)) {
+		dropped++;
+		return;
+	}
+
+	RINGBUFFER_GETREFNEXT(&ring, rec);
+	rec->level     = (uint8_t)level;
+	rec->nwords    = 0;
+	rec->truncated = 0;
+	rec->str       = str;
+
+	while(*p && !rec->truncated) {
+		enum msg_log_arg arg;
+		int stars;
+
+		if(*p++ != '%')
+			continue;
+		p = parse_spec(p, &stars, &arg);
+
+		while(stars--) {
+			int v = va_arg(ap, int);
+			rec->truncated |= (push_word(rec, &v, sizeof(v)) != 0);
+		}
+
+		switch(arg) {
+		case MSG_LOG_ARG_INT: {
+			int v = va_arg(ap, int);
+			rec->truncated |= (push_word(rec, &v, sizeof(v)) != 0);
+			break;
+		}
+		case MSG_LOG_ARG_LONG: {
+			long v = va_arg(ap, long);
+			rec->truncated |= (push_word(rec, &v, sizeof(v)) != 0);
+			break;
+		}
+		case MSG_LOG_ARG_LLONG: {
+			long long v = va_arg(ap, long long);
+			rec->truncated |= (push_word(rec, &v, sizeof(v)) != 0);
+			break;
+		}
+		case MSG_LOG_ARG_DOUBLE: {
+			double v = va_arg(ap, double);
+			rec->truncated |= (push_word(rec, &v, sizeof(v)) != 0);
+			break;
+		}
+		case MSG_LOG_ARG_PTR: {
+			const void * v = va_arg(ap, const void *);
+			rec->truncated |= (push_word(rec, &v, sizeof(v)) != 0);
+			break;
+		}
+		case MSG_LOG_ARG_SKIP:
+			(void)va_arg(ap, void *);
+			break;
+		default:
+			break;
+		}
+	}
+
+	RINGBUFFER_INCREMENT(&ring, rec);
+}
+
+/*
+ * Format a record in out_str the way vsnprintf() would have done at record time
+ */
+static unsigned format_rec(const struct msg_log_rec * rec)
+{
+	const char * p = rec->str;
+	unsigned idx = 0, w = 0;
+	int truncated = 0;
+	char spec[24];
+
+	idx += snprintf(&out_str[idx], sizeof(out_str) - idx, "%s", level_str[rec->level]);
+
+	while(*p && !truncated && idx < sizeof(out_str) - 1) {
+		const char * start = p;
+		unsigned len = 0;
+		enum msg_log_arg arg;
+		int stars, rc = 0;
+
+		if(*p != '%') {
+			out_str[idx++] = *p++;
+			continue;
+		}
+		p = parse_spec(p + 1, &stars, &arg);
+
+		/* copy the specification, replacing '*' by the recorded value */
+		for(; start < p && len < sizeof(spec) - 12; ++start) {
+			if(*start == '*') {
+				int v = 0;
+				truncated |= (pop_word(rec, &w, &v, sizeof(v)) != 0);
+				len += sprintf(&spec[len], "%d", v);
+			} else {
+				spec[len++] = *start;
+			}
+		}
+		spec[len] = '\0';
+
+		switch(arg) {
+		case MSG_LOG_ARG_NONE:
+			out_str[idx++] = '%';
+			break;
+		case MSG_LOG_ARG_INT: {
+			int v;
+			if((truncated |= (pop_word(rec, &w, &v, sizeof(v)) != 0)) == 0)
+				rc = snprintf(&out_str[idx], sizeof(out_str) - idx, spec, v);
+			break;
+		}
+		case MSG_LOG_ARG_LONG: {
+			long v;
+			if((truncated |= (pop_word(rec, &w, &v, sizeof(v)) != 0)) == 0)
+				rc = snprintf(&out_str[idx], sizeof(out_str) - idx, spec, v);
+			break;
+		}
+		case MSG_LOG_ARG_LLONG: {
+			long long v;
+			if((truncated |= (pop_word(rec, &w, &v, sizeof(v)) != 0)) == 0)
+				rc = snprintf(&out_str[idx], sizeof(out_str) - idx, spec, v);
+			break;
+		}
+		case MSG_LOG_ARG_DOUBLE: {
+			double v;
+			if((truncated |= (pop_word(rec, &w, &v, sizeof(v)) != 0)) == 0)
+				rc = snprintf(&out_str[idx], sizeof(out_str) - idx, spec, v);
+			break;
+		}
+		case MSG_LOG_ARG_PTR: {
+			const void * v;
+			if((truncated |= (pop_word(rec, &w, &v, sizeof(v)) != 0)) == 0)
+				rc = snprintf(&out_str[idx], sizeof(out_str) - idx, spec, v);
+			break;
+		}
+		default:
+			break;
+		}
+		if(rc > 0)
+			idx += rc;
+		if(idx > sizeof(out_str) - 1)
+			idx = sizeof(out_str) - 1;
+	}
+
+	if(truncated || rec->truncated)
+		idx += snprintf(&out_str[idx], sizeof(out_str) - idx, "...");
+	if(idx > sizeof(out_str) - 3)
+		idx = sizeof(out_str) - 3;
+	out_str[idx++] = '\r';
+	out_str[idx++] = '\n';
+	out_str[idx] = '\0';
+
+	return idx;
+}
+
+static void send_rec(const struct msg_log_rec * rec, int binary)
+{
+	if(binary) {
+		/* <level> <nwords> <format address (4)> <words (4*nwords)> */
+		uint8_t payload[2 + 4 + 4*MSG_LOG_MAX_WORDS];
+		unsigned i;
+
+		payload[0] = rec->level;
+		payload[1] = rec->nwords;
+		inv_dc_int32_to_little8((int32_t)(uintptr_t)rec->str, &payload[2]);
+		for(i = 0; i < rec->nwords; ++i)
+			inv_dc_int32_to_little8((int32_t)rec->words[i], &payload[6 + 4*i]);
+		host_cmd_send(HOST_CMD_TYPE_ASYNC, HOST_CMD_CODE_LOG, payload, 6 + 4*rec->nwords);
+	} else {
+		const unsigned len = format_rec(rec);
+		serialWrite(out_str, len);
+	}
+}
+
+int msg_log_flush(unsigned max, int binary)
+{
+	const uint32_t lost = dropped;
+	int count = 0;
+
+	if(!serialReady())
+		return 0;
+	while(!RINGBUFFER_EMPTY(&ring) && (max == 0 || count < (int)max)) {
+		struct msg_log_rec * rec;
+
+		RINGBUFFER_FRONT(&ring, rec);
+		send_rec(rec, binary);
+		RINGBUFFER_POPNLOSE(&ring);
+		++count;
+	}
+
+	/* report lost messages once the older ones are out */
+	if(RINGBUFFER_EMPTY(&ring) && lost != dropped_reported) {
+		struct msg_log_rec rec;
+		unsigned long n = lost - dropped_reported;
+
+		rec.level     = INV_MSG_LEVEL_WARNING;
+		rec.nwords    = 0;
+		rec.truncated = 0;
+		if(binary) {
+			/* MSG_LOG_ID_DROPPED, host knows the count is a single word */
+			rec.str = (const char *)MSG_LOG_ID_DROPPED;
+			rec.words[rec.nwords++] = (uint32_t)n;
+		} else {
+			rec.str = "%lu messages dropped";
+			push_word(&rec, &n, sizeof(n));
+		}
+		send_rec(&rec, binary);
+		dropped_reported = lost;
+	}
+
+	return count;
+}
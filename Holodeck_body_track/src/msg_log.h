@@ -0,0 +1,57 @@
+/*
+ * msg_log.h
+ *
+ * Deferred logger for the INV_MSG facility.
+ *
+ * Call sites only store the address of their format string (used as message
+ * ID) and the raw argument words into a single producer / single consumer
+ * ring. Records are formatted or sent later, from msg_log_flush(), when the
+ * acquisition loop has nothing else to do. Until the host enables CDC
+ * (serialReady()) they stay in the ring, so the boot messages are sent once
+ * it connects.
+ *
+ * In binary mode a record is sent as an async frame (see host_cmd.h):
+ *   HOST_CMD_CODE_LOG <level (1)> <nwords (1)> <format address (4)> <words (4*nwords)>
+ * The host expands it with tools/msg_log.py and the string table extracted
+ * from the firmware ELF at build time.
+ *
+ * As the format string is formatted later, %s arguments must point to strings
+ * that are still valid then (literals or constant tables, as done by the
+ * drivers).
+ */
+
+
+#ifndef MSG_LOG_H_
+#define MSG_LOG_H_
+
+#include <stdarg.h>
+#include <stdint.h>
+
+/* Number of records in the ring, must be a power of 2 */
+#define MSG_LOG_RECORDS		64
+
+/* Maximum number of 32-bit argument words stored per record */
+#define MSG_LOG_MAX_WORDS	8
+
+/* Format address reported when records were lost, words[0] is the count */
+#define MSG_LOG_ID_DROPPED	0
+
+/** @brief Reset the logger
+ */
+void msg_log_init(void);
+
+/** @brief Store a message in the ring, to be used as INV_MSG printer
+ *
+ *  Does not format anything. If the ring is full the message is dropped and
+ *  counted.
+ */
+void msg_log_record(int level, const char * str, va_list ap);
+
+/** @brief Send pending messages
+ *  @param[in] max     maximum number of records to send, 0 for all
+ *  @param[in] binary  1 to send binary frames, 0 to send formatted text lines
+ *  @return number of records sent, 0 while the host is not connected
+ */
+int msg_log_flush(unsigned max, int binary);
+
+#endif /* MSG_LOG_H_ */
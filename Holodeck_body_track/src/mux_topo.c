@@ -0,0 +1,413 @@
+/*
+ * mux_topo.c
+ *
+ * Topology of the IMU bus, see mux_topo.h.
+ */
+#include <asf.h>
+#include <string.h>
+
+#include "Invn/EmbUtils/Message.h"
+
+#include "time_wrapper.h"
+#include "prof_zone.h"
+#include "health.h"
+#include "idd_io_hal.h"
+#include "mux_topo.h"
+
+#define MUX_TOPO_WHOAMI_REG		0x00
+
+/* IMU addresses, AD0 low then high */
+static const uint8_t dev_addrs[MUX_TOPO_DEV_ADDRS] = { 0x68, 0x69 };
+
+static struct mux_topo_mux muxes[MUX_TOPO_MAX_MUXES];
+static unsigned mux_count;
+static struct mux_topo_dev devs[MUX_TOPO_MAX_DEVICES];
+static unsigned dev_count;
+
+/* Group of the last mux_topo_select_group(): control registers, IMUs */
+static int16_t group_want[MUX_TOPO_MAX_MUXES];
+static int group_devs[MUX_TOPO_MAX_DEVICES];
+static unsigned group_count;
+
+/* Control register write of a known mux */
+static int mux_write(int m, uint8_t mask)
+{
+	const uint64_t start = inv_icm20948_get_time_us();
+	uint8_t data = mask;
+	twi_package_t packet = {
+		.addr         = 0,
+		.addr_length  = 0,			// no register, the control register takes the byte
+		.chip         = muxes[m].addr,
+		.buffer       = &data,
+		.length       = 1
+	};
+	int rc;
+
+	PROF_ZONE_BEGIN(PROF_ZONE_CHANNEL_SET);
+	rc = twi_master_write(TWI0, &packet);
+	health_mux(rc, (uint32_t)(inv_icm20948_get_time_us() - start));
+	PROF_ZONE_END(PROF_ZONE_CHANNEL_SET);
+	muxes[m].mask = (rc == TWI_SUCCESS) ? mask : -1;
+	return (rc == TWI_SUCCESS) ? 0 : -1;
+}
+
+/* A mux at addr turned off, if there is one */
+static int mux_probe(uint8_t addr)
+{
+	uint8_t data = 0;
+	twi_package_t packet = {
+		.addr         = 0,
+		.addr_length  = 0,
+		.chip         = addr,
+		.buffer       = &data,
+		.length       = 1
+	};
+
+	return (twi_master_write(TWI0, &packet) == TWI_SUCCESS) ? 0 : -1;
+}
+
+static int read_reg(uint8_t addr, uint8_t reg, uint8_t * value)
+{
+	twi_package_t packet = {
+		.addr         = reg,
+		.addr_length  = sizeof(uint8_t),
+		.chip         = addr,
+		.buffer       = value,
+		.length       = 1
+	};
+
+	return (twi_master_read(TWI0, &packet) == TWI_SUCCESS) ? 0 : -1;
+}
+
+/* Whether a mux is right on a port: the bus itself when mux is -1 */
+static int on_port(int m, int mux, int channel)
+{
+	return muxes[m].parent == mux && (mux < 0 || muxes[m].channel == channel);
+}
+
+/* Whether a known mux answers at addr from a port, on it or on the way to it */
+static int seen_from(uint8_t addr, int mux, int channel)
+{
+	unsigned m;
+
+	for(;;) {
+		for(m = 0; m < mux_count; ++m) {
+			if(muxes[m].addr == addr && on_port(m, mux, channel))
+				return 1;
+		}
+		if(mux < 0)
+			return 0;
+		channel = muxes[mux].channel;
+		mux = muxes[mux].parent;
+	}
+}
+
+/*
+ * Open a port with the fewest writes, returns how many or -1
+ * Levels are set from TWI0 on, a mux can be written once the ones before it are
+ */
+static int select_port(int mux, int channel)
+{
+	int8_t path[MUX_TOPO_MAX_DEPTH];
+	uint8_t chan[MUX_TOPO_MAX_DEPTH];
+	int depth = 0, level, parent = -1, parent_channel = 0, writes = 0;
+	int m, c;
+	unsigned k;
+
+	for(m = mux; m >= 0; m = muxes[m].parent)
+		depth++;
+	for(m = mux, c = channel, level = depth - 1; m >= 0; c = muxes[m].channel, m = muxes[m].parent, --level) {
+		path[level] = (int8_t)m;
+		chan[level] = (uint8_t)c;
+	}
+
+	for(level = 0; level <= depth; ++level) {
+		const int open = (level < depth) ? path[level] : -1;
+
+		for(k = 0; k < mux_count; ++k) {
+			const int16_t want = ((int)k == open) ? (int16_t)(1 << chan[level]) : 0;
+
+			if(!on_port(k, parent, parent_channel) || muxes[k].mask == want)
+				continue;
+			if(mux_write(k, (uint8_t)want) < 0)
+				return -1;
+			writes++;
+		}
+		if(open < 0)
+			break;
+		parent = open;
+		parent_channel = chan[level];
+	}
+	return writes;
+}
+
+/* Whether a port is on the bus with the control registers want */
+static int port_seen(const int16_t * want, int mux, int channel)
+{
+	while(mux >= 0) {
+		if(!(want[mux] & (1 << channel)))
+			return 0;
+		channel = muxes[mux].channel;
+		mux = muxes[mux].parent;
+	}
+	return 1;
+}
+
+/*
+ * Control registers that open the paths to a set of IMUs together, the
+ * muxes in sight off the paths turned off
+ * Returns 0 if they make a group, -1 otherwise
+ */
+static int group_masks(const int * dev, unsigned n, int16_t * want)
+{
+	uint64_t set = 0;
+	unsigned k, m, j;
+	int mm, c;
+
+	memset(want, 0, sizeof(group_want));
+	for(k = 0; k < n; ++k) {
+		if(dev[k] < 0 || dev[k] >= (int)dev_count || devs[dev[k]].addr != devs[dev[0]].addr)
+			return -1;
+		set |= 1ull << dev[k];
+		for(mm = devs[dev[k]].mux, c = devs[dev[k]].channel; mm >= 0; c = muxes[mm].channel, mm = muxes[mm].parent)
+			want[mm] |= (int16_t)(1 << c);
+	}
+	/* whatever answers at their address gets the writes */
+	for(k = 0; k < dev_count; ++k) {
+		if(devs[k].addr == devs[dev[0]].addr && !(set & (1ull << k)) && port_seen(want, devs[k].mux, devs[k].channel))
+			return -1;
+	}
+	for(m = 0; m < mux_count; ++m) {
+		if(!port_seen(want, muxes[m].parent, muxes[m].channel))
+			continue;
+		for(j = m + 1; j < mux_count; ++j) {
+			if(muxes[j].addr == muxes[m].addr && port_seen(want, muxes[j].parent, muxes[j].channel))
+				return -1;
+		}
+	}
+	return 0;
+}
+
+/*
+ * Write the control registers that changed, returns how many or -1
+ * Levels are set from TWI0 on, as select_port()
+ */
+static int select_masks(const int16_t * want)
+{
+	int writes = 0, depth;
+	unsigned m;
+
+	for(depth = 0; depth < MUX_TOPO_MAX_DEPTH; ++depth) {
+		for(m = 0; m < mux_count; ++m) {
+			if(muxes[m].depth != depth || muxes[m].mask == want[m] || !port_seen(want, muxes[m].parent, muxes[m].channel))
+				continue;
+			if(mux_write(m, (uint8_t)want[m]) < 0)
+				return -1;
+			writes++;
+		}
+	}
+	return writes;
+}
+
+static void add_dev(uint8_t addr, int mux, int channel)
+{
+	devs[dev_count].addr = addr;
+	devs[dev_count].mux = (int8_t)mux;
+	devs[dev_count].channel = (uint8_t)((mux < 0) ? 0 : channel);
+	if(mux < 0)
+		INV_MSG(INV_MSG_LEVEL_INFO, "IMU %d at 0x%02x on TWI0", dev_count, addr);
+	else
+		INV_MSG(INV_MSG_LEVEL_INFO, "IMU %d at 0x%02x on mux 0x%02x channel %d", dev_count, addr,
+				muxes[mux].addr, channel);
+	dev_count++;
+}
+
+/* Port of a slot, TWI0 first then the channels of each mux */
+static void slot_port(unsigned slot, int * mux, int * channel)
+{
+	const unsigned port = slot / MUX_TOPO_DEV_ADDRS;
+
+	*mux = (port == 0) ? -1 : (int)((port - 1) / MUX_TOPO_CHANNELS);
+	*channel = (port == 0) ? 0 : (int)((port - 1) % MUX_TOPO_CHANNELS);
+}
+
+static void discover_port(int mux, int channel, uint8_t whoami)
+{
+	const int depth = (mux < 0) ? 0 : muxes[mux].depth + 1;
+	const unsigned first = mux_count;
+	unsigned last, m, k;
+	uint8_t addr, id;
+	int c;
+
+	if(select_port(mux, channel) < 0) {
+		INV_MSG(INV_MSG_LEVEL_WARNING, "Mux 0x%02x channel %d cannot be opened", (mux < 0) ? 0 : muxes[mux].addr, channel);
+		return;
+	}
+
+	/* the probe turns the new muxes off, the IMUs behind them stay hidden */
+	for(addr = MUX_TOPO_ADDR_FIRST; depth < MUX_TOPO_MAX_DEPTH && addr <= MUX_TOPO_ADDR_LAST; ++addr) {
+		if(seen_from(addr, mux, channel) || mux_probe(addr) != 0)
+			continue;
+		if(mux_count >= MUX_TOPO_MAX_MUXES) {
+			INV_MSG(INV_MSG_LEVEL_WARNING, "Mux 0x%02x ignored, more than %d muxes", addr, MUX_TOPO_MAX_MUXES);
+			continue;
+		}
+		muxes[mux_count].addr = addr;
+		muxes[mux_count].parent = (int8_t)mux;
+		muxes[mux_count].channel = (uint8_t)((mux < 0) ? 0 : channel);
+		muxes[mux_count].depth = (uint8_t)depth;
+		muxes[mux_count].mask = 0;
+		mux_count++;
+	}
+	last = mux_count;
+
+	for(k = 0; k < sizeof(dev_addrs); ++k) {
+		if(read_reg(dev_addrs[k], MUX_TOPO_WHOAMI_REG, &id) != 0 || id != whoami)
+			continue;
+		if(dev_count >= MUX_TOPO_MAX_DEVICES) {
+			INV_MSG(INV_MSG_LEVEL_WARNING, "IMU 0x%02x ignored, more than %d IMUs", dev_addrs[k], MUX_TOPO_MAX_DEVICES);
+			continue;
+		}
+		add_dev(dev_addrs[k], mux, channel);
+	}
+
+	for(m = first; m < last; ++m) {
+		for(c = 0; c < MUX_TOPO_CHANNELS; ++c)
+			discover_port((int)m, c, whoami);
+	}
+}
+
+unsigned mux_topo_discover(uint8_t whoami)
+{
+	mux_count = 0;
+	dev_count = 0;
+	discover_port(-1, 0, whoami);
+	INV_MSG(INV_MSG_LEVEL_INFO, "%d IMUs behind %d muxes", dev_count, mux_count);
+	return dev_count;
+}
+
+unsigned mux_topo_count(void)
+{
+	return dev_count;
+}
+
+const struct mux_topo_dev * mux_topo_dev(int dev)
+{
+	return &devs[dev];
+}
+
+unsigned mux_topo_mux_count(void)
+{
+	return mux_count;
+}
+
+const struct mux_topo_mux * mux_topo_mux(int mux)
+{
+	return &muxes[mux];
+}
+
+int mux_topo_select(int dev)
+{
+	if(dev < 0 || dev >= (int)dev_count)
+		return -1;
+	idd_io_hal_set_addr(devs[dev].addr);
+	return select_port(devs[dev].mux, devs[dev].channel);
+}
+
+unsigned mux_topo_groups(const int * dev, unsigned n, uint8_t * group)
+{
+	int16_t want[MUX_TOPO_MAX_MUXES];
+	int set[MUX_TOPO_MAX_DEVICES];
+	unsigned count = 0, size, g, j, k;
+
+	for(k = 0; k < n; ++k) {
+		for(g = 0; g < count; ++g) {
+			size = 0;
+			for(j = 0; j < k; ++j) {
+				if(group[j] == g)
+					set[size++] = dev[j];
+			}
+			set[size++] = dev[k];
+			if(group_masks(set, size, want) == 0)
+				break;
+		}
+		group[k] = (uint8_t)g;
+		if(g == count)
+			count++;
+	}
+	return count;
+}
+
+int mux_topo_select_group(const int * dev, unsigned n)
+{
+	group_count = 0;
+	if(!n || n > MUX_TOPO_MAX_DEVICES || group_masks(dev, n, group_want) != 0)
+		return -1;
+	memcpy(group_devs, dev, n * sizeof(*dev));
+	group_count = n;
+	idd_io_hal_set_addr(devs[dev[0]].addr);
+	return select_masks(group_want);
+}
+
+int mux_topo_route(int member)
+{
+	if(member == IDD_IO_HAL_GROUP)
+		return group_count ? select_masks(group_want) : -1;
+	if(member < 0 || member >= (int)group_count)
+		return -1;
+	return select_port(devs[group_devs[member]].mux, devs[group_devs[member]].channel);
+}
+
+void mux_topo_invalidate(void)
+{
+	unsigned m;
+
+	for(m = 0; m < mux_count; ++m)
+		muxes[m].mask = -1;
+}
+
+int mux_topo_whoami(int dev, uint8_t * whoami)
+{
+	if(mux_topo_select(dev) < 0)
+		return -1;
+	return read_reg(devs[dev].addr, MUX_TOPO_WHOAMI_REG, whoami);
+}
+
+unsigned mux_topo_slot_count(void)
+{
+	return (1 + mux_count * MUX_TOPO_CHANNELS) * MUX_TOPO_DEV_ADDRS;
+}
+
+int mux_topo_slot_dev(unsigned slot)
+{
+	const uint8_t addr = dev_addrs[slot % MUX_TOPO_DEV_ADDRS];
+	int mux, channel;
+	unsigned d;
+
+	slot_port(slot, &mux, &channel);
+	for(d = 0; d < dev_count; ++d) {
+		if(devs[d].addr == addr && devs[d].mux == mux && devs[d].channel == channel)
+			return (int)d;
+	}
+	return -1;
+}
+
+int mux_topo_probe_slot(unsigned slot, uint8_t whoami)
+{
+	const uint8_t addr = dev_addrs[slot % MUX_TOPO_DEV_ADDRS];
+	int mux, channel, dev;
+	uint8_t id;
+
+	if(slot >= mux_topo_slot_count())
+		return -1;
+	slot_port(slot, &mux, &channel);
+	if(select_port(mux, channel) < 0 || read_reg(addr, MUX_TOPO_WHOAMI_REG, &id) != 0 || id != whoami)
+		return -1;
+	dev = mux_topo_slot_dev(slot);
+	if(dev >= 0)
+		return dev;
+	if(dev_count >= MUX_TOPO_MAX_DEVICES)
+		return -2;
+	add_dev(addr, mux, channel);
+	return (int)dev_count - 1;
+}
@@ -0,0 +1,135 @@
+/*
+ * mux_topo.h
+ *
+ * Topology of the IMU bus: a tree of TCA9548 muxes with the IMUs at the
+ * leaves.
+ *
+ * Up to 8 muxes (0x70 to 0x77) sit on TWI0, each channel of a mux may lead
+ * to IMUs (0x68 and 0x69) and to further muxes, up to MUX_TOPO_MAX_DEPTH
+ * levels. A mux answers at its address whatever its channels, so the ones
+ * behind a channel must take addresses not used on the way to it.
+ * mux_topo_discover() walks the tree depth first: on each port, mux
+ * channel or the bus itself, it looks for the muxes not seen yet, which the
+ * probe also turns off, then for the IMUs by their WHO_AM_I. IMUs are
+ * numbered in that order, so consecutive ones share most of their path.
+ *
+ * mux_topo_select() reaches an IMU with the fewest control register writes
+ * from the state the muxes were left in: the muxes on its path get its
+ * channel, the other muxes that can be seen from its port are turned off
+ * as an IMU at the same address behind them would answer too. Muxes cut off
+ * behind a closed channel keep their state until they can be seen again.
+ *
+ * The IMUs at one address behind different channels can take the same
+ * writes at once, see idd_io_hal_broadcast(): mux_topo_select_group() opens
+ * every path to them together. A group holds no other IMU at its address
+ * in sight, nor two muxes at one address, which a write to either would
+ * reach both of.
+ *
+ * After discovery, every port of the tree and IMU address on it makes a
+ * slot: mux_topo_probe_slot() looks for an IMU in one of them, so one
+ * plugged in later is found without walking the whole tree again. Muxes
+ * are only found by mux_topo_discover().
+ */
+
+
+#ifndef MUX_TOPO_H_
+#define MUX_TOPO_H_
+
+#include <stdint.h>
+
+#define MUX_TOPO_ADDR_FIRST		0x70
+#define MUX_TOPO_ADDR_LAST		0x77
+#define MUX_TOPO_CHANNELS		8
+/* Levels of muxes, the ones on TWI0 being the first */
+#define MUX_TOPO_MAX_DEPTH		3
+#define MUX_TOPO_MAX_MUXES		16
+/* IMUs kept, the tables indexed as the sensor table of run_icm20948.c are this size */
+#define MUX_TOPO_MAX_DEVICES	64
+/* IMU addresses on a port, AD0 low then high */
+#define MUX_TOPO_DEV_ADDRS		2
+
+struct mux_topo_mux {
+	uint8_t addr;
+	int8_t  parent;		/* mux it is behind, -1 on TWI0 */
+	uint8_t channel;	/* channel of the parent */
+	uint8_t depth;		/* 0 on TWI0 */
+	int16_t mask;		/* control register as last written, -1 when unknown */
+};
+
+struct mux_topo_dev {
+	uint8_t addr;		/* I2C address */
+	int8_t  mux;		/* mux it is behind, -1 on TWI0 */
+	uint8_t channel;	/* channel of the mux */
+};
+
+/** @brief Find the muxes and the IMUs, forgetting the previous topology
+ *  @param[in] whoami  WHO_AM_I value of the IMUs
+ *  @return number of IMUs found, MUX_TOPO_MAX_DEVICES at most
+ */
+unsigned mux_topo_discover(uint8_t whoami);
+
+/** @brief Number of IMUs found by the last discovery
+ */
+unsigned mux_topo_count(void);
+
+/** @brief Where an IMU is
+ */
+const struct mux_topo_dev * mux_topo_dev(int dev);
+
+/** @brief Number of muxes found by the last discovery
+ */
+unsigned mux_topo_mux_count(void);
+
+/** @brief A mux and its state
+ */
+const struct mux_topo_mux * mux_topo_mux(int mux);
+
+/** @brief Open the path to an IMU and point the serif (idd_io_hal.c) at it
+ *  @return number of mux writes it took, negative value if one failed
+ */
+int mux_topo_select(int dev);
+
+/** @brief Split IMUs into groups that can be opened together
+ *  @param[in]  devs   IMUs, each joins the first group it fits in
+ *  @param[out] group  group of each IMU, numbered in the order of their first IMU
+ *  @return number of groups
+ */
+unsigned mux_topo_groups(const int * devs, unsigned n, uint8_t * group);
+
+/** @brief Open the paths to a group at once and point the serif at their address
+ *  @param[in] devs  IMUs at one address, the members of mux_topo_route()
+ *  @return number of mux writes it took, negative value if one failed or
+ *          if they do not make a group
+ */
+int mux_topo_select_group(const int * devs, unsigned n);
+
+/** @brief Route of a broadcast session (idd_io_hal_broadcast()) in the last group selected
+ *  @param[in] member  place of an IMU in the group, IDD_IO_HAL_GROUP for all of them
+ *  @return number of mux writes it took, negative value if one failed
+ */
+int mux_topo_route(int member);
+
+/** @brief Forget the state of every mux, the next selections write them all
+ */
+void mux_topo_invalidate(void);
+
+/** @brief Read the WHO_AM_I register of an IMU
+ *  @return 0 on success, negative value if it did not answer
+ */
+int mux_topo_whoami(int dev, uint8_t * whoami);
+
+/** @brief Number of slots, TWI0 and each mux channel times the IMU addresses
+ */
+unsigned mux_topo_slot_count(void);
+
+/** @brief IMU found in a slot, -1 if none was
+ */
+int mux_topo_slot_dev(unsigned slot);
+
+/** @brief Look for an IMU in a slot, adding it if it is a new one
+ *  @param[in] whoami  WHO_AM_I value of the IMUs
+ *  @return index of the IMU that answered, -1 if none did, -2 if the table is full
+ */
+int mux_topo_probe_slot(unsigned slot, uint8_t whoami);
+
+#endif /* MUX_TOPO_H_ */
@@ -0,0 +1,298 @@
+/*
+ * odr_adapt.c
+ *
+ * Period of the rotation vector of each IMU after how much it moves, see
+ * odr_adapt.h.
+ */
+#include <asf.h>
+#include <string.h>
+
+#include "Invn/EmbUtils/Message.h"
+#include "Invn/EmbUtils/DataConverter.h"
+#include "Invn/InvError.h"
+#include "Invn/Devices/SensorTypes.h"
+#include "Invn/Devices/Drivers/Icm20948/Icm20948DataConverter.h"
+
+#include "time_wrapper.h"
+#include "host_cmd.h"
+#include "fifo_watch.h"
+#include "odr_adapt.h"
+
+/* What an evaluation wants of an IMU */
+#define WANT_UP			1
+#define WANT_DOWN		2
+
+/* mdeg in a radian */
+#define MDEG_PER_RAD	57296u
+
+static struct odr_adapt_imu imus[ODR_ADAPT_IMUS];
+static struct odr_plan plan;
+static int type;				/* sensor adapted, 0 when stopped */
+static uint32_t fastest, slowest;	/* bounds as given */
+static uint8_t d_min, d_max, d_plan;
+static uint64_t eval_us;
+
+/* 1 - |q1.q2| of a turn of mdeg, theta^2 / 8 in Q30 */
+static uint32_t turn_q30(uint32_t mdeg)
+{
+	return (uint32_t)(((uint64_t)mdeg * mdeg << 30) / (8ull * MDEG_PER_RAD * MDEG_PER_RAD));
+}
+
+static uint16_t turn_mdeg(uint32_t q30)
+{
+	uint64_t mdeg;
+
+	/* sqrt(8 x) is taken in Q30 up to 2 rad */
+	if(q30 >= (1u << 28))
+		return 0xffff;
+	mdeg = ((uint64_t)inv_icm20948_convert_fast_sqrt_fxp((long)(q30 << 3)) * MDEG_PER_RAD) >> 30;
+	return (mdeg > 0xffff) ? 0xffff : (uint16_t)mdeg;
+}
+
+/* Bus bytes/s of the polls of an IMU, polled on the sweep closest to each sample */
+static uint32_t poll_bps(uint32_t period_us, uint32_t sweep_us)
+{
+	const uint32_t sweeps = (period_us > sweep_us) ? (period_us - sweep_us / 2 + sweep_us - 1) / sweep_us : 1;
+
+	return (uint32_t)((uint64_t)ODR_PLAN_POLL_BYTES * 1000000 / ((uint64_t)sweeps * sweep_us));
+}
+
+/* Bus load an IMU takes at the period of a change, per mille */
+static int64_t imu_load(const struct odr_adapt_change * c, uint32_t sweep_us, uint32_t ns_per_byte)
+{
+	const uint64_t bps = (uint64_t)fifo_watch_packet_bytes(type) * 1000000 / c->applied_us + poll_bps(c->applied_us, sweep_us);
+
+	return (int64_t)(bps * ns_per_byte / 1000000);
+}
+
+/* Change of an IMU to d, 0 if the DMP cannot run it */
+static int step(int imu, unsigned d, struct odr_adapt_change * c)
+{
+	c->imu = imu;
+	c->d = (uint8_t)d;
+	c->request_us = odr_plan_step(&plan, type, d, &c->applied_us);
+	return c->request_us != 0;
+}
+
+void odr_adapt_init(void)
+{
+	memset(imus, 0, sizeof(imus));
+	type = 0;
+}
+
+int odr_adapt_start(const struct odr_plan * p, int t, uint32_t fastest_us, uint32_t slowest_us)
+{
+	const unsigned d0 = odr_plan_samples(p, t);
+	unsigned d, lo = 0, hi = 0;
+	uint32_t applied_us, fastest_run_us;
+	int i;
+
+	type = 0;
+	if(!d0 || (t != INV_SENSOR_TYPE_ROTATION_VECTOR && t != INV_SENSOR_TYPE_GAME_ROTATION_VECTOR))
+		return INV_ERROR_BAD_ARG;
+	/* from the planned step, as far as the DMP and the bounds allow */
+	for(d = d0; d >= 1 && odr_plan_step(p, t, d, &applied_us) && (!fastest_us || applied_us >= fastest_us); --d)
+		lo = d;
+	for(d = d0; d <= 0xff && odr_plan_step(p, t, d, &applied_us) && (!slowest_us || applied_us <= slowest_us); ++d)
+		hi = d;
+	if(!lo || !hi || lo == hi) {
+		INV_MSG(INV_MSG_LEVEL_WARNING, "ODR adapt: no step of %s from %u us within %u to %u us", inv_sensor_2str(t),
+				p->sensors[odr_plan_find(p, t)].applied_us, fastest_us, slowest_us);
+		return INV_ERROR_BAD_ARG;
+	}
+	plan = *p;
+	type = t;
+	fastest = fastest_us;
+	slowest = slowest_us;
+	d_min = (uint8_t)lo;
+	d_max = (uint8_t)hi;
+	d_plan = (uint8_t)d0;
+	for(i = 0; i < ODR_ADAPT_IMUS; ++i)
+		odr_adapt_leave(i);
+	eval_us = inv_icm20948_get_time_us();
+	odr_plan_step(&plan, type, d_min, &fastest_run_us);
+	odr_plan_step(&plan, type, d_max, &applied_us);
+	INV_MSG(INV_MSG_LEVEL_INFO, "ODR adapt: %s between %u and %u us, planned at %u us", inv_sensor_2str(type),
+			fastest_run_us, applied_us, imus[0].period_us);
+	return 0;
+}
+
+int odr_adapt_replan(const struct odr_plan * p)
+{
+	if(!type)
+		return 0;
+	return odr_adapt_start(p, type, fastest, slowest);
+}
+
+void odr_adapt_stop(void)
+{
+	type = 0;
+}
+
+int odr_adapt_type(void)
+{
+	return type;
+}
+
+void odr_adapt_sample(int imu, int t, const int32_t q30[4])
+{
+	struct odr_adapt_imu * a;
+	int64_t dot = 0;
+	int k;
+
+	if(!type || t != type || imu < 0 || imu >= ODR_ADAPT_IMUS)
+		return;
+	a = &imus[imu];
+	if(a->sampled) {
+		for(k = 0; k < 4; ++k)
+			dot += (int64_t)a->q30[k] * q30[k];
+		dot >>= 30;
+		if(dot < 0)
+			dot = -dot;
+		if(dot < (1 << 30) && (uint32_t)((1 << 30) - dot) > a->peak_q30)
+			a->peak_q30 = (uint32_t)((1 << 30) - dot);
+	}
+	memcpy(a->q30, q30, sizeof(a->q30));
+	a->sampled = 1;
+}
+
+int odr_adapt_poll_due(int imu, uint32_t sweep_us)
+{
+	const uint64_t now = inv_icm20948_get_time_us();
+	struct odr_adapt_imu * a;
+
+	if(!type || !sweep_us || imu < 0 || imu >= ODR_ADAPT_IMUS)
+		return 1;
+	a = &imus[imu];
+	if(a->period_us > sweep_us && now - a->poll_us + sweep_us / 2 < a->period_us)
+		return 0;
+	a->poll_us = now;
+	return 1;
+}
+
+void odr_adapt_leave(int imu)
+{
+	struct odr_adapt_imu * a;
+	const int p = odr_plan_find(&plan, type);
+
+	if(imu < 0 || imu >= ODR_ADAPT_IMUS)
+		return;
+	a = &imus[imu];
+	a->d = d_plan;
+	a->period_us = (p < 0) ? 0 : plan.sensors[p].applied_us;
+	a->motion_mdeg = 0;
+	a->sampled = 0;
+	a->peak_q30 = 0;
+	a->quiet_us = 0;
+	a->poll_us = 0;
+}
+
+unsigned odr_adapt_evaluate(const int * order, unsigned n, uint32_t sweep_us, struct odr_adapt_change * changes)
+{
+	const uint64_t now = inv_icm20948_get_time_us();
+	const uint32_t ns_per_byte = fifo_watch_bus_ns_per_byte();
+	const uint32_t up_q30 = turn_q30(ODR_ADAPT_UP_MDEG), down_q30 = turn_q30(ODR_ADAPT_DOWN_MDEG);
+	uint8_t want[ODR_ADAPT_IMUS];
+	uint64_t bps = 0;
+	int64_t load;
+	unsigned k, count = 0;
+
+	if(!type || now - eval_us < ODR_ADAPT_PERIOD_US)
+		return 0;
+	eval_us = now;
+	if(!sweep_us)
+		sweep_us = plan.frame_us;
+	memset(want, 0, sizeof(want));
+	for(k = 0; k < n; ++k) {
+		struct odr_adapt_imu * a = &imus[order[k]];
+
+		bps += fifo_watch_get(order[k])->configured_bps + poll_bps(a->period_us, sweep_us);
+		if(!a->sampled)
+			continue;
+		a->motion_mdeg = turn_mdeg(a->peak_q30);
+		if(a->peak_q30 > up_q30) {
+			a->quiet_us = 0;
+			if(a->d > d_min)
+				want[order[k]] = WANT_UP;
+		} else if(a->d < d_max && (uint64_t)a->peak_q30 * (a->d + 1) * (a->d + 1) < (uint64_t)down_q30 * a->d * a->d) {
+			/* would still turn less than ODR_ADAPT_DOWN_MDEG one step slower */
+			if(!a->quiet_us)
+				a->quiet_us = now;
+			else if(now - a->quiet_us >= ODR_ADAPT_HOLD_US)
+				want[order[k]] = WANT_DOWN;
+		} else {
+			a->quiet_us = 0;
+		}
+		a->peak_q30 = 0;
+	}
+	load = (int64_t)(bps * ns_per_byte / 1000000);
+
+	/* the bus time of the IMUs slowing down first */
+	for(k = 0; k < n && count < ODR_ADAPT_CHANGES; ++k) {
+		const struct odr_adapt_imu * a = &imus[order[k]];
+		struct odr_adapt_change from;
+
+		if(want[order[k]] != WANT_DOWN || !step(order[k], a->d + 1, &changes[count]))
+			continue;
+		from = changes[count];
+		from.applied_us = a->period_us;
+		load += imu_load(&changes[count], sweep_us, ns_per_byte) - imu_load(&from, sweep_us, ns_per_byte);
+		count++;
+	}
+	/* goes to those turning the most */
+	while(count < ODR_ADAPT_CHANGES) {
+		struct odr_adapt_change from;
+		int64_t more;
+		int best = -1;
+
+		for(k = 0; k < n; ++k) {
+			if(want[order[k]] == WANT_UP && (best < 0 || imus[order[k]].motion_mdeg > imus[best].motion_mdeg))
+				best = order[k];
+		}
+		if(best < 0)
+			break;
+		want[best] = 0;
+		if(!step(best, imus[best].d - 1, &changes[count]))
+			continue;
+		from = changes[count];
+		from.applied_us = imus[best].period_us;
+		more = imu_load(&changes[count], sweep_us, ns_per_byte) - imu_load(&from, sweep_us, ns_per_byte);
+		if(load + more > ODR_ADAPT_LOAD_PERMILLE)
+			continue;
+		load += more;
+		count++;
+	}
+	return count;
+}
+
+void odr_adapt_changed(const struct odr_adapt_change * c, int rc)
+{
+	struct odr_adapt_imu * a;
+	uint8_t payload[8];
+
+	if(c->imu < 0 || c->imu >= ODR_ADAPT_IMUS)
+		return;
+	a = &imus[c->imu];
+	if(rc != 0) {
+		INV_MSG(INV_MSG_LEVEL_WARNING, "IMU %d: period of %u us not set (%d)", c->imu, c->applied_us, rc);
+		return;
+	}
+	a->d = c->d;
+	a->period_us = c->applied_us;
+	a->changes++;
+	/* the turn across the change is over another period */
+	a->sampled = 0;
+	a->peak_q30 = 0;
+	a->quiet_us = 0;
+
+	payload[0] = (uint8_t)c->imu;
+	payload[1] = (uint8_t)type;
+	inv_dc_int32_to_little8((int32_t)c->applied_us, &payload[2]);
+	inv_dc_int16_to_little8((int16_t)a->motion_mdeg, &payload[6]);
+	host_cmd_send(HOST_CMD_TYPE_ASYNC, HOST_CMD_CODE_ODR_RATE, payload, sizeof(payload));
+}
+
+const struct odr_adapt_imu * odr_adapt_get(int imu)
+{
+	return &imus[imu];
+}
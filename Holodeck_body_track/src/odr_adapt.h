@@ -0,0 +1,138 @@
+/*
+ * odr_adapt.h
+ *
+ * Period of the rotation vector of each IMU after how much it moves.
+ *
+ * The segments of a body do not move alike: the torso is mostly still while
+ * the hands and feet swing, yet the ODR plan (see odr_plan.h) runs every IMU
+ * at the same period. Each IMU steps its rotation vector one base sample at
+ * a time, on the base rate of the plan, between the fastest and the slowest
+ * period allowed. The motion is the angle it turns between two samples,
+ * taken from consecutive rotation vectors: 1 - |q1.q2| is theta^2 / 8 for
+ * small angles, so neither the gyroscope nor a square root is needed. Every
+ * ODR_ADAPT_PERIOD_US an IMU
+ *  - runs faster when it turned more than ODR_ADAPT_UP_MDEG between two
+ *    samples over the period,
+ *  - runs slower once it would have turned less than ODR_ADAPT_DOWN_MDEG at
+ *    the slower period for ODR_ADAPT_HOLD_US in a row.
+ * The gap between the thresholds and the hold keep it from going back and
+ * forth at the edge of a motion.
+ *
+ * The IMUs that slow down give their bus time back and the sweep polls them
+ * only when a sample is due, see odr_adapt_poll_due(). The IMUs turning the
+ * most speed up first, for as long as the predicted bus load stays under
+ * ODR_ADAPT_LOAD_PERMILLE. A change writes the DMP of the IMU, at most
+ * ODR_ADAPT_CHANGES are made per period. Each is sent in a
+ * HOST_CMD_CODE_ODR_RATE frame.
+ *
+ * The DMP wake on motion (dmp_icm20948_set_wom_enable()) is not used: it
+ * works on the accelerometer, which hardly sees a limb turning about a
+ * joint, and only tells still from moving.
+ */
+
+
+#ifndef ODR_ADAPT_H_
+#define ODR_ADAPT_H_
+
+#include <stdint.h>
+
+#include "mux_topo.h"
+#include "odr_plan.h"
+
+/* Number of IMUs, indexed as the sensor table of run_icm20948.c */
+#define ODR_ADAPT_IMUS				MUX_TOPO_MAX_DEVICES
+/* Time between two evaluations of the motion */
+#define ODR_ADAPT_PERIOD_US			100000u
+/* Time an IMU stays still before it slows down */
+#define ODR_ADAPT_HOLD_US			500000u
+/* Turn between two samples beyond which an IMU speeds up, mdeg */
+#define ODR_ADAPT_UP_MDEG			1500
+/* Turn between two samples at the slower period under which it slows down, mdeg */
+#define ODR_ADAPT_DOWN_MDEG			500
+/* Bus load the IMUs speed up to, per mille, as FIFO_WATCH_LOAD_PERMILLE */
+#define ODR_ADAPT_LOAD_PERMILLE		800
+/* Changes of period per evaluation */
+#define ODR_ADAPT_CHANGES			2
+
+struct odr_adapt_imu {
+	uint8_t  d;					/* base samples per sample */
+	uint16_t motion_mdeg;		/* largest turn between two samples over the last period */
+	uint32_t period_us;			/* period it runs at */
+	uint32_t changes;			/* changes of period made */
+	/* internal */
+	uint8_t  sampled;			/* q30 holds the last sample */
+	int32_t  q30[4];
+	uint32_t peak_q30;			/* 1 - |q1.q2| of the largest turn */
+	uint64_t quiet_us;			/* time it became still enough to slow down, 0 if it is not */
+	uint64_t poll_us;
+};
+
+/* A change of period to make */
+struct odr_adapt_change {
+	int      imu;
+	uint8_t  d;
+	uint32_t request_us;		/* period to give the driver */
+	uint32_t applied_us;		/* period it runs at */
+};
+
+/** @brief Stop and forget every IMU
+ */
+void odr_adapt_init(void);
+
+/** @brief Adapt the period of a sensor of the plan, every IMU starting at the plan
+ *  @param[in] type        INV_SENSOR_TYPE_* of a rotation vector
+ *  @param[in] fastest_us  shortest period allowed, 0 for the shortest the DMP can run
+ *  @param[in] slowest_us  longest period allowed, 0 for the longest the DMP can run
+ *  @return 0 on success, INV_ERROR_BAD_ARG if the sensor is not in the plan
+ *          or if the bounds leave it no step or exclude its planned period
+ */
+int odr_adapt_start(const struct odr_plan * plan, int type, uint32_t fastest_us, uint32_t slowest_us);
+
+/** @brief The plan changed, start over on it with the same sensor and bounds
+ *  @return 0 on success or when stopped, the error of odr_adapt_start()
+ *          when the new plan does not allow them, adaptation then stops
+ */
+int odr_adapt_replan(const struct odr_plan * plan);
+
+/** @brief Stop, the IMUs are left at their period
+ */
+void odr_adapt_stop(void);
+
+/** @brief Sensor adapted, 0 when stopped
+ */
+int odr_adapt_type(void);
+
+/** @brief A sample of the IMU, ignored if it is not of the sensor adapted
+ *  @param[in] q30  w x y z, Q30
+ */
+void odr_adapt_sample(int imu, int type, const int32_t q30[4]);
+
+/** @brief Whether the sweep should poll an IMU, counted as polled if so
+ *  @param[in] sweep_us  period of the sweeps, 0 to poll every sweep
+ *  @return 0 when it runs slower than the sweeps and has no sample due
+ */
+int odr_adapt_poll_due(int imu, uint32_t sweep_us);
+
+/** @brief An IMU was brought up at the period of the plan, or left
+ */
+void odr_adapt_leave(int imu);
+
+/** @brief Evaluate the motion of the IMUs streaming, when due
+ *  @param[in]  imus      indexes of the IMUs polled
+ *  @param[in]  n         number of IMUs
+ *  @param[in]  sweep_us  period of the sweeps, 0 for the frame of the plan
+ *  @param[out] changes   ODR_ADAPT_CHANGES at most, to make then give to odr_adapt_changed()
+ *  @return number of changes
+ */
+unsigned odr_adapt_evaluate(const int * imus, unsigned n, uint32_t sweep_us, struct odr_adapt_change * changes);
+
+/** @brief A change was made, or failed, sent in a HOST_CMD_CODE_ODR_RATE frame when made
+ *  @param[in] rc  return code of the driver
+ */
+void odr_adapt_changed(const struct odr_adapt_change * change, int rc);
+
+/** @brief State of an IMU
+ */
+const struct odr_adapt_imu * odr_adapt_get(int imu);
+
+#endif /* ODR_ADAPT_H_ */
@@ -0,0 +1,287 @@
+/*
+ * odr_plan.c
+ *
+ * Sensor periods the DMP can run, see odr_plan.h.
+ */
+#include <asf.h>
+#include <string.h>
+
+#include "Invn/EmbUtils/Message.h"
+#include "Invn/EmbUtils/DataConverter.h"
+#include "Invn/InvError.h"
+#include "Invn/Devices/SensorTypes.h"
+#include "Invn/Devices/Drivers/Icm20948/Icm20948DataBaseControl.h"
+#include "Invn/Devices/Drivers/Icm20948/Icm20948Dmp3Driver.h"
+
+#include "host_cmd.h"
+#include "fifo_watch.h"
+#include "run_icm20948.h"
+#include "odr_plan.h"
+
+/* What the driver makes of the period of a sensor */
+static const struct sensor_odr {
+	uint8_t  type;
+	uint8_t  output;			/* enum INV_SENSORS, its DMP output */
+	uint16_t min_ms, max_ms;	/* inv_androidSensorsOdr_boundaries */
+	uint8_t  base_225;			/* holds the base rate at 225 Hz */
+} sensor_odrs[] = {
+	{ INV_SENSOR_TYPE_RAW_ACCELEROMETER,      INV_SENSOR_ACCEL,         INV_MIN_ODR,       INV_MAX_ODR,       0 },
+	{ INV_SENSOR_TYPE_ACCELEROMETER,          INV_SENSOR_ACCEL,         INV_MIN_ODR,       INV_MAX_ODR,       0 },
+	{ INV_SENSOR_TYPE_RAW_GYROSCOPE,          INV_SENSOR_GYRO,          INV_MIN_ODR,       INV_MAX_ODR,       0 },
+	{ INV_SENSOR_TYPE_UNCAL_GYROSCOPE,        INV_SENSOR_GYRO,          INV_MIN_ODR,       INV_MAX_ODR,       0 },
+	{ INV_SENSOR_TYPE_GYROSCOPE,              INV_SENSOR_CALIB_GYRO,    INV_MIN_ODR,       INV_MAX_ODR,       0 },
+	{ INV_SENSOR_TYPE_UNCAL_MAGNETOMETER,     INV_SENSOR_COMPASS,       INV_MIN_ODR_CPASS, INV_MAX_ODR_CPASS, 0 },
+	{ INV_SENSOR_TYPE_MAGNETOMETER,           INV_SENSOR_CALIB_COMPASS, INV_MIN_ODR_CPASS, INV_MAX_ODR_CPASS, 0 },
+	{ INV_SENSOR_TYPE_GAME_ROTATION_VECTOR,   INV_SENSOR_SIXQ,          INV_MIN_ODR_GRV,   INV_MAX_ODR_GRV,   0 },
+	{ INV_SENSOR_TYPE_GRAVITY,                INV_SENSOR_SIXQ,          INV_MIN_ODR_GRV,   INV_MAX_ODR_GRV,   0 },
+	{ INV_SENSOR_TYPE_LINEAR_ACCELERATION,    INV_SENSOR_SIXQ,          INV_MIN_ODR_GRV,   INV_MAX_ODR_GRV,   0 },
+	{ INV_SENSOR_TYPE_ROTATION_VECTOR,        INV_SENSOR_NINEQ,         INV_MIN_ODR_GRV,   INV_MAX_ODR_GRV,   1 },
+	{ INV_SENSOR_TYPE_ORIENTATION,            INV_SENSOR_NINEQ,         INV_MIN_ODR_GRV,   INV_MAX_ODR_GRV,   0 },
+	{ INV_SENSOR_TYPE_GEOMAG_ROTATION_VECTOR, INV_SENSOR_GEOMAG,        INV_MIN_ODR,       INV_MAX_ODR,       1 },
+};
+
+/* USB bytes of a sample in the output formats but the skeleton, rotation vectors on the sim */
+static const uint8_t sample_usb_bytes[] = {
+	[OUTPUT_FORMAT_TEXT]              = 46,
+	[OUTPUT_FORMAT_BINARY]            = 24,
+	[OUTPUT_FORMAT_DYNPROTOCOL]       = 23,
+	[OUTPUT_FORMAT_DYNPROTOCOL_BATCH] = 19,
+};
+/* USB bytes of a HOST_CMD_CODE_SKELETON frame besides its IMUs, and of an IMU */
+#define SKELETON_FRAME_BYTES	(10 + 5)
+#define SKELETON_IMU_BYTES		9
+
+static const struct sensor_odr * sensor_odr(int type)
+{
+	unsigned i;
+
+	for(i = 0; i < sizeof(sensor_odrs)/sizeof(sensor_odrs[0]); ++i) {
+		if(sensor_odrs[i].type == type)
+			return &sensor_odrs[i];
+	}
+	return 0;
+}
+
+/* H of the shortest period in ms, SampleRateDividerGet() */
+static unsigned base_div(unsigned ms, int base_225)
+{
+	if(base_225 && ms > 5)
+		ms = 5;
+	if(ms > INV_ODR_MIN_DELAY)
+		ms = INV_ODR_MIN_DELAY;
+	return ms * 1125u / 1000u;
+}
+
+/* Base samples kept by an output asked ms, DividerRateSet() */
+static unsigned base_samples(unsigned ms, unsigned h)
+{
+	return ms * 1125u / (h * 1000u);
+}
+
+static uint32_t base_us(unsigned h, unsigned d)
+{
+	return (uint32_t)(((uint64_t)h * d * 1000000u + 1125 / 2) / 1125);
+}
+
+/* Shortest request of at least min_ms that keeps d base samples, 0 if the bounds do not allow it */
+static unsigned request_ms(const struct sensor_odr * odr, unsigned h, unsigned d, unsigned min_ms)
+{
+	unsigned ms = (d * h * 1000u + 1124) / 1125;
+
+	if(ms < min_ms)
+		ms = min_ms;
+	if(ms < odr->min_ms || ms > odr->max_ms || base_samples(ms, h) != d)
+		return 0;
+	return ms;
+}
+
+/* USB bytes/s of the plan, for every IMU */
+static uint64_t usb_bytes(const struct odr_plan * plan, int format, unsigned imus)
+{
+	uint64_t bytes = 0;
+	unsigned i;
+
+	if(format == OUTPUT_FORMAT_SKELETON) {
+		const unsigned frames = (imus + HOST_CMD_SKELETON_IMUS - 1) / HOST_CMD_SKELETON_IMUS;
+
+		return ((uint64_t)frames * SKELETON_FRAME_BYTES + imus * SKELETON_IMU_BYTES) * 1000000 / plan->frame_us;
+	}
+	if(format < 0 || format >= (int)sizeof(sample_usb_bytes))
+		return 0;
+	for(i = 0; i < plan->count; ++i)
+		bytes += (uint64_t)sample_usb_bytes[format] * 1000000 / plan->sensors[i].applied_us;
+	return bytes * imus;
+}
+
+int odr_plan_make(const struct odr_plan_config * cfg, struct odr_plan * plan)
+{
+	const struct sensor_odr * odr[ODR_PLAN_SENSORS];
+	const uint32_t ns_per_byte = cfg->bus_hz ? (uint32_t)(9 * 1000000000ull / cfg->bus_hz) : fifo_watch_bus_ns_per_byte();
+	const uint32_t usb_bps = cfg->usb_bps ? cfg->usb_bps : ODR_PLAN_USB_BPS;
+	uint32_t fastest = UINT32_MAX, frame_us, best = UINT32_MAX;
+	unsigned lo = INV_MIN_ODR, hi = INV_MAX_ODR, frame_ms = 0, frame_d = 0, ms, i, j;
+	uint64_t bus = 0;
+	int base_225 = 0;
+
+	memset(plan, 0, sizeof(*plan));
+	if(cfg->count == 0 || cfg->count > ODR_PLAN_SENSORS)
+		return INV_ERROR_BAD_ARG;
+	for(i = 0; i < cfg->count; ++i) {
+		odr[i] = sensor_odr(cfg->sensors[i].type);
+		if(!odr[i] || !cfg->sensors[i].period_us)
+			return INV_ERROR_BAD_ARG;
+		if(cfg->sensors[i].period_us < fastest)
+			fastest = cfg->sensors[i].period_us;
+		base_225 |= odr[i]->base_225;
+	}
+	frame_us = cfg->frame_us ? cfg->frame_us : fastest;
+
+	/* the request of the fastest sensors that runs the closest to the frame */
+	for(i = 0; i < cfg->count; ++i) {
+		if(cfg->sensors[i].period_us != fastest)
+			continue;
+		if(odr[i]->min_ms > lo)
+			lo = odr[i]->min_ms;
+		if(odr[i]->max_ms < hi)
+			hi = odr[i]->max_ms;
+	}
+	for(ms = lo; ms <= hi; ++ms) {
+		const unsigned h = base_div(ms, base_225);
+		const uint32_t us = base_us(h, base_samples(ms, h));
+		const uint32_t err = (us > frame_us) ? us - frame_us : frame_us - us;
+
+		if(err < best) {
+			best = err;
+			frame_ms = ms;
+			plan->base_div = (uint16_t)h;
+			plan->frame_us = us;
+		}
+	}
+	if(!frame_ms)
+		return INV_ERROR_BAD_ARG;
+	frame_d = base_samples(frame_ms, plan->base_div);
+
+	/* the others every k frames, the closest k their bounds allow */
+	for(i = 0; i < cfg->count; ++i) {
+		const uint32_t period = (cfg->sensors[i].period_us == fastest) ? plan->frame_us : cfg->sensors[i].period_us;
+		const unsigned k0 = (period + plan->frame_us / 2) / plan->frame_us;
+		unsigned dk, k = 0;
+
+		ms = 0;
+		for(dk = 0; !ms && dk < 0xff; ++dk) {
+			if(k0 > dk && (ms = request_ms(odr[i], plan->base_div, (k0 - dk) * frame_d, frame_ms)))
+				k = k0 - dk;
+			else if(k0 + dk <= 0xff && (ms = request_ms(odr[i], plan->base_div, (k0 + dk) * frame_d, frame_ms)))
+				k = k0 + dk;
+		}
+		if(!ms)
+			return INV_ERROR_BAD_ARG;
+		plan->sensors[i].type = cfg->sensors[i].type;
+		plan->sensors[i].frames = (uint8_t)k;
+		plan->sensors[i].request_us = ms * 1000;
+		plan->sensors[i].applied_us = base_us(plan->base_div, k * frame_d);
+	}
+	plan->count = cfg->count;
+	/* one output runs at the fastest of its sensors */
+	for(i = 0; i < plan->count; ++i) {
+		for(j = 0; j < i; ++j) {
+			if(odr[j]->output != odr[i]->output || plan->sensors[j].frames == plan->sensors[i].frames)
+				continue;
+			if(plan->sensors[i].frames < plan->sensors[j].frames) {
+				plan->sensors[j].frames = plan->sensors[i].frames;
+				plan->sensors[j].request_us = plan->sensors[i].request_us;
+				plan->sensors[j].applied_us = plan->sensors[i].applied_us;
+			} else {
+				plan->sensors[i].frames = plan->sensors[j].frames;
+				plan->sensors[i].request_us = plan->sensors[j].request_us;
+				plan->sensors[i].applied_us = plan->sensors[j].applied_us;
+			}
+		}
+	}
+
+	bus = (uint64_t)ODR_PLAN_POLL_BYTES * 1000000 / plan->frame_us;
+	for(i = 0; i < plan->count; ++i)
+		bus += (uint64_t)fifo_watch_packet_bytes(plan->sensors[i].type) * 1000000 / plan->sensors[i].applied_us;
+	plan->bus_permille = (uint32_t)(bus * cfg->imus * ns_per_byte / 1000000);
+	plan->usb_permille = (uint32_t)(usb_bytes(plan, cfg->format, cfg->imus) * 1000 / usb_bps);
+
+	INV_MSG(INV_MSG_LEVEL_INFO, "ODR plan: %u us frames for %u us, base 1125/%u Hz, bus %u permille, USB %u permille",
+			plan->frame_us, frame_us, plan->base_div, plan->bus_permille, plan->usb_permille);
+	for(i = 0; i < plan->count; ++i)
+		INV_MSG(INV_MSG_LEVEL_INFO, "  %s asked %u us, runs at %u us every %u frames", inv_sensor_2str(plan->sensors[i].type),
+				plan->sensors[i].request_us, plan->sensors[i].applied_us, plan->sensors[i].frames);
+	if(plan->bus_permille > ODR_PLAN_MAX_PERMILLE || plan->usb_permille > ODR_PLAN_MAX_PERMILLE) {
+		INV_MSG(INV_MSG_LEVEL_WARNING, "ODR plan of %u IMUs cannot be kept up with, bus at %u ns/B, USB at %u B/s",
+				cfg->imus, ns_per_byte, usb_bps);
+		return INV_ERROR_SIZE;
+	}
+	return 0;
+}
+
+int odr_plan_find(const struct odr_plan * plan, int type)
+{
+	unsigned i;
+
+	for(i = 0; i < plan->count; ++i) {
+		if(plan->sensors[i].type == type)
+			return (int)i;
+	}
+	return -1;
+}
+
+uint32_t odr_plan_step(const struct odr_plan * plan, int type, unsigned d, uint32_t * applied_us)
+{
+	const struct sensor_odr * odr = sensor_odr(type);
+	unsigned ms, shortest, i;
+	int base_225 = 0;
+
+	if(!odr || !d || !plan->base_div || odr_plan_find(plan, type) < 0)
+		return 0;
+	ms = request_ms(odr, plan->base_div, d, 0);
+	if(!ms)
+		return 0;
+	/* the driver takes H from the shortest period of all sensors */
+	shortest = ms;
+	for(i = 0; i < plan->count; ++i) {
+		base_225 |= sensor_odr(plan->sensors[i].type)->base_225;
+		if(plan->sensors[i].type != type && plan->sensors[i].request_us / 1000 < shortest)
+			shortest = plan->sensors[i].request_us / 1000;
+	}
+	if(base_div(shortest, base_225) != plan->base_div)
+		return 0;
+	*applied_us = base_us(plan->base_div, d);
+	return ms * 1000;
+}
+
+unsigned odr_plan_samples(const struct odr_plan * plan, int type)
+{
+	const int i = odr_plan_find(plan, type);
+
+	if(i < 0 || !plan->base_div)
+		return 0;
+	return (unsigned)(((uint64_t)plan->sensors[i].applied_us * 1125 + plan->base_div * 500000u) / (plan->base_div * 1000000u));
+}
+
+static int16_t permille16(uint32_t permille)
+{
+	return (int16_t)((permille > 0xffff) ? 0xffff : permille);
+}
+
+int odr_plan_send(const struct odr_plan * plan, int rc)
+{
+	uint8_t payload[11 + 6 * ODR_PLAN_SENSORS];
+	unsigned i;
+
+	payload[0] = (uint8_t)(int8_t)rc;
+	payload[1] = (uint8_t)plan->base_div;
+	inv_dc_int32_to_little8((int32_t)plan->frame_us, &payload[2]);
+	inv_dc_int16_to_little8(permille16(plan->bus_permille), &payload[6]);
+	inv_dc_int16_to_little8(permille16(plan->usb_permille), &payload[8]);
+	payload[10] = (uint8_t)plan->count;
+	for(i = 0; i < plan->count; ++i) {
+		payload[11 + 6 * i] = plan->sensors[i].type;
+		payload[12 + 6 * i] = plan->sensors[i].frames;
+		inv_dc_int32_to_little8((int32_t)plan->sensors[i].applied_us, &payload[13 + 6 * i]);
+	}
+	return host_cmd_send(HOST_CMD_TYPE_ASYNC, HOST_CMD_CODE_ODR_PLAN, payload, 11 + 6 * plan->count);
+}
@@ -0,0 +1,107 @@
+/*
+ * odr_plan.h
+ *
+ * Sensor periods the DMP can run, planned for every IMU at once.
+ *
+ * The driver does not run a sensor at the period it is given
+ * (inv_icm20948_set_odr() and inv_set_hw_smplrt_dmp_odrs() of
+ * Icm20948DataBaseControl.c). The period is truncated to whole ms and
+ * clamped to the bounds of the sensor, 5 to 20 ms for the rotation vectors.
+ * The engines then sample at a base rate of 1125 Hz / H, H the shortest
+ * period of all sensors times 1.125 truncated, and each DMP output keeps
+ * one base sample in D, its period in base samples truncated again. A
+ * rotation vector also holds the base rate at 225 Hz at least, H = 5: asked
+ * at 10 ms it runs at D = 2, 8889 us.
+ *
+ * odr_plan_make() replays this arithmetic. The fastest sensors of the list
+ * set the frame: of the periods they can be asked, the one that runs
+ * closest to the wanted frame period is taken. The others run every k
+ * frames on the same base rate, k the closest to their own period, so every
+ * sample of every sensor falls on a frame. Sensors of one DMP output, as
+ * RV and orientation, run at the fastest of them. Every IMU is given the
+ * same periods, the base rate is common to all of them.
+ *
+ * The plan predicts the load of the bus, a poll of ODR_PLAN_POLL_BYTES per
+ * IMU and frame plus the DMP packets, and the load of the USB link in the
+ * output format. A plan that loads either beyond ODR_PLAN_MAX_PERMILLE
+ * cannot be kept up with and is rejected. The periods are those of the
+ * nominal 1125 Hz, each IMU runs off by the ppm of its own clock (see
+ * frame_sync.h).
+ */
+
+
+#ifndef ODR_PLAN_H_
+#define ODR_PLAN_H_
+
+#include <stdint.h>
+
+/* Sensors planned, as tracked by fifo_watch.h */
+#define ODR_PLAN_SENSORS			4
+/* Bus bytes of a poll that drains the FIFO besides the packets: mux switch,
+ * bank select, FIFO count and the read of the data, as counted by
+ * idd_io_hal.c on the sim sweeping on the cycle of the ODR */
+#define ODR_PLAN_POLL_BYTES			26
+/* USB throughput taken when none is given, bytes/s, about what the bulk
+ * endpoint of the CDC takes at full speed */
+#define ODR_PLAN_USB_BPS			1000000u
+/* Load of the bus or the USB link beyond which a plan is rejected */
+#define ODR_PLAN_MAX_PERMILLE		1000
+
+struct odr_plan_config {
+	uint32_t frame_us;			/* wanted period of the fastest sensors, 0 for theirs */
+	uint32_t bus_hz;			/* TWI clock, 0 for the throughput measured by idd_io_hal.c */
+	uint32_t usb_bps;			/* bytes/s, 0 for ODR_PLAN_USB_BPS */
+	unsigned imus;				/* IMUs polled per sweep */
+	int format;					/* enum output_format of run_icm20948.h */
+	unsigned count;
+	struct {
+		uint8_t  type;			/* INV_SENSOR_TYPE_* */
+		uint32_t period_us;		/* wanted */
+	} sensors[ODR_PLAN_SENSORS];
+};
+
+struct odr_plan {
+	uint16_t base_div;			/* H, the engines sample at 1125 Hz / H */
+	uint32_t frame_us;			/* period the fastest sensors run at */
+	uint32_t bus_permille;
+	uint32_t usb_permille;
+	unsigned count;
+	struct {
+		uint8_t  type;
+		uint8_t  frames;		/* one sample every frames frames */
+		uint32_t request_us;	/* period to give the driver, whole ms */
+		uint32_t applied_us;	/* period it runs at */
+	} sensors[ODR_PLAN_SENSORS];
+};
+
+/** @brief Plan the sensors of a configuration
+ *  @param[in]  cfg   sensors and their wanted periods, links
+ *  @param[out] plan  periods and loads, filled too when rejected for the load
+ *  @return 0 on success, INV_ERROR_BAD_ARG if a sensor has no period the
+ *          DMP can run, INV_ERROR_SIZE if the load cannot be kept up with
+ */
+int odr_plan_make(const struct odr_plan_config * cfg, struct odr_plan * plan);
+
+/** @brief Index of a sensor in a plan, -1 if it is not in it
+ */
+int odr_plan_find(const struct odr_plan * plan, int type);
+
+/** @brief Period of a planned sensor run at d base samples, on the base rate of the plan
+ *  @param[in]  d           base samples per sample
+ *  @param[out] applied_us  period it runs at
+ *  @return period to give the driver, 0 if the bounds of the sensor do not
+ *          allow it or if it would change the base rate, which the other
+ *          sensors run on
+ */
+uint32_t odr_plan_step(const struct odr_plan * plan, int type, unsigned d, uint32_t * applied_us);
+
+/** @brief Base samples per sample of a planned sensor, 0 if it is not in the plan
+ */
+unsigned odr_plan_samples(const struct odr_plan * plan, int type);
+
+/** @brief Send a plan in a HOST_CMD_CODE_ODR_PLAN frame
+ *  @param[in] rc  return code of odr_plan_make(), or of applying the plan
+ */
+int odr_plan_send(const struct odr_plan * plan, int rc);
+
+#endif /* ODR_PLAN_H_ */
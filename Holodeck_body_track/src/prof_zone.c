@@ -0,0 +1,118 @@
+/*
+ * prof_zone.c
+ *
+ * Named cycle count zones, see prof_zone.h.
+ */
+#include <asf.h>
+#include <string.h>
+
+#include "Invn/InvError.h"
+#include "Invn/EmbUtils/DataConverter.h"
+
+#include "host_cmd.h"
+#include "prof_zone.h"
+
+#if PROF_ZONES
+
+static struct prof_zone_stats zones[PROF_ZONE_COUNT];
+
+static const char * const zone_names[PROF_ZONE_COUNT] = {
+	"sweep",
+	"channel_set",
+	"device_poll",
+	"fifo_drain",
+	"twi_read",
+	"twi_write",
+	"convert",
+	"serial_write",
+};
+
+static void clear(void)
+{
+	int i;
+
+	memset(zones, 0, sizeof(zones));
+	for(i = 0; i < PROF_ZONE_COUNT; ++i)
+		zones[i].min = UINT32_MAX;
+}
+
+void prof_zone_init(void)
+{
+#if defined(__SAM3X8E__)
+	/* CYCCNT is left running, it is the time base of inv_icm20948_get_time_us() */
+	CoreDebug->DEMCR |= CoreDebug_DEMCR_TRCENA_Msk;
+	DWT->CTRL |= DWT_CTRL_CYCCNTENA_Msk;
+#endif
+	clear();
+}
+
+uint32_t prof_zone_cycles(void)
+{
+#if defined(__SAM3X8E__)
+	return DWT->CYCCNT;
+#else
+	return prof_zone_host_cycles();
+#endif
+}
+
+void prof_zone_record(enum prof_zone zone, uint32_t cycles)
+{
+	struct prof_zone_stats * z = &zones[zone];
+	int bucket = cycles ? 31 - __builtin_clz(cycles) : 0;
+
+	if(bucket >= PROF_ZONE_BUCKETS)
+		bucket = PROF_ZONE_BUCKETS - 1;
+	z->count++;
+	z->total += cycles;
+	if(cycles < z->min)
+		z->min = cycles;
+	if(cycles > z->max)
+		z->max = cycles;
+	z->hist[bucket]++;
+}
+
+const struct prof_zone_stats * prof_zone_get(enum prof_zone zone)
+{
+	return &zones[zone];
+}
+
+const char * prof_zone_name(enum prof_zone zone)
+{
+	return zone_names[zone];
+}
+
+int prof_zone_dump(int clear_zones)
+{
+	/* <zone (1)> <count (4)> <min (4)> <max (4)> <mean (4)> <buckets (4*PROF_ZONE_BUCKETS)> */
+	static uint8_t payload[1 + 4*4 + 4*PROF_ZONE_BUCKETS];
+	int i, b, sent = 0;
+
+	for(i = 0; i < PROF_ZONE_COUNT; ++i) {
+		const struct prof_zone_stats * z = &zones[i];
+
+		if(!z->count)
+			continue;
+		payload[0] = (uint8_t)i;
+		inv_dc_int32_to_little8((int32_t)z->count, &payload[1]);
+		inv_dc_int32_to_little8((int32_t)z->min, &payload[5]);
+		inv_dc_int32_to_little8((int32_t)z->max, &payload[9]);
+		inv_dc_int32_to_little8((int32_t)(z->total / z->count), &payload[13]);
+		for(b = 0; b < PROF_ZONE_BUCKETS; ++b)
+			inv_dc_int32_to_little8((int32_t)z->hist[b], &payload[17 + 4*b]);
+		if(host_cmd_send(HOST_CMD_TYPE_ASYNC, HOST_CMD_CODE_PROF, payload, sizeof(payload)) == 0)
+			sent++;
+	}
+	if(clear_zones)
+		clear();
+	return sent;
+}
+
+#else
+
+int prof_zone_dump(int clear_zones)
+{
+	(void)clear_zones;
+	return INV_ERROR_NIMPL;
+}
+
+#endif
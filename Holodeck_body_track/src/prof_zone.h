@@ -0,0 +1,106 @@
+/*
+ * prof_zone.h
+ *
+ * Named cycle count zones.
+ *
+ *   PROF_ZONE_BEGIN(PROF_ZONE_CHANNEL_SET);
+ *   channel_set(...);
+ *   PROF_ZONE_END(PROF_ZONE_CHANNEL_SET);
+ *
+ * Each zone keeps count, min, max, total and a histogram of its durations,
+ * bucket b counting the durations of [2^b, 2^(b+1)) cycles (bucket 0 also
+ * takes 0 and the last one everything above). Cycles are DWT->CYCCNT on the
+ * Due, the host build provides prof_zone_host_cycles().
+ *
+ * Zones are only compiled in when PROF_ZONES is defined to 1, the macros
+ * are empty otherwise.
+ *
+ * The tables are sent on HOST_CMD_CODE_GET_PROF (see host_cmd.h), one async
+ * frame per zone that ran:
+ *   HOST_CMD_CODE_PROF <zone (1)> <count (4)> <min (4)> <max (4)> <mean (4)>
+ *                      <bucket counts (4*PROF_ZONE_BUCKETS)>
+ */
+
+
+#ifndef PROF_ZONE_H_
+#define PROF_ZONE_H_
+
+#include <stdint.h>
+
+#ifndef PROF_ZONES
+#define PROF_ZONES		0
+#endif
+
+#define PROF_ZONE_BUCKETS	24
+
+/* Keep tools/msg_log.py in sync */
+enum prof_zone {
+	PROF_ZONE_SWEEP,			/* acquisition of run_icm20948_sweep(), every IMU polled once */
+	PROF_ZONE_CHANNEL_SET,		/* mux switch */
+	PROF_ZONE_DEVICE_POLL,		/* inv_device_poll() of one IMU */
+	PROF_ZONE_FIFO_DRAIN,		/* FIFO count and read in inv_icm20948_poll_sensor() */
+	PROF_ZONE_TWI_READ,			/* twi_master_read() of the driver */
+	PROF_ZONE_TWI_WRITE,		/* twi_master_write() of the driver */
+	PROF_ZONE_CONVERT,			/* sensor_event_cb(), sample to output format */
+	PROF_ZONE_SERIAL_WRITE,		/* serialWrite() */
+	PROF_ZONE_COUNT
+};
+
+struct prof_zone_stats {
+	uint32_t count;
+	uint32_t min;
+	uint32_t max;
+	uint64_t total;
+	uint32_t hist[PROF_ZONE_BUCKETS];
+};
+
+#if PROF_ZONES
+
+#define PROF_ZONE_BEGIN(zone) \
+	const uint32_t prof_zone_start_##zone = prof_zone_cycles()
+
+#define PROF_ZONE_END(zone) \
+	prof_zone_record(zone, prof_zone_cycles() - prof_zone_start_##zone)
+
+/** @brief Start the cycle counter and clear every zone
+ */
+void prof_zone_init(void);
+
+/** @brief Current cycle count
+ */
+uint32_t prof_zone_cycles(void);
+
+/** @brief Account one run of a zone
+ */
+void prof_zone_record(enum prof_zone zone, uint32_t cycles);
+
+/** @brief Statistics of a zone
+ */
+const struct prof_zone_stats * prof_zone_get(enum prof_zone zone);
+
+/** @brief Name of a zone
+ */
+const char * prof_zone_name(enum prof_zone zone);
+
+#if !defined(__SAM3X8E__)
+/** @brief Cycle counter of the host build, provided by the harness
+ */
+uint32_t prof_zone_host_cycles(void);
+#endif
+
+#else
+
+#define PROF_ZONE_BEGIN(zone)
+#define PROF_ZONE_END(zone)		do {} while(0)
+
+static inline void prof_zone_init(void) {}
+
+#endif
+
+/** @brief Send one HOST_CMD_CODE_PROF frame per zone that ran
+ *  @param[in] clear  1 to clear the zones once sent
+ *  @return number of frames sent, INV_ERROR_NIMPL if zones are compiled out
+ */
+int prof_zone_dump(int clear);
+
+#endif /* PROF_ZONE_H_ */
@@ -0,0 +1,77 @@
+/*
+ * quat_batch.c
+ *
+ * Rotation vector conversion of a whole sweep, see quat_batch.h.
+ */
+#include "Invn/Devices/Drivers/Icm20948/Icm20948.h"
+#include "Invn/Devices/Drivers/Icm20948/Icm20948DataConverter.h"
+
+#include "quat_batch.h"
+
+/* inv_icm20948_convert_mult_q30_fxp(), with the 32 bit long of the target */
+static inline int32_t mult_q30(int32_t a, int32_t b)
+{
+	return (int32_t)(((int64_t)a * b) >> 30);
+}
+
+void quat_batch_clear(struct quat_batch * b)
+{
+	b->count = 0;
+}
+
+int quat_batch_add(struct quat_batch * b, const long quat[3], const long chip_to_body[4])
+{
+	const unsigned i = b->count;
+
+	if(i >= QUAT_BATCH_MAX)
+		return -1;
+	b->x[i] = (int32_t)quat[0];
+	b->y[i] = (int32_t)quat[1];
+	b->z[i] = (int32_t)quat[2];
+	b->mw[i] = (int32_t)chip_to_body[0];
+	b->mx[i] = (int32_t)chip_to_body[1];
+	b->my[i] = (int32_t)chip_to_body[2];
+	b->mz[i] = (int32_t)chip_to_body[3];
+	b->count = i + 1;
+	return (int)i;
+}
+
+void quat_batch_run(struct quat_batch * b)
+{
+	const unsigned n = b->count;
+	unsigned i;
+
+	/* scalar part, the Newton iterations of the driver branch so this pass stays scalar */
+	for(i = 0; i < n; ++i)
+		b->qw[i] = (int32_t)inv_icm20948_convert_fast_sqrt_fxp((1L << 30)
+				- mult_q30(b->x[i], b->x[i]) - mult_q30(b->y[i], b->y[i]) - mult_q30(b->z[i], b->z[i]));
+
+	/* q * chip_to_body', as inv_icm20948_q_mult_q_qi() */
+	for(i = 0; i < n; ++i) {
+		const int32_t w = b->qw[i], x = b->x[i], y = b->y[i], z = b->z[i];
+		const int32_t mw = b->mw[i], mx = b->mx[i], my = b->my[i], mz = b->mz[i];
+
+		b->qw[i] =  mult_q30(w, mw) + mult_q30(x, mx) + mult_q30(y, my) + mult_q30(z, mz);
+		b->qx[i] = -mult_q30(w, mx) + mult_q30(x, mw) - mult_q30(y, mz) + mult_q30(z, my);
+		b->qy[i] = -mult_q30(w, my) + mult_q30(x, mz) + mult_q30(y, mw) - mult_q30(z, mx);
+		b->qz[i] = -mult_q30(w, mz) - mult_q30(x, my) + mult_q30(y, mx) + mult_q30(z, mw);
+	}
+
+	/* w positive: -1 or 1 from the sign bit */
+	for(i = 0; i < n; ++i) {
+		const int32_t s = (b->qw[i] >> 31) | 1;
+
+		b->qw[i] *= s;
+		b->qx[i] *= s;
+		b->qy[i] *= s;
+		b->qz[i] *= s;
+	}
+
+	/* Q30 to Q14 */
+	for(i = 0; i < n; ++i) {
+		b->q14w[i] = quat_batch_q14(b->qw[i]);
+		b->q14x[i] = quat_batch_q14(b->qx[i]);
+		b->q14y[i] = quat_batch_q14(b->qy[i]);
+		b->q14z[i] = quat_batch_q14(b->qz[i]);
+	}
+}
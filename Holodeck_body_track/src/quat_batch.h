@@ -0,0 +1,81 @@
+/*
+ * quat_batch.h
+ *
+ * Rotation vector conversion of a whole sweep in one pass.
+ *
+ * Converting each sample inside inv_icm20948_poll_sensor() interleaves the
+ * maths with the bus transfers, so neither the code nor the mounting
+ * quaternions stay in cache. Instead, the driver hands over the DMP
+ * quaternions as read (inv_device_icm20948_set_quat_raw()). The samples of
+ * every IMU are gathered here in structure of arrays layout, then
+ * quat_batch_run() converts them together, one pass per step:
+ *   scalar part  w = sqrt(1 - x^2 - y^2 - z^2), DMP x y z in chip frame
+ *   mounting     q * chip_to_body', to the world frame
+ *   sign         w made positive, the same rotation
+ *   quantize     Q30 to Q14, rounded, for the binary frame
+ * The results match inv_icm20948_convert_rotation_vector_q30() exactly.
+ *
+ * Every pass but the square root is branch free integer arithmetic over
+ * contiguous arrays, which the host compiler vectorizes (bench/ builds it
+ * with -O3). The Cortex-M3 has no SIMD, there the gain is locality.
+ */
+
+
+#ifndef QUAT_BATCH_H_
+#define QUAT_BATCH_H_
+
+#include <stdint.h>
+
+/* Samples per batch, the sweep converts early when it fills up */
+#ifndef QUAT_BATCH_MAX
+#define QUAT_BATCH_MAX		64
+#endif
+
+struct quat_batch {
+	unsigned count;
+	/* in: DMP rotation vector x y z in chip frame, Q30 */
+	int32_t x[QUAT_BATCH_MAX];
+	int32_t y[QUAT_BATCH_MAX];
+	int32_t z[QUAT_BATCH_MAX];
+	/* in: chip to body rotation of the IMU w x y z, Q30 */
+	int32_t mw[QUAT_BATCH_MAX];
+	int32_t mx[QUAT_BATCH_MAX];
+	int32_t my[QUAT_BATCH_MAX];
+	int32_t mz[QUAT_BATCH_MAX];
+	/* out: world frame w x y z, Q30 */
+	int32_t qw[QUAT_BATCH_MAX];
+	int32_t qx[QUAT_BATCH_MAX];
+	int32_t qy[QUAT_BATCH_MAX];
+	int32_t qz[QUAT_BATCH_MAX];
+	/* out: same in Q14 */
+	int16_t q14w[QUAT_BATCH_MAX];
+	int16_t q14x[QUAT_BATCH_MAX];
+	int16_t q14y[QUAT_BATCH_MAX];
+	int16_t q14z[QUAT_BATCH_MAX];
+};
+
+/** @brief Q30 to Q14, rounded, the quantization of every binary frame
+ *
+ *  |q| <= 1 so it always fits.
+ */
+static inline int16_t quat_batch_q14(int32_t q30)
+{
+	return (int16_t)((q30 + (1 << 15)) >> 16);
+}
+
+/** @brief Empty the batch
+ */
+void quat_batch_clear(struct quat_batch * b);
+
+/** @brief Gather a sample
+ *  @param[in] quat          DMP rotation vector x y z in Q30
+ *  @param[in] chip_to_body  chip to body rotation w x y z in Q30
+ *  @return index of the sample in the batch, -1 if it is full
+ */
+int quat_batch_add(struct quat_batch * b, const long quat[3], const long chip_to_body[4]);
+
+/** @brief Convert every sample gathered, results in the out arrays
+ */
+void quat_batch_run(struct quat_batch * b);
+
+#endif /* QUAT_BATCH_H_ */
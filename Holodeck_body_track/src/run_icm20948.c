@@ -35,9 +35,11 @@
 #include <asf.h>
 #include <string.h>
 #include <stdint.h>
+#include <stdlib.h>
 //#include <stdio.h>
 
 #include "Invn/EmbUtils/Message.h"
+#include "Invn/EmbUtils/InvFormat.h"
 #include "Invn/EmbUtils/DataConverter.h"
 #include "Invn/Devices/DeviceIcm20948.h"
 #include "Invn/DynamicProtocol/DynProtocol.h"
@@ -46,6 +48,24 @@
 #include "idd_io_hal.h"
 #include "time_wrapper.h"
 #include "usb_cdc_coms.h"
+#include "host_cmd.h"
+#include "msg_log.h"
+#include "dynpro_cdc.h"
+#include "prof_zone.h"
+#include "lat_trace.h"
+#include "health.h"
+#include "acq_cycle.h"
+#include "fifo_watch.h"
+#include "quat_batch.h"
+#include "mux_topo.h"
+#include "bringup.h"
+#include "startup.h"
+#include "hotplug.h"
+#include "fault.h"
+#include "frame_sync.h"
+#include "odr_plan.h"
+#include "odr_adapt.h"
+#include "device_array.h"
 #include "run_icm20948.h"
 
 
@@ -56,6 +76,27 @@
  */
 #define USE_IDDWRAPPER   0
 
+/*
+ * Set to 1 to start the sweeps on a fixed cycle derived from the sensor ODR
+ * (see acq_cycle.h), 0 to free run. The host can change it at runtime.
+ */
+#define RUN_ICM20948_CYCLE   0
+
+/*
+ * Set to 1 to convert the rotation vectors of a sweep together once every
+ * IMU is polled (see quat_batch.h), 0 to convert each one as it is read.
+ */
+#define RUN_ICM20948_QUAT_BATCH   1
+
+/*
+ * Set to 1 to set the IMUs at one address up and configure them together,
+ * each write going to all of them at once (see device_array.h), 0 to do it
+ * one IMU at a time.
+ */
+#ifndef RUN_ICM20948_BROADCAST
+#define RUN_ICM20948_BROADCAST   1
+#endif
+
 #define ODR_NONE       0 /* Asynchronous sensors don't need to have a configured ODR */
 
 /*
@@ -164,19 +205,71 @@ const char * activityName(int act);
 /* Define msg level */
 #define MSG_LEVEL INV_MSG_LEVEL_DEBUG
 
+/* Maximum number of deferred messages sent per acquisition sweep */
+#define MSG_LOG_FLUSH_PER_SWEEP   4
+
 /* Forward declaration */
 void ext_interrupt_cb(void * context, int int_num);
-static void sensor_event_cb(const inv_sensor_event_t * event, void * arg);
+static void sensor_event_cb(const inv_sensor_event_t * event, int imu, void * arg);
+static void quat_batch_flush(void);
+static void skeleton_send(void);
 void inv_icm20948_sleep_us(int us);
 void inv_icm20948_sleep(int us);
 uint64_t inv_icm20948_get_time_us(void);
 uint64_t inv_icm20948_get_dataready_interrupt_time_us(void);
-static void check_rc(int rc);
 static void msg_printer(int level, const char * str, va_list ap);
-void channel_set(uint8_t channel);
-uint8_t read_id(uint8_t i2c_address);
 void sensorinit(void);
-int sensor_id;
+
+/*
+ * Format used by sensor_event_cb() to report sensor data, can be changed by the host
+ */
+static int output_format = OUTPUT_FORMAT_TEXT;
+
+/*
+ * Period of the stats frames, 0 when not sent, and time they were last sent
+ */
+static uint32_t stats_period_us;
+static uint64_t stats_sent_us;
+
+/*
+ * Sensor period the acquisition cycle follows, the frame of the ODR plan
+ * then the last one set by the host, and whether the cycle follows it
+ */
+static uint32_t odr_period_us;
+static int cycle_from_odr;
+
+/*
+ * Samples reported by the driver during the sweep, the first ones sent end the startup
+ */
+static unsigned sweep_samples;
+
+/*
+ * Rotation vectors reported by the poll of the current IMU, for frame_sync_drained()
+ */
+static unsigned poll_quats;
+
+/*
+ * Periods the sensors of sensor_list are started at, see odr_plan.h
+ */
+static struct odr_plan odr_plan;
+
+#if RUN_ICM20948_QUAT_BATCH
+/*
+ * Rotation vectors gathered during the sweep, and what their events hold
+ * besides the quaternion
+ */
+static struct quat_batch quat_batch;
+static struct {
+	uint64_t timestamp;
+	unsigned int sensor;
+	int32_t accuracy_q29;
+	uint8_t accuracy_flag;
+	uint8_t imu;
+} quat_batch_event[QUAT_BATCH_MAX];
+#define QUAT_BATCH_PENDING()	(quat_batch.count != 0)
+#else
+#define QUAT_BATCH_PENDING()	0
+#endif
 /*
  * Flag set from device irq handler 
  */
@@ -200,173 +293,469 @@ static const uint8_t dmp3_image[] = {
 	#include "Invn/Images/icm20948_img.dmp3a.h"
 };
 
+
 /*
- * States for icm20948 device object
+ * Last time at which 20948 IRQ was fired
  */
-static inv_device_icm20948_t device_icm20948;
+static volatile uint32_t last_irq_time = 0;
 
-/* 
- * Just a handy variable to keep the handle to device object
+#define MAIN_UART_ID UART1 // Through FTDI cable
+#define LOG_UART_ID  UART2 // Through ST-Link
+#define DELAY_TIMER  TIMER3
+#define TIMEBASE_TIMER TIMER2
+
+/*
+ * One member per IMU found, indexed as mux_topo.h, see device_array.h
+ * Its events go to sensor_event_cb() with the index of the IMU
  */
-static inv_device_t * device; 
+static struct device_array sensor_array;
+
+/* Start of the last sweep, to run the sweeps while an IMU is brought up */
+static uint64_t last_acquire_us;
 
 /*
- * A listener object will handle sensor events
+ * Indexes of the present IMUs into order when not null, returns how many
  */
-static const inv_sensor_listener_t sensor_listener = {
-	sensor_event_cb, /* callback that will receive sensor events */
-	0                /* some pointer passed to the callback */
-};
+static unsigned imus_present(int * order)
+{
+	unsigned n = 0;
 
+	for (int i = 0; i < (int)sensor_array.count; i++) {
+		if (sensor_array.members[i]->present != 1)
+			continue;
+		if (order)
+			order[n] = i;
+		n++;
+	}
+	return n;
+}
 
 /*
- * Last time at which 20948 IRQ was fired
+ * Plan of the sensors of sensor_list, the fastest at frame_us or at their own period when 0
  */
-static volatile uint32_t last_irq_time = 0;
+static int sensor_plan(struct odr_plan * plan, uint32_t frame_us, uint32_t bus_hz, uint32_t usb_bps, unsigned imus)
+{
+	struct odr_plan_config cfg;
 
-#define MAIN_UART_ID UART1 // Through FTDI cable
-#define LOG_UART_ID  UART2 // Through ST-Link
-#define DELAY_TIMER  TIMER3
-#define TIMEBASE_TIMER TIMER2
+	memset(plan, 0, sizeof(*plan));
+	memset(&cfg, 0, sizeof(cfg));
+	cfg.frame_us = frame_us;
+	cfg.bus_hz = bus_hz;
+	cfg.usb_bps = usb_bps;
+	cfg.imus = imus;
+	cfg.format = output_format;
+	for(unsigned i = 0; i < sizeof(sensor_list)/sizeof(sensor_list[0]); ++i) {
+		if(sensor_list[i].period_us == ODR_NONE)
+			continue;
+		if(cfg.count == ODR_PLAN_SENSORS)
+			return INV_ERROR_SIZE;
+		cfg.sensors[cfg.count].type = sensor_list[i].type;
+		cfg.sensors[cfg.count].period_us = sensor_list[i].period_us;
+		cfg.count++;
+	}
+	return odr_plan_make(&cfg, plan);
+}
 
- struct sensor{
-	int channel_numb;
-	uint8_t i2c_addr;
-	int present;
-	int ready;
-	inv_device_icm20948_t Device_handle;
-	inv_device_t * device;
-	} ;
-struct sensor sensors[15];
-void channel_set(uint8_t channel){
-	
-	uint8_t data_send[10];
-	data_send[0]=channel;
-	twi_package_t packet_write = {
-		.addr         = 0,      // TWI slave memory address data
-		.addr_length  = sizeof (uint8_t),    // TWI slave memory address data size
-		.chip         = 0x70,      // TWI slave bus address
-		.buffer       = data_send, // transfer data source buffer
-		.length       = 1  // transfer data size (bytes)
-	};
-	twi_master_write(TWI0, &packet_write) ;
-}
-
-uint8_t read_id(uint8_t i2c_address){
-	
-	uint8_t data_read[10];
-	data_read[0]=0;
-	twi_package_t packet_read = {
-		.addr         = 0,      // TWI slave memory address data
-		.addr_length  = sizeof (uint8_t),    // TWI slave memory address data size
-		.chip         = i2c_address,      // TWI slave bus address
-		.buffer       = data_read, // transfer data source buffer
-		.length       = 1  // transfer data size (bytes)
-	};
-	twi_master_read(TWI0, &packet_read) ;
-	return data_read[0];
-}
-void discovery(){
-	for(int i=0;i<16;i++){
-		INV_MSG(INV_MSG_LEVEL_INFO, "Discovery is working");
-		sensors[i].channel_numb = (int)i/2;
-		if(i%2==0){
-			sensors[i].i2c_addr = (uint8_t)0b1101000;
-		}else{
-			sensors[i].i2c_addr = (uint8_t)0b1101001;
+/*
+ * The sensors run at a new period, the cycle and the skeleton frames follow it
+ */
+static int sensor_period_changed(uint32_t period_us)
+{
+	odr_period_us = period_us;
+	if(output_format == OUTPUT_FORMAT_SKELETON)
+		frame_sync_start(odr_period_us);
+	return cycle_from_odr ? acq_cycle_start(odr_period_us) : 0;
+}
+
+/*
+ * Period of the sweeps, the cycle when there is one
+ */
+static uint32_t sweep_period_us(void)
+{
+	return acq_cycle_period_us() ? acq_cycle_period_us() : odr_period_us;
+}
+
+/*
+ * Start the sensors of every present IMU at the periods of a plan
+ */
+static int sensor_plan_apply(const struct odr_plan * plan)
+{
+	inv_device_t * const device = device_array_get_base(&sensor_array);
+	int rc = 0;
+
+	device_array_target(&sensor_array, DEVICE_ARRAY_ALL);
+	for(unsigned s = 0; s < plan->count; s++) {
+		if(inv_device_ping_sensor(device, plan->sensors[s].type) != 0)
+			continue;
+		rc |= inv_device_set_sensor_period_us(device, plan->sensors[s].type, plan->sensors[s].request_us);
+		for(int i=0;i<(int)sensor_array.count;i++){
+			if(sensor_array.members[i]->present == 1 && sensor_array.members[i]->rc == 0)
+				fifo_watch_sensor(i, plan->sensors[s].type, plan->sensors[s].applied_us);
 		}
-		channel_set(0b00000001<<sensors[i].channel_numb);
-		uint8_t id = read_id(sensors[i].i2c_addr);
-			INV_MSG(INV_MSG_LEVEL_INFO, "id read %d",(int)id);
-		if(id==234){
-			INV_MSG(INV_MSG_LEVEL_INFO, "Sensor on channel:%d  Address:%d Successfully polled", sensors[i].channel_numb, (int)sensors[i].i2c_addr);
-			sensors[i].present=1;
-		}else{
-			sensors[i].present =0;
-			INV_MSG(INV_MSG_LEVEL_INFO, "Sensor on channel:%d  Address:%d Failed", sensors[i].channel_numb, (int)sensors[i].i2c_addr);
+	}
+	for(int i=0;i<(int)sensor_array.count;i++){
+		if(sensor_array.members[i]->present != 1)
+			continue;
+		frame_sync_leave(i);
+		odr_adapt_leave(i);
+	}
+	fifo_watch_check(imus_present(0));
+	if(rc == 0)
+		rc = sensor_period_changed(plan->frame_us);
+	return rc;
+}
+
+/*
+ * Runtime control entry points, called by the host command parser between two sweeps
+ */
+int run_icm20948_set_sensor_period(int imu, int sensor, uint32_t period_us)
+{
+	inv_device_t * const device = device_array_get_base(&sensor_array);
+	int rc;
+
+	/* the host takes the period over */
+	if(sensor == odr_adapt_type())
+		odr_adapt_stop();
+	device_array_target(&sensor_array, (imu == HOST_CMD_ALL_IMUS) ? DEVICE_ARRAY_ALL : imu);
+	if(inv_device_ping_sensor(device, sensor) != 0)
+		return INV_ERROR_BAD_ARG;
+	rc = inv_device_set_sensor_period_us(device, sensor, period_us);
+	for(int i=0;i<(int)sensor_array.count;i++){
+		if(sensor_array.members[i]->present != 1 || (imu != HOST_CMD_ALL_IMUS && imu != i))
+			continue;
+		if(sensor_array.members[i]->rc == 0)
+			fifo_watch_sensor(i, sensor, period_us);
+		/* its sample clock is measured again */
+		frame_sync_leave(i);
+	}
+	fifo_watch_check(imus_present(0));
+	if(rc == 0 && period_us)
+		rc = sensor_period_changed(period_us);
+	return rc;
+}
+
+int run_icm20948_plan_odr(uint32_t frame_us, uint32_t bus_hz, uint32_t usb_bps)
+{
+	struct odr_plan plan;
+	int rc = sensor_plan(&plan, frame_us, bus_hz, usb_bps, imus_present(0));
+
+	if(rc != 0) {
+		odr_plan_send(&plan, rc);
+		return rc;
+	}
+	/* IMUs brought up later start at the plan too */
+	odr_plan = plan;
+	rc = sensor_plan_apply(&odr_plan);
+	/* adapting from the new plan, stops if it leaves no step within the bounds */
+	odr_adapt_replan(&odr_plan);
+	odr_plan_send(&plan, rc);
+	return rc;
+}
+
+int run_icm20948_set_adapt(int enable, uint32_t fastest_us, uint32_t slowest_us)
+{
+	int type = INV_SENSOR_TYPE_RESERVED;
+
+	if(!enable && !odr_adapt_type())
+		return 0;
+	odr_adapt_stop();
+	if(!odr_plan.count)
+		return enable ? INV_ERROR_BAD_ARG : 0;
+	if(enable) {
+		/* the rotation vector the skeleton follows */
+		for(unsigned s = 0; s < odr_plan.count && !type; s++) {
+			if(odr_plan.sensors[s].type == INV_SENSOR_TYPE_ROTATION_VECTOR
+					|| odr_plan.sensors[s].type == INV_SENSOR_TYPE_GAME_ROTATION_VECTOR)
+				type = odr_plan.sensors[s].type;
 		}
-		sensors[i].ready = 0;
-		
+		const int rc = odr_adapt_start(&odr_plan, type, fastest_us, slowest_us);
+		if(rc != 0)
+			return rc;
 	}
-	
-	
+	/* every IMU goes on from the plan */
+	return sensor_plan_apply(&odr_plan);
 }
-void sensorinit(void){
-	int rc = 0;
-	//rc += inv_host_serif_open(idd_io_hal_get_serif_instance_twi());
-	for(int i=0;i<15;i++){
-		INV_MSG(INV_MSG_LEVEL_INFO, "Sensor init");
-		if (sensors[i].present ==1){
-			uint8_t whoami = 0xff;
-			INV_MSG(INV_MSG_LEVEL_INFO, "if statement executed, for channel :%d",sensors[i].channel_numb);
-			//static inv_device_icm20948_t device_icm20948;
-			//static inv_device_t * device;
-			channel_set(0b00000001<<sensors[i].channel_numb);
-			uint8_t id = read_id(sensors[i].i2c_addr);
-			INV_MSG(INV_MSG_LEVEL_INFO, "read_id:%d",id);
-			
-			if (id !=234){
-				break;
-			}
-			inv_device_icm20948_init(&sensors[i].Device_handle, idd_io_hal_get_serif_instance_twi(),&sensor_listener, dmp3_image, sizeof(dmp3_image));
-			sensors[i].device = inv_device_icm20948_get_base(&sensors[i].Device_handle);
-			device = inv_device_icm20948_get_base(&sensors[i].Device_handle);
-			rc = inv_device_whoami(sensors[i].device, &whoami);
-			INV_MSG(INV_MSG_LEVEL_INFO, "ICM WHOAMI=%02x", whoami);
-			INV_MSG(INV_MSG_LEVEL_INFO, "Sensor working on channel:%d", sensors[i].channel_numb);
-			check_rc(rc);
-			INV_MSG(INV_MSG_LEVEL_INFO, "Setting-up ICM device");
-			rc = inv_device_setup(sensors[i].device);
-			check_rc(rc);
-			INV_MSG(INV_MSG_LEVEL_INFO, "Load DMP3 image");
-			rc = inv_device_load(sensors[i].device, NULL, dmp3_image, sizeof(dmp3_image), true /* verify */, NULL);
-			check_rc(rc);
-	{
-			uint64_t available_sensor_mask; /* To keep track of available sensors*/
-			unsigned i;
-		    //inv_device_t * device_temp = sensors[i].device;
-			/*
-			 * Check sensor availibitlity
-			 * if rc value is 0, it means sensor is available,
-			 * if rc value is INV_ERROR or INV_ERROR_BAD_ARG, sensor is NA
-			 */
-			available_sensor_mask = 0;
-			for(i = 0; i < sizeof(sensor_list)/sizeof(sensor_list[0]); ++i) {
-				const int rc = inv_device_ping_sensor(device, sensor_list[i].type);
-				INV_MSG(INV_MSG_LEVEL_INFO, "Ping %s %s", inv_sensor_2str(sensor_list[i].type), (rc == 0) ? "OK" : "KO");
-				if(rc == 0) {
-					available_sensor_mask |= (1ULL << sensor_list[i].type);
-				}
-			}
 
-			/*
-			 * Start all available sensors from the sensor list
-			 */
-			for(i = 0; i < sizeof(sensor_list)/sizeof(sensor_list[0]); ++i) {
-				if(available_sensor_mask & (1ULL << sensor_list[i].type)) {
-					INV_MSG(INV_MSG_LEVEL_INFO, "Starting %s @ %u us", inv_sensor_2str(sensor_list[i].type), sensor_list[i].period_us);
-					rc  = inv_device_set_sensor_period_us(device, sensor_list[i].type, sensor_list[i].period_us);
-					check_rc(rc);
-					rc += inv_device_start_sensor(device, sensor_list[i].type);
-					check_rc(rc);
-				}
-			}
+int run_icm20948_set_cycle(int enable, uint32_t period_us)
+{
+	if(!enable) {
+		acq_cycle_stop();
+		cycle_from_odr = 0;
+		return 0;
+	}
+	cycle_from_odr = (period_us == 0);
+	return acq_cycle_start(cycle_from_odr ? odr_period_us : period_us);
+}
+
+int run_icm20948_enable_sensor(int imu, int sensor, int enable)
+{
+	inv_device_t * const device = device_array_get_base(&sensor_array);
+	int rc;
+
+	device_array_target(&sensor_array, (imu == HOST_CMD_ALL_IMUS) ? DEVICE_ARRAY_ALL : imu);
+	if(inv_device_ping_sensor(device, sensor) != 0)
+		return INV_ERROR_BAD_ARG;
+	rc = inv_device_enable_sensor(device, sensor, enable);
+	for(int i=0;!enable && i<(int)sensor_array.count;i++){
+		if(sensor_array.members[i]->present == 1 && (imu == HOST_CMD_ALL_IMUS || imu == i))
+			fifo_watch_sensor(i, sensor, 0);
 	}
+	return rc;
+}
+
+int run_icm20948_ping_sensor(int imu, int sensor)
+{
+	device_array_target(&sensor_array, (imu == HOST_CMD_ALL_IMUS) ? DEVICE_ARRAY_ALL : imu);
+	return (inv_device_ping_sensor(device_array_get_base(&sensor_array), sensor) != 0) ? INV_ERROR_BAD_ARG : 0;
+}
+
+int run_icm20948_whoami(int imu, uint8_t * whoami)
+{
+	device_array_target(&sensor_array, (imu == HOST_CMD_ALL_IMUS) ? DEVICE_ARRAY_ALL : imu);
+	return inv_device_whoami(device_array_get_base(&sensor_array), whoami);
+}
+
+int run_icm20948_set_output_format(int format)
+{
+	if(format < OUTPUT_FORMAT_TEXT || format > OUTPUT_FORMAT_SKELETON)
+		return INV_ERROR_BAD_ARG;
+	/* do not leave samples of the previous format behind */
+	dynpro_cdc_flush();
+	lat_trace_sent();
+	output_format = format;
+	frame_sync_start((format == OUTPUT_FORMAT_SKELETON) ? odr_period_us : 0);
+	return 0;
+}
+
+int run_icm20948_set_stats_period(uint16_t period_ms)
+{
+	stats_period_us = (uint32_t)period_ms * 1000;
+	stats_sent_us = inv_icm20948_get_time_us();
+	lat_trace_init();
+	health_init();
+	return 0;
+}
 
-		}else{
-		INV_MSG(INV_MSG_LEVEL_INFO, "bypassed");
+/*
+ * Stats frames of one period
+ */
+static void stats_send(void)
+{
+	lat_trace_send();
+	/* quarantined IMUs too, for their fault state */
+	for (int i = 0; i < (int)sensor_array.count; i++)
+		health_send_imu(i, &sensor_array.members[i]->icm20948.icm20948_states.fifo_info, fault_get(i));
+	health_send();
+	acq_cycle_send();
+}
+
+int run_icm20948_get_output_format(void)
+{
+	return output_format;
+}
+
+/*
+ * Find the IMUs behind the muxes and allocate the sensor table for them
+ */
+void discovery(void){
+	const unsigned n = mux_topo_discover(EXPECTED_WHOAMI[0]);
+
+	device_array_clear(&sensor_array);
+	for(unsigned i = 0; i < n; i++) {
+		if(device_array_add(&sensor_array) < 0) {
+			INV_MSG(INV_MSG_LEVEL_ERROR, "No memory for IMU %d", i);
+			break;
 		}
 	}
+	startup_done(STARTUP_PHASE_DISCOVERY);
 }
 
-int setup_and_run_icm20948(void)
+/*
+ * Calls of the bring-up stages made through device_array_call(), on the IMU member
+ */
+static int sensor_setup(inv_device_t * device, int member, void * arg)
+{
+	(void)member;
+	(void)arg;
+	return inv_device_setup(device);
+}
+
+static int sensor_start(inv_device_t * device, int imu, void * arg)
 {
 	int rc = 0;
-	unsigned i = 0;
 
+	(void)arg;
+
+	/*
+	 * Start every sensor of the list the device has,
+	 * the ping returns INV_ERROR or INV_ERROR_BAD_ARG for the others
+	 */
+	for(unsigned i = 0; rc >= 0 && i < sizeof(sensor_list)/sizeof(sensor_list[0]); ++i) {
+		/* at the period of the plan, the one of the list when it is not planned */
+		const int p = odr_plan_find(&odr_plan, sensor_list[i].type);
+		const uint32_t request_us = (p < 0) ? sensor_list[i].period_us : odr_plan.sensors[p].request_us;
+		const uint32_t applied_us = (p < 0) ? sensor_list[i].period_us : odr_plan.sensors[p].applied_us;
+
+		if(inv_device_ping_sensor(device, sensor_list[i].type) != 0) {
+			INV_MSG(INV_MSG_LEVEL_INFO, "Ping %s KO", inv_sensor_2str(sensor_list[i].type));
+			continue;
+		}
+		INV_MSG(INV_MSG_LEVEL_INFO, "Starting %s @ %u us, runs at %u us", inv_sensor_2str(sensor_list[i].type), request_us, applied_us);
+		rc = inv_device_set_sensor_period_us(device, sensor_list[i].type, request_us);
+		if(rc == 0)
+			rc = inv_device_start_sensor(device, sensor_list[i].type);
+		if(rc == 0)
+			fifo_watch_sensor(imu, sensor_list[i].type, applied_us);
+	}
+	return rc;
+}
+
+/* The groups of the IMUs of bringup_run() are made, out of those that answered */
+static int sensor_grouped;
+
+/*
+ * Work of one bring-up stage of an IMU, see bringup.h
+ */
+static int sensor_bringup_step(int imu, int stage)
+{
+	struct device_array_member * const sensor = sensor_array.members[imu];
+	inv_device_t * device;
 	uint8_t whoami = 0xff;
+	int rc = 0;
 
+	switch(stage) {
+	case BRINGUP_STAGE_PROBE:
+		rc = mux_topo_whoami(imu, &whoami);
+		INV_MSG(INV_MSG_LEVEL_INFO, "IMU %d on mux 0x%02x channel %d: WHOAMI=%02x", imu,
+				(mux_topo_dev(imu)->mux < 0) ? 0 : mux_topo_mux(mux_topo_dev(imu)->mux)->addr, mux_topo_dev(imu)->channel, whoami);
+		if(rc != 0 || whoami != EXPECTED_WHOAMI[0]) {
+			/* not in a group */
+			sensor->present = 0;
+			return (rc != 0) ? rc : INV_ERROR;
+		}
+		device_array_member_init(&sensor_array, imu);
+		/* every output format takes the rotation vectors in Q30 */
+		inv_device_icm20948_set_quat_q30_only(&sensor->icm20948, true);
+		inv_device_icm20948_set_quat_raw(&sensor->icm20948, RUN_ICM20948_QUAT_BATCH);
+		break;
+	case BRINGUP_STAGE_SETUP:
+		/* every probe is done before the first setup */
+		if(!sensor_grouped) {
+			device_array_group(&sensor_array, RUN_ICM20948_BROADCAST);
+			sensor_grouped = 1;
+		}
+		bringup_step_group(device_array_led(&sensor_array, imu));
+		rc = device_array_call(&sensor_array, imu, stage, sensor_setup, 0);
+		break;
+	case BRINGUP_STAGE_LOAD:
+		device = device_array_select(&sensor_array, imu);
+		rc = device ? inv_device_load(device, 0, dmp3_image, sizeof(dmp3_image), true /* verify */, false) : sensor->rc;
+		break;
+	case BRINGUP_STAGE_START:
+		bringup_step_group(device_array_led(&sensor_array, imu));
+		rc = device_array_call(&sensor_array, imu, stage, sensor_start, 0);
+		odr_adapt_leave(imu);
+		sensor->ready = (rc >= 0);
+		break;
+	default:
+		return INV_ERROR_BAD_ARG;
+	}
+	/* Send the messages of this step now, the sweeps of a hot bring-up do not */
+	startup_poll();
+	msg_log_flush(0, (output_format == OUTPUT_FORMAT_BINARY));
+	return (rc < 0) ? rc : 0;
+}
 
+/*
+ * Bring every IMU found up together, the ones that fail are left out
+ */
+void sensorinit(void){
+	const struct device_array_stats * const calls = &sensor_array.stats;
+
+	sensor_grouped = 0;
+	bringup_run(sensor_array.count, sensor_bringup_step);
+	/* an IMU brought up later is alone */
+	device_array_group(&sensor_array, 0);
+	if(calls->led)
+		INV_MSG(INV_MSG_LEVEL_INFO, "  broadcast: %lu calls led, %lu followed, %lu made again alone",
+				(unsigned long)calls->led, (unsigned long)calls->followed, (unsigned long)calls->alone);
+	for(unsigned i = 0; i < sensor_array.count; i++) {
+		if(bringup_stage(i) != BRINGUP_READY)
+			sensor_array.members[i]->present = 0;
+		fault_brought_up(i, bringup_stage(i) == BRINGUP_READY);
+	}
+	startup_done(STARTUP_PHASE_BRINGUP);
+	msg_log_flush(0, (output_format == OUTPUT_FORMAT_BINARY));
+}
+
+/*
+ * An IMU is quarantined, the others go on without it until it is brought up again
+ */
+static void sensor_quarantine(int imu)
+{
+	sensor_array.members[imu]->present = 0;
+	sensor_array.members[imu]->ready = 0;
+	frame_sync_leave(imu);
+	odr_adapt_leave(imu);
+	hotplug_changed(imu, 0, imus_present(0));
+}
+
+/*
+ * Policy of the sweeps over sensor_array, see device_array.h
+ * Bus counters before the poll of the current IMU, and period of the sweeps
+ */
+static uint32_t poll_bus_errors, poll_bus_retries;
+static uint32_t poll_sweep_us;
+
+static unsigned sensor_poll_schedule(int * order, unsigned n, void * context)
+{
+	unsigned k, due = 0;
+
+	(void)context;
+	/* closest to overflow first */
+	fifo_watch_order(order, n);
+	for(k = 0; k < n; k++) {
+		/* backing off after a failure, or running slower than the sweeps */
+		if(fault_poll_due(order[k]) && odr_adapt_poll_due(order[k], poll_sweep_us))
+			order[due++] = order[k];
+	}
+	return due;
+}
+
+static void sensor_poll_begin(int imu, void * context)
+{
+	(void)context;
+	poll_bus_errors = idd_io_hal_get_stats()->errors;
+	poll_bus_retries = idd_io_hal_get_stats()->retries;
+	poll_quats = 0;
+	frame_sync_drain(imu, inv_icm20948_get_time_us());
+}
+
+static int sensor_poll_end(int imu, int rc, void * context)
+{
+	(void)context;
+	frame_sync_drained(imu, poll_quats);
+	health_bus(imu, idd_io_hal_get_stats()->errors - poll_bus_errors, idd_io_hal_get_stats()->retries - poll_bus_retries);
+	fifo_watch_polled(imu, &sensor_array.members[imu]->icm20948.icm20948_states.fifo_info);
+	/* the driver does not report failed transfers of a poll */
+	if(rc >= 0 && idd_io_hal_get_stats()->errors != poll_bus_errors)
+		rc = INV_ERROR_TRANSPORT;
+	if(fault_polled(imu, rc, health_get(imu)->samples, fifo_watch_get(imu)->configured_bps != 0))
+		sensor_quarantine(imu);
+	return rc;
+}
+
+static const struct device_array_policy sensor_poll_policy = {
+	sensor_poll_schedule,
+	sensor_poll_begin,
+	sensor_poll_end,
+	0
+};
+
+int run_icm20948_setup(void)
+{
+	int rc = 0;
+	unsigned i = 0;
 
 	/*
 	 * Register a handler called upon external interrupt
@@ -374,9 +763,19 @@ int setup_and_run_icm20948(void)
 	//gpio_sensor_irq_init(TO_MASK(GPIO_SENSOR_IRQ_D6) | TO_MASK(GPIO_SENSOR_IRQ_D7), ext_interrupt_cb, 0);
 	//timer_enable(TIMEBASE_TIMER);
 	
+	prof_zone_init();
+	lat_trace_init();
+	health_init();
+	fifo_watch_init();
+	hotplug_init();
+	fault_init();
+	frame_sync_init();
+	odr_adapt_init();
+
 	/*
 	 * Setup message facility to see internal traces from IDD
 	 */
+	msg_log_init();
 	INV_MSG_SETUP(MSG_LEVEL, msg_printer);
 
 	/*
@@ -390,8 +789,15 @@ int setup_and_run_icm20948(void)
 	 * Open serial interface before using the device
 	 * Init SPI communication: SPI1 - SCK(PA5) / MISO(PA6) / MOSI(PA7) / CS(PB6)
 	 */
+	host_cmd_init();
+	dynpro_cdc_init();
+
 	INV_MSG(INV_MSG_LEVEL_INFO, "Open TWI serial interface");
 	rc += inv_host_serif_open(idd_io_hal_get_serif_instance_twi());
+	device_array_init(&sensor_array, idd_io_hal_get_serif_instance_twi(), mux_topo_select, sensor_event_cb, 0,
+			dmp3_image, sizeof(dmp3_image));
+	device_array_set_policy(&sensor_array, &sensor_poll_policy);
+	device_array_set_broadcast(&sensor_array, RUN_ICM20948_BROADCAST);
 	//may have to move this into iteration
 	
 	
@@ -408,6 +814,9 @@ int setup_and_run_icm20948(void)
 			//twi_master_write(TWI0, &packet_write) ;
 		
 	discovery();
+	/* the sensors of the list start at the plan even when the load is beyond the bus, fifo_watch warns */
+	odr_plan_send(&odr_plan, sensor_plan(&odr_plan, 0, 0, 0, sensor_array.count));
+	msg_log_flush(0, (output_format == OUTPUT_FORMAT_BINARY));
 	sensorinit();
 
 	/*
@@ -493,27 +902,199 @@ int setup_and_run_icm20948(void)
 *///#endif
 	
 	INV_MSG(INV_MSG_LEVEL_INFO, "Sensor inti has stopped");
+
+	odr_period_us = odr_plan.count ? odr_plan.frame_us : 0;
+	for(i = 0; !odr_plan.count && i < sizeof(sensor_list)/sizeof(sensor_list[0]); ++i) {
+		if(sensor_list[i].period_us != ODR_NONE && (odr_period_us == 0 || sensor_list[i].period_us < odr_period_us))
+			odr_period_us = sensor_list[i].period_us;
+	}
+	fifo_watch_check(imus_present(0));
+#if RUN_ICM20948_CYCLE
+	run_icm20948_set_cycle(1, 0);
+#endif
+	return rc;
+}
+
+/*
+ * Poll every present IMU once
+ */
+static void run_icm20948_acquire(void)
+{
+	const unsigned n = imus_present(0);
+
+	last_acquire_us = inv_icm20948_get_time_us();
+	poll_sweep_us = sweep_period_us();
+	PROF_ZONE_BEGIN(PROF_ZONE_SWEEP);
+	/*
+	 * Poll device for data, events are reported from inv_device_poll()
+	 */
+	//if (irq_from_device & TO_MASK(GPIO_SENSOR_IRQ_D6)) {
+		inv_device_poll(device_array_get_base(&sensor_array));
+		PROF_ZONE_BEGIN(PROF_ZONE_CONVERT);
+		quat_batch_flush();
+		PROF_ZONE_END(PROF_ZONE_CONVERT);
+		/* one batch (or a few when it does not fit) per sweep */
+		if(output_format == OUTPUT_FORMAT_DYNPROTOCOL_BATCH) {
+			dynpro_cdc_flush();
+			lat_trace_sent();
+		}
+		if(output_format == OUTPUT_FORMAT_SKELETON)
+			skeleton_send();
+		if(sweep_samples) {
+			startup_frame_sent(n);
+			sweep_samples = 0;
+		}
+		PROF_ZONE_END(PROF_ZONE_SWEEP);
+        //sched_yield();  //trying not to block the OS
+
+	//	if(rc >= 0) {
+	//		__disable_irq();
+	//		irq_from_device &= ~TO_MASK(GPIO_SENSOR_IRQ_D6);
+	//		__enable_irq();
+	//	}
+	//}
+}
+
+/*
+ * The sweeps of the IMUs streaming while another one is brought up, see bringup.h
+ */
+static int sensor_yield(void)
+{
+	if(acq_cycle_period_us()) {
+		if(!acq_cycle_begin())
+			return 0;
+		run_icm20948_acquire();
+		acq_cycle_end();
+		return 1;
+	}
+	if(inv_icm20948_get_time_us() - last_acquire_us < odr_period_us)
+		return 0;
+	run_icm20948_acquire();
+	return 1;
+}
+
+/*
+ * Probe the next slot without an IMU streaming, see hotplug.h
+ * An IMU that answers is brought up and streams from the next sweep on
+ * Returns 0 if no probe was due
+ */
+static int sensor_hotplug(void)
+{
+	const unsigned slots = mux_topo_slot_count();
+	unsigned k, slot = 0;
+	int dev;
+
+	if(!sensor_array.count || !hotplug_due())
+		return 0;
+	for(k = 0; k < slots; ++k) {
+		slot = hotplug_next_slot(slots);
+		dev = mux_topo_slot_dev(slot);
+		if(dev < 0 || dev >= (int)sensor_array.count || (sensor_array.members[dev]->present != 1 && fault_recovery_due(dev)))
+			break;
+	}
+	if(k == slots)
+		return 0;
+	dev = mux_topo_probe_slot(slot, EXPECTED_WHOAMI[0]);
+	if(dev < 0)
+		return 1;
+	/* a new IMU is the last one of the topology */
+	while(sensor_array.count <= (unsigned)dev) {
+		const int added = device_array_add(&sensor_array);
+
+		if(added < 0) {
+			INV_MSG(INV_MSG_LEVEL_ERROR, "No memory for IMU %d", sensor_array.count);
+			return 1;
+		}
+		/* not streaming before it is brought up */
+		sensor_array.members[added]->present = 0;
+	}
+	if(bringup_imu(dev, sensor_bringup_step, sensor_yield) != 0) {
+		INV_MSG(INV_MSG_LEVEL_WARNING, "IMU %d answers but does not come up", dev);
+		fault_brought_up(dev, 0);
+		return 1;
+	}
+	fault_brought_up(dev, 1);
+	sensor_array.members[dev]->present = 1;
+	hotplug_changed(dev, 1, imus_present(0));
+	fifo_watch_check(imus_present(0));
+	return 1;
+}
+
+/*
+ * Step the rotation vector of the IMUs after their motion, see odr_adapt.h
+ * Returns 0 if no change was due
+ */
+static int sensor_adapt(void)
+{
+	struct odr_adapt_change changes[ODR_ADAPT_CHANGES];
+	int order[MUX_TOPO_MAX_DEVICES];
+	const unsigned n = imus_present(order);
+	const unsigned count = odr_adapt_evaluate(order, n, sweep_period_us(), changes);
+
+	for(unsigned k = 0; k < count; k++) {
+		const struct odr_adapt_change * c = &changes[k];
+		const unsigned from = odr_adapt_get(c->imu)->d;
+		inv_device_t * const device = device_array_select(&sensor_array, c->imu);
+		const int rc = device ? inv_device_set_sensor_period_us(device, odr_adapt_type(), c->request_us)
+				: sensor_array.members[c->imu]->rc;
+		if(rc == 0) {
+			fifo_watch_sensor(c->imu, odr_adapt_type(), c->applied_us);
+			frame_sync_rescale(c->imu, from, c->d);
+		}
+		odr_adapt_changed(c, rc);
+	}
+	return count != 0;
+}
+
+/*
+ * Service the host between two sweeps, bounded so acquisition never stalls
+ * Returns 0 if there was nothing to do
+ */
+static int run_icm20948_service(void)
+{
+	int done;
+
+	startup_poll();
+	handleInput();
+	done = host_cmd_process();
+	done += msg_log_flush(MSG_LOG_FLUSH_PER_SWEEP, (output_format == OUTPUT_FORMAT_BINARY));
+	if(stats_period_us) {
+		const uint64_t now = inv_icm20948_get_time_us();
+
+		if(now - stats_sent_us >= stats_period_us) {
+			stats_sent_us = now;
+			stats_send();
+			done++;
+		}
+	}
+	if(!done)
+		done = sensor_adapt();
+	if(!done)
+		done = sensor_hotplug();
+	return done;
+}
+
+void run_icm20948_sweep(void)
+{
+	if(acq_cycle_period_us()) {
+		/* what is left of the period goes to the host */
+		while(!acq_cycle_begin()) {
+			if(!run_icm20948_service())
+				acq_cycle_idle();
+		}
+		run_icm20948_acquire();
+		acq_cycle_end();
+	} else {
+		run_icm20948_acquire();
+		run_icm20948_service();
+	}
+}
+
+int setup_and_run_icm20948(void)
+{
+	run_icm20948_setup();
 	do {
-		/*
-		 * Poll device for data
-		 */
-		//if (irq_from_device & TO_MASK(GPIO_SENSOR_IRQ_D6)) {
-			for (int i =0;i<15;i++){
-				if (sensors[i].present ==1){
-				channel_set(0b00000001<<sensors[i].channel_numb);
-				rc = inv_device_poll(sensors[i].device);
-				sensor_id = i;
-				check_rc(rc);
-				}
-			}
-            //sched_yield();  //trying not to block the OS
-
-		//	if(rc >= 0) {
-		//		__disable_irq();
-		//		irq_from_device &= ~TO_MASK(GPIO_SENSOR_IRQ_D6);
-		//		__enable_irq();
-		//	}
-		//}
+		run_icm20948_sweep();
 	} while(1);
 }
 
@@ -528,18 +1109,64 @@ int setup_and_run_icm20948(void)
 //}
 
 /*
- * Callback called upon sensor event reception
- * This function is called in the same context as inv_device_poll()
+ * Skeleton frames due, see frame_sync.h
  */
-static void sensor_event_cb(const inv_sensor_event_t * event, void * arg)
+static void skeleton_send(void)
 {
-	/* arg will contained the value provided at init time */
-	(void)arg;
+	const struct frame_sync_frame * frame;
+	uint8_t payload[5 + 9 * HOST_CMD_SKELETON_IMUS];
+
+	while((frame = frame_sync_next()) != 0) {
+		unsigned k = 0;
+
+		do {
+			const unsigned count = (frame->count - k < HOST_CMD_SKELETON_IMUS) ? frame->count - k : HOST_CMD_SKELETON_IMUS;
 
+			inv_dc_int32_to_little8((int32_t)frame->timestamp_us, &payload[0]);
+			payload[4] = (uint8_t)count;
+			for(unsigned j = 0; j < count; j++, k++) {
+				payload[5+9*j] = frame->imu[k];
+				for(int c = 0; c < 4; c++)
+					inv_dc_int16_to_little8(frame->q14[k][c], &payload[5+9*j+1+2*c]);
+			}
+			host_cmd_send(HOST_CMD_TYPE_ASYNC, HOST_CMD_CODE_SKELETON, payload, 5 + 9 * count);
+		} while(k < frame->count);
+		lat_trace_sent();
+	}
+}
+
+/*
+ * Binary frame of a rotation vector, quaternion already in Q14
+ */
+static void sensor_quat_send(int imu, const inv_sensor_event_t * event, const int16_t q14[4])
+{
+	/* <imu> <sensor> <timestamp (4)> <w x y z in Q14 (4*2)> */
+	uint8_t payload[2+4+4*2];
+
+	payload[0] = (uint8_t)imu;
+	payload[1] = (uint8_t)INV_SENSOR_ID_TO_TYPE(event->sensor);
+	inv_dc_int32_to_little8((int32_t)event->timestamp, &payload[2]);
+	for(int k = 0; k < 4; k++)
+		inv_dc_int16_to_little8(q14[k], &payload[6+2*k]);
+	host_cmd_send(HOST_CMD_TYPE_ASYNC, HOST_CMD_CODE_SENSOR_DATA, payload, sizeof(payload));
+}
+
+/*
+ * Send a sensor event to the host in the current output format
+ */
+static void sensor_event_output(int imu, const inv_sensor_event_t * event)
+{
 /*
 	 * In normal mode, display sensor event over UART messages
 	 */
 	static char out_str[256];
+	if(event->status == INV_SENSOR_STATUS_DATA_UPDATED)
+		odr_adapt_sample(imu, INV_SENSOR_ID_TO_TYPE(event->sensor), event->data.quaternion.quat_q30);
+	if(event->status == INV_SENSOR_STATUS_DATA_UPDATED
+			&& (output_format == OUTPUT_FORMAT_DYNPROTOCOL || output_format == OUTPUT_FORMAT_DYNPROTOCOL_BATCH)) {
+		dynpro_cdc_sensor_event(imu, event, (output_format == OUTPUT_FORMAT_DYNPROTOCOL_BATCH));
+		return;
+	}
 	if(event->status == INV_SENSOR_STATUS_DATA_UPDATED) {
 
 		switch(INV_SENSOR_ID_TO_TYPE(event->sensor)) {
@@ -591,18 +1218,39 @@ static void sensor_event_cb(const inv_sensor_event_t * event, void * arg)
 			break;
 		case INV_SENSOR_TYPE_GAME_ROTATION_VECTOR:
 		case INV_SENSOR_TYPE_ROTATION_VECTOR:
-					sprintf(out_str,"%d:0:quat:%f,%f,%f,%f\n",sensor_id,(event->data.quaternion.quat[0]),
-					(event->data.quaternion.quat[1]),
-					(event->data.quaternion.quat[2]),
-					(event->data.quaternion.quat[3]));
-					serialWrite(out_str,strlen(out_str));
+					if(output_format == OUTPUT_FORMAT_SKELETON) {
+						/* sent with the others in the next skeleton frames */
+						frame_sync_sample(imu, event->data.quaternion.quat_q30);
+						break;
+					}
+					if(output_format == OUTPUT_FORMAT_BINARY) {
+						int16_t q14[4];
+
+						for(int k = 0; k < 4; k++)
+							q14[k] = quat_batch_q14(event->data.quaternion.quat_q30[k]);
+						lat_trace_formatted();
+						sensor_quat_send(imu, event, q14);
+						break;
+					}
+					{
+						/* "<imu>:0:quat:w,x,y,z\n" with 6 decimals, formatted from Q30 without float */
+						int idx;
+
+						idx = InvFormat_fixed2dec(out_str, sizeof(out_str), imu, 0, 0);
+						memcpy(&out_str[idx], ":0:quat:", 8);
+						idx += 8;
+						idx += InvFormat_fixedArray2dec(&out_str[idx], sizeof(out_str) - idx - 1, event->data.quaternion.quat_q30, 4, 30, 6, ',');
+						out_str[idx++] = '\n';
+						lat_trace_formatted();
+						serialWrite(out_str, idx);
+					}
 					break;
 		case INV_SENSOR_TYPE_GEOMAG_ROTATION_VECTOR:
 			INV_MSG(INV_MSG_LEVEL_INFO, "data event %s (e-3): %d %d %d %d ", inv_sensor_str(event->sensor),
-					(int)(event->data.quaternion.quat[0]*1000),
-					(int)(event->data.quaternion.quat[1]*1000),
-					(int)(event->data.quaternion.quat[2]*1000),
-					(int)(event->data.quaternion.quat[3]*1000));
+					(int)(((int64_t)event->data.quaternion.quat_q30[0]*1000) >> 30),
+					(int)(((int64_t)event->data.quaternion.quat_q30[1]*1000) >> 30),
+					(int)(((int64_t)event->data.quaternion.quat_q30[2]*1000) >> 30),
+					(int)(((int64_t)event->data.quaternion.quat_q30[3]*1000) >> 30));
 			break;
 		case INV_SENSOR_TYPE_ORIENTATION:
 			//INV_MSG(INV_MSG_LEVEL_INFO, "data event %s (e-3): %d %d %d %d ", inv_sensor_str(event->sensor),
@@ -630,6 +1278,119 @@ static void sensor_event_cb(const inv_sensor_event_t * event, void * arg)
 		}
 	}
 }
+
+#if RUN_ICM20948_QUAT_BATCH
+/*
+ * Keep a raw rotation vector for quat_batch_flush()
+ * Returns 0 if the event is not a rotation vector
+ */
+static int quat_batch_gather(int imu, const inv_sensor_event_t * event)
+{
+	const int type = INV_SENSOR_ID_TO_TYPE(event->sensor);
+	const int32_t * q = event->data.quaternion.quat_q30;
+	const long raw[3] = { q[1], q[2], q[3] };
+	const long * chip_to_body = sensor_array.members[imu]->icm20948.icm20948_states.s_quat_chip_to_body;
+	int k;
+
+	if(type != INV_SENSOR_TYPE_GAME_ROTATION_VECTOR && type != INV_SENSOR_TYPE_ROTATION_VECTOR
+			&& type != INV_SENSOR_TYPE_GEOMAG_ROTATION_VECTOR)
+		return 0;
+	k = quat_batch_add(&quat_batch, raw, chip_to_body);
+	if(k < 0) {
+		/* more than a batch in one sweep, convert what is there */
+		quat_batch_flush();
+		k = quat_batch_add(&quat_batch, raw, chip_to_body);
+	}
+	quat_batch_event[k].timestamp = event->timestamp;
+	quat_batch_event[k].sensor = event->sensor;
+	quat_batch_event[k].accuracy_q29 = event->data.quaternion.accuracy_q29;
+	quat_batch_event[k].accuracy_flag = event->data.quaternion.accuracy_flag;
+	quat_batch_event[k].imu = (uint8_t)imu;
+	return 1;
+}
+#endif
+
+/*
+ * Convert the rotation vectors gathered and send them in the current output format
+ */
+static void quat_batch_flush(void)
+{
+#if RUN_ICM20948_QUAT_BATCH
+	inv_sensor_event_t event;
+	unsigned k;
+
+	if(!quat_batch.count)
+		return;
+	quat_batch_run(&quat_batch);
+	lat_trace_formatted();
+
+	memset(&event, 0, sizeof(event));
+	event.status = INV_SENSOR_STATUS_DATA_UPDATED;
+	for(k = 0; k < quat_batch.count; ++k) {
+		event.sensor = quat_batch_event[k].sensor;
+		event.timestamp = quat_batch_event[k].timestamp;
+		event.data.quaternion.quat_q30[0] = quat_batch.qw[k];
+		event.data.quaternion.quat_q30[1] = quat_batch.qx[k];
+		event.data.quaternion.quat_q30[2] = quat_batch.qy[k];
+		event.data.quaternion.quat_q30[3] = quat_batch.qz[k];
+		event.data.quaternion.accuracy_q29 = quat_batch_event[k].accuracy_q29;
+		event.data.quaternion.accuracy_flag = quat_batch_event[k].accuracy_flag;
+		if(output_format == OUTPUT_FORMAT_BINARY
+				&& INV_SENSOR_ID_TO_TYPE(event.sensor) != INV_SENSOR_TYPE_GEOMAG_ROTATION_VECTOR) {
+			const int16_t q14[4] = { quat_batch.q14w[k], quat_batch.q14x[k], quat_batch.q14y[k], quat_batch.q14z[k] };
+
+			odr_adapt_sample(quat_batch_event[k].imu, INV_SENSOR_ID_TO_TYPE(event.sensor), event.data.quaternion.quat_q30);
+			sensor_quat_send(quat_batch_event[k].imu, &event, q14);
+		} else {
+			sensor_event_output(quat_batch_event[k].imu, &event);
+		}
+	}
+	quat_batch_clear(&quat_batch);
+	if(output_format != OUTPUT_FORMAT_DYNPROTOCOL_BATCH && output_format != OUTPUT_FORMAT_SKELETON)
+		lat_trace_sent();
+#endif
+}
+
+/*
+ * Callback called upon sensor event reception, imu the one that gave it
+ * This function is called in the same context as inv_device_poll()
+ */
+static void sensor_event_cb(const inv_sensor_event_t * event, int imu, void * arg)
+{
+	/* arg will contained the value provided at init time */
+	(void)arg;
+
+	PROF_ZONE_BEGIN(PROF_ZONE_CONVERT);
+	if(event->status == INV_SENSOR_STATUS_DATA_UPDATED) {
+		health_sample(imu);
+		sweep_samples++;
+		if(INV_SENSOR_ID_TO_TYPE(event->sensor) == INV_SENSOR_TYPE_ROTATION_VECTOR
+				|| INV_SENSOR_ID_TO_TYPE(event->sensor) == INV_SENSOR_TYPE_GAME_ROTATION_VECTOR) {
+			uint64_t sample_us;
+
+			/* the driver timestamp is the drain time spread, the clock line is not */
+			poll_quats++;
+			if(frame_sync_sample_us(imu, frame_sync_clock(imu)->samples + poll_quats, &sample_us) != 0)
+				sample_us = event->timestamp;
+			lat_trace_drained(imu, sample_us);
+		}
+		else
+			lat_trace_drained(imu, event->timestamp);
+#if RUN_ICM20948_QUAT_BATCH
+		if(quat_batch_gather(imu, event)) {
+			PROF_ZONE_END(PROF_ZONE_CONVERT);
+			return;
+		}
+#endif
+	}
+	sensor_event_output(imu, event);
+	lat_trace_formatted();
+	/* batched samples are sent by the sweep, the ones before are pending with them */
+	if(output_format != OUTPUT_FORMAT_DYNPROTOCOL_BATCH && output_format != OUTPUT_FORMAT_SKELETON
+			&& !QUAT_BATCH_PENDING())
+		lat_trace_sent();
+	PROF_ZONE_END(PROF_ZONE_CONVERT);
+}
 #if !USE_IDDWRAPPER
 /*
  * Function to return activity name in printable char
@@ -668,50 +1429,16 @@ uint64_t inv_icm20948_get_dataready_interrupt_time_us(void)
 	return last_irq_time;
 }
 
-static void check_rc(int rc)
-{
-	if(rc == -1) {
-		INV_MSG(INV_MSG_LEVEL_INFO, "BAD RC=%d", rc);
-		while(1);
-	}
-}
-
 /*
  * Printer function for IDD message facility
+ * Messages are only recorded here, they are formatted and sent by msg_log_flush()
+ * from the acquisition loop
  */
 
 static void msg_printer(int level, const char * str, va_list ap)
 {
 #ifdef INV_MSG_ENABLE
-	static char out_str[256]; /* static to limit stack usage */
-	unsigned idx = 0;
-	const char * ptr = out_str;
-	const char * s[INV_MSG_LEVEL_MAX] = {
-		"",    // INV_MSG_LEVEL_OFF
-		"[E] ", // INV_MSG_LEVEL_ERROR
-		"[W] ", // INV_MSG_LEVEL_WARNING
-		"[I] ", // INV_MSG_LEVEL_INFO
-		"[V] ", // INV_MSG_LEVEL_VERBOSE
-		"[D] ", // INV_MSG_LEVEL_DEBUG
-	};
-
-	idx += snprintf(&out_str[idx], sizeof(out_str) - idx, "%s", s[level]);
-	if(idx >= (sizeof(out_str)))
-		return;
-	idx += vsnprintf(&out_str[idx], sizeof(out_str) - idx, str, ap);
-	if(idx >= (sizeof(out_str)))
-		return;
-	idx += snprintf(&out_str[idx], sizeof(out_str) - idx, "\r\n");
-	if(idx >= (sizeof(out_str)))
-		return;
-
-    //while(*ptr != '\0') {
-	//	uart_putc(LOG_UART_ID, *ptr);
-	//	++ptr;
-	//}
-    
-    serialWrite(out_str,strlen(out_str));
-
+	msg_log_record(level, str, ap);
 #else
 	(void)level, (void)str, (void)ap;
 #endif
@@ -5,8 +5,45 @@
 #ifndef TESTANDROIDTHINGS_RUN_ICM20948_H
 #define TESTANDROIDTHINGS_RUN_ICM20948_H
 
+#include <stdint.h>
+
+/*
+ * Sensor data output format
+ */
+enum output_format {
+	OUTPUT_FORMAT_TEXT   = 0,	/* one "<imu>:0:quat:w,x,y,z" line per sample */
+	OUTPUT_FORMAT_BINARY = 1,	/* one HOST_CMD_CODE_SENSOR_DATA frame per sample (see host_cmd.h) */
+	OUTPUT_FORMAT_DYNPROTOCOL       = 2,	/* one DynProtocol NEW_SENSOR_DATA packet per sample (see dynpro_cdc.h) */
+	OUTPUT_FORMAT_DYNPROTOCOL_BATCH = 3,	/* DynProtocol NEW_SENSOR_DATA_BATCH packets, sent once per sweep */
+	OUTPUT_FORMAT_SKELETON = 4,	/* HOST_CMD_CODE_SKELETON frames of every IMU at one time (see frame_sync.h) */
+};
+
 int setup_and_run_icm20948(void);
+/* setup_and_run_icm20948() is run_icm20948_setup() then run_icm20948_sweep() forever */
+int run_icm20948_setup(void);
+/* Poll every present IMU once, then service the host */
+void run_icm20948_sweep(void);
 void discovery(void);
 
+/*
+ * Runtime control, imu is an index in the sensor table or HOST_CMD_ALL_IMUS
+ * All return 0 on success, a negative value otherwise
+ */
+int run_icm20948_set_sensor_period(int imu, int sensor, uint32_t period_us);
+int run_icm20948_enable_sensor(int imu, int sensor, int enable);
+int run_icm20948_set_output_format(int format);
+int run_icm20948_get_output_format(void);
+int run_icm20948_ping_sensor(int imu, int sensor);
+/* Start the sensors at the periods of an ODR plan (see odr_plan.h), the fastest at frame_us, 0 for the defaults of bus_hz and usb_bps */
+int run_icm20948_plan_odr(uint32_t frame_us, uint32_t bus_hz, uint32_t usb_bps);
+/* Adapt the period of the rotation vector of each IMU to its motion (see odr_adapt.h), between bounds, 0 for those of the DMP */
+int run_icm20948_set_adapt(int enable, uint32_t fastest_us, uint32_t slowest_us);
+/* Sweep on a fixed cycle (see acq_cycle.h), of the sensor period when period_us is 0 */
+int run_icm20948_set_cycle(int enable, uint32_t period_us);
+/* Send the stats frames (see lat_trace.h, health.h and acq_cycle.h) every period_ms, 0 to stop */
+int run_icm20948_set_stats_period(uint16_t period_ms);
+/* whoami of the first present IMU when imu is HOST_CMD_ALL_IMUS */
+int run_icm20948_whoami(int imu, uint8_t * whoami);
+
 
 #endif //TESTANDROIDTHINGS_RUN_ICM20948_H
@@ -0,0 +1,81 @@
+/*
+ * startup.c
+ *
+ * Startup sequence, see startup.h.
+ */
+#include <asf.h>
+
+#include "Invn/EmbUtils/Message.h"
+#include "Invn/EmbUtils/DataConverter.h"
+
+#include "time_wrapper.h"
+#include "usb_cdc_coms.h"
+#include "host_cmd.h"
+#include "startup.h"
+
+static uint64_t reset_us;
+static uint32_t phase_us[STARTUP_PHASE_COUNT];
+static uint8_t phase_done[STARTUP_PHASE_COUNT];
+
+void startup_init(void)
+{
+	int p;
+
+	reset_us = inv_icm20948_get_time_us();
+	for(p = 0; p < STARTUP_PHASE_COUNT; ++p) {
+		phase_us[p] = 0;
+		phase_done[p] = 0;
+	}
+}
+
+void startup_done(int phase)
+{
+	if(phase < 0 || phase >= STARTUP_PHASE_COUNT || phase_done[phase])
+		return;
+	phase_us[phase] = (uint32_t)(inv_icm20948_get_time_us() - reset_us);
+	phase_done[phase] = 1;
+}
+
+uint32_t startup_time_us(int phase)
+{
+	if(phase < 0 || phase >= STARTUP_PHASE_COUNT)
+		return 0;
+	return phase_us[phase];
+}
+
+void startup_poll(void)
+{
+	uint64_t now_us;
+	uint32_t ago_us;
+
+	if(phase_done[STARTUP_PHASE_USB] || !serialReady())
+		return;
+	/* back to when the UDC interrupt saw it, CYCCNT wraps after 51 s */
+	now_us = inv_icm20948_get_time_us();
+#if defined(__SAM3X8E__)
+	ago_us = (DWT->CYCCNT - serialEnableCycles()) / (sysclk_get_cpu_hz() / 1000000);
+#else
+	ago_us = (uint32_t)time_wrapper_host_us() - serialEnableCycles();
+#endif
+	phase_us[STARTUP_PHASE_USB] = (ago_us < now_us - reset_us) ? (uint32_t)(now_us - reset_us - ago_us) : 0;
+	phase_done[STARTUP_PHASE_USB] = 1;
+}
+
+void startup_frame_sent(unsigned imus)
+{
+	uint8_t payload[4 * STARTUP_PHASE_COUNT + 1];
+	int p;
+
+	if(phase_done[STARTUP_PHASE_FRAME] || !serialReady())
+		return;
+	startup_poll();
+	startup_done(STARTUP_PHASE_FRAME);
+
+	for(p = 0; p < STARTUP_PHASE_COUNT; ++p)
+		inv_dc_int32_to_little8((int32_t)phase_us[p], &payload[4 * p]);
+	payload[4 * STARTUP_PHASE_COUNT] = (uint8_t)imus;
+	host_cmd_send(HOST_CMD_TYPE_ASYNC, HOST_CMD_CODE_READY, payload, sizeof(payload));
+	INV_MSG(INV_MSG_LEVEL_INFO, "Ready: usb %lu ms, discovery %lu ms, bring-up %lu ms, first frame %lu ms",
+			(unsigned long)(phase_us[STARTUP_PHASE_USB] / 1000), (unsigned long)(phase_us[STARTUP_PHASE_DISCOVERY] / 1000),
+			(unsigned long)(phase_us[STARTUP_PHASE_BRINGUP] / 1000), (unsigned long)(phase_us[STARTUP_PHASE_FRAME] / 1000));
+}
@@ -0,0 +1,58 @@
+/*
+ * startup.h
+ *
+ * Startup sequence from reset to the first sensor frame.
+ *
+ * The host enumerates the USB device from the interrupts of the UDC, so
+ * main() starts it and goes on with the IMUs at once instead of waiting for
+ * the host. The phases overlap:
+ *   usb        udc_start() to CDC enabled by the host, taken from the UDC
+ *              interrupt by startup_poll()
+ *   discovery  muxes and IMUs found, see mux_topo.h
+ *   bringup    every IMU set up and started, see bringup.h
+ *   frame      first sensor frame sent, CDC enabled
+ * Until CDC is enabled msg_log.c keeps its records, so nothing logged
+ * during bring-up is lost but what does not fit in the ring.
+ *
+ * Once the first frame is sent, the times since reset are sent once:
+ *   HOST_CMD_CODE_READY <usb us (4)> <discovery us (4)> <bringup us (4)>
+ *                       <frame us (4)> <IMUs ready (1)>
+ * the last time being the time to first frame.
+ */
+
+
+#ifndef STARTUP_H_
+#define STARTUP_H_
+
+#include <stdint.h>
+
+enum startup_phase {
+	STARTUP_PHASE_USB = 0,
+	STARTUP_PHASE_DISCOVERY,
+	STARTUP_PHASE_BRINGUP,
+	STARTUP_PHASE_FRAME,
+	STARTUP_PHASE_COUNT,
+};
+
+/** @brief Start counting, right after reset
+ */
+void startup_init(void);
+
+/** @brief A phase is over, only the first call of each counts
+ */
+void startup_done(int phase);
+
+/** @brief Time a phase ended, us since startup_init(), 0 if it did not yet
+ */
+uint32_t startup_time_us(int phase);
+
+/** @brief Time the end of the usb phase, cheap enough for any loop
+ */
+void startup_poll(void);
+
+/** @brief Sensor frames went out, sends HOST_CMD_CODE_READY the first time
+ *  @param[in] imus  IMUs ready
+ */
+void startup_frame_sent(unsigned imus);
+
+#endif /* STARTUP_H_ */
@@ -1,26 +1,49 @@
 //
 // Created by Swift on 26/09/2018.
 //
+#include <asf.h>
 #include "time_wrapper.h"
+#include "bringup.h"
+#include "idd_io_hal.h"
 #include "delay.h"
 #include <unistd.h>
 #include <time.h>
 #include <stdbool.h>
 
 void inv_icm20948_sleep_us(int us){
-    delay_us(us);
+    /* a follower's writes went out with its leader's, and the waits after them */
+    if(idd_io_hal_broadcast_mode() == IDD_IO_HAL_FOLLOW)
+        return;
+    /* during bring-up the other IMUs get the wait first */
+    us = (int)bringup_wait_us((uint32_t)us);
+    if(us > 0)
+        delay_us(us);
 }
 
 uint64_t inv_icm20948_get_time_us(void){
-    /*
-	struct timespec time;
-    int ret = clock_gettime(CLOCK_BOOTTIME, &time);
-    if(0 != ret)
-    {
-        return 1;
-    }
+#if defined(__SAM3X8E__)
+	/*
+	 * DWT->CYCCNT extended to 64 bits, the remainder of the division carried
+	 * to the next call so the clock does not drift. CYCCNT wraps every 51 s
+	 * at 84 MHz, the acquisition loop calls this far more often.
+	 */
+	static uint64_t time_us;
+	static uint32_t last_cycles, rem_cycles;
+	const uint32_t cycles_per_us = sysclk_get_cpu_hz() / 1000000;
+	uint32_t now, elapsed;
 
-    return 1000*time.tv_nsec;
-	*/
-	return 0;
-}
\ No newline at end of file
+	if(!(DWT->CTRL & DWT_CTRL_CYCCNTENA_Msk)) {
+		CoreDebug->DEMCR |= CoreDebug_DEMCR_TRCENA_Msk;
+		DWT->CTRL |= DWT_CTRL_CYCCNTENA_Msk;
+		last_cycles = DWT->CYCCNT;
+	}
+	now = DWT->CYCCNT;
+	elapsed = now - last_cycles + rem_cycles;
+	last_cycles = now;
+	time_us += elapsed / cycles_per_us;
+	rem_cycles = elapsed % cycles_per_us;
+	return time_us;
+#else
+	return time_wrapper_host_us();
+#endif
+}
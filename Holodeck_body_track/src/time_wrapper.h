@@ -5,11 +5,19 @@
 #ifndef TESTANDROIDTHINGS_TIME_WRAPPER_H
 #define TESTANDROIDTHINGS_TIME_WRAPPER_H
 
+#include <stdint.h>
 
 #ifdef __cplusplus
 extern "C" {
+#endif
 void inv_icm20948_sleep_us(int us);
+/* Microseconds since boot, to be called at least once every 51 s on the Due */
 uint64_t inv_icm20948_get_time_us(void);
+#if !defined(__SAM3X8E__)
+/* Microsecond clock of the host build, provided by the harness */
+uint64_t time_wrapper_host_us(void);
+#endif
+#ifdef __cplusplus
 };
 #endif
 #endif //TESTANDROIDTHINGS_TIME_WRAPPER_H
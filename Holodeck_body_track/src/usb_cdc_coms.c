@@ -7,36 +7,64 @@
 #include <asf.h>
 #include <string.h>
 #include "usb_cdc_coms.h"
+#include "prof_zone.h"
 
-static char outBuf[400]={0};
+#include "Invn/EmbUtils/RingByteBuffer.h"
 
+/*
+ * Bytes received from the host are moved out of the CDC endpoint buffers
+ * into this FIFO by handleInput() and consumed by the command parser.
+ */
+#define SERIAL_RX_FIFO_SIZE		256
+#define SERIAL_RX_CHUNK_SIZE	32
+
+static uint8_t rx_fifo_buffer[SERIAL_RX_FIFO_SIZE];
+static RingByteBuffer rx_fifo;
+
+static struct serial_stats tx_stats;
+
+/* set from the UDC interrupts */
+static volatile bool my_flag_autorize_cdc_transfert = false;
+static volatile bool my_flag_cdc_tx_empty=true;
+static volatile uint32_t cdc_enable_cycles;
+
+void serialInit(){
+	RingByteBuffer_init(&rx_fifo, rx_fifo_buffer, sizeof(rx_fifo_buffer));
+}
+
+bool serialReady(void){
+	return my_flag_autorize_cdc_transfert;
+}
+
+uint32_t serialEnableCycles(void){
+	return cdc_enable_cycles;
+}
 
 void handleInput(){
-	
+	uint8_t chunk[SERIAL_RX_CHUNK_SIZE];
+	iram_size_t count;
+
 	if(!my_flag_autorize_cdc_transfert) return;   //if USB connection not setup, do nothing
-	int input=0;
-	//if no data ready for reading off USB cdc then return
-	if(!udi_cdc_is_rx_ready()) return;
-	
-	input=udi_cdc_getc();
-	
-	sprintf(outBuf,"Test cdc\n");
-	serialWrite(outBuf,strlen(outBuf));
-	
-}
-void handleInput_blocking(){
-	
-	//wait until there is data ready
-	int input=0;
-	while(!my_flag_autorize_cdc_transfert){
-		 while(!udi_cdc_is_rx_ready() ){
-		 }
+
+	//only take what is already sitting in the CDC buffer so udi_cdc_read_buf() never waits
+	count = udi_cdc_get_nb_received_data();
+	if(count > RingByteBuffer_available(&rx_fifo))
+		count = RingByteBuffer_available(&rx_fifo);
+
+	while(count){
+		iram_size_t len = (count > sizeof(chunk)) ? sizeof(chunk) : count;
+		udi_cdc_read_buf(chunk, len);
+		RingByteBuffer_pushBuffer(&rx_fifo, chunk, (uint16_t)len);
+		count -= len;
 	}
-	input=udi_cdc_getc();
-	
-	sprintf(outBuf,"Test cdc 2\n");
-	serialWrite(outBuf,strlen(outBuf));
-	
+}
+
+uint16_t serialRead(uint8_t *buffer, uint16_t max){
+	uint16_t len = RingByteBuffer_size(&rx_fifo);
+
+	if(len > max) len = max;
+	RingByteBuffer_popBuffer(&rx_fifo, buffer, len);
+	return len;
 }
 
 
@@ -51,15 +79,29 @@ void handleInput_blocking(){
 
 void serialWrite(char *buffer, int size){
 	if(!my_flag_autorize_cdc_transfert) return;			//do nothing if USB not connect not setup
+	PROF_ZONE_BEGIN(PROF_ZONE_SERIAL_WRITE);
 	if (!udi_cdc_is_tx_ready()) {
 		// Fifo full
 		udi_cdc_signal_overrun();
+		tx_stats.dropped_bytes += size;
+		tx_stats.dropped_writes++;
 		} else {
+		// waits for room, bytes are left only if the link stops meanwhile
+		const iram_size_t left = udi_cdc_write_buf(buffer, size);
+
 		my_flag_cdc_tx_empty=false;
-		udi_cdc_write_buf(buffer, size);
+		tx_stats.written_bytes += size - left;
+		if (left) {
+			tx_stats.dropped_bytes += left;
+			tx_stats.dropped_writes++;
+		}
 		
 		//udi_cdc_putc('Z');
 	}
+	PROF_ZONE_END(PROF_ZONE_SERIAL_WRITE);
+}
+const struct serial_stats * serialStats(void){
+	return &tx_stats;
 }
 void waitForTXReady(){
 	#ifdef waitForCDCTXReady
@@ -69,6 +111,8 @@ void waitForTXReady(){
 }
 bool my_callback_cdc_enable(void)
 {
+	/* raw, the clock of time_wrapper.c is not safe to update from here */
+	cdc_enable_cycles = DWT->CYCCNT;
 	my_flag_autorize_cdc_transfert = true;
 	return true;
 }
@@ -10,16 +10,28 @@
 #define USB_CDC_COMS_H_
 
 
+#include <stdint.h>
+#include <stdbool.h>
+
 #define waitForCDCTXReady  //enables the waitForCDCTXReady function
 
+void serialInit();
+/* CDC enabled by the host, nothing is sent before */
+bool serialReady(void);
+/* DWT->CYCCNT when the host last enabled CDC, microseconds of the host clock in the simulator */
+uint32_t serialEnableCycles(void);
 void serialWrite(char *buffer, int size);
 void handleInput();
-void handleInput_blocking();
+uint16_t serialRead(uint8_t *buffer, uint16_t max);
+
+/* serialWrite() counters since boot, nothing is counted while the host is not connected */
+struct serial_stats {
+	uint32_t written_bytes;
+	uint32_t dropped_bytes;		/* CDC buffer full */
+	uint32_t dropped_writes;
+};
+const struct serial_stats * serialStats(void);
 void twi_init(void);
 void waitForTXReady();
 
-
-static bool my_flag_autorize_cdc_transfert = false;
-static bool my_flag_cdc_tx_empty=true;
-
 #endif /* USB_CDC_COMS_H_ */
\ No newline at end of file
@@ -0,0 +1,404 @@
+#!/usr/bin/env python3
+"""
+msg_log.py
+
+Host side of the deferred INV_MSG logger (see src/msg_log.h).
+
+  table   Extract the constant strings of the firmware ELF into a table file.
+          Run as a post-build step, the table must match the flashed firmware.
+  decode  Read the CDC stream (capture file, serial port or stdin), expand
+          HOST_CMD_CODE_LOG frames with the table, print HOST_CMD_CODE_PROF
+          zones, HOST_CMD_CODE_LATENCY, HOST_CMD_CODE_HEALTH* and
+          HOST_CMD_CODE_CYCLE stats, the HOST_CMD_CODE_READY startup times, the
+          HOST_CMD_CODE_TOPOLOGY changes, the HOST_CMD_CODE_SKELETON frames, the
+          HOST_CMD_CODE_ODR_PLAN plans, the HOST_CMD_CODE_ODR_RATE changes and
+          every other frame and text line as received.
+
+    python msg_log.py table Debug/Holodeck_body_track.elf Debug/Holodeck_body_track.logtab
+    python msg_log.py decode Debug/Holodeck_body_track.logtab COM5
+"""
+
+import argparse
+import bisect
+import json
+import re
+import struct
+import sys
+
+HEADER = b'\x55\xaa\x55\xaa'
+TYPE_RESP = 0x02
+TYPE_ASYNC = 0x03
+CODE_SENSOR_DATA = 0x10
+CODE_LOG = 0x11
+CODE_PROF = 0x12
+CODE_LATENCY = 0x13
+CODE_HEALTH_IMU = 0x14
+CODE_HEALTH = 0x15
+CODE_CYCLE = 0x16
+CODE_READY = 0x17
+CODE_TOPOLOGY = 0x18
+CODE_SKELETON = 0x19
+CODE_ODR_PLAN = 0x1A
+CODE_ODR_RATE = 0x1B
+SKELETON_HELD = 0x80
+HEALTH_NEVER = 0xffffffff
+LOG_ID_DROPPED = 0
+FAULT_STATES = ['ok', 'backoff', 'quarantined']
+
+LEVELS = ['', '[E] ', '[W] ', '[I] ', '[V] ', '[D] ']
+
+# enum prof_zone of src/prof_zone.h
+PROF_ZONES = ['sweep', 'channel_set', 'device_poll', 'fifo_drain', 'twi_read', 'twi_write', 'convert', 'serial_write']
+
+SHT_PROGBITS = 1
+SHF_WRITE = 0x1
+SHF_ALLOC = 0x2
+
+# printable runs of at least 2 characters ending with NUL
+STRING_RE = re.compile(rb'[\t\n\r\x20-\x7e]{2,}\x00')
+
+SPEC_RE = re.compile(r'%([-+ #0]*)(\*|\d+)?(?:\.(\*|\d+))?(hh|h|ll|l|j|z|t|L)?([diouxXcfFeEgGaAspn%])')
+
+
+# ---------------------------------------------------------------------------
+# table
+
+def elf_strings(path):
+    """Return {address: string} for every string of the read-only loaded sections"""
+    with open(path, 'rb') as f:
+        elf = f.read()
+
+    if elf[:4] != b'\x7fELF':
+        raise ValueError('%s is not an ELF file' % path)
+    is64 = elf[4] == 2
+    endian = '<' if elf[5] == 1 else '>'
+
+    if is64:
+        shoff, = struct.unpack_from(endian + 'Q', elf, 0x28)
+        shentsize, shnum = struct.unpack_from(endian + 'HH', elf, 0x3a)
+        shfmt = endian + 'IIQQQQIIQQ'
+    else:
+        shoff, = struct.unpack_from(endian + 'I', elf, 0x20)
+        shentsize, shnum = struct.unpack_from(endian + 'HH', elf, 0x2e)
+        shfmt = endian + 'IIIIIIIIII'
+
+    strings = {}
+    for i in range(shnum):
+        (_, sh_type, sh_flags, sh_addr, sh_offset, sh_size,
+         _, _, _, _) = struct.unpack_from(shfmt, elf, shoff + i * shentsize)
+        if sh_type != SHT_PROGBITS or not (sh_flags & SHF_ALLOC) or (sh_flags & SHF_WRITE):
+            continue
+        data = elf[sh_offset:sh_offset + sh_size]
+        for m in STRING_RE.finditer(data):
+            strings[sh_addr + m.start()] = m.group()[:-1].decode('ascii')
+    return strings, (8 if is64 else 4)
+
+
+def cmd_table(args):
+    strings, ptr_size = elf_strings(args.elf)
+    table = {
+        'elf': args.elf,
+        'ptr_size': ptr_size,
+        'strings': {'0x%08x' % addr: s for addr, s in sorted(strings.items())},
+    }
+    with open(args.table, 'w') as f:
+        json.dump(table, f, indent=0)
+    print('%d strings written to %s' % (len(strings), args.table))
+
+
+# ---------------------------------------------------------------------------
+# decode
+
+class StringTable:
+    def __init__(self, path):
+        with open(path) as f:
+            table = json.load(f)
+        self.ptr_size = table.get('ptr_size', 4)
+        items = sorted((int(k, 16), v) for k, v in table['strings'].items())
+        self.addrs = [a for a, _ in items]
+        self.strs = [s for _, s in items]
+
+    def lookup(self, addr):
+        """Return the string at addr, addr may point inside a string (merged suffixes)"""
+        i = bisect.bisect_right(self.addrs, addr) - 1
+        if i < 0:
+            return None
+        offset = addr - self.addrs[i]
+        if offset > len(self.strs[i]):
+            return None
+        return self.strs[i][offset:]
+
+
+def expand(table, fmt, words):
+    """Format fmt with the raw argument words recorded by msg_log_record()"""
+    raw = b''.join(struct.pack('<I', w) for w in words)
+    pos = [0]
+    truncated = [False]
+
+    def take(size):
+        size = (size + 3) & ~3
+        if pos[0] + size > len(raw):
+            truncated[0] = True
+            return None
+        value = raw[pos[0]:pos[0] + size]
+        pos[0] += size
+        return value
+
+    def conv(m):
+        flags, width, prec, length, c = m.groups()
+        if c == '%':
+            return '%'
+        if truncated[0]:
+            return ''
+        if width == '*':
+            v = take(4)
+            width = str(struct.unpack('<i', v)[0]) if v else ''
+        if prec == '*':
+            v = take(4)
+            prec = str(struct.unpack('<i', v)[0]) if v else ''
+        spec = '%' + flags + (width or '') + ('.' + prec if prec is not None else '')
+
+        if c in 'fFeEgGaA':
+            v = take(8)
+            return (spec + c.replace('a', 'e').replace('A', 'E')) % struct.unpack('<d', v)[0] if v else ''
+        if c in 'sp':
+            v = take(table.ptr_size)
+            if v is None:
+                return ''
+            addr = int.from_bytes(v, 'little')
+            if c == 'p':
+                return '0x%x' % addr
+            s = table.lookup(addr)
+            return (spec + 's') % (s if s is not None else '<0x%08x>' % addr)
+        if c == 'n':
+            return ''
+
+        size = 8 if length in ('ll', 'j') else 4
+        v = take(size)
+        if v is None:
+            return ''
+        signed = c in 'di'
+        value = int.from_bytes(v, 'little', signed=signed)
+        if length == 'hh':
+            value = struct.unpack('<b' if signed else '<B', v[:1])[0]
+        elif length == 'h':
+            value = struct.unpack('<h' if signed else '<H', v[:2])[0]
+        if c in 'uoxX' and value < 0:
+            value &= (1 << (8 * size)) - 1
+        if c == 'c':
+            return (spec + 'c') % chr(value & 0xff)
+        return (spec + ('d' if c in 'iu' else c)) % value
+
+    text = SPEC_RE.sub(conv, fmt)
+    return text + ('...' if truncated[0] else '')
+
+
+def decode_log(table, args):
+    level, nwords = args[0], args[1]
+    fmt_addr, = struct.unpack_from('<I', args, 2)
+    words = list(struct.unpack_from('<%dI' % nwords, args, 6))
+    prefix = LEVELS[level] if level < len(LEVELS) else '[%d] ' % level
+
+    if fmt_addr == LOG_ID_DROPPED:
+        return prefix + '%u messages dropped' % words[0]
+    fmt = table.lookup(fmt_addr)
+    if fmt is None:
+        return prefix + '<unknown format 0x%08x> %s' % (fmt_addr, ' '.join('0x%08x' % w for w in words))
+    return prefix + expand(table, fmt, words)
+
+
+def decode_prof(args):
+    zone, count, cmin, cmax, mean = struct.unpack_from('<BIIII', args)
+    hist = struct.unpack_from('<%dI' % ((len(args) - 17) // 4), args, 17)
+    name = PROF_ZONES[zone] if zone < len(PROF_ZONES) else 'zone%d' % zone
+    buckets = ' '.join('%d:%u' % (b, n) for b, n in enumerate(hist) if n)
+    return 'prof %s count=%u min=%u max=%u mean=%u cycles log2 %s' % (name, count, cmin, cmax, mean, buckets)
+
+
+def decode_latency(args):
+    imu, count, p50, p99, lmax = struct.unpack_from('<BIIII', args)
+    stages = struct.unpack_from('<6I', args, 17)
+    return 'latency imu=%d samples=%u p50=%u p99=%u max=%u us fifo=%u/%u format=%u/%u usb=%u/%u us mean/max' % (
+        (imu, count, p50, p99, lmax) + stages)
+
+
+def decode_health_imu(args):
+    imu, samples, odr, resets, lost, decode, errors, retries, per_drain, since = struct.unpack_from('<BIIIIIIIHI', args)
+    since = 'never' if since == HEALTH_NEVER else '%u ms' % since
+    text = ('health imu=%d samples=%u odr=%.3f Hz fifo resets=%u lost=%u decode errors=%u '
+            'bus errors=%u retries=%u bytes/drain=%u last sample %s' %
+            (imu, samples, odr / 1000.0, resets, lost, decode, errors, retries, per_drain, since))
+    if len(args) >= 48:
+        state, failed, quarantines, recoveries = struct.unpack_from('<BIII', args, 35)
+        text += (' fault %s failed polls=%u quarantines=%u recoveries=%u' %
+                 (FAULT_STATES[state] if state < len(FAULT_STATES) else state, failed, quarantines, recoveries))
+    return text
+
+
+def decode_health(args):
+    period, switches, mux_errors, busy, usb, dropped, dropped_writes = struct.unpack_from('<IIIHIII', args)
+    return ('health period=%u ms mux switches=%u errors=%u bus busy=%.1f %% usb bytes=%u dropped=%u in %u writes' %
+            (period, switches, mux_errors, busy / 10.0, usb, dropped, dropped_writes))
+
+
+def decode_cycle(args):
+    return ('cycle period=%u us cycles=%u overruns=%u missed=%u jitter=%u/%u busy=%u/%u us mean/max' %
+            struct.unpack_from('<8I', args))
+
+
+def decode_ready(args):
+    usb, discovery, bringup, frame, imus = struct.unpack_from('<4IB', args)
+    return ('ready usb=%.1f discovery=%.1f bringup=%.1f first_frame=%.1f ms imus=%u' %
+            (usb / 1e3, discovery / 1e3, bringup / 1e3, frame / 1e3, imus))
+
+
+def decode_topology(args):
+    generation, imu, present, mux, channel, addr, imus = struct.unpack_from('<I6B', args)
+    where = ('mux 0x%02x channel %u' % (mux, channel)) if mux else 'TWI0'
+    return ('topology generation=%u imu=%u %s on %s addr 0x%02x imus=%u' %
+            (generation, imu, 'up' if present else 'down', where, addr, imus))
+
+
+def decode_skeleton(args):
+    ts, count = struct.unpack_from('<IB', args)
+    imus = []
+    for k in range(min(count, (len(args) - 5) // 9)):
+        imu = args[5 + 9 * k]
+        q = [v / 16384.0 for v in struct.unpack_from('<4h', args, 5 + 9 * k + 1)]
+        imus.append('%d%s:%f,%f,%f,%f' % (imu & ~SKELETON_HELD, '*' if imu & SKELETON_HELD else '',
+                                           q[0], q[1], q[2], q[3]))
+    return 'skeleton @%u %s' % (ts, ' '.join(imus))
+
+
+def decode_odr_plan(args):
+    rc, base_div, frame, bus, usb, count = struct.unpack_from('<bBIHHB', args)
+    sensors = []
+    for k in range(min(count, (len(args) - 11) // 6)):
+        sensor, frames, period = struct.unpack_from('<BBI', args, 11 + 6 * k)
+        sensors.append('%u:%u us/%u' % (sensor, period, frames))
+    return ('odr plan rc=%d base=1125/%u Hz frame=%u us bus=%u usb=%u permille %s' %
+            (rc, base_div, frame, bus, usb, ' '.join(sensors)))
+
+
+def decode_odr_rate(args):
+    imu, sensor, period, turn = struct.unpack_from('<BBIH', args)
+    return 'odr rate imu=%u sensor=%u period=%u us turn=%u mdeg/sample' % (imu, sensor, period, turn)
+
+
+def decode_frame(table, ftype, code, args):
+    if ftype == TYPE_ASYNC and code == CODE_LOG:
+        return decode_log(table, args)
+    if ftype == TYPE_ASYNC and code == CODE_PROF and len(args) >= 17:
+        return decode_prof(args)
+    if ftype == TYPE_ASYNC and code == CODE_LATENCY and len(args) >= 41:
+        return decode_latency(args)
+    if ftype == TYPE_ASYNC and code == CODE_HEALTH_IMU and len(args) >= 35:
+        return decode_health_imu(args)
+    if ftype == TYPE_ASYNC and code == CODE_HEALTH and len(args) >= 26:
+        return decode_health(args)
+    if ftype == TYPE_ASYNC and code == CODE_CYCLE and len(args) >= 32:
+        return decode_cycle(args)
+    if ftype == TYPE_ASYNC and code == CODE_READY and len(args) >= 17:
+        return decode_ready(args)
+    if ftype == TYPE_ASYNC and code == CODE_TOPOLOGY and len(args) >= 10:
+        return decode_topology(args)
+    if ftype == TYPE_ASYNC and code == CODE_SKELETON and len(args) >= 5:
+        return decode_skeleton(args)
+    if ftype == TYPE_ASYNC and code == CODE_ODR_PLAN and len(args) >= 11:
+        return decode_odr_plan(args)
+    if ftype == TYPE_ASYNC and code == CODE_ODR_RATE and len(args) >= 8:
+        return decode_odr_rate(args)
+    if ftype == TYPE_ASYNC and code == CODE_SENSOR_DATA and len(args) >= 14:
+        imu, sensor, ts = struct.unpack_from('<BBI', args)
+        q = [v / 16384.0 for v in struct.unpack_from('<4h', args, 6)]
+        return '%d:%d:quat:%f,%f,%f,%f @%u' % (imu, sensor, q[0], q[1], q[2], q[3], ts)
+    if ftype == TYPE_RESP and len(args) >= 1:
+        return '<resp code=0x%02x rc=%d>' % (code, struct.unpack('<b', args[:1])[0])
+    return '<frame type=0x%02x code=0x%02x %s>' % (ftype, code, args.hex())
+
+
+def cksum(data):
+    chk = 1
+    for b in data:
+        chk = (chk * 3 + b) & 0xffff
+    return chk
+
+
+def frames(stream):
+    """Split the stream in text lines and InvProtocol frames"""
+    buf = b''
+    while True:
+        chunk = stream.read(1)
+        if not chunk:
+            break
+        buf += chunk
+        while True:
+            start = buf.find(HEADER)
+            if start < 0:
+                # keep a possible partial header, emit complete text lines
+                cut = buf.rfind(b'\n') + 1
+                if cut:
+                    yield 'text', buf[:cut]
+                    buf = buf[cut:]
+                break
+            if start:
+                yield 'text', buf[:start]
+                buf = buf[start:]
+            if len(buf) < 8:
+                break
+            ftype, code, size = struct.unpack_from('<BBH', buf, 4)
+            if len(buf) < 8 + size + 2:
+                break
+            args = buf[8:8 + size]
+            chk, = struct.unpack_from('<H', buf, 8 + size)
+            if chk != cksum(args):
+                yield 'text', buf[:1]
+                buf = buf[1:]
+                continue
+            yield 'frame', (ftype, code, args)
+            buf = buf[8 + size + 2:]
+    if buf:
+        yield 'text', buf
+
+
+def open_input(name):
+    if name in (None, '-'):
+        return sys.stdin.buffer
+    try:
+        return open(name, 'rb')
+    except OSError:
+        import serial  # pyserial, only needed for live capture
+        return serial.Serial(name, 115200)
+
+
+def cmd_decode(args):
+    table = StringTable(args.table)
+    for kind, value in frames(open_input(args.input)):
+        if kind == 'text':
+            sys.stdout.write(value.decode('ascii', 'replace').replace('\r\n', '\n'))
+        else:
+            print(decode_frame(table, *value))
+        sys.stdout.flush()
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__, formatter_class=argparse.RawDescriptionHelpFormatter)
+    sub = parser.add_subparsers(dest='cmd')
+    p = sub.add_parser('table', help='extract string table from firmware ELF')
+    p.add_argument('elf')
+    p.add_argument('table')
+    p.set_defaults(func=cmd_table)
+    p = sub.add_parser('decode', help='expand deferred log frames')
+    p.add_argument('table')
+    p.add_argument('input', nargs='?', help='capture file or serial port, stdin if omitted')
+    p.set_defaults(func=cmd_decode)
+    args = parser.parse_args()
+    if not getattr(args, 'func', None):
+        parser.print_help()
+        return 1
+    args.func(args)
+    return 0
+
+
+if __name__ == '__main__':
+    sys.exit(main())